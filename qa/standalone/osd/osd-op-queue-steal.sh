@@ -0,0 +1,111 @@
+#!/usr/bin/env bash
+
+source $CEPH_ROOT/qa/standalone/ceph-helpers.sh
+
+function run() {
+    local dir=$1
+    shift
+
+    export CEPH_MON="127.0.0.1:7160" # git grep '\<7160\>' : there must be only one
+    export CEPH_ARGS
+    CEPH_ARGS+="--fsid=$(uuidgen) --auth-supported=none "
+    CEPH_ARGS+="--mon-host=$CEPH_MON "
+    CEPH_ARGS+="--osd_pool_default_size=1 "
+
+    local funcs=${@:-$(set | sed -n -e 's/^\(TEST_[0-9a-z_]*\) .*/\1/p')}
+    for func in $funcs ; do
+        setup $dir || return 1
+        $func $dir || return 1
+        teardown $dir || return 1
+    done
+}
+
+function get_op_wq_counter() {
+    local counter=$1
+    CEPH_ARGS='' ceph daemon $(get_asok_path osd.0) perf dump osd | \
+        jq ".osd.$counter"
+}
+
+# A few PGs spread over many single-threaded shards, so that most shards
+# sit idle and their threads steal from the busy ones.  ceph_test_rados
+# fails if the writes to an object are acked out of order.
+function run_steal_order() {
+    local dir=$1
+    local scheduler=$2
+
+    run_mon $dir a || return 1
+    run_mgr $dir x || return 1
+    run_osd $dir 0 \
+        --osd_op_queue=$scheduler \
+        --osd_op_num_shards=8 \
+        --osd_op_num_threads_per_shard=1 \
+        --osd_op_queue_work_stealing=true || return 1
+
+    create_pool foo 4 || return 1
+    ceph osd pool application enable foo rados || return 1
+    wait_for_clean || return 1
+
+    ceph_test_rados --pool foo \
+        --max-ops 4000 --objects 16 --max-in-flight 64 \
+        --size 400000 --min-stride-size 4000 --max-stride-size 40000 \
+        --max-seconds 0 \
+        --op write 100 --op write_excl 50 --op append 50 \
+        --op read 100 --op delete 10 || return 1
+
+    local steal=$(get_op_wq_counter op_wq_steal)
+    echo "$scheduler: op_wq_steal $steal op_wq_idle $(get_op_wq_counter op_wq_idle)"
+    test "$steal" -gt 0 || return 1
+}
+
+function TEST_steal_order_wpq() {
+    run_steal_order $1 wpq
+}
+
+function TEST_steal_order_mclock() {
+    run_steal_order $1 mclock_scheduler
+}
+
+# Shard skew: one 2 PG pool on an OSD with 8 shards of one thread each.
+# Prints the rados bench latency with stealing off and on.
+function TEST_steal_skew_bench() {
+    local dir=$1
+
+    run_mon $dir a || return 1
+    run_mgr $dir x || return 1
+
+    local stealing
+    for stealing in false true ; do
+        run_osd $dir 0 \
+            --osd_op_queue=wpq \
+            --osd_op_num_shards=8 \
+            --osd_op_num_threads_per_shard=1 \
+            --osd_op_queue_work_stealing=$stealing || return 1
+        create_pool skew 2 || return 1
+        wait_for_clean || return 1
+
+        timeout 120 rados bench -p skew 20 write -b 4096 -t 64 \
+            --no-cleanup > $dir/bench.$stealing || return 1
+        echo "work stealing $stealing:"
+        grep -E '^(Bandwidth|Average IOPS|Average Latency|Max latency)' \
+            $dir/bench.$stealing
+        echo "op_wq_steal $(get_op_wq_counter op_wq_steal)" \
+            "op_wq_idle $(get_op_wq_counter op_wq_idle)"
+        if [ $stealing = false ]; then
+            test "$(get_op_wq_counter op_wq_steal)" = 0 || return 1
+        else
+            test "$(get_op_wq_counter op_wq_steal)" -gt 0 || return 1
+        fi
+
+        delete_pool skew || return 1
+        kill_daemons $dir TERM osd.0 || return 1
+        ceph osd down 0 || return 1
+        ceph osd purge 0 --yes-i-really-mean-it || return 1
+        rm -fr $dir/0
+    done
+}
+
+main osd-op-queue-steal "$@"
+
+# Local Variables:
+# compile-command: "cd ../.. ; make -j4 && test/osd/osd-op-queue-steal.sh"
+# End:
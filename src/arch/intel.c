@@ -23,6 +23,10 @@ int ceph_arch_intel_ssse3 = 0;
 int ceph_arch_intel_sse3 = 0;
 int ceph_arch_intel_sse2 = 0;
 int ceph_arch_intel_aesni = 0;
+int ceph_arch_intel_avx2 = 0;
+int ceph_arch_intel_avx512f = 0;
+int ceph_arch_intel_avx512dq = 0;
+int ceph_arch_intel_avx512bw = 0;
 
 #ifdef __x86_64__
 #include <cpuid.h>
@@ -36,6 +40,26 @@ int ceph_arch_intel_aesni = 0;
 #define CPUID_SSE3	(1)
 #define CPUID_SSE2	(1 << 26)
 #define CPUID_AESNI (1 << 25)
+#define CPUID_OSXSAVE	(1 << 27)
+#define CPUID_AVX	(1 << 28)
+
+/* https://en.wikipedia.org/wiki/CPUID#EAX=7,_ECX=0:_Extended_Features */
+
+#define CPUID7_AVX2	(1 << 5)
+#define CPUID7_AVX512F	(1 << 16)
+#define CPUID7_AVX512DQ	(1 << 17)
+#define CPUID7_AVX512BW	(1 << 30)
+
+/* XCR0 state components the OS must save for us to use ymm/zmm */
+#define XCR0_YMM	0x06	/* SSE and AVX state */
+#define XCR0_ZMM	0xe0	/* opmask, ZMM_Hi256 and Hi16_ZMM state */
+
+static unsigned long long xgetbv0(void)
+{
+	unsigned int eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+}
 
 int ceph_arch_intel_probe(void)
 {
@@ -66,6 +90,31 @@ int ceph_arch_intel_probe(void)
           ceph_arch_intel_aesni = 1;
   }
 
+	/* the wide vector units are only usable if the OS saves their state */
+	if ((ecx & CPUID_OSXSAVE) == 0 || (ecx & CPUID_AVX) == 0) {
+		return 0;
+	}
+	unsigned long long xcr0 = xgetbv0();
+	if ((xcr0 & XCR0_YMM) != XCR0_YMM) {
+		return 0;
+	}
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		return 0;
+	}
+	if ((ebx & CPUID7_AVX2) != 0) {
+		ceph_arch_intel_avx2 = 1;
+	}
+	if ((xcr0 & XCR0_ZMM) == XCR0_ZMM &&
+	    (ebx & CPUID7_AVX512F) != 0) {
+		ceph_arch_intel_avx512f = 1;
+		if ((ebx & CPUID7_AVX512DQ) != 0) {
+			ceph_arch_intel_avx512dq = 1;
+		}
+		if ((ebx & CPUID7_AVX512BW) != 0) {
+			ceph_arch_intel_avx512bw = 1;
+		}
+	}
+
 	return 0;
 }
 
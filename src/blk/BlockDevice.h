@@ -292,6 +292,8 @@ public:
 
   // for managing buffered readers/writers
   virtual int invalidate_cache(uint64_t off, uint64_t len) = 0;
+  /// start reading [off, off+len) into the page cache, without waiting
+  virtual void readahead(uint64_t off, uint64_t len) {}
   virtual int open(const std::string& path) = 0;
   virtual void close() = 0;
 
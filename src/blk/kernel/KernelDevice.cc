@@ -1447,3 +1447,17 @@ int KernelDevice::invalidate_cache(uint64_t off, uint64_t len)
   }
   return r;
 }
+
+void KernelDevice::readahead(uint64_t off, uint64_t len)
+{
+  dout(20) << __func__ << " 0x" << std::hex << off << "~" << len << std::dec
+	   << dendl;
+  // the buffered fd is POSIX_FADV_RANDOM, so the kernel does not read
+  // ahead on its own
+  int r = posix_fadvise(fd_buffereds[WRITE_LIFE_NOT_SET], off, len,
+			POSIX_FADV_WILLNEED);
+  if (r) {
+    dout(5) << __func__ << " 0x" << std::hex << off << "~" << len << std::dec
+	    << " error: " << cpp_strerror(-r) << dendl;
+  }
+}
@@ -149,6 +149,7 @@ public:
 
   // for managing buffered readers/writers
   int invalidate_cache(uint64_t off, uint64_t len) override;
+  void readahead(uint64_t off, uint64_t len) override;
   int open(const std::string& path) override;
   void close() override;
 };
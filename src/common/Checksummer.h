@@ -4,14 +4,20 @@
 #ifndef CEPH_OS_BLUESTORE_CHECKSUMMER
 #define CEPH_OS_BLUESTORE_CHECKSUMMER
 
+#include <algorithm>
+
 #include "include/buffer.h"
 #include "include/byteorder.h"
 #include "include/ceph_assert.h"
+#include "common/csum_multi.h"
 
 #include "xxHash/xxhash.h"
 
 class Checksummer {
 public:
+  /// max number of csum chunks handed to a multi-buffer kernel at once
+  static constexpr size_t MULTI_BATCH = 16;
+
   enum CSumType {
     CSUM_NONE = 1,	//intentionally set to 1 to be aligned with OSDMnitor's pool_opts_t handling - it treats 0 as unset while we need to distinguish none and unset cases
     CSUM_XXHASH32 = 2,
@@ -90,6 +96,15 @@ public:
       ) {
       return p.crc32c(len, init_value);
     }
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      const unsigned char* const* bufs,
+      size_t n,
+      init_value_t* out
+      ) {
+      ceph::csum_multi::crc32c(init_value, len, bufs, n, out);
+    }
   };
 
   struct crc32c_16 {
@@ -111,6 +126,18 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xffff;
     }
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      const unsigned char* const* bufs,
+      size_t n,
+      init_value_t* out
+      ) {
+      ceph::csum_multi::crc32c(init_value, len, bufs, n, out);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] &= 0xffff;
+      }
+    }
   };
 
   struct crc32c_8 {
@@ -132,6 +159,18 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xff;
     }
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      const unsigned char* const* bufs,
+      size_t n,
+      init_value_t* out
+      ) {
+      ceph::csum_multi::crc32c(init_value, len, bufs, n, out);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] &= 0xff;
+      }
+    }
   };
 
   struct xxhash32 {
@@ -161,6 +200,15 @@ public:
       }
       return XXH32_digest(state);
     }
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      const unsigned char* const* bufs,
+      size_t n,
+      init_value_t* out
+      ) {
+      ceph::csum_multi::xxhash32(init_value, len, bufs, n, out);
+    }
   };
 
   struct xxhash64 {
@@ -190,8 +238,50 @@ public:
       }
       return XXH64_digest(state);
     }
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      const unsigned char* const* bufs,
+      size_t n,
+      init_value_t* out
+      ) {
+      ceph::csum_multi::xxhash64(init_value, len, bufs, n, out);
+    }
   };
 
+  /*
+   * Checksum up to MULTI_BATCH consecutive chunks starting at @p with a
+   * multi-buffer kernel, as long as they sit in one contiguous segment
+   * of the bufferlist.  A chunk that straddles two segments is left for
+   * the caller; returns the number of chunks done and advances @p past
+   * them.
+   */
+  template<class Alg>
+  static size_t calc_batch(
+    typename Alg::init_value_t init_value,
+    size_t csum_block_size,
+    size_t blocks,
+    ceph::buffer::list::const_iterator& p,
+    typename Alg::init_value_t* out
+    ) {
+    auto q = p;
+    const char *data;
+    size_t l = q.get_ptr_and_advance(
+      std::min(blocks, MULTI_BATCH) * csum_block_size, &data);
+    size_t n = l / csum_block_size;
+    if (n == 0) {
+      return 0;
+    }
+    const unsigned char *bufs[MULTI_BATCH];
+    for (size_t i = 0; i < n; ++i) {
+      bufs[i] = reinterpret_cast<const unsigned char*>(data) +
+	i * csum_block_size;
+    }
+    Alg::calc_multi(init_value, csum_block_size, bufs, n, out);
+    p += n * csum_block_size;
+    return n;
+  }
+
   template<class Alg>
   static int calculate(
     size_t csum_block_size,
@@ -225,9 +315,19 @@ public:
     typename Alg::value_t *pv =
       reinterpret_cast<typename Alg::value_t*>(csum_data->c_str());
     pv += offset / csum_block_size;
-    while (blocks--) {
-      *pv = Alg::calc(state, init_value, csum_block_size, p);
-      ++pv;
+    typename Alg::init_value_t v[MULTI_BATCH];
+    while (blocks) {
+      size_t n = calc_batch<Alg>(init_value, csum_block_size, blocks, p, v);
+      if (n == 0) {
+	*pv = Alg::calc(state, init_value, csum_block_size, p);
+	++pv;
+	--blocks;
+	continue;
+      }
+      for (size_t i = 0; i < n; ++i) {
+	*pv++ = v[i];
+      }
+      blocks -= n;
     }
     Alg::fini(&state);
     return 0;
@@ -253,18 +353,26 @@ public:
       reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
     pv += offset / csum_block_size;
     size_t pos = offset;
+    typename Alg::init_value_t v[MULTI_BATCH];
     while (length > 0) {
-      typename Alg::init_value_t v = Alg::calc(state, -1, csum_block_size, p);
-      if (*pv != v) {
-	if (bad_csum) {
-	  *bad_csum = v;
+      size_t n = calc_batch<Alg>(-1, csum_block_size,
+				 length / csum_block_size, p, v);
+      if (n == 0) {
+	v[0] = Alg::calc(state, -1, csum_block_size, p);
+	n = 1;
+      }
+      for (size_t i = 0; i < n; ++i) {
+	if (*pv != v[i]) {
+	  if (bad_csum) {
+	    *bad_csum = v[i];
+	  }
+	  Alg::fini(&state);
+	  return pos;
 	}
-	Alg::fini(&state);
-	return pos;
+	++pv;
+	pos += csum_block_size;
+	length -= csum_block_size;
       }
-      ++pv;
-      pos += csum_block_size;
-      length -= csum_block_size;
     }
     Alg::fini(&state);
     return -1;  // no errors
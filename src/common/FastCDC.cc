@@ -4,6 +4,13 @@
 #include <random>
 
 #include "FastCDC.h"
+#include "arch/probe.h"
+#include "arch/intel.h"
+#include "common/likely.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 
 // Unlike FastCDC described in the paper, if we are close to the
@@ -71,6 +78,176 @@ void FastCDC::_setup(int target, int size_window_bits)
   }
 }
 
+namespace {
+
+/*
+ * Cut point search over contiguous memory.
+ *
+ * The fingerprint is shifted left once per byte, so it only depends on
+ * the last 64 bytes (the window).  That means the fingerprint at any
+ * offset can be computed from scratch, and a range can be split into
+ * several stripes that are scanned in lock-step, each starting with its
+ * own window.  A match in stripe j is only the cut point once the
+ * stripes before it have been scanned to their end without a match, so
+ * the result is identical to the byte-at-a-time scan.
+ *
+ * Each function returns the first offset in [lo, hi) (relative to base)
+ * at which (fp & mask) == mask, or max(lo, hi) if there is none.  The
+ * caller guarantees lo >= 64.
+ */
+constexpr unsigned GEAR_WINDOW = sizeof(uint64_t) * 8;
+constexpr unsigned LANES = 4;
+constexpr size_t STRIPE = 4096;     ///< max bytes per stripe
+constexpr size_t MIN_STRIPE = 256;  ///< don't split ranges smaller than this
+
+inline uint64_t gear_window(const unsigned char *p, const uint64_t *table)
+{
+  uint64_t fp = 0;
+  for (const unsigned char *s = p - GEAR_WINDOW; s < p; ++s) {
+    fp = (fp << 1) ^ table[*s];
+  }
+  return fp;
+}
+
+size_t find_cut_scalar(const unsigned char *base, size_t lo, size_t hi,
+		       uint64_t mask, const uint64_t *table)
+{
+  if (lo >= hi) {
+    return lo;
+  }
+  uint64_t fp = gear_window(base + lo, table);
+  for (size_t pos = lo; pos < hi; ++pos) {
+    if ((fp & mask) == mask) {
+      return pos;
+    }
+    fp = (fp << 1) ^ table[base[pos]];
+  }
+  return hi;
+}
+
+// four independent fingerprint chains in general purpose registers; the
+// loads and shift/xor of the chains overlap in the pipeline.
+size_t find_cut_lanes(const unsigned char *base, size_t lo, size_t hi,
+		      uint64_t mask, const uint64_t *table)
+{
+  while (hi > lo && hi - lo >= LANES * MIN_STRIPE) {
+    const size_t stripe = std::min(STRIPE, (hi - lo) / LANES);
+    const unsigned char *d0 = base + lo;
+    const unsigned char *d1 = d0 + stripe;
+    const unsigned char *d2 = d1 + stripe;
+    const unsigned char *d3 = d2 + stripe;
+    uint64_t f0 = gear_window(d0, table);
+    uint64_t f1 = gear_window(d1, table);
+    uint64_t f2 = gear_window(d2, table);
+    uint64_t f3 = gear_window(d3, table);
+    unsigned live = (1u << LANES) - 1;  // stripes that can still win
+    size_t cut = 0;
+    for (size_t i = 0; i < stripe; ++i) {
+      if (unlikely(((f0 & mask) == mask) | ((f1 & mask) == mask) |
+		   ((f2 & mask) == mask) | ((f3 & mask) == mask))) {
+	unsigned hit = (((f0 & mask) == mask) |
+			((f1 & mask) == mask) << 1 |
+			((f2 & mask) == mask) << 2 |
+			((f3 & mask) == mask) << 3) & live;
+	if (hit) {
+	  unsigned lane = __builtin_ctz(hit);
+	  cut = lo + lane * stripe + i;
+	  if (lane == 0) {
+	    return cut;
+	  }
+	  live = (1u << lane) - 1;
+	}
+      }
+      f0 = (f0 << 1) ^ table[d0[i]];
+      f1 = (f1 << 1) ^ table[d1[i]];
+      f2 = (f2 << 1) ^ table[d2[i]];
+      f3 = (f3 << 1) ^ table[d3[i]];
+    }
+    if (live != (1u << LANES) - 1) {
+      return cut;
+    }
+    lo += LANES * stripe;
+  }
+  return find_cut_scalar(base, lo, hi, mask, table);
+}
+
+#if defined(__x86_64__)
+// same stripes, with the four fingerprints in one ymm register.  The
+// table lookups stay scalar: with 64-bit entries a gather is slower
+// than four plain loads on current cores.
+__attribute__((target("avx2")))
+size_t find_cut_avx2(const unsigned char *base, size_t lo, size_t hi,
+		     uint64_t mask, const uint64_t *table)
+{
+  const __m256i vmask = _mm256_set1_epi64x(mask);
+  while (hi > lo && hi - lo >= LANES * MIN_STRIPE) {
+    const size_t stripe = std::min(STRIPE, (hi - lo) / LANES);
+    const unsigned char *d0 = base + lo;
+    const unsigned char *d1 = d0 + stripe;
+    const unsigned char *d2 = d1 + stripe;
+    const unsigned char *d3 = d2 + stripe;
+    __m256i fp = _mm256_set_epi64x(gear_window(d3, table),
+				   gear_window(d2, table),
+				   gear_window(d1, table),
+				   gear_window(d0, table));
+    unsigned live = (1u << LANES) - 1;
+    size_t cut = 0;
+    for (size_t i = 0; i < stripe; ++i) {
+      __m256i miss = _mm256_andnot_si256(fp, vmask);
+      unsigned hit = _mm256_movemask_pd(_mm256_castsi256_pd(
+	_mm256_cmpeq_epi64(miss, _mm256_setzero_si256())));
+      if (unlikely(hit)) {
+	hit &= live;
+	if (hit) {
+	  unsigned lane = __builtin_ctz(hit);
+	  cut = lo + lane * stripe + i;
+	  if (lane == 0) {
+	    return cut;
+	  }
+	  live = (1u << lane) - 1;
+	}
+      }
+      __m256i t = _mm256_set_epi64x(table[d3[i]], table[d2[i]],
+				    table[d1[i]], table[d0[i]]);
+      fp = _mm256_xor_si256(_mm256_add_epi64(fp, fp), t);
+    }
+    if (live != (1u << LANES) - 1) {
+      return cut;
+    }
+    lo += LANES * stripe;
+  }
+  return find_cut_scalar(base, lo, hi, mask, table);
+}
+#endif
+
+using find_cut_fn = decltype(&find_cut_scalar);
+
+struct find_cut_kernel_t {
+  find_cut_fn fn;
+  const char *name;
+};
+
+const find_cut_kernel_t& find_cut_kernel()
+{
+  static const find_cut_kernel_t k = [] () -> find_cut_kernel_t {
+    ceph_arch_probe();
+#if defined(__x86_64__)
+    if (ceph_arch_intel_avx2) {
+      return {find_cut_avx2, "avx2"};
+    }
+#endif
+    return {find_cut_lanes, "lanes"};
+  }();
+  return k;
+}
+
+} // anonymous namespace
+
+const char *FastCDC::get_scan_impl()
+{
+  return find_cut_kernel().name;
+}
+
 static inline bool _scan(
   // these are our cursor/postion...
   bufferlist::buffers_t::const_iterator *p,
@@ -103,6 +280,21 @@ static inline bool _scan(
 void FastCDC::calc_chunks(
   const bufferlist& bl,
   std::vector<std::pair<uint64_t, uint64_t>> *chunks) const
+{
+  _calc_chunks(bl, chunks, true);
+}
+
+void FastCDC::calc_chunks_scalar(
+  const bufferlist& bl,
+  std::vector<std::pair<uint64_t, uint64_t>> *chunks) const
+{
+  _calc_chunks(bl, chunks, false);
+}
+
+void FastCDC::_calc_chunks(
+  const bufferlist& bl,
+  std::vector<std::pair<uint64_t, uint64_t>> *chunks,
+  bool contiguous_scan) const
 {
   if (bl.length() == 0) {
     return;
@@ -123,6 +315,30 @@ void FastCDC::calc_chunks(
       break;
     }
 
+    // if the whole chunk candidate is within the current buffer, search
+    // it as flat memory.
+    size_t small_end = std::min(len,
+      cstart + (1 << (target_bits - TARGET_WINDOW_BITS)));
+    size_t target_end = std::min(len,
+      cstart + (1 << (target_bits + TARGET_WINDOW_BITS)));
+    size_t end = std::min(len, cstart + (1 << max_bits));
+    if (contiguous_scan && (size_t)(pe - pp) >= end - cstart) {
+      auto base = reinterpret_cast<const unsigned char*>(pp);
+      auto find_cut = find_cut_kernel().fn;
+      size_t off = find_cut(base, 1 << min_bits, small_end - cstart,
+			    small_mask, table);
+      if (TARGET_WINDOW_BITS && off >= small_end - cstart) {
+	off = find_cut(base, off, target_end - cstart, target_mask, table);
+      }
+      if (off >= target_end - cstart) {
+	off = find_cut(base, off, end - cstart, large_mask, table);
+      }
+      pos = cstart + off;
+      pp += off;
+      chunks->push_back(std::pair<uint64_t,uint64_t>(cstart, off));
+      continue;
+    }
+
     // skip forward to the min chunk size cut point (minus the window, so
     // we can initialize the rolling fingerprint).
     size_t skip = (1 << min_bits) - window;
@@ -156,19 +372,12 @@ void FastCDC::calc_chunks(
     // find an end marker
     if (
       // for the first "small" region
-      _scan(&p, &pp, &pe, pos,
-	    std::min(len, cstart + (1 << (target_bits - TARGET_WINDOW_BITS))),
-	    fp, small_mask, table) &&
+      _scan(&p, &pp, &pe, pos, small_end, fp, small_mask, table) &&
       // for the middle range (close to our target)
       (TARGET_WINDOW_BITS == 0 ||
-       _scan(&p, &pp, &pe, pos,
-	     std::min(len, cstart + (1 << (target_bits + TARGET_WINDOW_BITS))),
-	     fp, target_mask, table)) &&
+       _scan(&p, &pp, &pe, pos, target_end, fp, target_mask, table)) &&
       // we're past target, use large_mask!
-      _scan(&p, &pp, &pe, pos,
-	    std::min(len,
-		     cstart + (1 << max_bits)),
-	    fp, large_mask, table))
+      _scan(&p, &pp, &pe, pos, end, fp, large_mask, table))
       ;
 
     chunks->push_back(std::pair<uint64_t,uint64_t>(cstart, pos - cstart));
@@ -38,6 +38,10 @@ private:
   const size_t window = sizeof(uint64_t)*8; // bits in uint64_t
 
   void _setup(int target, int window_bits);
+  void _calc_chunks(
+    const bufferlist& bl,
+    std::vector<std::pair<uint64_t, uint64_t>> *chunks,
+    bool contiguous_scan) const;
 
 public:
   FastCDC(int target = 18, int window_bits = 0) {
@@ -51,4 +55,12 @@ public:
   void calc_chunks(
     const bufferlist& bl,
     std::vector<std::pair<uint64_t, uint64_t>> *chunks) const override;
+
+  /// byte-at-a-time cut point search; the reference for tests/benchmarks
+  void calc_chunks_scalar(
+    const bufferlist& bl,
+    std::vector<std::pair<uint64_t, uint64_t>> *chunks) const;
+
+  /// name of the cut point search used for contiguous input, e.g. "avx2"
+  static const char *get_scan_impl();
 };
@@ -76,6 +76,96 @@ FormatterAttrs::FormatterAttrs(const char *attr, ...)
   va_end(ap);
 }
 
+// -----------------------
+
+bufferlist_streambuf::bufferlist_streambuf(const bufferlist_streambuf& rhs)
+  : std::streambuf(), m_bl(rhs.m_bl)
+{
+  m_bl.append(rhs.pbase(), rhs.pptr() - rhs.pbase());
+}
+
+bufferlist_streambuf& bufferlist_streambuf::operator=(const bufferlist_streambuf& rhs)
+{
+  if (this != &rhs) {
+    discard();
+    m_bl = rhs.m_bl;
+    m_bl.append(rhs.pbase(), rhs.pptr() - rhs.pbase());
+  }
+  return *this;
+}
+
+void bufferlist_streambuf::commit()
+{
+  unsigned len = pptr() - pbase();
+  if (len) {
+    // contiguous with the previous commit from the same segment, in which
+    // case append() just extends the tail ptr
+    m_bl.append(m_seg, m_seg_start, len);
+    m_seg_start += len;
+    setp(pptr(), epptr());
+  }
+}
+
+void bufferlist_streambuf::new_segment()
+{
+  commit();
+  m_seg = buffer::create(m_next_seg);
+  m_next_seg = std::min(m_next_seg * 2, MAX_SEGMENT);
+  m_seg_start = 0;
+  setp(m_seg.c_str(), m_seg.c_str() + m_seg.length());
+}
+
+std::streamsize bufferlist_streambuf::xsputn(const char *s, std::streamsize n)
+{
+  std::streamsize left = n;
+  while (left > 0) {
+    if (pptr() == epptr()) {
+      new_segment();
+    }
+    std::streamsize len = std::min<std::streamsize>(left, epptr() - pptr());
+    memcpy(pptr(), s, len);
+    pbump(len);
+    s += len;
+    left -= len;
+  }
+  return n;
+}
+
+int bufferlist_streambuf::overflow(int c)
+{
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    return traits_type::not_eof(c);
+  }
+  new_segment();
+  *pptr() = traits_type::to_char_type(c);
+  pbump(1);
+  return c;
+}
+
+void bufferlist_streambuf::claim(bufferlist& bl)
+{
+  commit();
+  bl.claim_append(m_bl);
+}
+
+void bufferlist_streambuf::write_to(std::ostream& os)
+{
+  commit();
+  for (const auto& p : m_bl.buffers()) {
+    os.write(p.c_str(), p.length());
+  }
+  m_bl.clear();
+}
+
+void bufferlist_streambuf::discard()
+{
+  m_bl.clear();
+  // the uncommitted bytes can simply be overwritten
+  setp(pbase(), epptr());
+}
+
+// -----------------------
+
 void Formatter::write_bin_data(const char*, int){}
 
 Formatter::Formatter() { }
@@ -157,18 +247,23 @@ JSONFormatter::JSONFormatter(bool p)
 void JSONFormatter::flush(std::ostream& os)
 {
   finish_pending_string();
-  os << m_ss.str();
+  m_ss.write_to(os);
   if (m_line_break_enabled)
     os << "\n";
-  m_ss.clear();
-  m_ss.str("");
+}
+
+void JSONFormatter::flush(bufferlist &bl)
+{
+  finish_pending_string();
+  m_ss.claim(bl);
+  if (m_line_break_enabled)
+    bl.append('\n');
 }
 
 void JSONFormatter::reset()
 {
   m_stack.clear();
-  m_ss.clear();
-  m_ss.str("");
+  m_ss.discard();
   m_pending_string.clear();
   m_pending_string.str("");
 }
@@ -292,10 +387,15 @@ void JSONFormatter::finish_pending_string()
 template <class T>
 void JSONFormatter::add_value(std::string_view name, T val)
 {
-  std::stringstream ss;
-  ss.precision(std::numeric_limits<T>::max_digits10);
-  ss << val;
-  add_value(name, ss.str(), false);
+  fmt::memory_buffer buf;
+  if constexpr (std::is_floating_point_v<T>) {
+    // same digits as an ostream with precision max_digits10
+    fmt::format_to(std::back_inserter(buf), "{:.{}g}", val,
+                   std::numeric_limits<T>::max_digits10);
+  } else {
+    fmt::format_to(std::back_inserter(buf), "{}", val);
+  }
+  add_value(name, std::string_view(buf.data(), buf.size()), false);
 }
 
 void JSONFormatter::add_value(std::string_view name, std::string_view val, bool quoted)
@@ -349,7 +449,7 @@ void JSONFormatter::dump_format_va(std::string_view name, const char *ns, bool q
 
 int JSONFormatter::get_len() const
 {
-  return m_ss.str().size();
+  return m_ss.length();
 }
 
 void JSONFormatter::write_raw_data(const char *data)
@@ -371,22 +471,30 @@ XMLFormatter::XMLFormatter(bool pretty, bool lowercased, bool underscored)
 void XMLFormatter::flush(std::ostream& os)
 {
   finish_pending_string();
-  std::string m_ss_str = m_ss.str();
-  os << m_ss_str;
+  bool empty = m_ss.length() == 0;
+  m_ss.write_to(os);
   /* There is a small catch here. If the rest of the formatter had NO output,
    * we should NOT output a newline. This primarily triggers on HTTP redirects */
-  if (m_pretty && !m_ss_str.empty())
+  if (m_pretty && !empty)
     os << "\n";
   else if (m_line_break_enabled)
     os << "\n";
-  m_ss.clear();
-  m_ss.str("");
+}
+
+void XMLFormatter::flush(bufferlist &bl)
+{
+  finish_pending_string();
+  bool empty = m_ss.length() == 0;
+  m_ss.claim(bl);
+  if (m_pretty && !empty)
+    bl.append('\n');
+  else if (m_line_break_enabled)
+    bl.append('\n');
 }
 
 void XMLFormatter::reset()
 {
-  m_ss.clear();
-  m_ss.str("");
+  m_ss.discard();
   m_pending_string.clear();
   m_pending_string.str("");
   m_sections.clear();
@@ -540,7 +648,7 @@ void XMLFormatter::dump_format_va(std::string_view name, const char *ns, bool qu
 
 int XMLFormatter::get_len() const
 {
-  return m_ss.str().size();
+  return m_ss.length();
 }
 
 void XMLFormatter::write_raw_data(const char *data)
@@ -550,9 +658,7 @@ void XMLFormatter::write_raw_data(const char *data)
 
 void XMLFormatter::write_bin_data(const char* buff, int buf_len)
 {
-  std::stringbuf *pbuf = m_ss.rdbuf();
-  pbuf->sputn(buff, buf_len);
-  m_ss.seekg(buf_len);
+  m_ss.write(buff, buf_len);
 }
 
 void XMLFormatter::get_attrs_str(const FormatterAttrs *attrs, std::string& attrs_str)
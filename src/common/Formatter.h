@@ -4,7 +4,7 @@
 #define CEPH_FORMATTER_H
 
 #include "include/int_types.h"
-#include "include/buffer_fwd.h"
+#include "include/buffer.h"
 
 #include <deque>
 #include <list>
@@ -75,7 +75,7 @@ namespace ceph {
 
     virtual void enable_line_break() = 0;
     virtual void flush(std::ostream& os) = 0;
-    void flush(bufferlist &bl);
+    virtual void flush(bufferlist &bl);
     virtual void reset() = 0;
 
     virtual void set_status(int status, const char* status_name) = 0;
@@ -128,6 +128,67 @@ namespace ceph {
     virtual void write_bin_data(const char* buff, int buf_len);
   };
 
+  /*
+   * streambuf that writes straight into bufferptr segments.  Completed
+   * output is handed out as sub-ptrs of those segments, so flushing into a
+   * bufferlist does not copy the formatted text again.
+   */
+  class bufferlist_streambuf : public std::streambuf {
+  public:
+    bufferlist_streambuf() {}
+    bufferlist_streambuf(const bufferlist_streambuf& rhs);
+    bufferlist_streambuf& operator=(const bufferlist_streambuf& rhs);
+    ~bufferlist_streambuf() override {}
+
+    size_t length() const {
+      return m_bl.length() + (pptr() - pbase());
+    }
+    /// move everything written so far to the end of @p bl
+    void claim(bufferlist& bl);
+    /// write everything written so far to @p os and forget it
+    void write_to(std::ostream& os);
+    /// drop everything written so far
+    void discard();
+
+  protected:
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+    int overflow(int c) override;
+
+  private:
+    static constexpr unsigned MIN_SEGMENT = 4096;
+    static constexpr unsigned MAX_SEGMENT = 65536;
+
+    void commit();
+    void new_segment();
+
+    bufferlist m_bl;           // committed output
+    bufferptr m_seg;           // segment backing the put area
+    unsigned m_seg_start = 0;  // offset of pbase() within m_seg
+    unsigned m_next_seg = MIN_SEGMENT;
+  };
+
+  class bufferlist_ostream : public std::ostream {
+  public:
+    bufferlist_ostream() : std::ostream(&m_buf) {}
+    bufferlist_ostream(const bufferlist_ostream& rhs)
+      : std::ostream(&m_buf), m_buf(rhs.m_buf) {}
+    bufferlist_ostream& operator=(const bufferlist_ostream& rhs) {
+      m_buf = rhs.m_buf;
+      return *this;
+    }
+
+    size_t length() const { return m_buf.length(); }
+    void claim(bufferlist& bl) { m_buf.claim(bl); }
+    void write_to(std::ostream& os) { m_buf.write_to(os); }
+    void discard() {
+      m_buf.discard();
+      clear();
+    }
+
+  private:
+    bufferlist_streambuf m_buf;
+  };
+
   class copyable_sstream : public std::stringstream {
   public:
     copyable_sstream() {}
@@ -149,7 +210,7 @@ namespace ceph {
     void output_footer() override {};
     void enable_line_break() override { m_line_break_enabled = true; }
     void flush(std::ostream& os) override;
-    using Formatter::flush; // don't hide Formatter::flush(bufferlist &bl)
+    void flush(bufferlist &bl) override;
     void reset() override;
     void open_array_section(std::string_view name) override;
     void open_array_section_in_ns(std::string_view name, const char *ns) override;
@@ -199,7 +260,7 @@ namespace ceph {
     void add_value(std::string_view name, T val);
     void add_value(std::string_view name, std::string_view val, bool quoted);
 
-    copyable_sstream m_ss;
+    bufferlist_ostream m_ss;
     copyable_sstream m_pending_string;
     std::string m_pending_name;
     std::list<json_formatter_stack_entry_d> m_stack;
@@ -221,7 +282,7 @@ namespace ceph {
 
     void enable_line_break() override { m_line_break_enabled = true; }
     void flush(std::ostream& os) override;
-    using Formatter::flush; // don't hide Formatter::flush(bufferlist &bl)
+    void flush(bufferlist &bl) override;
     void reset() override;
     void open_array_section(std::string_view name) override;
     void open_array_section_in_ns(std::string_view name, const char *ns) override;
@@ -250,7 +311,8 @@ namespace ceph {
     void get_attrs_str(const FormatterAttrs *attrs, std::string& attrs_str);
     char to_lower_underscore(char c) const;
 
-    std::stringstream m_ss, m_pending_string;
+    bufferlist_ostream m_ss;
+    std::stringstream m_pending_string;
     std::deque<std::string> m_sections;
     const bool m_pretty;
     const bool m_lowercased;
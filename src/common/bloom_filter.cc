@@ -6,6 +6,13 @@
 #include <bit>
 #include <numeric>
 
+#include "arch/probe.h"
+#include "arch/intel.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 using ceph::bufferlist;
 using ceph::bufferptr;
 using ceph::Formatter;
@@ -143,3 +150,337 @@ void compressible_bloom_filter::generate_test_instances(std::list<compressible_b
   ls.back()->compress(20);
   ls.back()->insert("boogggg");
 }
+
+// -- blocked_bloom_filter --
+
+namespace {
+
+// multiply-shift salts for the eight bit positions in a block; any odd
+// constants with well spread bits will do, these are the ones used by
+// the split block bloom filters in Impala and Parquet.
+alignas(32) constexpr uint32_t block_salt[blocked_bloom_filter::BLOCK_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+inline unsigned block_bit(uint32_t h, unsigned word)
+{
+  return (h * block_salt[word]) >> 26;
+}
+
+inline uint64_t mix64(uint64_t x)
+{
+  // murmur3 finalizer
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+bool probe_scalar(const uint64_t* block, uint32_t h)
+{
+  for (unsigned i = 0; i < blocked_bloom_filter::BLOCK_WORDS; ++i) {
+    if (!(block[i] & (1ull << block_bit(h, i)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+inline __m256i block_shifts_avx2(uint32_t h)
+{
+  const __m256i salt = _mm256_load_si256((const __m256i*)block_salt);
+  return _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(h), salt), 26);
+}
+
+__attribute__((target("avx2")))
+bool probe_avx2(const uint64_t* block, uint32_t h)
+{
+  const __m256i shifts = block_shifts_avx2(h);
+  const __m256i one = _mm256_set1_epi64x(1);
+  __m256i lo = _mm256_sllv_epi64(
+    one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(shifts)));
+  __m256i hi = _mm256_sllv_epi64(
+    one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(shifts, 1)));
+  // testc: (~block & mask) == 0, i.e. all mask bits are set
+  return _mm256_testc_si256(_mm256_load_si256((const __m256i*)block), lo) &
+    _mm256_testc_si256(_mm256_load_si256((const __m256i*)(block + 4)), hi);
+}
+
+__attribute__((target("avx512f,avx2")))
+bool probe_avx512(const uint64_t* block, uint32_t h)
+{
+  const __m512i mask = _mm512_sllv_epi64(
+    _mm512_set1_epi64(1), _mm512_cvtepu32_epi64(block_shifts_avx2(h)));
+  // the whole cache line in one compare
+  return _mm512_mask_cmpneq_epi64_mask(
+    0xff, _mm512_and_si512(_mm512_load_si512(block), mask), mask) == 0;
+}
+#endif
+
+using probe_fn = decltype(&probe_scalar);
+
+struct probe_kernel_t {
+  probe_fn fn;
+  const char* name;
+};
+
+const probe_kernel_t& probe_kernel()
+{
+  static const probe_kernel_t k = [] () -> probe_kernel_t {
+    ceph_arch_probe();
+#if defined(__x86_64__)
+    if (ceph_arch_intel_avx512f && ceph_arch_intel_avx2) {
+      return {probe_avx512, "avx512"};
+    }
+    if (ceph_arch_intel_avx2) {
+      return {probe_avx2, "avx2"};
+    }
+#endif
+    return {probe_scalar, "scalar"};
+  }();
+  return k;
+}
+
+} // anonymous namespace
+
+const char* blocked_bloom_filter::get_probe_impl()
+{
+  return probe_kernel().name;
+}
+
+blocked_bloom_filter& blocked_bloom_filter::operator=(
+  const blocked_bloom_filter& o)
+{
+  if (this != &o) {
+    size_list_ = o.size_list_;
+    insert_count_ = o.insert_count_;
+    target_element_count_ = o.target_element_count_;
+    random_seed_ = o.random_seed_;
+    resize_table(block_count());
+    // copy the blocks, not the vector: the alignment slack may differ
+    std::copy_n(o.blocks(), block_count() * BLOCK_WORDS, blocks());
+  }
+  return *this;
+}
+
+void blocked_bloom_filter::init()
+{
+  resize_table(block_count());
+}
+
+void blocked_bloom_filter::resize_table(std::size_t blocks)
+{
+  bit_table_.assign(blocks ? blocks * BLOCK_WORDS + BLOCK_WORDS - 1 : 0, 0);
+}
+
+void blocked_bloom_filter::clear()
+{
+  std::fill_n(blocks(), block_count() * BLOCK_WORDS, 0);
+  insert_count_ = 0;
+}
+
+uint64_t blocked_bloom_filter::hash_u32(uint32_t val) const
+{
+  return mix64(val ^ (random_seed_ * 0x9e3779b97f4a7c15ull));
+}
+
+uint64_t blocked_bloom_filter::hash_bytes(const unsigned char* key,
+					  std::size_t length) const
+{
+  // 64-bit FNV-1a, seeded
+  uint64_t h = 0xcbf29ce484222325ull ^ (random_seed_ * 0x9e3779b97f4a7c15ull);
+  for (std::size_t i = 0; i < length; ++i) {
+    h ^= key[i];
+    h *= 0x100000001b3ull;
+  }
+  return mix64(h);
+}
+
+void blocked_bloom_filter::insert_hash(uint64_t hash)
+{
+  if (size_list_.empty()) {
+    return;
+  }
+  uint64_t* block = const_cast<uint64_t*>(block_for(hash));
+  for (unsigned i = 0; i < BLOCK_WORDS; ++i) {
+    block[i] |= 1ull << block_bit(hash, i);
+  }
+  ++insert_count_;
+}
+
+bool blocked_bloom_filter::contains_hash(uint64_t hash) const
+{
+  if (size_list_.empty()) {
+    return false;
+  }
+  return probe_kernel().fn(block_for(hash), hash);
+}
+
+double blocked_bloom_filter::density() const
+{
+  if (size_list_.empty()) {
+    return 0;
+  }
+  const uint64_t* p = blocks();
+  uint64_t set = 0;
+  for (std::size_t i = 0; i < block_count() * BLOCK_WORDS; ++i) {
+    set += std::popcount(p[i]);
+  }
+  return (double)set / size();
+}
+
+double blocked_bloom_filter::approx_unique_element_count() const
+{
+  // each key sets one bit in every word of its block, so a word has
+  // 1 - (63/64)^(keys per block) of its bits set
+  double d = density();
+  if (d >= 1.0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return block_count() * std::log1p(-d) / std::log1p(-1.0 / 64);
+}
+
+double blocked_bloom_filter::estimate_fpp(std::size_t blocks, std::size_t n)
+{
+  if (!blocks) {
+    return 1.0;
+  }
+  // keys per block are Poisson distributed; a probe is a false positive
+  // if all eight of its bits were set by the keys of its block
+  const double lambda = (double)n / blocks;
+  const double spread = 10 * std::sqrt(lambda) + 10;
+  const unsigned lo = std::max(0.0, lambda - spread);
+  const unsigned hi = lambda + spread;
+  double fpp = 0;
+  for (unsigned i = lo; i <= hi; ++i) {
+    double p = std::exp(i * std::log(lambda) - lambda - std::lgamma(i + 1.0));
+    fpp += p * std::pow(1.0 - std::pow(63.0 / 64, i), (int)BLOCK_WORDS);
+  }
+  return fpp;
+}
+
+std::size_t blocked_bloom_filter::find_block_count(std::size_t n, double fpp)
+{
+  n = std::max<std::size_t>(n, 1);
+  // fpp falls monotonically with the block count; a cap of 512 bytes per
+  // key only matters for absurdly small targets
+  std::size_t lo = 1, hi = 1;
+  while (estimate_fpp(hi, n) > fpp && hi < n * 8) {
+    lo = hi + 1;
+    hi *= 2;
+  }
+  hi = std::min(hi, n * 8);
+  while (lo < hi) {
+    std::size_t mid = lo + (hi - lo) / 2;
+    if (estimate_fpp(mid, n) > fpp) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return hi;
+}
+
+bool blocked_bloom_filter::compress(double target_ratio)
+{
+  if (size_list_.empty() || target_ratio <= 0.0 || target_ratio >= 1.0) {
+    return false;
+  }
+  std::size_t old_count = block_count();
+  std::size_t new_count = old_count * target_ratio;
+  if (!new_count || new_count >= old_count) {
+    return false;
+  }
+  blocked_bloom_filter tmp;
+  tmp.resize_table(new_count);
+  uint64_t* dst = tmp.blocks();
+  const uint64_t* src = blocks();
+  for (std::size_t b = 0; b < old_count; ++b) {
+    uint64_t* d = dst + (b % new_count) * BLOCK_WORDS;
+    for (unsigned i = 0; i < BLOCK_WORDS; ++i) {
+      d[i] |= src[b * BLOCK_WORDS + i];
+    }
+  }
+  std::swap(bit_table_, tmp.bit_table_);
+  size_list_.push_back(new_count);
+  return true;
+}
+
+void blocked_bloom_filter::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  encode((uint64_t)insert_count_, bl);
+  encode((uint64_t)target_element_count_, bl);
+  encode((uint64_t)random_seed_, bl);
+  encode(size_list_, bl);
+  const uint64_t* p = blocks();
+  for (std::size_t i = 0; i < block_count() * BLOCK_WORDS; ++i) {
+    encode(p[i], bl);
+  }
+  ENCODE_FINISH(bl);
+}
+
+void blocked_bloom_filter::decode(bufferlist::const_iterator& p)
+{
+  DECODE_START(1, p);
+  uint64_t v;
+  decode(v, p);
+  insert_count_ = v;
+  decode(v, p);
+  target_element_count_ = v;
+  decode(v, p);
+  random_seed_ = v;
+  decode(size_list_, p);
+  for (auto size : size_list_) {
+    if (!size) {
+      throw ceph::buffer::malformed_input("empty blocked_bloom_filter table");
+    }
+  }
+  resize_table(block_count());
+  uint64_t* b = blocks();
+  for (std::size_t i = 0; i < block_count() * BLOCK_WORDS; ++i) {
+    decode(b[i], p);
+  }
+  DECODE_FINISH(p);
+}
+
+void blocked_bloom_filter::dump(Formatter *f) const
+{
+  f->dump_unsigned("insert_count", insert_count_);
+  f->dump_unsigned("target_element_count", target_element_count_);
+  f->dump_unsigned("random_seed", random_seed_);
+
+  f->open_array_section("block_counts");
+  for (auto size : size_list_) {
+    f->dump_unsigned("blocks", size);
+  }
+  f->close_section();
+
+  f->open_array_section("bit_table");
+  const uint64_t* p = blocks();
+  for (std::size_t i = 0; i < block_count() * BLOCK_WORDS; ++i) {
+    f->dump_unsigned("word", p[i]);
+  }
+  f->close_section();
+}
+
+void blocked_bloom_filter::generate_test_instances(
+  std::list<blocked_bloom_filter*>& ls)
+{
+  ls.push_back(new blocked_bloom_filter);
+  ls.push_back(new blocked_bloom_filter(10, .5, 1));
+  ls.back()->insert("foo");
+  ls.back()->insert("bar");
+  ls.push_back(new blocked_bloom_filter(500, .01, 1));
+  ls.back()->insert("foo");
+  ls.back()->insert("bar");
+  ls.back()->insert("baz");
+  ls.back()->insert("boof");
+  ls.back()->compress(.5);
+  ls.back()->insert("boogggg");
+}
@@ -569,6 +569,171 @@ public:
 };
 WRITE_CLASS_ENCODER(compressible_bloom_filter)
 
+
+/*
+ * Cache-line blocked bloom filter.
+ *
+ * A key picks one 64-byte block and sets one bit in each of its eight
+ * 64-bit words, so an insert or a lookup touches a single cache line
+ * instead of one line per hash function.  The eight bit positions come
+ * from one 32-bit hash multiplied by fixed odd salts, which lets a
+ * lookup build the whole block mask and check it with one SIMD compare.
+ *
+ * For the same number of bits the false positive rate is somewhat
+ * higher than bloom_filter's; the table is sized for the requested fpp
+ * with that taken into account.  Like compressible_bloom_filter, the
+ * table can be folded down to fewer blocks once it is sealed.
+ */
+class blocked_bloom_filter
+{
+public:
+  static constexpr unsigned BLOCK_WORDS = 8;
+  static constexpr unsigned BLOCK_BYTES = BLOCK_WORDS * sizeof(uint64_t);
+
+  blocked_bloom_filter()
+    : insert_count_(0),
+      target_element_count_(0),
+      random_seed_(0)
+  {}
+
+  blocked_bloom_filter(std::size_t predicted_inserted_element_count,
+		       double false_positive_probability,
+		       std::size_t random_seed)
+    : insert_count_(0),
+      target_element_count_(predicted_inserted_element_count),
+      random_seed_((random_seed) ? random_seed : 0xA5A5A5A5)
+  {
+    ceph_assert(false_positive_probability > 0.0);
+    size_list_.push_back(find_block_count(predicted_inserted_element_count,
+					  false_positive_probability));
+    init();
+  }
+
+  blocked_bloom_filter(const blocked_bloom_filter& o) {
+    *this = o;
+  }
+  blocked_bloom_filter& operator=(const blocked_bloom_filter& o);
+
+  bool operator!() const {
+    return size_list_.empty();
+  }
+
+  void clear();
+
+  /**
+   * insert a u32 into the set
+   *
+   * Unlike bloom_filter, the value is run through a 64-bit mixer first,
+   * so consecutive inputs are fine.
+   */
+  void insert(uint32_t val) {
+    insert_hash(hash_u32(val));
+  }
+  void insert(const unsigned char* key, std::size_t length) {
+    insert_hash(hash_bytes(key, length));
+  }
+  void insert(const std::string& key) {
+    insert(reinterpret_cast<const unsigned char*>(key.data()), key.size());
+  }
+  void insert(const char* data, std::size_t length) {
+    insert(reinterpret_cast<const unsigned char*>(data), length);
+  }
+
+  bool contains(uint32_t val) const {
+    return contains_hash(hash_u32(val));
+  }
+  bool contains(const unsigned char* key, std::size_t length) const {
+    return contains_hash(hash_bytes(key, length));
+  }
+  bool contains(const std::string& key) const {
+    return contains(reinterpret_cast<const unsigned char*>(key.data()),
+		    key.size());
+  }
+  bool contains(const char* data, std::size_t length) const {
+    return contains(reinterpret_cast<const unsigned char*>(data), length);
+  }
+
+  /// number of bits in the (possibly compressed) table
+  std::size_t size() const {
+    return block_count() * BLOCK_BYTES * CHAR_BIT;
+  }
+  std::size_t block_count() const {
+    return size_list_.empty() ? 0 : size_list_.back();
+  }
+  std::size_t element_count() const {
+    return insert_count_;
+  }
+  bool is_full() const {
+    return insert_count_ >= target_element_count_;
+  }
+
+  /// fraction of bits set
+  double density() const;
+  double approx_unique_element_count() const;
+  double effective_fpp() const {
+    return estimate_fpp(size_list_.empty() ? 0 : size_list_.front(),
+			insert_count_);
+  }
+
+  /**
+   * fold the table down to about target_ratio of its size
+   *
+   * Blocks are OR-ed together, so nothing inserted so far is lost.
+   * @returns false if the table cannot be made smaller
+   */
+  bool compress(double target_ratio);
+
+  /// name of the selected probe kernel, e.g. "avx2" or "scalar"
+  static const char* get_probe_impl();
+
+  /// false positive rate of a table of @blocks blocks holding @n keys
+  static double estimate_fpp(std::size_t blocks, std::size_t n);
+
+private:
+  using table_type = mempool::bloom_filter::vector<uint64_t>;
+
+  void init();
+  const uint64_t* blocks() const {
+    // the table is allocated with slack so the blocks can start on a
+    // cache line boundary
+    auto p = reinterpret_cast<uintptr_t>(bit_table_.data());
+    return reinterpret_cast<const uint64_t*>(
+      (p + BLOCK_BYTES - 1) & ~uintptr_t(BLOCK_BYTES - 1));
+  }
+  uint64_t* blocks() {
+    return const_cast<uint64_t*>(std::as_const(*this).blocks());
+  }
+  void resize_table(std::size_t blocks);
+
+  uint64_t hash_u32(uint32_t val) const;
+  uint64_t hash_bytes(const unsigned char* key, std::size_t length) const;
+
+  const uint64_t* block_for(uint64_t hash) const {
+    uint64_t b = hash >> 32;
+    for (auto size : size_list_) {
+      b %= size;
+    }
+    return blocks() + b * BLOCK_WORDS;
+  }
+  void insert_hash(uint64_t hash);
+  bool contains_hash(uint64_t hash) const;
+
+  static std::size_t find_block_count(std::size_t n, double fpp);
+
+  table_type bit_table_;
+  std::vector<uint64_t> size_list_;  ///< block count before each compress()
+  std::size_t insert_count_;
+  std::size_t target_element_count_;
+  std::size_t random_seed_;
+
+public:
+  void encode(ceph::buffer::list& bl) const;
+  void decode(ceph::buffer::list::const_iterator& bl);
+  void dump(ceph::Formatter *f) const;
+  static void generate_test_instances(std::list<blocked_bloom_filter*>& ls);
+};
+WRITE_CLASS_ENCODER(blocked_bloom_filter)
+
 #endif
 
 
@@ -25,6 +25,7 @@
 #include "include/compat.h"
 #include "include/mempool.h"
 #include "armor.h"
+#include "common/buffer_instrumentation.h"
 #include "common/environment.h"
 #include "common/errno.h"
 #include "common/error_code.h"
@@ -81,6 +82,78 @@ static ceph::spinlock debug_lock;
     return buffer_missed_crc;
   }
 
+  /*
+   * Per-thread caches of the two allocations made for nearly every
+   * small append: the ptr_node linking a segment into a list, and the
+   * CEPH_BUFFER_ALLOC_UNIT sized raw_combined holding the append
+   * buffer.  A freed block goes into the cache of whichever thread
+   * frees it; the caches are small and bounded, so nothing piles up
+   * when one thread allocates and another frees.
+   *
+   * Set CEPH_BUFFER_NO_POOL to bypass them, e.g. under valgrind.
+   */
+  static bool buffer_pool_disabled = get_env_bool("CEPH_BUFFER_NO_POOL");
+
+  namespace {
+  template <unsigned N>
+  struct free_cache {
+    void* slots[N];
+    unsigned count = 0;
+
+    void* get() {
+      return count ? slots[--count] : nullptr;
+    }
+    bool put(void* p) {
+      if (count == N) {
+	return false;
+      }
+      slots[count++] = p;
+      return true;
+    }
+  };
+
+  struct thread_buffer_cache {
+    free_cache<256> nodes;
+    free_cache<16> combined;
+    buffer_instrumentation::alloc_counters counters;
+
+    ~thread_buffer_cache();
+  };
+
+  // blocks freed after this thread's cache has been destroyed (e.g. by
+  // static destructors) go straight back to the allocator.
+  thread_local bool thread_buffer_cache_gone = false;
+  thread_local thread_buffer_cache thread_cache;
+
+  thread_buffer_cache::~thread_buffer_cache()
+  {
+    thread_buffer_cache_gone = true;
+    while (void* p = nodes.get()) {
+      ::operator delete(p);
+    }
+    while (void* p = combined.get()) {
+      aligned_free(p);
+    }
+  }
+
+  inline thread_buffer_cache* get_thread_cache()
+  {
+    if (unlikely(buffer_pool_disabled || thread_buffer_cache_gone)) {
+      return nullptr;
+    }
+    return &thread_cache;
+  }
+  } // anonymous namespace
+
+  buffer_instrumentation::alloc_counters
+  buffer_instrumentation::get_thread_alloc_counters()
+  {
+    if (auto cache = get_thread_cache(); cache) {
+      return cache->counters;
+    }
+    return {};
+  }
+
   /*
    * raw_combined is always placed within a single allocation along
    * with the data buffer.  the data goes at the beginning, and
@@ -103,14 +176,27 @@ static ceph::spinlock debug_lock;
 				  alignof(buffer::raw_combined));
       size_t datalen = round_up_to(len, alignof(buffer::raw_combined));
 
+      char *ptr = 0;
+      // only append buffers are cached; everything in the cache is at
+      // least sizeof(void *) aligned
+      auto cache = rawlen + datalen == CEPH_BUFFER_ALLOC_UNIT &&
+	align == sizeof(void *) ? get_thread_cache() : nullptr;
+      if (cache) {
+	++cache->counters.combined_alloc;
+	ptr = static_cast<char*>(cache->combined.get());
+	if (ptr) {
+	  ++cache->counters.combined_reuse;
+	}
+      }
+      if (!ptr) {
 #ifdef DARWIN
-      char *ptr = (char *) valloc(rawlen + datalen);
+	ptr = (char *) valloc(rawlen + datalen);
 #else
-      char *ptr = 0;
-      int r = ::posix_memalign((void**)(void*)&ptr, align, rawlen + datalen);
-      if (r)
-	throw bad_alloc();
+	int r = ::posix_memalign((void**)(void*)&ptr, align, rawlen + datalen);
+	if (r)
+	  throw bad_alloc();
 #endif /* DARWIN */
+      }
       if (!ptr)
 	throw bad_alloc();
 
@@ -122,6 +208,14 @@ static ceph::spinlock debug_lock;
 
     static void operator delete(void *ptr) {
       raw_combined *raw = (raw_combined *)ptr;
+      // the data and raw_combined fill the whole allocation, so this
+      // is an append buffer iff raw_combined ends at the unit boundary
+      if ((char*)(raw + 1) - raw->data == CEPH_BUFFER_ALLOC_UNIT) {
+	if (auto cache = get_thread_cache();
+	    cache && cache->combined.put(raw->data)) {
+	  return;
+	}
+      }
       aligned_free((void *)raw->data);
     }
   };
@@ -1317,15 +1411,17 @@ static ceph::spinlock debug_lock;
   buffer::list::reserve_t buffer::list::obtain_contiguous_space(
     const unsigned len)
   {
-    // note: if len < the normal append_buffer size it *might*
-    // be better to allocate a normal-sized append_buffer and
-    // use part of it.  however, that optimizes for the case of
-    // old-style types including new-style types.  and in most
-    // such cases, this won't be the very first thing encoded to
-    // the list, so append_buffer will already be allocated.
-    // OTOH if everything is new-style, we *should* allocate
-    // only what we need and conserve memory.
+    // a small reservation gets a normal-sized append_buffer rather
+    // than exactly len bytes: the encoders that follow (ENCODE_FINISH,
+    // the next denc'ed member, ...) then keep writing into it instead
+    // of each allocating another raw and ptr_node, and the buffer
+    // itself usually comes from the per-thread cache.  only larger
+    // reservations get a buffer of their own, sized to fit.
     if (unlikely(get_append_buffer_unused_tail_length() < len)) {
+      if (len <= CEPH_BUFFER_APPEND_SIZE) {
+	auto& new_back = refill_append_space(len);
+	return { new_back.c_str(), &new_back._len, &_len };
+      }
       auto new_back = \
 	buffer::ptr_node::create(buffer::create(len)).release();
       new_back->set_length(0);   // unused, so far.
@@ -2209,6 +2305,27 @@ buffer::ptr_node::create_hypercombined(ceph::unique_leakable_ptr<buffer::raw> r)
     new ptr_node(std::move(r)));
 }
 
+void* buffer::ptr_node::operator new(const std::size_t size)
+{
+  if (auto cache = get_thread_cache(); cache && size == sizeof(ptr_node)) {
+    ++cache->counters.node_alloc;
+    if (void* p = cache->nodes.get(); p) {
+      ++cache->counters.node_reuse;
+      return p;
+    }
+  }
+  return ::operator new(size);
+}
+
+void buffer::ptr_node::operator delete(void* const p, const std::size_t size)
+{
+  if (auto cache = get_thread_cache();
+      cache && size == sizeof(ptr_node) && cache->nodes.put(p)) {
+    return;
+  }
+  ::operator delete(p);
+}
+
 buffer::ptr_node* buffer::ptr_node::cloner::operator()(
   const buffer::ptr_node& clone_this)
 {
@@ -29,4 +29,17 @@ struct instrumented_bptr : public ceph::buffer::ptr {
   }
 };
 
+// allocation counters of the calling thread, kept by the per-thread
+// ptr_node and append buffer caches in buffer.cc.  *_alloc counts the
+// requests, *_reuse those served from the cache, so the difference is
+// what reached the allocator.  All zero with CEPH_BUFFER_NO_POOL set.
+struct alloc_counters {
+  uint64_t node_alloc = 0;
+  uint64_t node_reuse = 0;
+  uint64_t combined_alloc = 0;
+  uint64_t combined_reuse = 0;
+};
+
+alloc_counters get_thread_alloc_counters();
+
 } // namespace ceph::buffer_instrumentation
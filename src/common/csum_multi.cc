@@ -0,0 +1,543 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "common/csum_multi.h"
+
+#include <cstring>
+
+#include "acconfig.h"
+#include "arch/probe.h"
+#include "arch/intel.h"
+#include "arch/arm.h"
+#include "include/crc32c.h"
+#include "xxHash/xxhash.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__aarch64__) && defined(HAVE_ARMV8_CRC)
+/* Request crc extension capabilities from the assembler */
+asm(".arch_extension crc");
+#endif
+
+namespace ceph::csum_multi {
+
+void crc32c_scalar(uint32_t init, size_t len,
+		   const unsigned char* const* bufs, size_t n, uint32_t* out)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = ceph_crc32c(init, bufs[i], len);
+  }
+}
+
+void xxhash32_scalar(uint32_t seed, size_t len,
+		     const unsigned char* const* bufs, size_t n, uint32_t* out)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = XXH32(bufs[i], len, seed);
+  }
+}
+
+void xxhash64_scalar(uint64_t seed, size_t len,
+		     const unsigned char* const* bufs, size_t n, uint64_t* out)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = XXH64(bufs[i], len, seed);
+  }
+}
+
+namespace {
+
+inline uint32_t read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+inline uint64_t read64(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// The vector kernels below run the stripe loop of xxhash for several
+// buffers at once and then finish every buffer with the scalar code
+// here.  They read the input as little-endian words, so they are only
+// built for little-endian targets.
+#if (defined(__x86_64__) || defined(__aarch64__)) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CEPH_CSUM_MULTI_XXHASH 1
+
+constexpr uint32_t XXH_PRIME32_1 = 2654435761U;
+constexpr uint32_t XXH_PRIME32_2 = 2246822519U;
+constexpr uint32_t XXH_PRIME32_3 = 3266489917U;
+constexpr uint32_t XXH_PRIME32_4 = 668265263U;
+constexpr uint32_t XXH_PRIME32_5 = 374761393U;
+
+constexpr uint64_t XXH_PRIME64_1 = 11400714785074694791ULL;
+constexpr uint64_t XXH_PRIME64_2 = 14029467366897019727ULL;
+constexpr uint64_t XXH_PRIME64_3 = 1609587929392839161ULL;
+constexpr uint64_t XXH_PRIME64_4 = 9650029242287828579ULL;
+constexpr uint64_t XXH_PRIME64_5 = 2870177450012600261ULL;
+
+inline uint32_t rotl32(uint32_t x, int r) {
+  return (x << r) | (x >> (32 - r));
+}
+inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// finish XXH32 of a buffer of @len bytes (>= 16) whose 16-byte stripes
+// have been folded into @v; @tail points past the last full stripe.
+uint32_t xxh32_finish(const uint32_t* v, const unsigned char* tail,
+		      size_t len)
+{
+  uint32_t h = rotl32(v[0], 1) + rotl32(v[1], 7) +
+    rotl32(v[2], 12) + rotl32(v[3], 18);
+  h += static_cast<uint32_t>(len);
+  size_t left = len & 15;
+  for (; left >= 4; left -= 4, tail += 4) {
+    h += read32(tail) * XXH_PRIME32_3;
+    h = rotl32(h, 17) * XXH_PRIME32_4;
+  }
+  for (; left > 0; --left, ++tail) {
+    h += (*tail) * XXH_PRIME32_5;
+    h = rotl32(h, 11) * XXH_PRIME32_1;
+  }
+  h ^= h >> 15;
+  h *= XXH_PRIME32_2;
+  h ^= h >> 13;
+  h *= XXH_PRIME32_3;
+  h ^= h >> 16;
+  return h;
+}
+
+inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH_PRIME64_2;
+  acc = rotl64(acc, 31);
+  return acc * XXH_PRIME64_1;
+}
+inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+  acc ^= xxh64_round(0, val);
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+// finish XXH64 of a buffer of @len bytes (>= 32) whose 32-byte stripes
+// have been folded into @v; @tail points past the last full stripe.
+uint64_t xxh64_finish(const uint64_t* v, const unsigned char* tail,
+		      size_t len)
+{
+  uint64_t h = rotl64(v[0], 1) + rotl64(v[1], 7) +
+    rotl64(v[2], 12) + rotl64(v[3], 18);
+  for (int i = 0; i < 4; ++i) {
+    h = xxh64_merge_round(h, v[i]);
+  }
+  h += len;
+  size_t left = len & 31;
+  for (; left >= 8; left -= 8, tail += 8) {
+    h ^= xxh64_round(0, read64(tail));
+    h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+  }
+  if (left >= 4) {
+    h ^= static_cast<uint64_t>(read32(tail)) * XXH_PRIME64_1;
+    h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    left -= 4;
+    tail += 4;
+  }
+  for (; left > 0; --left, ++tail) {
+    h ^= (*tail) * XXH_PRIME64_5;
+    h = rotl64(h, 11) * XXH_PRIME64_1;
+  }
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+#endif
+
+#if defined(__x86_64__)
+
+// crc32 has a latency of 3 cycles but a throughput of 1 per cycle, so
+// feeding four independent buffers keeps the unit busy.
+__attribute__((target("sse4.2")))
+void crc32c_sse42(uint32_t init, size_t len,
+		  const unsigned char* const* bufs, size_t n, uint32_t* out)
+{
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const unsigned char *p0 = bufs[i], *p1 = bufs[i + 1];
+    const unsigned char *p2 = bufs[i + 2], *p3 = bufs[i + 3];
+    uint64_t c0 = init, c1 = init, c2 = init, c3 = init;
+    size_t off = 0;
+    for (; off + 8 <= len; off += 8) {
+      c0 = _mm_crc32_u64(c0, read64(p0 + off));
+      c1 = _mm_crc32_u64(c1, read64(p1 + off));
+      c2 = _mm_crc32_u64(c2, read64(p2 + off));
+      c3 = _mm_crc32_u64(c3, read64(p3 + off));
+    }
+    for (; off < len; ++off) {
+      c0 = _mm_crc32_u8(c0, p0[off]);
+      c1 = _mm_crc32_u8(c1, p1[off]);
+      c2 = _mm_crc32_u8(c2, p2[off]);
+      c3 = _mm_crc32_u8(c3, p3[off]);
+    }
+    out[i] = c0;
+    out[i + 1] = c1;
+    out[i + 2] = c2;
+    out[i + 3] = c3;
+  }
+  crc32c_scalar(init, len, bufs + i, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+inline __m256i xxh32_round_avx2(__m256i acc, __m256i input)
+{
+  acc = _mm256_add_epi32(
+    acc, _mm256_mullo_epi32(input, _mm256_set1_epi32(XXH_PRIME32_2)));
+  acc = _mm256_or_si256(_mm256_slli_epi32(acc, 13),
+			_mm256_srli_epi32(acc, 32 - 13));
+  return _mm256_mullo_epi32(acc, _mm256_set1_epi32(XXH_PRIME32_1));
+}
+
+__attribute__((target("avx2")))
+inline __m256i load_2x128(const unsigned char* lo, const unsigned char* hi)
+{
+  return _mm256_inserti128_si256(
+    _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)lo)),
+    _mm_loadu_si128((const __m128i*)hi), 1);
+}
+
+// two buffers per ymm register (4 x 32-bit accumulators each), and two
+// registers in flight.
+__attribute__((target("avx2")))
+void xxhash32_avx2(uint32_t seed, size_t len,
+		   const unsigned char* const* bufs, size_t n, uint32_t* out)
+{
+  size_t i = 0;
+  if (len >= 16) {
+    const size_t stripes_len = len & ~size_t(15);
+    const __m256i init = _mm256_setr_epi32(
+      seed + XXH_PRIME32_1 + XXH_PRIME32_2, seed + XXH_PRIME32_2,
+      seed, seed - XXH_PRIME32_1,
+      seed + XXH_PRIME32_1 + XXH_PRIME32_2, seed + XXH_PRIME32_2,
+      seed, seed - XXH_PRIME32_1);
+    for (; i + 4 <= n; i += 4) {
+      const unsigned char *p0 = bufs[i], *p1 = bufs[i + 1];
+      const unsigned char *p2 = bufs[i + 2], *p3 = bufs[i + 3];
+      __m256i a = init, b = init;
+      for (size_t off = 0; off < stripes_len; off += 16) {
+	a = xxh32_round_avx2(a, load_2x128(p0 + off, p1 + off));
+	b = xxh32_round_avx2(b, load_2x128(p2 + off, p3 + off));
+      }
+      alignas(32) uint32_t v[16];
+      _mm256_store_si256((__m256i*)v, a);
+      _mm256_store_si256((__m256i*)(v + 8), b);
+      out[i] = xxh32_finish(v, p0 + stripes_len, len);
+      out[i + 1] = xxh32_finish(v + 4, p1 + stripes_len, len);
+      out[i + 2] = xxh32_finish(v + 8, p2 + stripes_len, len);
+      out[i + 3] = xxh32_finish(v + 12, p3 + stripes_len, len);
+    }
+  }
+  xxhash32_scalar(seed, len, bufs + i, n - i, out + i);
+}
+
+__attribute__((target("avx512f")))
+inline __m512i xxh32_round_avx512(__m512i acc, __m512i input)
+{
+  acc = _mm512_add_epi32(
+    acc, _mm512_mullo_epi32(input, _mm512_set1_epi32(XXH_PRIME32_2)));
+  acc = _mm512_rol_epi32(acc, 13);
+  return _mm512_mullo_epi32(acc, _mm512_set1_epi32(XXH_PRIME32_1));
+}
+
+__attribute__((target("avx512f")))
+inline __m512i load_4x128(const unsigned char* p0, const unsigned char* p1,
+			  const unsigned char* p2, const unsigned char* p3)
+{
+  __m512i v = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i*)p0));
+  v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i*)p1), 1);
+  v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i*)p2), 2);
+  return _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i*)p3), 3);
+}
+
+// four buffers per zmm register, and two registers in flight.
+__attribute__((target("avx512f,avx2")))
+void xxhash32_avx512(uint32_t seed, size_t len,
+		     const unsigned char* const* bufs, size_t n, uint32_t* out)
+{
+  size_t i = 0;
+  if (len >= 16) {
+    const size_t stripes_len = len & ~size_t(15);
+    const __m512i init = _mm512_broadcast_i32x4(_mm_setr_epi32(
+      seed + XXH_PRIME32_1 + XXH_PRIME32_2, seed + XXH_PRIME32_2,
+      seed, seed - XXH_PRIME32_1));
+    for (; i + 8 <= n; i += 8) {
+      const unsigned char* const* p = bufs + i;
+      __m512i a = init, b = init;
+      for (size_t off = 0; off < stripes_len; off += 16) {
+	a = xxh32_round_avx512(
+	  a, load_4x128(p[0] + off, p[1] + off, p[2] + off, p[3] + off));
+	b = xxh32_round_avx512(
+	  b, load_4x128(p[4] + off, p[5] + off, p[6] + off, p[7] + off));
+      }
+      alignas(64) uint32_t v[32];
+      _mm512_store_si512(v, a);
+      _mm512_store_si512(v + 16, b);
+      for (size_t j = 0; j < 8; ++j) {
+	out[i + j] = xxh32_finish(v + 4 * j, p[j] + stripes_len, len);
+      }
+    }
+  }
+  xxhash32_avx2(seed, len, bufs + i, n - i, out + i);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+inline __m512i xxh64_round_avx512(__m512i acc, __m512i input)
+{
+  acc = _mm512_add_epi64(
+    acc, _mm512_mullo_epi64(input, _mm512_set1_epi64(XXH_PRIME64_2)));
+  acc = _mm512_rol_epi64(acc, 31);
+  return _mm512_mullo_epi64(acc, _mm512_set1_epi64(XXH_PRIME64_1));
+}
+
+__attribute__((target("avx512f")))
+inline __m512i load_2x256(const unsigned char* lo, const unsigned char* hi)
+{
+  return _mm512_inserti64x4(
+    _mm512_castsi256_si512(_mm256_loadu_si256((const __m256i*)lo)),
+    _mm256_loadu_si256((const __m256i*)hi), 1);
+}
+
+// xxhash64 needs a 64-bit multiply, which only avx512dq has; two
+// buffers per zmm register (4 x 64-bit accumulators each), and two
+// registers in flight.
+__attribute__((target("avx512f,avx512dq")))
+void xxhash64_avx512(uint64_t seed, size_t len,
+		     const unsigned char* const* bufs, size_t n, uint64_t* out)
+{
+  size_t i = 0;
+  if (len >= 32) {
+    const size_t stripes_len = len & ~size_t(31);
+    const __m512i init = _mm512_setr_epi64(
+      seed + XXH_PRIME64_1 + XXH_PRIME64_2, seed + XXH_PRIME64_2,
+      seed, seed - XXH_PRIME64_1,
+      seed + XXH_PRIME64_1 + XXH_PRIME64_2, seed + XXH_PRIME64_2,
+      seed, seed - XXH_PRIME64_1);
+    for (; i + 4 <= n; i += 4) {
+      const unsigned char *p0 = bufs[i], *p1 = bufs[i + 1];
+      const unsigned char *p2 = bufs[i + 2], *p3 = bufs[i + 3];
+      __m512i a = init, b = init;
+      for (size_t off = 0; off < stripes_len; off += 32) {
+	a = xxh64_round_avx512(a, load_2x256(p0 + off, p1 + off));
+	b = xxh64_round_avx512(b, load_2x256(p2 + off, p3 + off));
+      }
+      alignas(64) uint64_t v[16];
+      _mm512_store_si512(v, a);
+      _mm512_store_si512(v + 8, b);
+      out[i] = xxh64_finish(v, p0 + stripes_len, len);
+      out[i + 1] = xxh64_finish(v + 4, p1 + stripes_len, len);
+      out[i + 2] = xxh64_finish(v + 8, p2 + stripes_len, len);
+      out[i + 3] = xxh64_finish(v + 12, p3 + stripes_len, len);
+    }
+  }
+  xxhash64_scalar(seed, len, bufs + i, n - i, out + i);
+}
+
+#endif // __x86_64__
+
+#if defined(__aarch64__) && defined(HAVE_ARMV8_CRC)
+
+#define CRC32CX(crc, value) __asm__("crc32cx %w[c], %w[c], %x[v]":[c]"+r"(crc):[v]"r"(value))
+#define CRC32CB(crc, value) __asm__("crc32cb %w[c], %w[c], %w[v]":[c]"+r"(crc):[v]"r"(value))
+
+void crc32c_aarch64(uint32_t init, size_t len,
+		    const unsigned char* const* bufs, size_t n, uint32_t* out)
+{
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const unsigned char *p0 = bufs[i], *p1 = bufs[i + 1];
+    const unsigned char *p2 = bufs[i + 2], *p3 = bufs[i + 3];
+    uint32_t c0 = init, c1 = init, c2 = init, c3 = init;
+    size_t off = 0;
+    for (; off + 8 <= len; off += 8) {
+      CRC32CX(c0, read64(p0 + off));
+      CRC32CX(c1, read64(p1 + off));
+      CRC32CX(c2, read64(p2 + off));
+      CRC32CX(c3, read64(p3 + off));
+    }
+    for (; off < len; ++off) {
+      CRC32CB(c0, p0[off]);
+      CRC32CB(c1, p1[off]);
+      CRC32CB(c2, p2[off]);
+      CRC32CB(c3, p3[off]);
+    }
+    out[i] = c0;
+    out[i + 1] = c1;
+    out[i + 2] = c2;
+    out[i + 3] = c3;
+  }
+  crc32c_scalar(init, len, bufs + i, n - i, out + i);
+}
+
+#endif // __aarch64__ && HAVE_ARMV8_CRC
+
+#if defined(__aarch64__) && defined(__ARM_NEON) && \
+    defined(CEPH_CSUM_MULTI_XXHASH)
+
+inline uint32x4_t xxh32_round_neon(uint32x4_t acc, uint32x4_t input)
+{
+  acc = vmlaq_u32(acc, input, vdupq_n_u32(XXH_PRIME32_2));
+  acc = vorrq_u32(vshlq_n_u32(acc, 13), vshrq_n_u32(acc, 32 - 13));
+  return vmulq_u32(acc, vdupq_n_u32(XXH_PRIME32_1));
+}
+
+// one buffer per q register, four registers in flight.
+void xxhash32_neon(uint32_t seed, size_t len,
+		   const unsigned char* const* bufs, size_t n, uint32_t* out)
+{
+  size_t i = 0;
+  if (len >= 16) {
+    const size_t stripes_len = len & ~size_t(15);
+    const uint32_t init_v[4] = {
+      seed + XXH_PRIME32_1 + XXH_PRIME32_2, seed + XXH_PRIME32_2,
+      seed, seed - XXH_PRIME32_1
+    };
+    const uint32x4_t init = vld1q_u32(init_v);
+    for (; i + 4 <= n; i += 4) {
+      const unsigned char *p0 = bufs[i], *p1 = bufs[i + 1];
+      const unsigned char *p2 = bufs[i + 2], *p3 = bufs[i + 3];
+      uint32x4_t a = init, b = init, c = init, d = init;
+      for (size_t off = 0; off < stripes_len; off += 16) {
+	a = xxh32_round_neon(a, vreinterpretq_u32_u8(vld1q_u8(p0 + off)));
+	b = xxh32_round_neon(b, vreinterpretq_u32_u8(vld1q_u8(p1 + off)));
+	c = xxh32_round_neon(c, vreinterpretq_u32_u8(vld1q_u8(p2 + off)));
+	d = xxh32_round_neon(d, vreinterpretq_u32_u8(vld1q_u8(p3 + off)));
+      }
+      uint32_t v[16];
+      vst1q_u32(v, a);
+      vst1q_u32(v + 4, b);
+      vst1q_u32(v + 8, c);
+      vst1q_u32(v + 12, d);
+      out[i] = xxh32_finish(v, p0 + stripes_len, len);
+      out[i + 1] = xxh32_finish(v + 4, p1 + stripes_len, len);
+      out[i + 2] = xxh32_finish(v + 8, p2 + stripes_len, len);
+      out[i + 3] = xxh32_finish(v + 12, p3 + stripes_len, len);
+    }
+  }
+  xxhash32_scalar(seed, len, bufs + i, n - i, out + i);
+}
+
+#endif // __aarch64__ && __ARM_NEON
+
+template<typename Fn>
+struct kernel_t {
+  Fn fn;
+  const char* name;
+};
+
+using crc32c_fn = decltype(&crc32c_scalar);
+using xxhash32_fn = decltype(&xxhash32_scalar);
+using xxhash64_fn = decltype(&xxhash64_scalar);
+
+/*
+ * choose best implementation based on the CPU architecture.
+ *
+ * These are function-local statics rather than globals so that callers
+ * running from other static initializers never see an unset pointer.
+ */
+const kernel_t<crc32c_fn>& crc32c_kernel()
+{
+  static const kernel_t<crc32c_fn> k = [] () -> kernel_t<crc32c_fn> {
+    ceph_arch_probe();
+#if defined(__x86_64__)
+    if (ceph_arch_intel_sse42) {
+      return {crc32c_sse42, "sse4.2"};
+    }
+#elif defined(__aarch64__) && defined(HAVE_ARMV8_CRC)
+    if (ceph_arch_aarch64_crc32) {
+      return {crc32c_aarch64, "aarch64"};
+    }
+#endif
+    return {crc32c_scalar, "scalar"};
+  }();
+  return k;
+}
+
+const kernel_t<xxhash32_fn>& xxhash32_kernel()
+{
+  static const kernel_t<xxhash32_fn> k = [] () -> kernel_t<xxhash32_fn> {
+    ceph_arch_probe();
+#if defined(__x86_64__)
+    if (ceph_arch_intel_avx512f) {
+      return {xxhash32_avx512, "avx512"};
+    }
+    if (ceph_arch_intel_avx2) {
+      return {xxhash32_avx2, "avx2"};
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON) && \
+      defined(CEPH_CSUM_MULTI_XXHASH)
+    if (ceph_arch_neon) {
+      return {xxhash32_neon, "neon"};
+    }
+#endif
+    return {xxhash32_scalar, "scalar"};
+  }();
+  return k;
+}
+
+const kernel_t<xxhash64_fn>& xxhash64_kernel()
+{
+  static const kernel_t<xxhash64_fn> k = [] () -> kernel_t<xxhash64_fn> {
+    ceph_arch_probe();
+#if defined(__x86_64__)
+    if (ceph_arch_intel_avx512f && ceph_arch_intel_avx512dq) {
+      return {xxhash64_avx512, "avx512"};
+    }
+#endif
+    return {xxhash64_scalar, "scalar"};
+  }();
+  return k;
+}
+
+} // anonymous namespace
+
+void crc32c(uint32_t init, size_t len,
+	    const unsigned char* const* bufs, size_t n, uint32_t* out)
+{
+  crc32c_kernel().fn(init, len, bufs, n, out);
+}
+
+void xxhash32(uint32_t seed, size_t len,
+	      const unsigned char* const* bufs, size_t n, uint32_t* out)
+{
+  xxhash32_kernel().fn(seed, len, bufs, n, out);
+}
+
+void xxhash64(uint64_t seed, size_t len,
+	      const unsigned char* const* bufs, size_t n, uint64_t* out)
+{
+  xxhash64_kernel().fn(seed, len, bufs, n, out);
+}
+
+const char* get_crc32c_impl()
+{
+  return crc32c_kernel().name;
+}
+
+const char* get_xxhash32_impl()
+{
+  return xxhash32_kernel().name;
+}
+
+const char* get_xxhash64_impl()
+{
+  return xxhash64_kernel().name;
+}
+
+} // namespace ceph::csum_multi
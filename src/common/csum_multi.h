@@ -0,0 +1,48 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_COMMON_CSUM_MULTI_H
+#define CEPH_COMMON_CSUM_MULTI_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Multi-buffer checksum kernels.
+ *
+ * Each function checksums @n independent buffers of the same length
+ * @len and stores one value per buffer in @out.  The buffers are
+ * hashed in lock-step, so the serial dependency chains of the
+ * individual hashes overlap in the pipeline, and on CPUs with wide
+ * vector units the lanes of several buffers share one register.
+ *
+ * The results are bit-identical to calling the scalar implementation
+ * (ceph_crc32c(), XXH32(), XXH64()) on every buffer.  The kernel is
+ * picked at startup from the features reported by arch/probe.h.
+ */
+namespace ceph::csum_multi {
+
+void crc32c(uint32_t init, size_t len,
+	    const unsigned char* const* bufs, size_t n, uint32_t* out);
+void xxhash32(uint32_t seed, size_t len,
+	      const unsigned char* const* bufs, size_t n, uint32_t* out);
+void xxhash64(uint64_t seed, size_t len,
+	      const unsigned char* const* bufs, size_t n, uint64_t* out);
+
+// one buffer at a time through the regular entry points; used as the
+// fallback and as the baseline in tests and benchmarks.
+void crc32c_scalar(uint32_t init, size_t len,
+		   const unsigned char* const* bufs, size_t n, uint32_t* out);
+void xxhash32_scalar(uint32_t seed, size_t len,
+		     const unsigned char* const* bufs, size_t n, uint32_t* out);
+void xxhash64_scalar(uint64_t seed, size_t len,
+		     const unsigned char* const* bufs, size_t n, uint64_t* out);
+
+/// name of the selected kernel per algorithm, e.g. "avx512" or "scalar"
+const char* get_crc32c_impl();
+const char* get_xxhash32_impl();
+const char* get_xxhash64_impl();
+
+}
+
+#endif
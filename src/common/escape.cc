@@ -16,8 +16,6 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <iomanip>
-#include <boost/optional.hpp>
 
 /*
  * Some functions for escaping RGW responses
@@ -114,53 +112,59 @@ void escape_xml_attr(const char *buf, char *out)
 	*o = '\0';
 }
 
-// applies hex formatting on construction, restores on destruction
-struct hex_formatter {
-  std::ostream& out;
-  const char old_fill;
-  const std::ostream::fmtflags old_flags;
-
-  explicit hex_formatter(std::ostream& out)
-    : out(out),
-      old_fill(out.fill('0')),
-      old_flags(out.setf(out.hex, out.basefield))
-  {}
-  ~hex_formatter() {
-    out.fill(old_fill);
-    out.flags(old_flags);
+static inline bool xml_needs_escape(unsigned char c)
+{
+  switch (c) {
+  case '<':
+  case '&':
+  case '>':
+  case '\'':
+  case '"':
+    return true;
+  default:
+    return ((c < 0x20) && (c != 0x09) && (c != 0x0a)) || (c == 0x7f);
   }
-};
+}
 
 std::ostream& operator<<(std::ostream& out, const xml_stream_escaper& e)
 {
-  boost::optional<hex_formatter> fmt;
-
-  for (unsigned char c : e.str) {
+  const char *p = e.str.data();
+  const char *end = p + e.str.size();
+  while (p != end) {
+    // write out the longest run that needs no escaping in one go
+    const char *run = p;
+    while (p != end && !xml_needs_escape(*p)) {
+      ++p;
+    }
+    if (p != run) {
+      out.write(run, p - run);
+    }
+    if (p == end) {
+      break;
+    }
+    unsigned char c = *p++;
     switch (c) {
     case '<':
-      out << LESS_THAN_XESCAPE;
+      out.write(LESS_THAN_XESCAPE, SSTRL(LESS_THAN_XESCAPE));
       break;
     case '&':
-      out << AMPERSAND_XESCAPE;
+      out.write(AMPERSAND_XESCAPE, SSTRL(AMPERSAND_XESCAPE));
       break;
     case '>':
-      out << GREATER_THAN_XESCAPE;
+      out.write(GREATER_THAN_XESCAPE, SSTRL(GREATER_THAN_XESCAPE));
       break;
     case '\'':
-      out << SGL_QUOTE_XESCAPE;
+      out.write(SGL_QUOTE_XESCAPE, SSTRL(SGL_QUOTE_XESCAPE));
       break;
     case '"':
-      out << DBL_QUOTE_XESCAPE;
+      out.write(DBL_QUOTE_XESCAPE, SSTRL(DBL_QUOTE_XESCAPE));
       break;
     default:
-      // Escape control characters.
-      if (((c < 0x20) && (c != 0x09) && (c != 0x0a)) || (c == 0x7f)) {
-        if (!fmt) {
-          fmt.emplace(out); // enable hex formatting
-        }
-        out << "&#x" << std::setw(2) << static_cast<unsigned int>(c) << ';';
-      } else {
-        out << c;
+      {
+        // Escape control characters.
+        char buf[7];
+        snprintf(buf, sizeof(buf), "&#x%02x;", c);
+        out.write(buf, 6);
       }
       break;
     }
@@ -251,33 +255,47 @@ void escape_json_attr(const char *buf, size_t src_len, char *out)
 	*o = '\0';
 }
 
-std::ostream& operator<<(std::ostream& out, const json_stream_escaper& e)
+static inline bool json_needs_escape(unsigned char c)
 {
-  boost::optional<hex_formatter> fmt;
+  return c == '"' || c == '\\' || c < 0x20 || c == 0x7f;
+}
 
-  for (unsigned char c : e.str) {
+std::ostream& operator<<(std::ostream& out, const json_stream_escaper& e)
+{
+  const char *p = e.str.data();
+  const char *end = p + e.str.size();
+  while (p != end) {
+    // write out the longest run that needs no escaping in one go
+    const char *run = p;
+    while (p != end && !json_needs_escape(*p)) {
+      ++p;
+    }
+    if (p != run) {
+      out.write(run, p - run);
+    }
+    if (p == end) {
+      break;
+    }
+    unsigned char c = *p++;
     switch (c) {
     case '"':
-      out << DBL_QUOTE_JESCAPE;
+      out.write(DBL_QUOTE_JESCAPE, SSTRL(DBL_QUOTE_JESCAPE));
       break;
     case '\\':
-      out << BACKSLASH_JESCAPE;
+      out.write(BACKSLASH_JESCAPE, SSTRL(BACKSLASH_JESCAPE));
       break;
     case '\t':
-      out << TAB_JESCAPE;
+      out.write(TAB_JESCAPE, SSTRL(TAB_JESCAPE));
       break;
     case '\n':
-      out << NEWLINE_JESCAPE;
+      out.write(NEWLINE_JESCAPE, SSTRL(NEWLINE_JESCAPE));
       break;
     default:
-      // Escape control characters.
-      if ((c < 0x20) || (c == 0x7f)) {
-        if (!fmt) {
-          fmt.emplace(out); // enable hex formatting
-        }
-        out << "\\u" << std::setw(4) << static_cast<unsigned int>(c);
-      } else {
-        out << c;
+      {
+        // Escape control characters.
+        char buf[7];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out.write(buf, 6);
       }
       break;
     }
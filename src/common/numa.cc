@@ -6,6 +6,9 @@
 #include <cstring>
 #include <errno.h>
 #include <iostream>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "include/stringify.h"
 #include "common/safe_io.h"
@@ -224,6 +227,32 @@ int set_cpu_affinity_all_threads(size_t cpu_set_size, cpu_set_t *cpu_set)
   return 0;
 }
 
+int get_current_numa_node()
+{
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) < 0) {
+    return -errno;
+  }
+  return node;
+}
+
+int bind_memory_to_numa_node(void *addr, size_t len, int node)
+{
+  if (node < 0) {
+    return -EINVAL;
+  }
+  constexpr unsigned bits = sizeof(unsigned long) * 8;
+  std::vector<unsigned long> mask(node / bits + 1);
+  mask[node / bits] = 1ul << (node % bits);
+  // MPOL_BIND from <numaif.h>, which we avoid depending on
+  constexpr int mpol_bind = 2;
+  if (syscall(SYS_mbind, addr, len, mpol_bind, mask.data(),
+	      mask.size() * bits + 1, 0) < 0) {
+    return -errno;
+  }
+  return 0;
+}
+
 #else
 int parse_cpu_set_list(const char *s,
 		       size_t *cpu_set_size,
@@ -257,4 +286,14 @@ int set_cpu_affinity_all_threads(size_t cpu_set_size,
   return -ENOTSUP;
 }
 
+int get_current_numa_node()
+{
+  return -ENOTSUP;
+}
+
+int bind_memory_to_numa_node(void *addr, size_t len, int node)
+{
+  return -ENOTSUP;
+}
+
 #endif
@@ -22,3 +22,9 @@ int get_numa_node_cpu_set(int node,
 
 int set_cpu_affinity_all_threads(size_t cpu_set_size,
 				 cpu_set_t *cpu_set);
+
+/// numa node of the cpu the calling thread is running on
+int get_current_numa_node();
+
+/// allocate the (not yet touched) pages of [addr, addr+len) on @node
+int bind_memory_to_numa_node(void *addr, size_t len, int node);
@@ -19,6 +19,9 @@
 #include "common/valgrind.h"
 #include "include/common_fwd.h"
 
+#include <bit>
+#include <thread>
+
 using std::ostringstream;
 using std::make_pair;
 using std::pair;
@@ -170,13 +173,7 @@ void PerfCounters::inc(int idx, uint64_t amt)
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount++;
-    data.u64 += amt;
-    data.avgcount2++;
-  } else {
-    data.u64 += amt;
-  }
+  add_value(data, amt);
 }
 
 void PerfCounters::dec(int idx, uint64_t amt)
@@ -192,7 +189,12 @@ void PerfCounters::dec(int idx, uint64_t amt)
   ceph_assert(!(data.type & PERFCOUNTER_LONGRUNAVG));
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  data.u64 -= amt;
+  if (data.shards) {
+    // wraps around in the slot, but adds up right
+    data.shard(shard_slot())[0] -= amt;
+  } else {
+    data.u64 -= amt;
+  }
 }
 
 void PerfCounters::set(int idx, uint64_t amt)
@@ -210,6 +212,7 @@ void PerfCounters::set(int idx, uint64_t amt)
 
   ANNOTATE_BENIGN_RACE_SIZED(&data.u64, sizeof(data.u64),
                              "perf counter atomic");
+  data.clear_shards();
   if (data.type & PERFCOUNTER_LONGRUNAVG) {
     data.avgcount++;
     data.u64 = amt;
@@ -231,7 +234,7 @@ uint64_t PerfCounters::get(int idx) const
   const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return 0;
-  return data.u64;
+  return data.read_u64();
 }
 
 void PerfCounters::tinc(int idx, utime_t amt)
@@ -246,13 +249,7 @@ void PerfCounters::tinc(int idx, utime_t amt)
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return;
-  if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount++;
-    data.u64 += amt.to_nsec();
-    data.avgcount2++;
-  } else {
-    data.u64 += amt.to_nsec();
-  }
+  add_value(data, amt.to_nsec());
 }
 
 void PerfCounters::tinc(int idx, ceph::timespan amt)
@@ -267,13 +264,7 @@ void PerfCounters::tinc(int idx, ceph::timespan amt)
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return;
-  if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount++;
-    data.u64 += amt.count();
-    data.avgcount2++;
-  } else {
-    data.u64 += amt.count();
-  }
+  add_value(data, amt.count());
 }
 
 void PerfCounters::tset(int idx, utime_t amt)
@@ -288,6 +279,7 @@ void PerfCounters::tset(int idx, utime_t amt)
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return;
+  data.clear_shards();
   data.u64 = amt.to_nsec();
   if (data.type & PERFCOUNTER_LONGRUNAVG)
     ceph_abort();
@@ -305,7 +297,7 @@ utime_t PerfCounters::tget(int idx) const
   const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return utime_t();
-  uint64_t v = data.u64;
+  uint64_t v = data.read_u64();
   return utime_t(v / 1000000000ull, v % 1000000000ull);
 }
 
@@ -344,6 +336,40 @@ pair<uint64_t, uint64_t> PerfCounters::get_tavg_ns(int idx) const
   return make_pair(a.second, a.first);
 }
 
+unsigned PerfCounters::shard_count()
+{
+  static const unsigned count = std::min(
+    64u, std::bit_ceil(std::max(1u, std::thread::hardware_concurrency())));
+  return count;
+}
+
+unsigned PerfCounters::shard_slot()
+{
+  static std::atomic<unsigned> next_slot = 0;
+  thread_local unsigned slot = next_slot++ & (shard_count() - 1);
+  return slot;
+}
+
+void PerfCounters::add_value(perf_counter_data_any_d& data, uint64_t amt)
+{
+  if (data.shards) {
+    auto s = data.shard(shard_slot());
+    if (data.type & PERFCOUNTER_LONGRUNAVG) {
+      s[0]++;
+      s[1] += amt;
+      s[2]++;
+    } else {
+      s[0] += amt;
+    }
+  } else if (data.type & PERFCOUNTER_LONGRUNAVG) {
+    data.avgcount++;
+    data.u64 += amt;
+    data.avgcount2++;
+  } else {
+    data.u64 += amt;
+  }
+}
+
 void PerfCounters::reset()
 {
   perf_counter_data_vec_t::iterator d = m_data.begin();
@@ -474,7 +500,7 @@ void PerfCounters::dump_formatted_generic(Formatter *f, bool schema,
         d->histogram->dump_formatted(f);
         f->close_section();
       } else {
-	uint64_t v = d->u64;
+	uint64_t v = d->read_u64();
 	if (d->type & PERFCOUNTER_U64) {
 	  f->dump_unsigned(d->name, v);
 	} else if (d->type & PERFCOUNTER_TIME) {
@@ -600,6 +626,16 @@ void PerfCountersBuilder::add_impl(
   data.histogram = std::move(histogram);
 }
 
+void PerfCountersBuilder::set_sharded(int idx)
+{
+  ceph_assert(idx > m_perf_counters->m_lower_bound);
+  ceph_assert(idx < m_perf_counters->m_upper_bound);
+  auto& data = m_perf_counters->m_data[idx - m_perf_counters->m_lower_bound - 1];
+  ceph_assert(data.type != PERFCOUNTER_NONE);
+  ceph_assert(!(data.type & PERFCOUNTER_HISTOGRAM));
+  m_sharded.push_back(idx);
+}
+
 PerfCounters *PerfCountersBuilder::create_perf_counters()
 {
   PerfCounters::perf_counter_data_vec_t::const_iterator d = m_perf_counters->m_data.begin();
@@ -609,6 +645,27 @@ PerfCounters *PerfCountersBuilder::create_perf_counters()
     ceph_assert(d->type & (PERFCOUNTER_U64 | PERFCOUNTER_TIME));
   }
 
+  if (!m_sharded.empty()) {
+    // pack the values of all sharded counters of a slot together, each
+    // slot starting on a cache line of its own
+    std::vector<std::pair<PerfCounters::perf_counter_data_any_d*, unsigned>> offsets;
+    unsigned words = 0;
+    for (int idx : m_sharded) {
+      auto& data = m_perf_counters->m_data[idx - m_perf_counters->m_lower_bound - 1];
+      offsets.emplace_back(&data, words);
+      words += (data.type & PERFCOUNTER_LONGRUNAVG) ? 3 : 1;
+    }
+    unsigned lines = (words + 7) / 8;
+    m_perf_counters->m_shards = std::vector<PerfCounters::shard_line_t>(
+      lines * PerfCounters::shard_count());
+    auto base = reinterpret_cast<std::atomic<uint64_t>*>(
+      m_perf_counters->m_shards.data());
+    for (auto& [data, offset] : offsets) {
+      data->shards = base + offset;
+      data->shard_stride = lines * 8;
+    }
+  }
+
   PerfCounters *ret = m_perf_counters;
   m_perf_counters = NULL;
   return ret;
@@ -113,6 +113,10 @@ public:
     prio_default = prio_;
   }
 
+  // Spread the updates of a counter over per-thread slots, summed up when
+  // it is read, for hot counters updated from many threads at once.
+  void set_sharded(int key);
+
   PerfCounters* create_perf_counters();
 private:
   PerfCountersBuilder(const PerfCountersBuilder &rhs);
@@ -124,6 +128,7 @@ private:
   PerfCounters *m_perf_counters;
 
   int prio_default = 0;
+  std::vector<int> m_sharded;
 };
 
 /*
@@ -150,6 +155,11 @@ private:
  * For the time average, it returns the current value and
  * the "avgcount" member when read off. avgcount is incremented when you call
  * tinc. Calling tset on an average is an error and will assert out.
+ *
+ * A sharded counter (see PerfCountersBuilder::set_sharded) keeps a copy of
+ * its values per thread slot, each slot on cache lines of its own, and
+ * adds them up when read.  Setting one is not atomic against concurrent
+ * increments.
  */
 class PerfCounters
 {
@@ -171,7 +181,7 @@ public:
         nick(other.nick),
 	 type(other.type),
 	 unit(other.unit),
-	 u64(other.u64.load()) {
+	 u64(other.read_u64()) {
       auto a = other.read_avg();
       u64 = a.first;
       avgcount = a.second;
@@ -192,6 +202,14 @@ public:
     std::atomic<uint64_t> avgcount = { 0 };
     std::atomic<uint64_t> avgcount2 = { 0 };
     std::unique_ptr<PerfHistogram<>> histogram;
+    // values of a sharded counter in slot 0, as {u64} or, for averages,
+    // {avgcount, u64, avgcount2}; the next slot is shard_stride further
+    std::atomic<uint64_t> *shards = nullptr;
+    uint32_t shard_stride = 0;
+
+    std::atomic<uint64_t> *shard(unsigned slot) const {
+      return shards + slot * shard_stride;
+    }
 
     void reset()
     {
@@ -199,12 +217,37 @@ public:
 	    u64 = 0;
 	    avgcount = 0;
 	    avgcount2 = 0;
+	    clear_shards();
       }
       if (histogram) {
         histogram->reset();
       }
     }
 
+    void clear_shards()
+    {
+      if (!shards) {
+	return;
+      }
+      unsigned words = (type & PERFCOUNTER_LONGRUNAVG) ? 3 : 1;
+      for (unsigned i = 0; i < PerfCounters::shard_count(); ++i) {
+	for (unsigned j = 0; j < words; ++j) {
+	  shard(i)[j] = 0;
+	}
+      }
+    }
+
+    uint64_t read_u64() const {
+      uint64_t v = u64;
+      if (shards) {
+	unsigned word = (type & PERFCOUNTER_LONGRUNAVG) ? 1 : 0;
+	for (unsigned i = 0; i < PerfCounters::shard_count(); ++i) {
+	  v += shard(i)[word];
+	}
+      }
+      return v;
+    }
+
     // read <sum, count> safely by making sure the post- and pre-count
     // are identical; in other words the whole loop needs to be run
     // without any intervening calls to inc, set, or tinc.
@@ -214,6 +257,21 @@ public:
 	count = avgcount2;
 	sum = u64;
       } while (avgcount != count);
+      if (shards && !(type & PERFCOUNTER_LONGRUNAVG)) {
+	sum = read_u64();
+      } else if (shards) {
+	// the same, slot by slot
+	for (unsigned i = 0; i < PerfCounters::shard_count(); ++i) {
+	  auto s = shard(i);
+	  uint64_t ssum, scount;
+	  do {
+	    scount = s[2];
+	    ssum = s[1];
+	  } while (s[0] != scount);
+	  sum += ssum;
+	  count += scount;
+	}
+      }
       return { sum, count };
     }
   };
@@ -275,7 +333,14 @@ public:
                     0);
   }
 
+  /// number of slots of a sharded counter
+  static unsigned shard_count();
+
 private:
+  /// the slot of the calling thread
+  static unsigned shard_slot();
+  static void add_value(perf_counter_data_any_d& data, uint64_t amt);
+
   PerfCounters(CephContext *cct, const std::string &name,
 	     int lower_bound, int upper_bound);
   PerfCounters(const PerfCounters &rhs);
@@ -301,6 +366,12 @@ private:
 
   perf_counter_data_vec_t m_data;
 
+  struct alignas(64) shard_line_t {
+    std::atomic<uint64_t> v[8] = {};
+  };
+  /// the values of the sharded counters, one run of lines per slot
+  std::vector<shard_line_t> m_shards;
+
   friend class PerfCountersBuilder;
   friend class PerfCountersCollectionImpl;
 };
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <iostream>
+#include <thread>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/icl/interval_map.hpp>
@@ -370,6 +371,32 @@ void CrushTester::write_integer_indexed_scalar_data_string(vector<string> &dst,
   dst.push_back( data_buffer.str() );
 }
 
+void CrushTester::for_each_slice(
+  int first, int last,
+  const std::function<void(int, int, int)>& fn) const
+{
+  int64_t len = (int64_t)last - first + 1;
+  int n = std::min<int64_t>(num_threads, len);
+  if (n <= 1) {
+    if (len > 0)
+      fn(0, first, last);
+    return;
+  }
+  vector<std::thread> threads;
+  int64_t begin = first;
+  for (int i = 0; i < n; i++) {
+    int64_t end = first + len * (i + 1) / n;
+    if (i == n - 1) {
+      fn(i, begin, end - 1);
+    } else {
+      threads.emplace_back(fn, i, (int)begin, (int)(end - 1));
+    }
+    begin = end;
+  }
+  for (auto& t : threads)
+    t.join();
+}
+
 int CrushTester::test_with_fork(CephContext* cct, int timeout)
 {
   ldout(cct, 20) << __func__ << dendl;
@@ -570,6 +597,15 @@ int CrushTester::test(CephContext* cct)
         // create a vector to hold placement results temporarily 
         vector<int> temporary_per ( per.size() );
 
+        // CRUSH placements are computed MAPPING_CHUNK inputs per thread at
+        // a time, everything else is done here in x order.  the choose
+        // tries profile is not thread safe, so it keeps to one thread.
+        const int MAPPING_CHUNK = 1024;
+        int chunk_len = MAPPING_CHUNK;
+        if (!output_choose_tries)
+          chunk_len *= num_threads;
+        vector<vector<int>> chunk_out;
+
         for (int x = batch_min; x <= batch_max; x++) {
           // create a vector to hold the results of a CRUSH placement or RNG simulation
           vector<int> out;
@@ -577,11 +613,30 @@ int CrushTester::test(CephContext* cct)
           if (use_crush) {
             if (output_mappings)
 	      err << "CRUSH"; // prepend CRUSH to placement output
-            uint32_t real_x = x;
-            if (pool_id != -1) {
-              real_x = crush_hash32_2(CRUSH_HASH_RJENKINS1, x, (uint32_t)pool_id);
+            if ((x - batch_min) % chunk_len == 0) {
+              int chunk_min = x;
+              int chunk_max = std::min<int64_t>(batch_max, (int64_t)x + chunk_len - 1);
+              chunk_out.resize(chunk_max - chunk_min + 1);
+              auto map_slice = [&](int slice, int first, int last) {
+                vector<int> real_xs;
+                for (int cx = first; cx <= last; cx++) {
+                  uint32_t real_x = cx;
+                  if (pool_id != -1) {
+                    real_x = crush_hash32_2(CRUSH_HASH_RJENKINS1, cx, (uint32_t)pool_id);
+                  }
+                  real_xs.push_back(real_x);
+                }
+                vector<vector<int>> slice_out;
+                crush.do_rule_batch(r, real_xs, slice_out, nr, weight, 0);
+                std::move(slice_out.begin(), slice_out.end(),
+                          chunk_out.begin() + (first - chunk_min));
+              };
+              if (output_choose_tries)
+                map_slice(0, chunk_min, chunk_max);
+              else
+                for_each_slice(chunk_min, chunk_max, map_slice);
             }
-            crush.do_rule(r, real_x, out, nr, weight, 0);
+            out.swap(chunk_out[(x - batch_min) % chunk_len]);
           } else {
             if (output_mappings)
 	      err << "RNG"; // prepend RNG to placement output to denote simulation
@@ -735,18 +790,49 @@ int CrushTester::compare(CrushWrapper& crush2)
         err << "rule " << r << " dne" << std::endl;
       continue;
     }
-    int bad = 0;
+    // per thread: mismatched mappings, replicas placed by crush and
+    // how many of those crush2 places elsewhere
+    struct tally_t {
+      int bad = 0;
+      uint64_t replicas = 0;
+      uint64_t moved = 0;
+    };
+    vector<tally_t> tallies(num_threads);
     for (int nr = min_rep; nr <= max_rep; nr++) {
-      for (int x = min_x; x <= max_x; ++x) {
-	vector<int> out;
-	crush.do_rule(r, x, out, nr, weight, 0);
-	vector<int> out2;
-	crush2.do_rule(r, x, out2, nr, weight, 0);
-	if (out != out2) {
-	  ++bad;
+      for_each_slice(min_x, max_x, [&](int slice, int first, int last) {
+	tally_t& t = tallies[slice];
+	vector<int> xs;
+	vector<vector<int>> outs, outs2;
+	for (int64_t chunk = first; chunk <= last; chunk += 1024) {
+	  xs.clear();
+	  for (int64_t x = chunk; x <= std::min<int64_t>(last, chunk + 1023); ++x)
+	    xs.push_back(x);
+	  crush.do_rule_batch(r, xs, outs, nr, weight, 0);
+	  crush2.do_rule_batch(r, xs, outs2, nr, weight, 0);
+	  for (size_t i = 0; i < xs.size(); ++i) {
+	    auto& out = outs[i];
+	    auto& out2 = outs2[i];
+	    if (out != out2) {
+	      ++t.bad;
+	    }
+	    for (auto item : out) {
+	      if (item == CRUSH_ITEM_NONE)
+		continue;
+	      ++t.replicas;
+	      if (std::find(out2.begin(), out2.end(), item) == out2.end())
+		++t.moved;
+	    }
+	  }
 	}
-      }
+      });
     }
+    tally_t total;
+    for (auto& t : tallies) {
+      total.bad += t.bad;
+      total.replicas += t.replicas;
+      total.moved += t.moved;
+    }
+    int bad = total.bad;
     if (bad) {
       ret = -1;
     }
@@ -754,6 +840,12 @@ int CrushTester::compare(CrushWrapper& crush2)
     double ratio = (double)bad / (double)max;
     cout << "rule " << r << " had " << bad << "/" << max
 	 << " mismatched mappings (" << ratio << ")" << std::endl;
+    if (output_statistics) {
+      double moved_ratio = total.replicas ?
+	(double)total.moved / (double)total.replicas : 0;
+      cout << "rule " << r << " moved " << total.moved << "/" << total.replicas
+	   << " replicas (" << moved_ratio << ")" << std::endl;
+    }
   }
   if (ret) {
     cerr << "warning: maps are NOT equivalent" << std::endl;
@@ -8,6 +8,7 @@
 #include "include/common_fwd.h"
 
 #include <fstream>
+#include <functional>
 
 class CrushTester {
   CrushWrapper& crush;
@@ -20,6 +21,7 @@ class CrushTester {
   int64_t pool_id;
 
   int num_batches;
+  int num_threads;
   bool use_crush;
 
   float mark_down_device_ratio;
@@ -75,6 +77,13 @@ class CrushTester {
    */
   int random_placement(int ruleno, std::vector<int>& out, int maxout, std::vector<__u32>& weight);
 
+  /*
+   * split [first, last] into one slice per thread and call fn(slice, first,
+   * last) for each of them in parallel, returning once all are done
+   */
+  void for_each_slice(int first, int last,
+                      const std::function<void(int, int, int)>& fn) const;
+
   // scaffolding to store data for off-line processing
    struct tester_data_set {
      std::vector<std::string> device_utilization;
@@ -173,6 +182,7 @@ public:
       min_rep(-1), max_rep(-1),
       pool_id(-1),
       num_batches(1),
+      num_threads(1),
       use_crush(true),
       mark_down_device_ratio(0.0),
       mark_down_bucket_ratio(1.0),
@@ -257,6 +267,12 @@ public:
   int get_batches() const {
     return num_batches;
   }
+  void set_threads(int n) {
+    num_threads = std::max(n, 1);
+  }
+  int get_threads() const {
+    return num_threads;
+  }
 
   void set_random_placement() {
     use_crush = false;
@@ -89,6 +89,41 @@ static __u32 crush_hash32_rjenkins1_5(__u32 a, __u32 b, __u32 c, __u32 d,
 	return hash;
 }
 
+/*
+ * crush_hash32_rjenkins1_3 on many "b" at once.  the mix only uses
+ * add, sub, xor and shifts, so with gcc/clang vector extensions every
+ * lane computes exactly what the scalar version would, on whatever
+ * simd width the target offers (sse2, avx2, neon...).
+ */
+#if !defined(__KERNEL__) && defined(__GNUC__)
+# define CRUSH_HASH_LANES 8
+typedef __u32 crush_hash_vec_t
+	__attribute__((vector_size(CRUSH_HASH_LANES * sizeof(__u32))));
+#endif
+
+static void crush_hash32_rjenkins1_3_batch(__u32 a, const __u32 *b, __u32 c,
+					   __u32 *out, unsigned int n)
+{
+	unsigned int i = 0;
+#ifdef CRUSH_HASH_LANES
+	for (; i + CRUSH_HASH_LANES <= n; i += CRUSH_HASH_LANES) {
+		const crush_hash_vec_t zero = {0};
+		crush_hash_vec_t va = zero + a, vb, vc = zero + c;
+		crush_hash_vec_t x = zero + 231232, y = zero + 1232;
+		crush_hash_vec_t hash;
+		memcpy(&vb, b + i, sizeof(vb));
+		hash = crush_hash_seed ^ va ^ vb ^ vc;
+		crush_hashmix(va, vb, hash);
+		crush_hashmix(vc, x, hash);
+		crush_hashmix(y, va, hash);
+		crush_hashmix(vb, x, hash);
+		crush_hashmix(y, vc, hash);
+		memcpy(out + i, &hash, sizeof(hash));
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = crush_hash32_rjenkins1_3(a, b[i], c);
+}
 
 __u32 crush_hash32(int type, __u32 a)
 {
@@ -120,6 +155,19 @@ __u32 crush_hash32_3(int type, __u32 a, __u32 b, __u32 c)
 	}
 }
 
+void crush_hash32_3_batch(int type, __u32 a, const __u32 *b, __u32 c,
+			  __u32 *out, unsigned int n)
+{
+	switch (type) {
+	case CRUSH_HASH_RJENKINS1:
+		crush_hash32_rjenkins1_3_batch(a, b, c, out, n);
+		break;
+	default:
+		memset(out, 0, n * sizeof(*out));
+		break;
+	}
+}
+
 __u32 crush_hash32_4(int type, __u32 a, __u32 b, __u32 c, __u32 d)
 {
 	switch (type) {
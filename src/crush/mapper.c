@@ -308,11 +308,12 @@ static inline __s32 *get_choose_arg_ids(const struct crush_bucket_straw2 *bucket
  *
  * for reference, see the exponential distribution example at:  
  * https://en.wikipedia.org/wiki/Inverse_transform_sampling#Examples
+ *
+ * __u__ is the item's crush_hash32_3(bucket hash, x, item id, r).
  */
-static inline __s64 generate_exponential_distribution(int type, int x, int y, int z, 
-                                                      int weight)
+static inline __s64 exponential_distribution_from_hash(unsigned int u,
+                                                       int weight)
 {
-	unsigned int u = crush_hash32_3(type, x, y, z);
 	u &= 0xffff;
 
 	/*
@@ -336,25 +337,41 @@ static inline __s64 generate_exponential_distribution(int type, int x, int y, in
 	return div64_s64(ln, weight);
 }
 
+/*
+ * the hashes of up to this many items are computed together, which
+ * lets crush_hash32_3_batch() spread them over simd lanes
+ */
+#define CRUSH_STRAW2_HASH_BATCH 64
+
 static int bucket_straw2_choose(const struct crush_bucket_straw2 *bucket,
 				int x, int r, const struct crush_choose_arg *arg,
                                 int position)
 {
-	unsigned int i, high = 0;
+	unsigned int i, j, n, high = 0;
 	__s64 draw, high_draw = 0;
+	__u32 hashes[CRUSH_STRAW2_HASH_BATCH];
         __u32 *weights = get_choose_arg_weights(bucket, arg, position);
         __s32 *ids = get_choose_arg_ids(bucket, arg);
-	for (i = 0; i < bucket->h.size; i++) {
-                dprintk("weight 0x%x item %d\n", weights[i], ids[i]);
-		if (weights[i]) {
-			draw = generate_exponential_distribution(bucket->h.hash, x, ids[i], r, weights[i]);
-		} else {
-			draw = S64_MIN;
-		}
+	for (i = 0; i < bucket->h.size; i += n) {
+		n = bucket->h.size - i;
+		if (n > CRUSH_STRAW2_HASH_BATCH)
+			n = CRUSH_STRAW2_HASH_BATCH;
+		crush_hash32_3_batch(bucket->h.hash, x,
+				     (const __u32 *)ids + i, r, hashes, n);
+		for (j = 0; j < n; j++) {
+			dprintk("weight 0x%x item %d\n", weights[i + j],
+				ids[i + j]);
+			if (weights[i + j]) {
+				draw = exponential_distribution_from_hash(
+					hashes[j], weights[i + j]);
+			} else {
+				draw = S64_MIN;
+			}
 
-		if (i == 0 || draw > high_draw) {
-			high = i;
-			high_draw = draw;
+			if (i + j == 0 || draw > high_draw) {
+				high = i + j;
+				high_draw = draw;
+			}
 		}
 	}
 
@@ -1081,3 +1098,37 @@ int crush_do_rule(const struct crush_map *map,
 
 	return result_len;
 }
+
+/**
+ * crush_do_rule_batch - map several inputs with the same rule
+ * @map: the crush_map
+ * @ruleno: the rule id
+ * @x: hash inputs
+ * @num_x: number of hash inputs
+ * @result: result vectors, @result_max entries for each input
+ * @result_len: size of each result vector
+ * @result_max: maximum result size
+ * @weight: weight vector (for map leaves)
+ * @weight_max: size of weight vector
+ * @cwin: Pointer to at least crush_work_size() bytes of memory
+ * @choose_args: weights and ids for each known bucket
+ */
+void crush_do_rule_batch(const struct crush_map *map,
+			 int ruleno, const int *x, int num_x,
+			 int *result, int *result_len, int result_max,
+			 const __u32 *weight, int weight_max,
+			 void *cwin, const struct crush_choose_arg *choose_args)
+{
+	int i;
+
+	/*
+	 * crush_do_rule() leaves the workspace ready for the next input,
+	 * so it is set up once for the whole batch
+	 */
+	for (i = 0; i < num_x; i++) {
+		result_len[i] = crush_do_rule(map, ruleno, x[i],
+					      result + i * result_max,
+					      result_max, weight, weight_max,
+					      cwin, choose_args);
+	}
+}
@@ -77,6 +77,22 @@ extern int crush_do_rule(const struct crush_map *map,
 			 const __u32 *weights, int weight_max,
 			 void *cwin, const struct crush_choose_arg *choose_args);
 
+/** @ingroup API
+ *
+ * Map each of the __num_x__ inputs in __x__ as crush_do_rule() would.
+ * The items for __x[i]__ are stored in
+ * __result[i * result_max, (i + 1) * result_max[__ and their number in
+ * __result_len[i]__.  All the other arguments are the same as for
+ * crush_do_rule(), including the requirements on __cwin__, which is
+ * shared by the whole batch.
+ */
+extern void crush_do_rule_batch(const struct crush_map *map,
+				int ruleno, const int *x, int num_x,
+				int *result, int *result_len, int result_max,
+				const __u32 *weights, int weight_max,
+				void *cwin,
+				const struct crush_choose_arg *choose_args);
+
 /* Returns the exact amount of workspace that will need to be used
    for a given combination of crush_map and result_max. The caller can
    then allocate this much on its own, either on the stack, in a
@@ -387,6 +387,10 @@ struct error_code;
 
     static ptr_node* copy_hypercombined(const ptr_node& copy_this);
 
+    // served from a small per-thread cache, see buffer.cc
+    static void* operator new(std::size_t size);
+    static void operator delete(void* p, std::size_t size);
+
   private:
     friend list;
 
@@ -93,6 +93,9 @@
 /* Defined if you have liburing */
 #cmakedefine HAVE_LIBURING
 
+/* Defined if the io_uring AsyncMessenger transport is enabled */
+#cmakedefine HAVE_ASYNC_IO_URING
+
 /* Defind if you have POSIX AIO */
 #cmakedefine HAVE_POSIXAIO
 
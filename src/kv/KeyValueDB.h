@@ -9,6 +9,7 @@
 #include <map>
 #include <optional>
 #include <string>
+#include <vector>
 #include <boost/scoped_ptr.hpp>
 #include "include/encoding.h"
 #include "common/Formatter.h"
@@ -189,6 +190,24 @@ public:
 		  ceph::buffer::list *value) {
     return get(prefix, std::string(key, keylen), value);
   }
+  /// Retrieve a batch of keys at once; (*values)[i] and (*rs)[i] (0,
+  /// -ENOENT or another error) correspond to keys[i].  Errors are those
+  /// of get(), e.g. RocksDBStore aborts on a failed read in both.
+  /// Backends that can look up many keys more cheaply than one by one
+  /// (rocksdb's MultiGet) override this; keys in ascending order are the
+  /// fast path there.
+  virtual void multi_get(const std::string &prefix,
+			 const std::vector<std::string> &keys,
+			 std::vector<ceph::buffer::list> *values,
+			 std::vector<int> *rs) {
+    values->clear();
+    values->resize(keys.size());
+    rs->resize(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      int r = get(prefix, keys[i], &(*values)[i]);
+      (*rs)[i] = r < 0 ? r : 0;
+    }
+  }
 
   // This superclass is used both by kv iterators *and* by the ObjectMap
   // omap iterator.  The class hierarchies are unfortunately tied together
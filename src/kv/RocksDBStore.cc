@@ -1,10 +1,12 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 // vim: ts=8 sw=2 smarttab
 
+#include <algorithm>
 #include <filesystem>
 #include <map>
 #include <memory>
 #include <set>
+#include <sstream>
 #include <string>
 #include <errno.h>
 #include <unistd.h>
@@ -18,6 +20,7 @@
 #include "rocksdb/cache.h"
 #include "rocksdb/filter_policy.h"
 #include "rocksdb/utilities/convenience.h"
+#include "rocksdb/version.h"
 #include "rocksdb/utilities/table_properties_collectors.h"
 #include "rocksdb/merge_operator.h"
 
@@ -58,6 +61,55 @@ static const char* sharding_def_dir = "sharding";
 static const char* sharding_def_file = "sharding/def";
 static const char* sharding_recreate = "sharding/recreate_columns";
 static const char* resharding_column_lock = "reshardingXcommencingXlocked";
+/// an online reshard in progress: sharding from, sharding to and where
+/// to resume scanning the old layout ("<column index> <hex key>")
+static const char* sharding_online = "sharding/online";
+
+namespace {
+struct online_reshard_state_t {
+  std::string from;
+  std::string to;
+  size_t shard = 0;
+  std::string key;
+};
+}
+
+static bool read_online_reshard(rocksdb::Env *env,
+				online_reshard_state_t *st)
+{
+  std::string text;
+  if (!env->FileExists(sharding_online).ok() ||
+      !rocksdb::ReadFileToString(env, sharding_online, &text).ok()) {
+    return false;
+  }
+  std::istringstream in(text);
+  std::string hex;
+  if (!std::getline(in, st->from) || !std::getline(in, st->to)) {
+    return false;
+  }
+  if (in >> st->shard) {
+    in >> hex;
+    if (!rocksdb::Slice(hex).DecodeHex(&st->key)) {
+      st->shard = 0;
+      st->key.clear();
+    }
+  } else {
+    st->shard = 0;
+  }
+  return true;
+}
+
+static int write_online_reshard(rocksdb::Env *env,
+				const online_reshard_state_t& st)
+{
+  std::string text = st.from + "\n" + st.to + "\n" +
+    std::to_string(st.shard) + " " + rocksdb::Slice(st.key).ToString(true);
+  env->CreateDir(sharding_def_dir);
+  if (!rocksdb::WriteStringToFile(env, text, sharding_online, true).ok()) {
+    return -EIO;
+  }
+  return 0;
+}
 
 static bufferlist to_bufferlist(rocksdb::Slice in) {
   bufferlist bl;
@@ -460,6 +512,11 @@ std::shared_ptr<rocksdb::Cache> RocksDBStore::create_block_cache(
   auto shard_bits = cct->_conf->rocksdb_cache_shard_bits;
   if (cache_type == "binned_lru") {
     cache = rocksdb_cache::NewBinnedLRUCache(cct, cache_size, shard_bits, false, cache_prio_high);
+  } else if (cache_type == "binned_clock") {
+    // a block is what the cache mostly holds
+    cache = rocksdb_cache::NewBinnedClockCache(cct, cache_size, shard_bits, false,
+                                               cache_prio_high,
+                                               cct->_conf->rocksdb_block_size);
   } else if (cache_type == "lru") {
     cache = rocksdb::NewLRUCache(cache_size, shard_bits);
   } else if (cache_type == "clock") {
@@ -617,6 +674,7 @@ void RocksDBStore::add_column_family(const std::string& cf_name, uint32_t hash_l
     column.handles.resize(shard_idx + 1);
   column.handles[shard_idx] = handle;
   cf_ids_to_prefix.emplace(handle->GetID(), cf_name);
+  cf_ids_to_handle[handle->GetID()] = handle;
 }
 
 bool RocksDBStore::is_column_family(const std::string& prefix) {
@@ -635,30 +693,61 @@ rocksdb::ColumnFamilyHandle *RocksDBStore::get_key_cf(const prefix_shards& shard
   return shards.handles[hash % shards.handles.size()];
 }
 
+const RocksDBStore::prefix_shards& RocksDBStore::get_current_layout(
+  const prefix_shards& shards) const
+{
+  auto r = shards.resharding.load(std::memory_order_acquire);
+  return r ? r->to : shards;
+}
+
+const std::vector<rocksdb::ColumnFamilyHandle*>& RocksDBStore::get_prefix_handles(
+  const prefix_shards& shards, bool *migrating) const
+{
+  auto r = shards.resharding.load(std::memory_order_acquire);
+  bool m = r && !r->done.load(std::memory_order_acquire);
+  if (migrating) {
+    *migrating = m;
+  }
+  if (!r) {
+    return shards.handles;
+  }
+  return m ? r->all : r->to.handles;
+}
+
 rocksdb::ColumnFamilyHandle *RocksDBStore::get_cf_handle(const std::string& prefix, const std::string& key) {
+  return get_cf_handle(prefix, key.data(), key.size());
+}
+
+rocksdb::ColumnFamilyHandle *RocksDBStore::get_cf_handle(const std::string& prefix, const char* key, size_t keylen) {
   auto iter = cf_handles.find(prefix);
   if (iter == cf_handles.end()) {
     return nullptr;
   } else {
-    if (iter->second.handles.size() == 1) {
-      return iter->second.handles[0];
-    } else {
-      return get_key_cf(iter->second, key.data(), key.size());
-    }
+    return get_layout_cf(get_current_layout(iter->second), key, keylen);
   }
 }
 
-rocksdb::ColumnFamilyHandle *RocksDBStore::get_cf_handle(const std::string& prefix, const char* key, size_t keylen) {
+rocksdb::ColumnFamilyHandle *RocksDBStore::get_cf_handle(
+  const std::string& prefix, const char* key, size_t keylen,
+  rocksdb::ColumnFamilyHandle **from)
+{
+  *from = nullptr;
   auto iter = cf_handles.find(prefix);
   if (iter == cf_handles.end()) {
     return nullptr;
-  } else {
-    if (iter->second.handles.size() == 1) {
-      return iter->second.handles[0];
-    } else {
-      return get_key_cf(iter->second, key, keylen);
+  }
+  auto r = iter->second.resharding.load(std::memory_order_acquire);
+  if (!r) {
+    return get_layout_cf(iter->second, key, keylen);
+  }
+  auto cf = get_layout_cf(r->to, key, keylen);
+  if (!r->done.load(std::memory_order_acquire)) {
+    auto f = get_layout_cf(*r->from, key, keylen);
+    if (f != cf) {
+      *from = f;
     }
   }
+  return cf;
 }
 
 /**
@@ -667,20 +756,19 @@ rocksdb::ColumnFamilyHandle *RocksDBStore::get_cf_handle(const std::string& pref
  * CF handle. In all other cases, we return a nullptr to indicate that the specified bounds cannot necessarily be mapped
  * to a single CF.
  */
-rocksdb::ColumnFamilyHandle *RocksDBStore::check_cf_handle_bounds(const cf_handles_iterator& iter, const IteratorBounds& bounds) {
+rocksdb::ColumnFamilyHandle *RocksDBStore::check_cf_handle_bounds(const prefix_shards& shards, const IteratorBounds& bounds) {
   if (!bounds.lower_bound || !bounds.upper_bound) {
     return nullptr;
   }
-  ceph_assert(iter != cf_handles.end());
-  ceph_assert(iter->second.handles.size() != 1);
-  if (iter->second.hash_l != 0) {
+  ceph_assert(shards.handles.size() != 1);
+  if (shards.hash_l != 0) {
     return nullptr;
   }
-  auto lower_bound_hash_str = get_key_hash_view(iter->second, bounds.lower_bound->data(), bounds.lower_bound->size());
-  auto upper_bound_hash_str = get_key_hash_view(iter->second, bounds.upper_bound->data(), bounds.upper_bound->size());
+  auto lower_bound_hash_str = get_key_hash_view(shards, bounds.lower_bound->data(), bounds.lower_bound->size());
+  auto upper_bound_hash_str = get_key_hash_view(shards, bounds.upper_bound->data(), bounds.upper_bound->size());
   if (lower_bound_hash_str == upper_bound_hash_str) {
     auto key = *bounds.lower_bound;
-    return get_key_cf(iter->second, key.data(), key.size());
+    return get_key_cf(shards, key.data(), key.size());
   } else {
     return nullptr;
   }
@@ -1023,7 +1111,8 @@ int RocksDBStore::verify_sharding(const rocksdb::Options& opt,
 				  std::vector<rocksdb::ColumnFamilyDescriptor>& existing_cfs,
 				  std::vector<std::pair<size_t, RocksDBStore::ColumnFamily> >& existing_cfs_shard,
 				  std::vector<rocksdb::ColumnFamilyDescriptor>& missing_cfs,
-				  std::vector<std::pair<size_t, RocksDBStore::ColumnFamily> >& missing_cfs_shard)
+				  std::vector<std::pair<size_t, RocksDBStore::ColumnFamily> >& missing_cfs_shard,
+				  std::vector<rocksdb::ColumnFamilyDescriptor>& online_cfs)
 {
   rocksdb::Status status;
   std::string stored_sharding_text;
@@ -1087,7 +1176,40 @@ int RocksDBStore::verify_sharding(const rocksdb::Options& opt,
   }
   existing_cfs.emplace_back("default", opt);
 
- if (existing_cfs.size() != rocksdb_cfs.size()) {
+  // an online reshard in progress also has the columns of its other layout
+  online_reshard_state_t st;
+  if (read_online_reshard(opt.env, &st)) {
+    std::vector<ColumnFamily> other_def;
+    parse_sharding_def(stored_sharding_text == st.from ? st.to : st.from,
+		       other_def);
+    auto known = [&](const std::string& name) {
+      auto is = [&](const rocksdb::ColumnFamilyDescriptor& c) {
+	return c.name == name;
+      };
+      return std::any_of(existing_cfs.begin(), existing_cfs.end(), is) ||
+	std::any_of(missing_cfs.begin(), missing_cfs.end(), is) ||
+	std::any_of(online_cfs.begin(), online_cfs.end(), is);
+    };
+    for (auto& column : other_def) {
+      rocksdb::ColumnFamilyOptions cf_opt(opt);
+      int r = update_column_family_options(column.name, column.options, &cf_opt);
+      if (r != 0) {
+	return r;
+      }
+      for (size_t i = 0; i < column.shard_cnt; i++) {
+	std::string cf_name = column.shard_cnt == 1 ?
+	  column.name : column.name + "-" + std::to_string(i);
+	if (std::find(rocksdb_cfs.begin(), rocksdb_cfs.end(), cf_name) != rocksdb_cfs.end() &&
+	    !known(cf_name)) {
+	  online_cfs.emplace_back(cf_name, cf_opt);
+	}
+      }
+    }
+    dout(5) << __func__ << " online reshard from " << st.from << " to "
+	    << st.to << " in progress" << dendl;
+  }
+
+ if (existing_cfs.size() + online_cfs.size() != rocksdb_cfs.size()) {
    std::vector<std::string> columns_from_stored;
    sharding_def_to_columns(stored_sharding_def, columns_from_stored);
    derr << __func__ << " extra columns in rocksdb. rocksdb columns = " << rocksdb_cfs
@@ -1128,6 +1250,8 @@ int RocksDBStore::do_open(ostream &out,
     return r;
   }
   rocksdb::Status status;
+  // the other layout of an online reshard in progress
+  std::map<std::string, rocksdb::ColumnFamilyHandle*> online_handles;
   if (create_if_missing) {
     status = rocksdb::DB::Open(opt, path, &db);
     if (!status.ok()) {
@@ -1144,10 +1268,12 @@ int RocksDBStore::do_open(ostream &out,
     std::vector<std::pair<size_t, RocksDBStore::ColumnFamily> > existing_cfs_shard;
     std::vector<rocksdb::ColumnFamilyDescriptor> missing_cfs;
     std::vector<std::pair<size_t, RocksDBStore::ColumnFamily> > missing_cfs_shard;
+    std::vector<rocksdb::ColumnFamilyDescriptor> online_cfs;
 
     r = verify_sharding(opt,
 			existing_cfs, existing_cfs_shard,
-			missing_cfs, missing_cfs_shard);
+			missing_cfs, missing_cfs_shard,
+			online_cfs);
     if (r < 0) {
       return r;
     }
@@ -1185,20 +1311,26 @@ int RocksDBStore::do_open(ostream &out,
       default_cf = db->DefaultColumnFamily();
     } else {
       std::vector<rocksdb::ColumnFamilyHandle*> handles;
+      auto to_open = existing_cfs;
+      to_open.insert(to_open.end(), online_cfs.begin(), online_cfs.end());
       if (open_readonly) {
         status = rocksdb::DB::OpenForReadOnly(rocksdb::DBOptions(opt),
-				              path, existing_cfs,
+				              path, to_open,
 					      &handles, &db);
       } else {
         status = rocksdb::DB::Open(rocksdb::DBOptions(opt),
-				   path, existing_cfs, &handles, &db);
+				   path, to_open, &handles, &db);
       }
       if (!status.ok()) {
 	derr << status.ToString() << dendl;
 	return -EINVAL;
       }
       ceph_assert(existing_cfs.size() == existing_cfs_shard.size() + 1);
-      ceph_assert(handles.size() == existing_cfs.size());
+      ceph_assert(handles.size() == to_open.size());
+      for (size_t i = 0; i < online_cfs.size(); i++) {
+	online_handles[online_cfs[i].name] = handles[existing_cfs.size() + i];
+      }
+      handles.resize(existing_cfs.size());
       dout(10) << __func__ << " existing_cfs=" << existing_cfs.size() << dendl;
       for (size_t i = 0; i < existing_cfs_shard.size(); i++) {
 	add_column_family(existing_cfs_shard[i].second.name,
@@ -1251,6 +1383,17 @@ int RocksDBStore::do_open(ostream &out,
   plb.add_time_avg(l_rocksdb_write_delay_time, "rocksdb_write_delay_time", "Rocksdb write delay time");
   plb.add_time_avg(l_rocksdb_write_pre_and_post_process_time, 
       "rocksdb_write_pre_and_post_time", "total time spent on writing a record, excluding write process");
+  plb.add_time_avg(l_rocksdb_multiget_latency, "multiget_latency",
+		   "Latency of a batched (MultiGet) lookup");
+  plb.add_u64_counter(l_rocksdb_multiget_keys, "multiget_keys",
+		      "Keys looked up in batches");
+  plb.add_u64_counter(l_rocksdb_reshard_keys_moved, "reshard_keys_moved",
+		      "Keys moved by online resharding");
+  plb.add_u64_counter(l_rocksdb_reshard_bytes_moved, "reshard_bytes_moved",
+		      "Bytes moved by online resharding",
+		      NULL, 0, unit_t(UNIT_BYTES));
+  plb.add_u64(l_rocksdb_reshard_progress, "reshard_progress",
+	      "Progress of the current online reshard, in percent");
   logger = plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 
@@ -1259,6 +1402,12 @@ int RocksDBStore::do_open(ostream &out,
     compact();
     derr << "Finished compacting rocksdb store" << dendl;
   }
+  if (!create_if_missing) {
+    r = resume_online_reshard(std::move(online_handles), open_readonly);
+    if (r < 0) {
+      return r;
+    }
+  }
   return 0;
 }
 
@@ -1296,6 +1445,8 @@ void RocksDBStore::close()
     compact_queue_lock.unlock();
   }
 
+  stop_online_reshard();
+
   if (logger) {
     cct->get_perfcounters_collection()->remove(logger);
     delete logger;
@@ -1309,6 +1460,14 @@ void RocksDBStore::close()
     }
   }
   cf_handles.clear();
+  for (auto& r : online_reshards) {
+    for (auto cf : r->created) {
+      db->DestroyColumnFamilyHandle(cf);
+    }
+  }
+  online_reshards.clear();
+  reshard_active = nullptr;
+  cf_ids_to_handle.clear();
   if (must_close_default_cf) {
     db->DestroyColumnFamilyHandle(default_cf);
     must_close_default_cf = false;
@@ -1395,7 +1554,7 @@ int64_t RocksDBStore::estimate_prefix_size(const string& prefix,
   uint64_t size = 0;
   auto p_iter = cf_handles.find(prefix);
   if (p_iter != cf_handles.end()) {
-    for (auto cf : p_iter->second.handles) {
+    for (auto cf : get_prefix_handles(p_iter->second)) {
       uint64_t s = 0;
       string start = key_prefix + string(1, '\x00');
       string limit = key_prefix + string("\xff\xff\xff\xff");
@@ -1535,6 +1694,121 @@ struct RocksDBStore::RocksWBHandler: public rocksdb::WriteBatch::Handler {
   bool Continue() override { return num_seen < 50; }
 };
 
+/**
+ * Rewrites a batch for the column family layout of a prefix being
+ * resharded online: keys are written to the column family of the new
+ * layout and removed from the one of the old layout, so they never end
+ * up in both.  Also redirects batches that were built against a layout
+ * that changed before they got submitted.
+ */
+struct RocksDBStore::ReshardRouter : public rocksdb::WriteBatch::Handler {
+  RocksDBStore& db;
+  rocksdb::WriteBatch out;
+  const prefix_shards* last_range_shards = nullptr;
+  std::string last_range_begin, last_range_end;
+  explicit ReshardRouter(RocksDBStore& db) : db(db) {}
+
+  rocksdb::ColumnFamilyHandle* handle(uint32_t id) {
+    if (id == 0) {
+      return db.default_cf;
+    }
+    auto p = db.cf_ids_to_handle.find(id);
+    ceph_assert(p != db.cf_ids_to_handle.end());
+    return p->second;
+  }
+  /// the prefix the column family belongs to, if it was resharded online
+  const prefix_shards* resharded(uint32_t id) {
+    auto p = db.cf_ids_to_prefix.find(id);
+    if (p == db.cf_ids_to_prefix.end()) {
+      return nullptr;
+    }
+    auto c = db.cf_handles.find(p->second);
+    if (c == db.cf_handles.end() ||
+	c->second.resharding.load(std::memory_order_acquire) == nullptr) {
+      return nullptr;
+    }
+    return &c->second;
+  }
+  template <typename F>
+  void route(uint32_t id, const rocksdb::Slice& key, F&& f) {
+    auto shards = resharded(id);
+    if (!shards) {
+      f(handle(id), false);
+      return;
+    }
+    auto r = shards->resharding.load(std::memory_order_acquire);
+    auto to = db.get_layout_cf(r->to, key.data(), key.size());
+    f(to, false);
+    if (!r->done.load(std::memory_order_acquire)) {
+      auto from = db.get_layout_cf(*r->from, key.data(), key.size());
+      if (from != to) {
+	f(from, true);
+      }
+    }
+  }
+
+  rocksdb::Status PutCF(uint32_t column_family_id, const rocksdb::Slice& key,
+			const rocksdb::Slice& value) override {
+    route(column_family_id, key, [&](auto cf, bool stale) {
+      if (stale) {
+	out.Delete(cf, key);
+      } else {
+	out.Put(cf, key, value);
+      }
+    });
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status DeleteCF(uint32_t column_family_id,
+			   const rocksdb::Slice& key) override {
+    route(column_family_id, key, [&](auto cf, bool) {
+      out.Delete(cf, key);
+    });
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status SingleDeleteCF(uint32_t column_family_id,
+				 const rocksdb::Slice& key) override {
+    if (resharded(column_family_id)) {
+      // a moved key may have been put twice, once per layout
+      return DeleteCF(column_family_id, key);
+    }
+    out.SingleDelete(handle(column_family_id), key);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status DeleteRangeCF(uint32_t column_family_id,
+				const rocksdb::Slice& begin_key,
+				const rocksdb::Slice& end_key) override {
+    auto shards = resharded(column_family_id);
+    if (!shards) {
+      out.DeleteRange(handle(column_family_id), begin_key, end_key);
+      return rocksdb::Status::OK();
+    }
+    // a range spans all shards of the prefix, so the batch holds one
+    // range delete per shard of the layout it was built for; expand the
+    // first to the shards that may hold keys now and skip the rest
+    if (last_range_shards == shards &&
+	last_range_begin == begin_key.ToString() &&
+	last_range_end == end_key.ToString()) {
+      return rocksdb::Status::OK();
+    }
+    last_range_shards = shards;
+    last_range_begin = begin_key.ToString();
+    last_range_end = end_key.ToString();
+    for (auto cf : db.get_prefix_handles(*shards)) {
+      out.DeleteRange(cf, begin_key, end_key);
+    }
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status MergeCF(uint32_t column_family_id, const rocksdb::Slice& key,
+			  const rocksdb::Slice& value) override {
+    // prefixes with a merge operator are never resharded online
+    out.Merge(handle(column_family_id), key, value);
+    return rocksdb::Status::OK();
+  }
+  void LogData(const rocksdb::Slice& blob) override {
+    out.PutLogData(blob);
+  }
+};
+
 int RocksDBStore::submit_common(rocksdb::WriteOptions& woptions, KeyValueDB::Transaction t) 
 {
   // enable rocksdb breakdown
@@ -1547,11 +1821,20 @@ int RocksDBStore::submit_common(rocksdb::WriteOptions& woptions, KeyValueDB::Tra
   RocksDBTransactionImpl * _t =
     static_cast<RocksDBTransactionImpl *>(t.get());
   woptions.disableWAL = disableWAL;
+  // keep an online reshard from moving keys or switching layouts under us
+  std::shared_lock l(reshard_lock);
   lgeneric_subdout(cct, rocksdb, 30) << __func__;
   RocksWBHandler bat_txc(*this);
   _t->bat.Iterate(&bat_txc);
   *_dout << " Rocksdb transaction: " << bat_txc.seen.str() << dendl;
-  
+
+  if (reshard_active ||
+      _t->layout_gen != layout_gen.load(std::memory_order_relaxed)) {
+    ReshardRouter router(*this);
+    _t->bat.Iterate(&router);
+    _t->bat = std::move(router.out);
+    _t->layout_gen = layout_gen.load(std::memory_order_relaxed);
+  }
   rocksdb::Status s = db->Write(woptions, &_t->bat);
   if (!s.ok()) {
     RocksWBHandler rocks_txc(*this);
@@ -1614,6 +1897,7 @@ int RocksDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
 RocksDBStore::RocksDBTransactionImpl::RocksDBTransactionImpl(RocksDBStore *_db)
 {
   db = _db;
+  layout_gen = db->layout_gen.load(std::memory_order_acquire);
 }
 
 void RocksDBStore::RocksDBTransactionImpl::put_bat(
@@ -1725,7 +2009,7 @@ void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix
     }
   } else {
     ceph_assert(p_iter->second.handles.size() >= 1);
-    for (auto cf : p_iter->second.handles) {
+    for (auto cf : db->get_prefix_handles(p_iter->second)) {
       uint64_t cnt = db->get_delete_range_threshold();
       bat.SetSavePoint();
       auto it = db->new_shard_iterator(cf);
@@ -1777,14 +2061,14 @@ void RocksDBStore::RocksDBTransactionImpl::rm_range_keys(const string &prefix,
     }
   } else if (cnt == 0) {
     ceph_assert(p_iter->second.handles.size() >= 1);
-    for (auto cf : p_iter->second.handles) {
+    for (auto cf : db->get_prefix_handles(p_iter->second)) {
       ldout(db->cct, 10) << __func__ << " p_iter != end(), resorting to DeleteRange"
 			   << dendl;
 	bat.DeleteRange(cf, rocksdb::Slice(start), rocksdb::Slice(end));
     }
   } else {
     ceph_assert(p_iter->second.handles.size() >= 1);
-    for (auto cf : p_iter->second.handles) {
+    for (auto cf : db->get_prefix_handles(p_iter->second)) {
       cnt = db->get_delete_range_threshold();
       uint64_t cnt0 = cnt;
       bat.SetSavePoint();
@@ -1857,40 +2141,124 @@ int RocksDBStore::get(
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
-  rocksdb::PinnableSlice value;
   utime_t start = ceph_clock_now();
+  std::vector<string> kv(keys.begin(), keys.end());
+  std::vector<bufferlist> values;
+  std::vector<int> rs;
+  multi_get(prefix, kv, &values, &rs);
+  int r = 0;
+  for (size_t i = 0; i < kv.size(); ++i) {
+    if (rs[i] == 0) {
+      (*out)[kv[i]] = std::move(values[i]);
+    } else if (rs[i] != -ENOENT) {
+      r = rs[i];
+    }
+  }
+  utime_t lat = ceph_clock_now() - start;
+  logger->tinc(l_rocksdb_get_latency, lat);
+  return r;
+}
+
+void RocksDBStore::multi_get(
+    const string &prefix,
+    const std::vector<string> &keys,
+    std::vector<bufferlist> *values,
+    std::vector<int> *rs)
+{
+  size_t n = keys.size();
+  values->clear();
+  values->resize(n);
+  rs->resize(n);
+  if (n == 0) {
+    return;
+  }
+  utime_t start = ceph_clock_now();
+  // a sharded prefix spreads the batch over its column families; a
+  // single MultiGet covers all of them
+  std::vector<rocksdb::ColumnFamilyHandle*> cfs(n);
+  std::vector<rocksdb::Slice> slices(n);
+  std::vector<string> combined;
+  // keys of a prefix being resharded online are looked up where they
+  // used to be first, and where they go second
+  std::vector<rocksdb::ColumnFamilyHandle*> second;
   if (cf_handles.count(prefix) > 0) {
-    for (auto& key : keys) {
-      auto cf_handle = get_cf_handle(prefix, key);
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    cf_handle,
-			    rocksdb::Slice(key),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value.data(), value.size());
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(status.getState());
+    for (size_t i = 0; i < n; ++i) {
+      rocksdb::ColumnFamilyHandle *from;
+      cfs[i] = get_cf_handle(prefix, keys[i].data(), keys[i].size(), &from);
+      if (from) {
+	second.resize(n);
+	second[i] = cfs[i];
+	cfs[i] = from;
       }
-      value.Reset();
+      slices[i] = rocksdb::Slice(keys[i]);
     }
   } else {
-    for (auto& key : keys) {
-      string k = combine_strings(prefix, key);
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    default_cf,
-			    rocksdb::Slice(k),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value.data(), value.size());
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(status.getState());
+    combined.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      cfs[i] = default_cf;
+      combined.push_back(combine_strings(prefix, keys[i]));
+      slices[i] = rocksdb::Slice(combined.back());
+    }
+  }
+  // rocksdb can skip sorting a batch already in (column family, key)
+  // order.  Sorted keys stay sorted with the prefix prepended, but those
+  // of a sharded prefix may jump back and forth between its column
+  // families, so only a batch going to a single one qualifies.
+  bool sorted = std::is_sorted(keys.begin(), keys.end()) &&
+    std::all_of(cfs.begin(), cfs.end(),
+		[&](auto cf) { return cf == cfs.front(); });
+
+  rocksdb::ReadOptions ro;
+#if ROCKSDB_MAJOR >= 7
+  // let rocksdb issue the reads of the batch concurrently
+  ro.async_io = cct->_conf->rocksdb_multiget_async_io;
+#endif
+  std::vector<rocksdb::PinnableSlice> pvalues(n);
+  std::vector<rocksdb::Status> statuses(n);
+  db->MultiGet(ro, n, cfs.data(), slices.data(), pvalues.data(),
+	       statuses.data(), sorted);
+  if (!second.empty()) {
+    std::vector<size_t> idx;
+    std::vector<rocksdb::ColumnFamilyHandle*> cfs2;
+    std::vector<rocksdb::Slice> slices2;
+    for (size_t i = 0; i < n; ++i) {
+      if (second[i] && statuses[i].IsNotFound()) {
+	idx.push_back(i);
+	cfs2.push_back(second[i]);
+	slices2.push_back(slices[i]);
       }
-      value.Reset();
+    }
+    std::vector<rocksdb::PinnableSlice> pvalues2(idx.size());
+    std::vector<rocksdb::Status> statuses2(idx.size());
+    // cfs2 mixes the column families of the old and the new layout, so
+    // the same (column family, key) order rule applies
+    bool sorted2 = std::is_sorted(keys.begin(), keys.end()) &&
+      std::all_of(cfs2.begin(), cfs2.end(),
+		  [&](auto cf) { return cf == cfs2.front(); });
+    db->MultiGet(ro, idx.size(), cfs2.data(), slices2.data(), pvalues2.data(),
+		 statuses2.data(), sorted2);
+    for (size_t j = 0; j < idx.size(); ++j) {
+      pvalues[idx[j]] = std::move(pvalues2[j]);
+      statuses[idx[j]] = statuses2[j];
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (statuses[i].ok()) {
+      (*values)[i].append(pvalues[i].data(), pvalues[i].size());
+      (*rs)[i] = 0;
+    } else if (statuses[i].IsNotFound()) {
+      (*rs)[i] = -ENOENT;
+    } else {
+      // like get(): a failed read is not something callers can handle
+      derr << __func__ << " " << prefix << " "
+	   << pretty_binary_string(keys[i]) << ": "
+	   << statuses[i].ToString() << dendl;
+      ceph_abort_msg(statuses[i].getState());
     }
   }
   utime_t lat = ceph_clock_now() - start;
-  logger->tinc(l_rocksdb_get_latency, lat);
-  return 0;
+  logger->tinc(l_rocksdb_multiget_latency, lat);
+  logger->inc(l_rocksdb_multiget_keys, n);
 }
 
 int RocksDBStore::get(
@@ -1903,12 +2271,19 @@ int RocksDBStore::get(
   int r = 0;
   rocksdb::PinnableSlice value;
   rocksdb::Status s;
-  auto cf = get_cf_handle(prefix, key);
+  rocksdb::ColumnFamilyHandle *from;
+  auto cf = get_cf_handle(prefix, key.data(), key.size(), &from);
   if (cf) {
-    s = db->Get(rocksdb::ReadOptions(),
-		cf,
-		rocksdb::Slice(key),
-		&value);
+    if (from) {
+      s = db->Get(rocksdb::ReadOptions(), from, rocksdb::Slice(key), &value);
+    }
+    if (!from || s.IsNotFound()) {
+      value.Reset();
+      s = db->Get(rocksdb::ReadOptions(),
+		  cf,
+		  rocksdb::Slice(key),
+		  &value);
+    }
   } else {
     string k = combine_strings(prefix, key);
     s = db->Get(rocksdb::ReadOptions(),
@@ -1939,12 +2314,20 @@ int RocksDBStore::get(
   int r = 0;
   rocksdb::PinnableSlice value;
   rocksdb::Status s;
-  auto cf = get_cf_handle(prefix, key, keylen);
+  rocksdb::ColumnFamilyHandle *from;
+  auto cf = get_cf_handle(prefix, key, keylen, &from);
   if (cf) {
-    s = db->Get(rocksdb::ReadOptions(),
-		cf,
-		rocksdb::Slice(key, keylen),
-		&value);
+    if (from) {
+      s = db->Get(rocksdb::ReadOptions(), from, rocksdb::Slice(key, keylen),
+		  &value);
+    }
+    if (!from || s.IsNotFound()) {
+      value.Reset();
+      s = db->Get(rocksdb::ReadOptions(),
+		  cf,
+		  rocksdb::Slice(key, keylen),
+		  &value);
+    }
   } else {
     string k;
     combine_strings(prefix, key, keylen, &k);
@@ -1990,8 +2373,8 @@ void RocksDBStore::compact()
   logger->inc(l_rocksdb_compact);
   rocksdb::CompactRangeOptions options;
   db->CompactRange(options, default_cf, nullptr, nullptr);
-  for (auto cf : cf_handles) {
-    for (auto shard_cf : cf.second.handles) {
+  for (auto& cf : cf_handles) {
+    for (auto shard_cf : get_prefix_handles(cf.second)) {
       db->CompactRange(
 	options,
 	shard_cf,
@@ -2093,7 +2476,7 @@ void RocksDBStore::compact_range(const string& start, const string& end)
 			    const std::string& end) {
     rocksdb::Slice cstart(start);
     rocksdb::Slice cend(end);
-    for (const auto& shard_it : column_it->second.handles) {
+    for (const auto& shard_it : get_prefix_handles(column_it->second)) {
       db->CompactRange(options, shard_it, &cstart, &cend);
     }
   };
@@ -2813,17 +3196,25 @@ private:
   const rocksdb::Slice iterate_lower_bound;
   const rocksdb::Slice iterate_upper_bound;
   std::vector<rocksdb::Iterator*> iters;
+  const rocksdb::Snapshot* snapshot = nullptr;
 public:
+  /// with @consistent, all shards are read at the same snapshot; needed
+  /// when keys may move between them meanwhile (online resharding)
   explicit ShardMergeIteratorImpl(const RocksDBStore* db,
 				  const std::string& prefix,
 				  const std::vector<rocksdb::ColumnFamilyHandle*>& shards,
-                  KeyValueDB::IteratorBounds bounds_)
+                  KeyValueDB::IteratorBounds bounds_,
+				  bool consistent = false)
     : db(db), keyless(db->comparator), prefix(prefix), bounds(std::move(bounds_)),
       iterate_lower_bound(make_slice(bounds.lower_bound)),
       iterate_upper_bound(make_slice(bounds.upper_bound))
   {
     iters.reserve(shards.size());
     auto options = rocksdb::ReadOptions();
+    if (consistent) {
+      snapshot = db->db->GetSnapshot();
+      options.snapshot = snapshot;
+    }
     if (db->cct->_conf->osd_rocksdb_iterator_bounds_enabled) {
       if (bounds.lower_bound) {
         options.iterate_lower_bound = &iterate_lower_bound;
@@ -2840,6 +3231,9 @@ public:
     for (auto& it : iters) {
       delete it;
     }
+    if (snapshot) {
+      db->db->ReleaseSnapshot(snapshot);
+    }
   }
   int seek_to_first() override {
     for (auto& it : iters) {
@@ -3009,10 +3403,22 @@ KeyValueDB::Iterator RocksDBStore::get_iterator(const std::string& prefix, Itera
   auto cf_it = cf_handles.find(prefix);
   if (cf_it != cf_handles.end()) {
     rocksdb::ColumnFamilyHandle* cf = nullptr;
-    if (cf_it->second.handles.size() == 1) {
-      cf = cf_it->second.handles[0];
+    bool migrating;
+    auto& handles = get_prefix_handles(cf_it->second, &migrating);
+    auto& layout = get_current_layout(cf_it->second);
+    if (migrating) {
+      // keys move between the shards, iterate a snapshot of all of them
+      return std::make_shared<ShardMergeIteratorImpl>(
+        this,
+        prefix,
+        handles,
+        std::move(bounds),
+        true);
+    }
+    if (layout.handles.size() == 1) {
+      cf = layout.handles[0];
     } else if (cct->_conf->osd_rocksdb_iterator_bounds_enabled) {
-      cf = check_cf_handle_bounds(cf_it, bounds);
+      cf = check_cf_handle_bounds(layout, bounds);
     }
     if (cf) {
       return std::make_shared<CFIteratorImpl>(
@@ -3024,7 +3430,7 @@ KeyValueDB::Iterator RocksDBStore::get_iterator(const std::string& prefix, Itera
       return std::make_shared<ShardMergeIteratorImpl>(
         this,
         prefix,
-        cf_it->second.handles,
+        layout.handles,
         std::move(bounds));
     }
   } else {
@@ -3449,6 +3855,8 @@ int RocksDBStore::reshard(const std::string& new_sharding, const RocksDBStore::r
     derr << __func__ << " cannot write to " << sharding_def_file << dendl;
     return -EIO;
   }
+  // this completes (or supersedes) an interrupted online reshard too
+  env->DeleteFile(sharding_online);
 
   return r;
 }
@@ -3471,3 +3879,526 @@ bool RocksDBStore::get_sharding(std::string& sharding) {
   }
   return result;
 }
+
+int RocksDBStore::reshard_online(const std::string& new_sharding,
+				 const RocksDBStore::resharding_ctrl* ctrl_in)
+{
+  // checking for a reshard in progress and starting this one is one step
+  std::lock_guard l(reshard_thread_lock);
+  return _reshard_online(new_sharding, ctrl_in, {}, 0, {}, false);
+}
+
+int RocksDBStore::resume_online_reshard(
+  std::map<std::string, rocksdb::ColumnFamilyHandle*>&& opened,
+  bool open_readonly)
+{
+  online_reshard_state_t st;
+  if (!read_online_reshard(env, &st)) {
+    ceph_assert(opened.empty());
+    return 0;
+  }
+  std::string stored_sharding_text;
+  get_sharding(stored_sharding_text);
+  if (stored_sharding_text == st.to) {
+    // stopped right after the cutover; what is left of the old layout
+    // was emptied already
+    for (auto& [name, cf] : opened) {
+      if (!open_readonly) {
+	dout(5) << __func__ << " dropping column " << name << dendl;
+	db->DropColumnFamily(cf);
+      }
+      db->DestroyColumnFamilyHandle(cf);
+    }
+    if (!open_readonly) {
+      env->DeleteFile(sharding_online);
+    }
+    return 0;
+  }
+  if (stored_sharding_text != st.from) {
+    derr << __func__ << " online reshard from " << st.from << " to " << st.to
+	 << " does not match stored sharding " << stored_sharding_text << dendl;
+    for (auto& [name, cf] : opened) {
+      db->DestroyColumnFamilyHandle(cf);
+    }
+    return -EIO;
+  }
+  dout(1) << __func__ << " resuming online reshard to " << st.to
+	  << " at column " << st.shard << dendl;
+  std::lock_guard l(reshard_thread_lock);
+  return _reshard_online(st.to, nullptr, std::move(opened),
+			 st.shard, st.key, open_readonly);
+}
+
+int RocksDBStore::_reshard_online(
+  const std::string& new_sharding,
+  const RocksDBStore::resharding_ctrl* ctrl_in,
+  std::map<std::string, rocksdb::ColumnFamilyHandle*>&& opened,
+  size_t resume_shard,
+  const std::string& resume_key,
+  bool open_readonly)
+{
+  ceph_assert(ceph_mutex_is_locked_by_me(reshard_thread_lock));
+  bool resuming = !opened.empty() || resume_shard || !resume_key.empty();
+  auto close_opened = [&] {
+    for (auto& [name, cf] : opened) {
+      db->DestroyColumnFamilyHandle(cf);
+    }
+  };
+  {
+    std::shared_lock l(reshard_lock);
+    if (reshard_active) {
+      dout(1) << __func__ << " an online reshard is already in progress"
+	      << dendl;
+      return -EBUSY;
+    }
+  }
+  if (reshard_thread.is_started()) {
+    // the previous one is complete
+    reshard_thread.join();
+  }
+
+  bool b;
+  std::vector<ColumnFamily> new_sharding_def;
+  char const* error_position;
+  std::string error_msg;
+  b = parse_sharding_def(new_sharding, new_sharding_def, &error_position, &error_msg);
+  if (!b) {
+    dout(1) << __func__ << " bad sharding: " << dendl;
+    dout(1) << __func__ << new_sharding << dendl;
+    dout(1) << __func__ << std::string(error_position - &new_sharding[0], ' ') << "^" << error_msg << dendl;
+    close_opened();
+    return -EINVAL;
+  }
+  std::string stored_sharding_text;
+  get_sharding(stored_sharding_text);
+  std::vector<ColumnFamily> sharding_def;
+  b = parse_sharding_def(stored_sharding_text, sharding_def);
+  if (!b || stored_sharding_text.find(resharding_column_lock) != string::npos) {
+    derr << __func__ << " unexpected stored sharding: "
+	 << stored_sharding_text << dendl;
+    close_opened();
+    return -EIO;
+  }
+
+  // only the shard count and hash range of one prefix can change
+  if (new_sharding_def.size() != sharding_def.size()) {
+    dout(1) << __func__ << " column families can only be added or removed"
+	    << " offline" << dendl;
+    close_opened();
+    return -ENOTSUP;
+  }
+  const ColumnFamily* changed = nullptr;
+  for (const auto& nsd : new_sharding_def) {
+    auto sd = std::find_if(sharding_def.begin(), sharding_def.end(),
+			   [&](const ColumnFamily& c) { return c.name == nsd.name; });
+    if (sd == sharding_def.end() || sd->options != nsd.options) {
+      dout(1) << __func__ << " column family " << nsd.name
+	      << " can only be added or reconfigured offline" << dendl;
+      close_opened();
+      return -ENOTSUP;
+    }
+    if (sd->shard_cnt == nsd.shard_cnt &&
+	sd->hash_l == nsd.hash_l && sd->hash_h == nsd.hash_h) {
+      continue;
+    }
+    if (changed) {
+      dout(1) << __func__ << " only one column family can be resharded"
+	      << " online at a time" << dendl;
+      close_opened();
+      return -EINVAL;
+    }
+    changed = &nsd;
+  }
+  if (!changed) {
+    dout(5) << __func__ << " sharding unchanged" << dendl;
+    close_opened();
+    if (resuming && !open_readonly) {
+      env->DeleteFile(sharding_online);
+    }
+    return 0;
+  }
+  const std::string& prefix = changed->name;
+  for (auto& p : merge_ops) {
+    if (p.first == prefix) {
+      // merge operands cannot be applied to a value in another column family
+      dout(1) << __func__ << " column family " << prefix
+	      << " has a merge operator, reshard it offline" << dendl;
+      close_opened();
+      return -ENOTSUP;
+    }
+  }
+  auto column = cf_handles.find(prefix);
+  ceph_assert(column != cf_handles.end());
+  const prefix_shards& current = get_current_layout(column->second);
+
+  auto r = std::make_unique<online_reshard_t>();
+  r->prefix = prefix;
+  r->from = &current;
+  r->to.hash_l = changed->hash_l;
+  r->to.hash_h = changed->hash_h;
+  r->sharding = new_sharding;
+  r->ctrl = ctrl_in ? *ctrl_in : resharding_ctrl();
+  r->resume_shard = resume_shard;
+  r->resume_key = resume_key;
+  for (auto cf : current.handles) {
+    uint64_t size = 0;
+    if (db->GetIntProperty(cf, "rocksdb.estimate-live-data-size", &size)) {
+      r->bytes_estimated += size;
+    }
+  }
+
+  // columns are named like with an offline reshard, those existing in
+  // both layouts are kept
+  auto column_name = [&prefix](size_t shard_cnt, size_t idx) {
+    return shard_cnt == 1 ? prefix : prefix + "-" + std::to_string(idx);
+  };
+  std::map<std::string, rocksdb::ColumnFamilyHandle*> existing;
+  for (size_t i = 0; i < current.handles.size(); i++) {
+    existing[column_name(current.handles.size(), i)] = current.handles[i];
+  }
+  if (open_readonly) {
+    // columns are all created before the first key moves, so with some
+    // missing the old layout still holds every key
+    for (size_t idx = 0; idx < changed->shard_cnt; idx++) {
+      std::string cf_name = column_name(changed->shard_cnt, idx);
+      if (!existing.count(cf_name) && !opened.count(cf_name)) {
+	dout(1) << __func__ << " column " << cf_name << " was never created,"
+		<< " reading the old layout only" << dendl;
+	close_opened();
+	return 0;
+      }
+    }
+  } else if (!resuming) {
+    // from here on, opening the db resumes this reshard
+    online_reshard_state_t st{stored_sharding_text, new_sharding, 0, {}};
+    if (int ret = write_online_reshard(env, st); ret < 0) {
+      return ret;
+    }
+  }
+  rocksdb::ColumnFamilyDescriptor desc;
+  rocksdb::Status status = current.handles[0]->GetDescriptor(&desc);
+  for (size_t idx = 0; status.ok() && idx < changed->shard_cnt; idx++) {
+    std::string cf_name = column_name(changed->shard_cnt, idx);
+    auto p = existing.find(cf_name);
+    if (p != existing.end()) {
+      r->to.handles.push_back(p->second);
+      existing.erase(p);
+      continue;
+    }
+    rocksdb::ColumnFamilyHandle *cf;
+    if (auto q = opened.find(cf_name); q != opened.end()) {
+      cf = q->second;
+      opened.erase(q);
+    } else {
+      status = db->CreateColumnFamily(desc.options, cf_name, &cf);
+      if (!status.ok()) {
+	break;
+      }
+      dout(10) << __func__ << " created column " << cf_name << dendl;
+    }
+    r->to.handles.push_back(cf);
+    r->created.push_back(cf);
+  }
+  // anything left was opened for a layout other than this one
+  close_opened();
+  if (!status.ok()) {
+    derr << __func__ << " Failed to create rocksdb column family: "
+	 << status.ToString() << dendl;
+    for (auto cf : r->created) {
+      if (!resuming) {
+	db->DropColumnFamily(cf);
+      }
+      db->DestroyColumnFamilyHandle(cf);
+    }
+    if (!resuming) {
+      env->DeleteFile(sharding_online);
+    }
+    return -EINVAL;
+  }
+  for (auto& [name, cf] : existing) {
+    r->retired.push_back(cf);
+  }
+  r->all = current.handles;
+  r->all.insert(r->all.end(), r->created.begin(), r->created.end());
+
+  dout(1) << __func__ << " resharding " << prefix << " from "
+	  << current.handles.size() << " to " << r->to.handles.size()
+	  << " shards, about " << byte_u_t(r->bytes_estimated) << dendl;
+  {
+    std::unique_lock l(reshard_lock);
+    for (auto cf : r->created) {
+      cf_ids_to_prefix.emplace(cf->GetID(), prefix);
+      cf_ids_to_handle[cf->GetID()] = cf;
+    }
+    reshard_active = r.get();
+    column->second.resharding.store(r.get(), std::memory_order_release);
+    ++layout_gen;
+    online_reshards.push_back(std::move(r));
+  }
+  if (open_readonly) {
+    // reads look in both layouts, keys move once opened for writing
+    return 0;
+  }
+  logger->set(l_rocksdb_reshard_progress, 0);
+  reshard_thread_stop = false;
+  reshard_thread.create("rstore_reshard");
+  return 0;
+}
+
+int RocksDBStore::wait_online_reshard()
+{
+  if (reshard_thread.is_started()) {
+    reshard_thread.join();
+  }
+  std::shared_lock l(reshard_lock);
+  return online_reshards.empty() ? 0 : online_reshards.back()->r;
+}
+
+void RocksDBStore::stop_online_reshard()
+{
+  {
+    std::lock_guard l(reshard_thread_lock);
+    reshard_thread_stop = true;
+    reshard_thread_cond.notify_all();
+  }
+  if (reshard_thread.is_started()) {
+    reshard_thread.join();
+  }
+}
+
+void RocksDBStore::dump_online_reshard(ceph::Formatter *f) const
+{
+  std::shared_lock l(reshard_lock);
+  f->open_object_section("online_reshard");
+  if (!online_reshards.empty()) {
+    auto& r = online_reshards.back();
+    f->dump_string("prefix", r->prefix);
+    f->dump_string("sharding", r->sharding);
+    f->dump_bool("done", r->done);
+    f->dump_unsigned("bytes_estimated", r->bytes_estimated);
+    f->dump_unsigned("bytes_scanned", r->bytes_scanned);
+    f->dump_unsigned("keys_moved", r->keys_moved);
+    f->dump_unsigned("bytes_moved", r->bytes_moved);
+  }
+  f->close_section();
+}
+
+void RocksDBStore::reshard_thread_entry()
+{
+  online_reshard_t *r;
+  {
+    std::shared_lock l(reshard_lock);
+    r = reshard_active;
+  }
+  ceph_assert(r);
+  dout(5) << __func__ << " start " << r->prefix << dendl;
+  auto start = ceph::mono_clock::now();
+  uint64_t throttled = 0;
+  for (size_t shard = r->resume_shard; shard < r->from->handles.size();
+       ++shard) {
+    auto cf = r->from->handles[shard];
+    rocksdb::ReadOptions ro;
+    ro.fill_cache = false;
+    std::unique_ptr<rocksdb::Iterator> it{db->NewIterator(ro, cf)};
+    size_t bytes_per_iterator = 0;
+    size_t keys_per_iterator = 0;
+    if (shard == r->resume_shard && !r->resume_key.empty()) {
+      it->Seek(r->resume_key);
+    } else {
+      it->SeekToFirst();
+    }
+    while (true) {
+      // collect keys the new layout puts elsewhere
+      std::vector<std::string> keys;
+      size_t bytes_in_batch = 0;
+      for (; it->Valid() &&
+	     keys.size() < r->ctrl.keys_per_batch &&
+	     bytes_in_batch < r->ctrl.bytes_per_batch;
+	   it->Next()) {
+	rocksdb::Slice key = it->key();
+	size_t len = key.size() + it->value().size();
+	r->bytes_scanned += len;
+	bytes_per_iterator += len;
+	++keys_per_iterator;
+	if (get_layout_cf(r->to, key.data(), key.size()) != cf) {
+	  keys.push_back(key.ToString());
+	  bytes_in_batch += len;
+	}
+      }
+      if (!it->status().ok()) {
+	derr << __func__ << " iterator error: " << it->status().ToString()
+	     << dendl;
+	r->r = -EIO;
+	return;
+      }
+      bool end = !it->Valid();
+      if (!keys.empty()) {
+	uint64_t bytes = 0;
+	int ret = reshard_move_batch(r, cf, keys, &bytes);
+	if (ret < 0) {
+	  r->r = ret;
+	  return;
+	}
+	throttled += bytes;
+      }
+      if (r->bytes_estimated) {
+	logger->set(l_rocksdb_reshard_progress,
+		    std::min<uint64_t>(99, r->bytes_scanned * 100 / r->bytes_estimated));
+      }
+      {
+	std::unique_lock l(reshard_thread_lock);
+	uint64_t max_bytes_per_sec =
+	  cct->_conf.get_val<Option::size_t>("rocksdb_online_reshard_max_bytes_per_sec");
+	if (max_bytes_per_sec && !reshard_thread_stop) {
+	  auto due = start + ceph::make_timespan((double)throttled / max_bytes_per_sec);
+	  auto now = ceph::mono_clock::now();
+	  if (due > now) {
+	    reshard_thread_cond.wait_for(l, due - now,
+					 [this] { return reshard_thread_stop; });
+	  }
+	}
+	if (reshard_thread_stop) {
+	  l.unlock();
+	  if (end) {
+	    reshard_save_progress(r, shard + 1, {});
+	  } else {
+	    reshard_save_progress(r, shard, it->key().ToString());
+	  }
+	  dout(1) << __func__ << " interrupted, " << r->prefix
+		  << " resumes resharding when the db is opened again" << dendl;
+	  r->r = -ECANCELED;
+	  return;
+	}
+      }
+      if (end) {
+	reshard_save_progress(r, shard + 1, {});
+	break;
+      }
+      // the moves pile up tombstones under a long lived iterator
+      if (bytes_per_iterator >= r->ctrl.bytes_per_iterator ||
+	  keys_per_iterator >= r->ctrl.keys_per_iterator) {
+	dout(8) << __func__ << " refreshing iterator" << dendl;
+	bytes_per_iterator = 0;
+	keys_per_iterator = 0;
+	std::string next = it->key().ToString();
+	reshard_save_progress(r, shard, next);
+	it.reset(db->NewIterator(ro, cf));
+	it->Seek(next);
+      }
+    }
+  }
+  r->r = reshard_cutover(r);
+  dout(1) << __func__ << " " << r->prefix << " done, moved "
+	  << r->keys_moved << " keys (" << byte_u_t(r->bytes_moved) << ") in "
+	  << ceph::mono_clock::now() - start << ", r = " << r->r << dendl;
+}
+
+void RocksDBStore::reshard_save_progress(online_reshard_t *r, size_t shard,
+					 const std::string& key)
+{
+  if (disableWAL) {
+    // moves not flushed yet are lost with the memtable on a crash, keys
+    // before the position could come back; rescan from the start then
+    return;
+  }
+  // the moves up to here must survive a crash if the position does
+  if (auto status = db->FlushWAL(true); !status.ok()) {
+    derr << __func__ << " FlushWAL: " << status.ToString() << dendl;
+    return;
+  }
+  std::string stored_sharding_text;
+  get_sharding(stored_sharding_text);
+  online_reshard_state_t st{stored_sharding_text, r->sharding, shard, key};
+  if (write_online_reshard(env, st) < 0) {
+    derr << __func__ << " cannot write to " << sharding_online << dendl;
+    return;
+  }
+  dout(20) << __func__ << " column " << shard << " at "
+	   << pretty_binary_string(key) << dendl;
+}
+
+int RocksDBStore::reshard_move_batch(online_reshard_t *r,
+				     rocksdb::ColumnFamilyHandle *cf,
+				     const std::vector<std::string>& keys,
+				     uint64_t *bytes)
+{
+  size_t n = keys.size();
+  std::vector<rocksdb::ColumnFamilyHandle*> cfs(n, cf);
+  std::vector<rocksdb::Slice> slices(keys.begin(), keys.end());
+  std::vector<rocksdb::PinnableSlice> values(n);
+  std::vector<rocksdb::Status> statuses(n);
+  rocksdb::WriteBatch bat;
+  uint64_t moved = 0;
+
+  // writers wait for one batch at most; read the values again under the
+  // lock, they may have been overwritten since they were scanned
+  std::unique_lock l(reshard_lock);
+  db->MultiGet(rocksdb::ReadOptions(), n, cfs.data(), slices.data(),
+	       values.data(), statuses.data(), true);
+  for (size_t i = 0; i < n; ++i) {
+    if (statuses[i].IsNotFound()) {
+      continue;
+    }
+    if (!statuses[i].ok()) {
+      derr << __func__ << " read error: " << statuses[i].ToString() << dendl;
+      return -EIO;
+    }
+    bat.Put(get_layout_cf(r->to, keys[i].data(), keys[i].size()),
+	    slices[i], values[i]);
+    bat.Delete(cf, slices[i]);
+    moved++;
+    *bytes += keys[i].size() * 2 + values[i].size();
+  }
+  rocksdb::WriteOptions woptions;
+  woptions.disableWAL = disableWAL;
+  rocksdb::Status s = db->Write(woptions, &bat);
+  if (!s.ok()) {
+    derr << __func__ << " error: " << s.ToString() << dendl;
+    return -EIO;
+  }
+  l.unlock();
+  dout(20) << __func__ << " moved " << moved << " keys" << dendl;
+  r->keys_moved += moved;
+  r->bytes_moved += *bytes;
+  logger->inc(l_rocksdb_reshard_keys_moved, moved);
+  logger->inc(l_rocksdb_reshard_bytes_moved, *bytes);
+  return 0;
+}
+
+int RocksDBStore::reshard_cutover(online_reshard_t *r)
+{
+  std::unique_lock l(reshard_lock);
+  for (auto cf : r->retired) {
+    // every key was moved, and writers only delete from here
+    std::unique_ptr<rocksdb::Iterator> it{
+      db->NewIterator(rocksdb::ReadOptions(), cf)};
+    it->SeekToFirst();
+    if (it->Valid()) {
+      derr << __func__ << " column " << cf->GetName() << " is not empty"
+	   << dendl;
+      return -EIO;
+    }
+  }
+  // the new sharding goes first: opening the db after a crash from here
+  // on drops whatever is left of the old columns, all of them empty
+  env->CreateDir(sharding_def_dir);
+  if (auto status = rocksdb::WriteStringToFile(env, r->sharding,
+					       sharding_def_file, true);
+      !status.ok()) {
+    derr << __func__ << " cannot write to " << sharding_def_file << dendl;
+    return -EIO;
+  }
+  for (auto cf : r->retired) {
+    dout(5) << __func__ << " dropping column " << cf->GetName() << dendl;
+    if (rocksdb::Status status = db->DropColumnFamily(cf); !status.ok()) {
+      derr << __func__ << " Failed to drop column: " << cf->GetName() << dendl;
+      return -EIO;
+    }
+  }
+  env->DeleteFile(sharding_online);
+  r->done = true;
+  reshard_active = nullptr;
+  ++layout_gen;
+  logger->set(l_rocksdb_reshard_progress, 100);
+  return 0;
+}
@@ -6,6 +6,8 @@
 #include "include/types.h"
 #include "include/buffer_fwd.h"
 #include "KeyValueDB.h"
+#include <atomic>
+#include <list>
 #include <set>
 #include <map>
 #include <string>
@@ -18,6 +20,7 @@
 #include "rocksdb/table.h"
 #include "rocksdb/db.h"
 #include "kv/rocksdb_cache/BinnedLRUCache.h"
+#include "kv/rocksdb_cache/BinnedClockCache.h"
 #include <errno.h>
 #include "common/errno.h"
 #include "common/dout.h"
@@ -26,6 +29,8 @@
 #include "common/Formatter.h"
 #include "common/Cond.h"
 #include "common/ceph_context.h"
+#include "common/ceph_mutex.h"
+#include "common/Thread.h"
 #include "common/PriorityCache.h"
 #include "common/pretty_binary.h"
 
@@ -42,6 +47,11 @@ enum {
   l_rocksdb_write_memtable_time,
   l_rocksdb_write_delay_time,
   l_rocksdb_write_pre_and_post_process_time,
+  l_rocksdb_multiget_latency,
+  l_rocksdb_multiget_keys,
+  l_rocksdb_reshard_keys_moved,
+  l_rocksdb_reshard_bytes_moved,
+  l_rocksdb_reshard_progress,
   l_rocksdb_last,
 };
 
@@ -115,15 +125,20 @@ private:
   bool must_close_default_cf = false;
   rocksdb::ColumnFamilyHandle *default_cf = nullptr;
 
+  struct online_reshard_t;
   /// column families in use, name->handles
   struct prefix_shards {
     uint32_t hash_l;  //< first character to take for hash calc.
     uint32_t hash_h;  //< last character to take for hash calc.
     std::vector<rocksdb::ColumnFamilyHandle *> handles;
+    /// set once the prefix is resharded online; from then on it, not
+    /// the fields above, tells where keys live
+    std::atomic<online_reshard_t*> resharding = nullptr;
   };
   std::unordered_map<std::string, prefix_shards> cf_handles;
   typedef decltype(cf_handles)::iterator cf_handles_iterator;
   std::unordered_map<uint32_t, std::string> cf_ids_to_prefix;
+  std::unordered_map<uint32_t, rocksdb::ColumnFamilyHandle*> cf_ids_to_handle;
   std::unordered_map<std::string, rocksdb::BlockBasedTableOptions> cf_bbt_opts;
   
   void add_column_family(const std::string& cf_name, uint32_t hash_l, uint32_t hash_h,
@@ -131,9 +146,24 @@ private:
   bool is_column_family(const std::string& prefix);
   std::string_view get_key_hash_view(const prefix_shards& shards, const char* key, const size_t keylen);
   rocksdb::ColumnFamilyHandle *get_key_cf(const prefix_shards& shards, const char* key, const size_t keylen);
+  rocksdb::ColumnFamilyHandle *get_layout_cf(const prefix_shards& shards, const char* key, const size_t keylen) {
+    if (shards.handles.size() == 1) {
+      return shards.handles[0];
+    }
+    return get_key_cf(shards, key, keylen);
+  }
+  /// the layout new keys of the prefix go to
+  const prefix_shards& get_current_layout(const prefix_shards& shards) const;
+  /// every column family that may currently hold keys of the prefix
+  const std::vector<rocksdb::ColumnFamilyHandle*>& get_prefix_handles(
+    const prefix_shards& shards, bool *migrating = nullptr) const;
   rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix, const std::string& key);
   rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix, const char* key, size_t keylen);
-  rocksdb::ColumnFamilyHandle *check_cf_handle_bounds(const cf_handles_iterator& it, const IteratorBounds& bounds);
+  /// for reads: *from is set to the column family the key may still sit
+  /// in while its prefix is resharded online (look there first), or null
+  rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix, const char* key, size_t keylen,
+					     rocksdb::ColumnFamilyHandle **from);
+  rocksdb::ColumnFamilyHandle *check_cf_handle_bounds(const prefix_shards& shards, const IteratorBounds& bounds);
 
   int submit_common(rocksdb::WriteOptions& woptions, KeyValueDB::Transaction t);
   int install_cf_mergeop(const std::string &cf_name, rocksdb::ColumnFamilyOptions *cf_opt);
@@ -161,7 +191,8 @@ private:
 		      std::vector<rocksdb::ColumnFamilyDescriptor>& existing_cfs,
 		      std::vector<std::pair<size_t, RocksDBStore::ColumnFamily> >& existing_cfs_shard,
 		      std::vector<rocksdb::ColumnFamilyDescriptor>& missing_cfs,
-		      std::vector<std::pair<size_t, RocksDBStore::ColumnFamily> >& missing_cfs_shard);
+		      std::vector<std::pair<size_t, RocksDBStore::ColumnFamily> >& missing_cfs_shard,
+		      std::vector<rocksdb::ColumnFamilyDescriptor>& online_cfs);
   std::shared_ptr<rocksdb::Cache> create_block_cache(const std::string& cache_type, size_t cache_size, double cache_prio_high = 0.0);
   int split_column_family_options(const std::string& opts_str,
 				  std::unordered_map<std::string, std::string>* column_opts_map,
@@ -284,10 +315,12 @@ public:
   int64_t estimate_prefix_size(const std::string& prefix,
 			       const std::string& key_prefix) override;
   struct RocksWBHandler;
+  struct ReshardRouter;
   class RocksDBTransactionImpl : public KeyValueDB::TransactionImpl {
   public:
     rocksdb::WriteBatch bat;
     RocksDBStore *db;
+    uint64_t layout_gen;   ///< of the db when the batch was started
 
     explicit RocksDBTransactionImpl(RocksDBStore *_db);
   private:
@@ -350,6 +383,11 @@ public:
     const char *key,
     size_t keylen,
     ceph::bufferlist *out) override;
+  void multi_get(
+    const std::string &prefix,
+    const std::vector<std::string> &keys,
+    std::vector<ceph::bufferlist> *values,
+    std::vector<int> *rs) override;
 
 
   class RocksDBWholeSpaceIteratorImpl :
@@ -544,6 +582,96 @@ public:
   int reshard(const std::string& new_sharding, const resharding_ctrl* ctrl = nullptr);
   bool get_sharding(std::string& sharding);
 
+  /**
+   * Reshard one column family prefix while the db stays in use.
+   *
+   * @new_sharding may differ from the current sharding in the shard
+   * count and hash range of a single prefix.  Its keys are moved to
+   * their new column families by a background thread, throttled by
+   * rocksdb_online_reshard_max_bytes_per_sec.  Meanwhile reads look a
+   * key up in its old column family first, then in its new one, and
+   * writes go to the new one (and delete it from the old one), so every
+   * key lives in exactly one place.  Once all keys are moved, the new
+   * sharding is stored and the emptied column families dropped, in a
+   * single step that excludes writers.
+   *
+   * The target and how far the keys have been moved are stored next to
+   * the sharding, and opening the db resumes an interrupted online
+   * reshard from there (reads only look in both layouts when it is
+   * opened read only).  An offline reshard() completes it as well.
+   */
+  int reshard_online(const std::string& new_sharding,
+		     const resharding_ctrl* ctrl = nullptr);
+  /// wait for the online reshard to complete; returns its result
+  int wait_online_reshard();
+  void dump_online_reshard(ceph::Formatter *f) const;
+
+private:
+  struct online_reshard_t {
+    std::string prefix;
+    const prefix_shards* from = nullptr;   ///< layout keys move off
+    prefix_shards to;                      ///< layout keys move to
+    std::vector<rocksdb::ColumnFamilyHandle*> all;  ///< both layouts
+    std::vector<rocksdb::ColumnFamilyHandle*> created;
+    std::vector<rocksdb::ColumnFamilyHandle*> retired;  ///< dropped at the end
+    std::string sharding;                  ///< stored at the end
+    resharding_ctrl ctrl;
+    size_t resume_shard = 0;               ///< of from->handles
+    std::string resume_key;                ///< first key to scan there
+    uint64_t bytes_estimated = 0;
+    std::atomic<uint64_t> bytes_scanned = 0;
+    std::atomic<uint64_t> keys_moved = 0;
+    std::atomic<uint64_t> bytes_moved = 0;
+    std::atomic<bool> done = false;
+    int r = 0;
+  };
+
+  /// held shared by writers, exclusively while moving keys and on cutover
+  mutable ceph::shared_mutex reshard_lock =
+    ceph::make_shared_mutex("RocksDBStore::reshard_lock");
+  std::atomic<uint64_t> layout_gen = 0;   ///< bumped on reshard start and end
+  online_reshard_t *reshard_active = nullptr;  ///< protected by reshard_lock
+  /// every online reshard of this session; lock-free readers may still
+  /// refer to finished ones
+  std::list<std::unique_ptr<online_reshard_t>> online_reshards;
+
+  /// also held from checking for a reshard in progress through starting
+  /// the thread of a new one
+  ceph::mutex reshard_thread_lock =
+    ceph::make_mutex("RocksDBStore::reshard_thread_lock");
+  ceph::condition_variable reshard_thread_cond;
+  bool reshard_thread_stop = false;
+  class ReshardThread : public Thread {
+    RocksDBStore *db;
+  public:
+    explicit ReshardThread(RocksDBStore *d) : db(d) {}
+    void *entry() override {
+      db->reshard_thread_entry();
+      return NULL;
+    }
+  } reshard_thread{this};
+
+  int _reshard_online(const std::string& new_sharding,
+		      const resharding_ctrl* ctrl,
+		      std::map<std::string, rocksdb::ColumnFamilyHandle*>&& opened,
+		      size_t resume_shard,
+		      const std::string& resume_key,
+		      bool open_readonly);
+  /// on open: pick up an online reshard the db was closed during; the
+  /// columns of its other layout were @opened along with the others
+  int resume_online_reshard(
+    std::map<std::string, rocksdb::ColumnFamilyHandle*>&& opened,
+    bool open_readonly);
+  void reshard_save_progress(online_reshard_t *r, size_t shard,
+			     const std::string& key);
+  void reshard_thread_entry();
+  int reshard_move_batch(online_reshard_t *r,
+			 rocksdb::ColumnFamilyHandle *cf,
+			 const std::vector<std::string>& keys,
+			 uint64_t *bytes);
+  int reshard_cutover(online_reshard_t *r);
+  void stop_online_reshard();
+
 };
 
 #endif
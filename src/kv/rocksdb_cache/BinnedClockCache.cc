@@ -0,0 +1,775 @@
+// Copyright (c) 2018-Present Red Hat Inc.  All rights reserved.
+//
+// Copyright (c) 2011-Present, Facebook, Inc.  All rights reserved.
+// This source code is licensed under both the GPLv2 and Apache 2.0 License
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+
+#include "BinnedClockCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <bit>
+#include <string>
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_rocksdb
+#undef dout_prefix
+#define dout_prefix *_dout << "rocksdb: "
+
+namespace rocksdb_cache {
+
+using H = BinnedClockHandle;
+
+namespace {
+
+// Countdown a new entry starts with; a hit sets it to the maximum (3).
+// High priority entries (indexes and filters) survive more sweeps.
+constexpr uint64_t kLowPriCountdown = 1;
+constexpr uint64_t kHighPriCountdown = 2;
+
+// Slots claimed by each move of the clock hand.
+constexpr size_t kClockStep = 4;
+
+// Share of the slots that may be taken; past it the clock sweeps to free
+// one before an insert, which keeps the expected probe short.
+constexpr double kStrictLoadFactor = 0.84;
+// Slots an insert probes, and a lookup follows, at most.  The clock frees
+// slots in runs, so an insert that finds none on the way evicts one there
+// before it gives up and detaches its entry.
+constexpr size_t kMaxInsertProbes = 64;
+
+// Probe sequence by double hashing; the increment is odd, so it visits
+// every slot of the power of two sized table.
+inline uint32_t ProbeIncrement(uint32_t hash) {
+  return ((hash >> 7) ^ (hash << 9)) | 1;
+}
+
+}  // anonymous namespace
+
+BinnedClockCacheShard::BinnedClockCacheShard(CephContext *c, size_t capacity,
+                                             bool strict_capacity_limit,
+                                             double high_pri_pool_ratio,
+                                             size_t table_size)
+    : cct(c),
+      capacity_(0),
+      high_pri_pool_capacity_(0),
+      strict_capacity_limit_(strict_capacity_limit),
+      high_pri_pool_ratio_(high_pri_pool_ratio),
+      table_size_(table_size),
+      table_mask_(table_size - 1),
+      max_insert_probes_(std::min(table_size, kMaxInsertProbes)),
+      occupancy_limit_((size_t)(table_size * kStrictLoadFactor)),
+      table_(new BinnedClockHandle[table_size]),
+      age_bins_(new AgeBin[kMaxAgeBins]) {
+  ceph_assert(std::has_single_bit(table_size));
+  SetCapacity(capacity);
+}
+
+BinnedClockCacheShard::~BinnedClockCacheShard() {
+  // whatever is left is not referenced anymore
+  for (size_t i = 0; i < table_size_; i++) {
+    BinnedClockHandle* h = &table_[i];
+    uint64_t meta = h->meta.load(std::memory_order_acquire);
+    if (H::state(meta) == H::kStateVisible) {
+      ceph_assert(H::refs(meta) == 0);
+      if (h->deleter) {
+        (*h->deleter)(h->key(), h->value);
+      }
+      delete[] h->key_data;
+    }
+  }
+}
+
+template <typename MatchFn, typename AbortFn, typename UpdateFn>
+BinnedClockHandle* BinnedClockCacheShard::FindSlot(uint32_t hash,
+                                                   size_t max_probes,
+                                                   MatchFn match,
+                                                   AbortFn abort,
+                                                   UpdateFn update) {
+  uint32_t pos = hash & table_mask_;
+  uint32_t increment = ProbeIncrement(hash);
+  for (size_t i = 0; i < max_probes; i++) {
+    BinnedClockHandle* h = &table_[pos];
+    if (match(h)) {
+      return h;
+    }
+    if (abort(h)) {
+      return nullptr;
+    }
+    update(h);
+    pos = (pos + increment) & table_mask_;
+  }
+  return nullptr;
+}
+
+void BinnedClockCacheShard::Rollback(uint32_t hash, const BinnedClockHandle* h) {
+  uint32_t pos = hash & table_mask_;
+  uint32_t increment = ProbeIncrement(hash);
+  for (size_t i = 0; i < max_insert_probes_ && &table_[pos] != h; i++) {
+    table_[pos].displacements.fetch_sub(1, std::memory_order_relaxed);
+    pos = (pos + increment) & table_mask_;
+  }
+}
+
+BinnedClockHandle* BinnedClockCacheShard::LookupRef(const rocksdb::Slice& key,
+                                                    uint32_t hash) {
+  return FindSlot(
+    hash, max_insert_probes_,
+    [&](BinnedClockHandle* h) {
+      uint64_t meta = h->meta.load(std::memory_order_relaxed);
+      if (H::state(meta) != H::kStateVisible) {
+        return false;
+      }
+      meta = h->meta.fetch_add(H::kOneRef, std::memory_order_acquire);
+      switch (H::state(meta)) {
+      case H::kStateVisible:
+        if (h->hash == hash && h->key() == key) {
+          return true;
+        }
+        Unref(h);
+        return false;
+      case H::kStateInvisible:
+        Unref(h);
+        return false;
+      default:
+        // the owner of the slot overwrites the reference we took
+        return false;
+      }
+    },
+    [](BinnedClockHandle* h) {
+      return h->displacements.load(std::memory_order_relaxed) == 0;
+    },
+    [](BinnedClockHandle*) {});
+}
+
+bool BinnedClockCacheShard::Unref(BinnedClockHandle* h) {
+  uint64_t meta = h->meta.fetch_sub(H::kOneRef, std::memory_order_acq_rel);
+  ceph_assert(H::refs(meta) > 0);
+  if (H::refs(meta) == 1 && H::state(meta) == H::kStateInvisible) {
+    // last reference to an erased entry; it may race with another thread
+    // doing the same after taking and dropping a reference of its own
+    uint64_t expected = meta - H::kOneRef;
+    if (h->meta.compare_exchange_strong(
+          expected, H::with_state(expected, H::kStateConstruction),
+          std::memory_order_acquire)) {
+      FreeEntry(h, expected);
+      return true;
+    }
+  }
+  return false;
+}
+
+void BinnedClockCacheShard::MarkInvisible(BinnedClockHandle* h) {
+  uint64_t meta = h->meta.load(std::memory_order_relaxed);
+  while (H::state(meta) == H::kStateVisible &&
+         !h->meta.compare_exchange_weak(
+           meta, H::with_state(meta, H::kStateInvisible),
+           std::memory_order_acq_rel)) {
+  }
+}
+
+void BinnedClockCacheShard::FreeEntry(BinnedClockHandle* h, uint64_t meta) {
+  usage_.fetch_sub(h->charge, std::memory_order_relaxed);
+  if (meta & H::kHighPri) {
+    high_pri_pool_usage_.fetch_sub(h->charge, std::memory_order_relaxed);
+  } else {
+    AddToBin(h->age_epoch.load(std::memory_order_relaxed),
+             -(int64_t)h->charge);
+  }
+  if (h->deleter) {
+    (*h->deleter)(h->key(), h->value);
+  }
+  delete[] h->key_data;
+  if (meta & H::kDetached) {
+    detached_usage_.fetch_sub(h->charge, std::memory_order_relaxed);
+    delete h;
+    return;
+  }
+  Rollback(h->hash, h);
+  h->key_data = nullptr;
+  h->meta.store(0, std::memory_order_release);
+  occupancy_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void BinnedClockCacheShard::Evict(size_t charge, bool need_slot) {
+  size_t capacity = capacity_.load(std::memory_order_relaxed);
+  bool protect_high_pri = high_pri_pool_usage_.load(std::memory_order_relaxed) <=
+    high_pri_pool_capacity_.load(std::memory_order_relaxed);
+  // an entry hit just before is evicted on the fourth pass at the latest;
+  // give up after that, everything is pinned
+  size_t max_steps = table_size_ * 4;
+  for (size_t steps = 0;
+       steps < max_steps &&
+         (usage_.load(std::memory_order_relaxed) + charge > capacity ||
+          (need_slot &&
+           occupancy_.load(std::memory_order_relaxed) >= occupancy_limit_));
+       steps += kClockStep) {
+    uint64_t start = clock_pointer_.fetch_add(kClockStep,
+                                              std::memory_order_relaxed);
+    for (size_t i = 0; i < kClockStep; i++) {
+      BinnedClockHandle* h = &table_[(start + i) & table_mask_];
+      uint64_t meta = h->meta.load(std::memory_order_relaxed);
+      if (H::state(meta) != H::kStateVisible || H::refs(meta) > 0) {
+        continue;
+      }
+      if ((meta & H::kHighPri) && protect_high_pri) {
+        continue;
+      }
+      if (H::countdown(meta) > 0) {
+        h->meta.compare_exchange_strong(meta, meta - H::kOneCountdown,
+                                        std::memory_order_relaxed);
+        continue;
+      }
+      if (h->meta.compare_exchange_strong(
+            meta, H::with_state(meta, H::kStateConstruction),
+            std::memory_order_acquire)) {
+        FreeEntry(h, meta);
+      }
+    }
+  }
+}
+
+bool BinnedClockCacheShard::EvictOnProbe(uint32_t hash) {
+  uint32_t pos = hash & table_mask_;
+  uint32_t increment = ProbeIncrement(hash);
+  for (size_t i = 0; i < max_insert_probes_; i++) {
+    BinnedClockHandle* h = &table_[pos];
+    uint64_t meta = h->meta.load(std::memory_order_relaxed);
+    if (H::state(meta) == H::kStateVisible && H::refs(meta) == 0 &&
+        h->meta.compare_exchange_strong(
+          meta, H::with_state(meta, H::kStateConstruction),
+          std::memory_order_acquire)) {
+      FreeEntry(h, meta);
+      return true;
+    }
+    pos = (pos + increment) & table_mask_;
+  }
+  return false;
+}
+
+void BinnedClockCacheShard::AddToBin(uint64_t epoch, int64_t bytes) {
+  AgeBin& bin = age_bins_[epoch % kMaxAgeBins];
+  if (bin.epoch.load(std::memory_order_relaxed) == epoch) {
+    bin.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+}
+
+void BinnedClockCacheShard::EraseUnRefEntries() {
+  for (size_t i = 0; i < table_size_; i++) {
+    BinnedClockHandle* h = &table_[i];
+    uint64_t meta = h->meta.load(std::memory_order_relaxed);
+    if (H::state(meta) == H::kStateVisible && H::refs(meta) == 0 &&
+        h->meta.compare_exchange_strong(
+          meta, H::with_state(meta, H::kStateConstruction),
+          std::memory_order_acquire)) {
+      FreeEntry(h, meta);
+    }
+  }
+}
+
+void BinnedClockCacheShard::ApplyToAllCacheEntries(
+  const std::function<void(const rocksdb::Slice& key,
+                           void* value,
+                           size_t charge,
+                           DeleterFn)>& callback,
+  bool thread_safe)
+{
+  // the reference taken keeps an entry from going away under callback
+  for (size_t i = 0; i < table_size_; i++) {
+    BinnedClockHandle* h = &table_[i];
+    if (H::state(h->meta.load(std::memory_order_relaxed)) != H::kStateVisible) {
+      continue;
+    }
+    uint64_t meta = h->meta.fetch_add(H::kOneRef, std::memory_order_acquire);
+    if (H::state(meta) == H::kStateVisible) {
+      callback(h->key(), h->value, h->charge, h->deleter);
+    }
+    if (H::state(meta) >= H::kStateInvisible) {
+      Unref(h);
+    }
+  }
+}
+
+size_t BinnedClockCacheShard::TEST_GetOccupancy() const {
+  size_t n = 0;
+  for (size_t i = 0; i < table_size_; i++) {
+    if (H::state(table_[i].meta.load(std::memory_order_relaxed)) ==
+        H::kStateVisible) {
+      n++;
+    }
+  }
+  return n;
+}
+
+double BinnedClockCacheShard::GetHighPriPoolRatio() const {
+  return high_pri_pool_ratio_.load(std::memory_order_relaxed);
+}
+
+size_t BinnedClockCacheShard::GetHighPriPoolUsage() const {
+  return high_pri_pool_usage_.load(std::memory_order_relaxed);
+}
+
+uint64_t BinnedClockCacheShard::sum_bins(uint32_t start, uint32_t end) const {
+  uint64_t epoch = age_epoch_.load(std::memory_order_relaxed);
+  uint32_t count = bin_count_.load(std::memory_order_relaxed);
+  end = std::min<uint64_t>({end, count, epoch + 1});
+  int64_t bytes = 0;
+  for (auto i = start; i < end; i++) {
+    const AgeBin& bin = age_bins_[(epoch - i) % kMaxAgeBins];
+    if (bin.epoch.load(std::memory_order_relaxed) == epoch - i) {
+      bytes += std::max<int64_t>(0, bin.bytes.load(std::memory_order_relaxed));
+    }
+  }
+  return bytes;
+}
+
+void BinnedClockCacheShard::SetCapacity(size_t capacity) {
+  capacity_ = capacity;
+  high_pri_pool_capacity_ = (size_t)(capacity * high_pri_pool_ratio_.load());
+  Evict(0, false);
+}
+
+void BinnedClockCacheShard::SetStrictCapacityLimit(bool strict_capacity_limit) {
+  strict_capacity_limit_ = strict_capacity_limit;
+}
+
+void BinnedClockCacheShard::SetHighPriPoolRatio(double high_pri_pool_ratio) {
+  high_pri_pool_ratio_ = high_pri_pool_ratio;
+  high_pri_pool_capacity_ = (size_t)(capacity_.load() * high_pri_pool_ratio);
+}
+
+rocksdb::Cache::Handle* BinnedClockCacheShard::Lookup(const rocksdb::Slice& key, uint32_t hash) {
+  BinnedClockHandle* h = LookupRef(key, hash);
+  if (h == nullptr) {
+    return nullptr;
+  }
+  uint64_t meta = h->meta.load(std::memory_order_relaxed);
+  if (H::countdown(meta) != 3) {
+    h->meta.fetch_or(H::kCountdownMask, std::memory_order_relaxed);
+  }
+  if (!(meta & H::kHighPri)) {
+    // move to the bin of this epoch, once per epoch
+    uint64_t epoch = age_epoch_.load(std::memory_order_relaxed);
+    uint64_t old = h->age_epoch.load(std::memory_order_relaxed);
+    if (old != epoch &&
+        h->age_epoch.compare_exchange_strong(old, epoch,
+                                             std::memory_order_relaxed)) {
+      AddToBin(old, -(int64_t)h->charge);
+      AddToBin(epoch, h->charge);
+    }
+  }
+  return reinterpret_cast<rocksdb::Cache::Handle*>(h);
+}
+
+bool BinnedClockCacheShard::Ref(rocksdb::Cache::Handle* handle) {
+  BinnedClockHandle* h = reinterpret_cast<BinnedClockHandle*>(handle);
+  // the caller holds a reference already, the entry cannot go away
+  h->meta.fetch_add(H::kOneRef, std::memory_order_relaxed);
+  return true;
+}
+
+bool BinnedClockCacheShard::Release(rocksdb::Cache::Handle* handle, bool force_erase) {
+  if (handle == nullptr) {
+    return false;
+  }
+  BinnedClockHandle* h = reinterpret_cast<BinnedClockHandle*>(handle);
+  if (force_erase) {
+    MarkInvisible(h);
+  } else if (usage_.load(std::memory_order_relaxed) >
+             capacity_.load(std::memory_order_relaxed) &&
+             H::refs(h->meta.load(std::memory_order_relaxed)) == 1) {
+    // the cache is full, take this opportunity and remove the item
+    MarkInvisible(h);
+  }
+  return Unref(h);
+}
+
+rocksdb::Status BinnedClockCacheShard::Insert(const rocksdb::Slice& key, uint32_t hash, void* value,
+                             size_t charge,
+                             DeleterFn deleter,
+                             rocksdb::Cache::Handle** handle, rocksdb::Cache::Priority priority) {
+  bool high_pri = priority == rocksdb::Cache::Priority::HIGH &&
+    high_pri_pool_ratio_.load(std::memory_order_relaxed) > 0;
+
+  // Free the space, and a slot, following the clock until enough is freed
+  // or nothing else can go
+  Evict(charge, true);
+  if (usage_.load(std::memory_order_relaxed) + charge >
+        capacity_.load(std::memory_order_relaxed) &&
+      (strict_capacity_limit_.load(std::memory_order_relaxed) ||
+       handle == nullptr)) {
+    if (handle == nullptr) {
+      // Don't insert the entry but still return ok, as if the entry inserted
+      // into cache and get evicted immediately.
+      if (deleter) {
+        (*deleter)(key, value);
+      }
+      return rocksdb::Status::OK();
+    } else {
+      *handle = nullptr;
+      return rocksdb::Status::Incomplete("Insert failed due to clock cache being full.");
+    }
+  }
+
+  // replace the entry of the same key, if any
+  Erase(key, hash);
+
+  auto claim = [](BinnedClockHandle* h) {
+    uint64_t meta = h->meta.load(std::memory_order_relaxed);
+    while (H::state(meta) == H::kStateEmpty) {
+      if (h->meta.compare_exchange_weak(
+            meta, H::kStateConstruction << H::kStateShift,
+            std::memory_order_acquire)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  auto displace = [](BinnedClockHandle* h) {
+    h->displacements.fetch_add(1, std::memory_order_relaxed);
+  };
+  auto never = [](BinnedClockHandle*) { return false; };
+  // take a slot of the quota first, so that concurrent inserts can not
+  // load the table past the limit between them
+  BinnedClockHandle* h = nullptr;
+  if (occupancy_.fetch_add(1, std::memory_order_relaxed) < occupancy_limit_) {
+    h = FindSlot(hash, max_insert_probes_, claim, never, displace);
+    if (h == nullptr) {
+      // the slots the clock freed are all off this probe sequence
+      Rollback(hash, nullptr);
+      if (EvictOnProbe(hash)) {
+        h = FindSlot(hash, max_insert_probes_, claim, never, displace);
+        if (h == nullptr) {
+          Rollback(hash, nullptr);
+        }
+      }
+    }
+  }
+  uint64_t meta = 0;
+  if (h == nullptr) {
+    // the table is full, or the probe too long
+    occupancy_.fetch_sub(1, std::memory_order_relaxed);
+    if (handle == nullptr) {
+      if (deleter) {
+        (*deleter)(key, value);
+      }
+      return rocksdb::Status::OK();
+    }
+    ldout(cct, 20) << __func__ << " table full, detaching entry" << dendl;
+    h = new BinnedClockHandle;
+    meta = H::kDetached | (H::kStateInvisible << H::kStateShift);
+    detached_usage_.fetch_add(charge, std::memory_order_relaxed);
+  } else {
+    meta = H::kStateVisible << H::kStateShift;
+  }
+
+  h->value = value;
+  h->deleter = deleter;
+  h->charge = charge;
+  h->hash = hash;
+  h->key_length = key.size();
+  h->key_data = new char[key.size()];
+  std::copy_n(key.data(), key.size(), h->key_data);
+  usage_.fetch_add(charge, std::memory_order_relaxed);
+  if (high_pri) {
+    meta |= H::kHighPri | (kHighPriCountdown << H::kCountdownShift);
+    high_pri_pool_usage_.fetch_add(charge, std::memory_order_relaxed);
+  } else {
+    meta |= kLowPriCountdown << H::kCountdownShift;
+    uint64_t epoch = age_epoch_.load(std::memory_order_relaxed);
+    h->age_epoch.store(epoch, std::memory_order_relaxed);
+    AddToBin(epoch, charge);
+  }
+  if (handle != nullptr) {
+    meta += H::kOneRef;
+    *handle = reinterpret_cast<rocksdb::Cache::Handle*>(h);
+  }
+  // publish
+  h->meta.store(meta, std::memory_order_release);
+  return rocksdb::Status::OK();
+}
+
+void BinnedClockCacheShard::Erase(const rocksdb::Slice& key, uint32_t hash) {
+  BinnedClockHandle* h = LookupRef(key, hash);
+  if (h != nullptr) {
+    MarkInvisible(h);
+    Unref(h);
+  }
+}
+
+size_t BinnedClockCacheShard::GetUsage() const {
+  return usage_.load(std::memory_order_relaxed);
+}
+
+size_t BinnedClockCacheShard::GetPinnedUsage() const {
+  size_t usage = detached_usage_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < table_size_; i++) {
+    BinnedClockHandle* h = &table_[i];
+    uint64_t meta = h->meta.load(std::memory_order_relaxed);
+    if (H::state(meta) < H::kStateInvisible || H::refs(meta) == 0) {
+      continue;
+    }
+    // hold it while reading the charge
+    meta = h->meta.fetch_add(H::kOneRef, std::memory_order_acquire);
+    if (H::state(meta) >= H::kStateInvisible) {
+      if (H::refs(meta) > 0) {
+        usage += h->charge;
+      }
+      const_cast<BinnedClockCacheShard*>(this)->Unref(h);
+    }
+  }
+  return usage;
+}
+
+void BinnedClockCacheShard::shift_bins() {
+  uint64_t epoch = age_epoch_.load(std::memory_order_relaxed) + 1;
+  AgeBin& bin = age_bins_[epoch % kMaxAgeBins];
+  bin.bytes.store(0, std::memory_order_relaxed);
+  bin.epoch.store(epoch, std::memory_order_relaxed);
+  age_epoch_.store(epoch, std::memory_order_relaxed);
+}
+
+uint32_t BinnedClockCacheShard::get_bin_count() const {
+  return bin_count_.load(std::memory_order_relaxed);
+}
+
+void BinnedClockCacheShard::set_bin_count(uint32_t count) {
+  bin_count_.store(std::min(count, kMaxAgeBins - 1), std::memory_order_relaxed);
+}
+
+std::string BinnedClockCacheShard::GetPrintableOptions() const {
+  const int kBufferSize = 200;
+  char buffer[kBufferSize];
+  snprintf(buffer, kBufferSize, "    high_pri_pool_ratio: %.3lf\n"
+           "    table_size: %zu\n",
+           high_pri_pool_ratio_.load(), table_size_);
+  return std::string(buffer);
+}
+
+DeleterFn BinnedClockCacheShard::GetDeleter(rocksdb::Cache::Handle* h) const
+{
+  auto* handle = reinterpret_cast<BinnedClockHandle*>(h);
+  return handle->deleter;
+}
+
+BinnedClockCache::BinnedClockCache(CephContext *c,
+                                   size_t capacity,
+                                   int num_shard_bits,
+                                   bool strict_capacity_limit,
+                                   double high_pri_pool_ratio,
+                                   size_t estimated_entry_charge)
+    : ShardedCache(capacity, num_shard_bits, strict_capacity_limit), cct(c) {
+  num_shards_ = 1 << num_shard_bits;
+  // TODO: Switch over to use mempool
+  int rc = posix_memalign((void**) &shards_,
+                          CACHE_LINE_SIZE,
+                          sizeof(BinnedClockCacheShard) * num_shards_);
+  if (rc != 0) {
+    throw std::bad_alloc();
+  }
+  size_t per_shard = (capacity + (num_shards_ - 1)) / num_shards_;
+  // the table can not grow: leave room for the capacity to double, at a
+  // load factor of 0.5 for the estimated entry charge; past that, entries
+  // are evicted by table occupancy rather than by charge
+  size_t table_size = std::max<size_t>(
+    256, std::bit_ceil(per_shard * 4 / std::max<size_t>(1, estimated_entry_charge)));
+  ldout(cct, 10) << __func__ << " " << num_shards_ << " shards of "
+                 << table_size << " slots" << dendl;
+  for (int i = 0; i < num_shards_; i++) {
+    new (&shards_[i])
+        BinnedClockCacheShard(c, per_shard, strict_capacity_limit, high_pri_pool_ratio,
+                              table_size);
+  }
+}
+
+BinnedClockCache::~BinnedClockCache() {
+  for (int i = 0; i < num_shards_; i++) {
+    shards_[i].~BinnedClockCacheShard();
+  }
+  aligned_free(shards_);
+}
+
+CacheShard* BinnedClockCache::GetShard(int shard) {
+  return reinterpret_cast<CacheShard*>(&shards_[shard]);
+}
+
+const CacheShard* BinnedClockCache::GetShard(int shard) const {
+  return reinterpret_cast<CacheShard*>(&shards_[shard]);
+}
+
+void* BinnedClockCache::Value(Handle* handle) {
+  return reinterpret_cast<const BinnedClockHandle*>(handle)->value;
+}
+
+size_t BinnedClockCache::GetCharge(Handle* handle) const {
+  return reinterpret_cast<const BinnedClockHandle*>(handle)->charge;
+}
+
+uint32_t BinnedClockCache::GetHash(Handle* handle) const {
+  return reinterpret_cast<const BinnedClockHandle*>(handle)->hash;
+}
+
+void BinnedClockCache::DisownData() {
+// Do not drop data if compile with ASAN to suppress leak warning.
+#ifndef __SANITIZE_ADDRESS__
+  shards_ = nullptr;
+#endif  // !__SANITIZE_ADDRESS__
+}
+
+#if (ROCKSDB_MAJOR >= 7 || (ROCKSDB_MAJOR == 6 && ROCKSDB_MINOR >= 22))
+DeleterFn BinnedClockCache::GetDeleter(Handle* handle) const
+{
+  return reinterpret_cast<const BinnedClockHandle*>(handle)->deleter;
+}
+#endif
+
+size_t BinnedClockCache::TEST_GetOccupancy() const {
+  size_t n = 0;
+  for (int i = 0; i < num_shards_; i++) {
+    n += shards_[i].TEST_GetOccupancy();
+  }
+  return n;
+}
+
+size_t BinnedClockCache::TEST_GetTableSize() const {
+  size_t n = 0;
+  for (int i = 0; i < num_shards_; i++) {
+    n += shards_[i].GetTableSize();
+  }
+  return n;
+}
+
+void BinnedClockCache::SetHighPriPoolRatio(double high_pri_pool_ratio) {
+  for (int i = 0; i < num_shards_; i++) {
+    shards_[i].SetHighPriPoolRatio(high_pri_pool_ratio);
+  }
+}
+
+double BinnedClockCache::GetHighPriPoolRatio() const {
+  double result = 0.0;
+  if (num_shards_ > 0) {
+    result = shards_[0].GetHighPriPoolRatio();
+  }
+  return result;
+}
+
+size_t BinnedClockCache::GetHighPriPoolUsage() const {
+  size_t usage = 0;
+  for (int s = 0; s < num_shards_; s++) {
+    usage += shards_[s].GetHighPriPoolUsage();
+  }
+  return usage;
+}
+
+// PriCache
+
+int64_t BinnedClockCache::request_cache_bytes(PriorityCache::Priority pri, uint64_t total_cache) const
+{
+  int64_t assigned = get_cache_bytes(pri);
+  int64_t request = 0;
+
+  switch(pri) {
+  // PRI0 is for rocksdb's high priority items (indexes/filters)
+  case PriorityCache::Priority::PRI0:
+    {
+      request = PriorityCache::get_chunk(GetHighPriPoolUsage(), total_cache);
+      break;
+    }
+  case PriorityCache::Priority::LAST:
+    {
+      auto max = get_bin_count();
+      request = GetUsage();
+      request -= GetHighPriPoolUsage();
+      request -= sum_bins(0, max);
+      break;
+    }
+  default:
+    {
+      ceph_assert(pri > 0 && pri < PriorityCache::Priority::LAST);
+      auto prev_pri = static_cast<PriorityCache::Priority>(pri - 1);
+      uint64_t start = get_bins(prev_pri);
+      uint64_t end = get_bins(pri);
+      request = sum_bins(start, end);
+      break;
+    }
+  }
+  request = (request > assigned) ? request - assigned : 0;
+  ldout(cct, 10) << __func__ << " Priority: " << static_cast<uint32_t>(pri)
+                 << " Request: " << request << dendl;
+  return request;
+}
+
+int64_t BinnedClockCache::commit_cache_size(uint64_t total_bytes)
+{
+  size_t old_bytes = GetCapacity();
+  int64_t new_bytes = PriorityCache::get_chunk(
+      get_cache_bytes(), total_bytes);
+  ldout(cct, 10) << __func__ << " old: " << old_bytes
+                 << " new: " << new_bytes << dendl;
+  SetCapacity((size_t) new_bytes);
+
+  double ratio = 0;
+  if (new_bytes > 0) {
+    int64_t pri0_bytes = get_cache_bytes(PriorityCache::Priority::PRI0);
+    ratio = (double) pri0_bytes / new_bytes;
+  }
+  ldout(cct, 5) << __func__ << " High Pri Pool Ratio set to " << ratio << dendl;
+  SetHighPriPoolRatio(ratio);
+  return new_bytes;
+}
+
+void BinnedClockCache::shift_bins() {
+  for (int s = 0; s < num_shards_; s++) {
+    shards_[s].shift_bins();
+  }
+}
+
+uint64_t BinnedClockCache::sum_bins(uint32_t start, uint32_t end) const {
+  uint64_t bytes = 0;
+  for (int s = 0; s < num_shards_; s++) {
+    bytes += shards_[s].sum_bins(start, end);
+  }
+  return bytes;
+}
+
+uint32_t BinnedClockCache::get_bin_count() const {
+  uint32_t result = 0;
+  if (num_shards_ > 0) {
+    result = shards_[0].get_bin_count();
+  }
+  return result;
+}
+
+void BinnedClockCache::set_bin_count(uint32_t count) {
+  for (int s = 0; s < num_shards_; s++) {
+    shards_[s].set_bin_count(count);
+  }
+}
+
+std::shared_ptr<rocksdb::Cache> NewBinnedClockCache(
+    CephContext *c,
+    size_t capacity,
+    int num_shard_bits,
+    bool strict_capacity_limit,
+    double high_pri_pool_ratio,
+    size_t estimated_entry_charge) {
+  if (num_shard_bits >= 20) {
+    return nullptr;  // the cache cannot be sharded into too many fine pieces
+  }
+  if (high_pri_pool_ratio < 0.0 || high_pri_pool_ratio > 1.0) {
+    // invalid high_pri_pool_ratio
+    return nullptr;
+  }
+  if (num_shard_bits < 0) {
+    num_shard_bits = GetDefaultCacheShardBits(capacity);
+  }
+  return std::make_shared<BinnedClockCache>(
+      c, capacity, num_shard_bits, strict_capacity_limit, high_pri_pool_ratio,
+      estimated_entry_charge);
+}
+
+}  // namespace rocksdb_cache
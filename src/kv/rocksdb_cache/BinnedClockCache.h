@@ -0,0 +1,270 @@
+// Copyright (c) 2018-Present Red Hat Inc.  All rights reserved.
+//
+// Copyright (c) 2011-Present, Facebook, Inc.  All rights reserved.
+// This source code is licensed under both the GPLv2 and Apache 2.0 License
+
+#ifndef ROCKSDB_BINNED_CLOCK_CACHE
+#define ROCKSDB_BINNED_CLOCK_CACHE
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "ShardedCache.h"
+#include "common/dout.h"
+#include "include/ceph_assert.h"
+#include "common/ceph_context.h"
+
+namespace rocksdb_cache {
+
+// CLOCK cache implementation
+//
+// A lock-free alternative to BinnedLRUCache, after RocksDB's HyperClockCache.
+// Each shard is a fixed size, open addressed table of handles and the
+// whole state of a handle (visibility, references, clock countdown) is
+// kept in a single atomic word, so that Lookup and Release take no lock
+// and move nothing around: a hit is one fetch_add, a release one
+// fetch_sub.  Eviction sweeps a clock hand over the table, counting down
+// unreferenced entries and evicting those that reach zero; a hit resets
+// the countdown.
+//
+// The table is sized when the cache is created, from its capacity and
+// the estimated charge of an entry, and does not grow with it: the clock
+// also sweeps when the table is loaded past kStrictLoadFactor, so that
+// new entries always find a slot within a few probes.  Entries that still
+// do not get one are handed out when a handle is asked for, detached from
+// the table, and dropped otherwise.
+//
+// BinnedClockHandle is in one of these states:
+// 1. empty: the slot is free.
+// 2. construction: a single thread owns the slot, to fill or free it.
+// 3. visible: in the table, found by Lookup.  Can be evicted once there
+//  are no references to it.
+// 4. invisible: erased or replaced, but still referenced.  The thread
+//  releasing the last reference frees it.
+//
+// Age bins, which the PriorityCache manager uses to balance the caches,
+// account for the low priority entries by the time they were inserted or
+// last hit.
+
+std::shared_ptr<rocksdb::Cache> NewBinnedClockCache(
+    CephContext *c,
+    size_t capacity,
+    int num_shard_bits = -1,
+    bool strict_capacity_limit = false,
+    double high_pri_pool_ratio = 0.0,
+    size_t estimated_entry_charge = 4096);
+
+struct BinnedClockHandle {
+  // meta: references (30 bits), state (2 bits), clock countdown (2 bits)
+  // and flags
+  static constexpr uint64_t kOneRef = 1;
+  static constexpr uint64_t kRefsMask = (1ull << 30) - 1;
+  static constexpr int kStateShift = 30;
+  static constexpr uint64_t kStateMask = 3ull << kStateShift;
+  static constexpr uint64_t kStateEmpty = 0;
+  static constexpr uint64_t kStateConstruction = 1;
+  static constexpr uint64_t kStateInvisible = 2;
+  static constexpr uint64_t kStateVisible = 3;
+  static constexpr int kCountdownShift = 32;
+  static constexpr uint64_t kOneCountdown = 1ull << kCountdownShift;
+  static constexpr uint64_t kCountdownMask = 3ull << kCountdownShift;
+  static constexpr uint64_t kHighPri = 1ull << 34;
+  static constexpr uint64_t kDetached = 1ull << 35;
+
+  std::atomic<uint64_t> meta{0};
+  // number of entries whose probe sequence passes this slot
+  std::atomic<uint32_t> displacements{0};
+  uint32_t hash = 0;
+  std::atomic<uint64_t> age_epoch{0};
+  void* value = nullptr;
+  DeleterFn deleter = nullptr;
+  size_t charge = 0;
+  size_t key_length = 0;
+  char* key_data = nullptr;
+
+  static uint64_t state(uint64_t meta) {
+    return (meta & kStateMask) >> kStateShift;
+  }
+  static uint64_t refs(uint64_t meta) {
+    return meta & kRefsMask;
+  }
+  static uint64_t countdown(uint64_t meta) {
+    return (meta & kCountdownMask) >> kCountdownShift;
+  }
+  static uint64_t with_state(uint64_t meta, uint64_t state) {
+    return (meta & ~kStateMask) | (state << kStateShift);
+  }
+
+  rocksdb::Slice key() const {
+    return rocksdb::Slice(key_data, key_length);
+  }
+};
+
+// A single shard of sharded cache.
+class alignas(CACHE_LINE_SIZE) BinnedClockCacheShard : public CacheShard {
+ public:
+  BinnedClockCacheShard(CephContext *c, size_t capacity, bool strict_capacity_limit,
+                        double high_pri_pool_ratio, size_t table_size);
+  virtual ~BinnedClockCacheShard();
+
+  virtual void SetCapacity(size_t capacity) override;
+  virtual void SetStrictCapacityLimit(bool strict_capacity_limit) override;
+  void SetHighPriPoolRatio(double high_pri_pool_ratio);
+
+  virtual rocksdb::Status Insert(const rocksdb::Slice& key, uint32_t hash, void* value,
+                        size_t charge,
+                        DeleterFn deleter,
+                        rocksdb::Cache::Handle** handle,
+                        rocksdb::Cache::Priority priority) override;
+  virtual rocksdb::Cache::Handle* Lookup(const rocksdb::Slice& key, uint32_t hash) override;
+  virtual bool Ref(rocksdb::Cache::Handle* handle) override;
+  virtual bool Release(rocksdb::Cache::Handle* handle,
+                       bool force_erase = false) override;
+  virtual void Erase(const rocksdb::Slice& key, uint32_t hash) override;
+
+  virtual size_t GetUsage() const override;
+  // walks the table
+  virtual size_t GetPinnedUsage() const override;
+
+  virtual void ApplyToAllCacheEntries(
+    const std::function<void(const rocksdb::Slice& key,
+                             void* value,
+                             size_t charge,
+                             DeleterFn)>& callback,
+    bool thread_safe) override;
+
+  virtual void EraseUnRefEntries() override;
+
+  virtual std::string GetPrintableOptions() const override;
+
+  virtual DeleterFn GetDeleter(rocksdb::Cache::Handle* handle) const override;
+
+  double GetHighPriPoolRatio() const;
+  size_t GetHighPriPoolUsage() const;
+  size_t GetTableSize() const { return table_size_; }
+  //  Number of entries in the table, for unit test purpose only
+  size_t TEST_GetOccupancy() const;
+
+  // Rotate the bins
+  void shift_bins();
+  uint32_t get_bin_count() const;
+  void set_bin_count(uint32_t count);
+  // Get the byte counts for a range of age bins
+  uint64_t sum_bins(uint32_t start, uint32_t end) const;
+
+ private:
+  CephContext *cct;
+
+  // Probe the table along the sequence of hash: stop at the slot for which
+  // match() is true and return it, or after abort() is true for a slot or
+  // max_probes slots; update() is called for every slot passed.
+  template <typename MatchFn, typename AbortFn, typename UpdateFn>
+  BinnedClockHandle* FindSlot(uint32_t hash, size_t max_probes, MatchFn match,
+                              AbortFn abort, UpdateFn update);
+  // Undo the displacements of the slots the insert probe of hash passes
+  // up to (not including) h, or all of them
+  void Rollback(uint32_t hash, const BinnedClockHandle* h);
+  // Take a reference to the visible entry of key, or return null
+  BinnedClockHandle* LookupRef(const rocksdb::Slice& key, uint32_t hash);
+  // Drop a reference; returns true if that freed the entry
+  bool Unref(BinnedClockHandle* h);
+  // Make a referenced entry invisible, to be freed on its last release
+  void MarkInvisible(BinnedClockHandle* h);
+  // Free an entry in construction state; meta is its state before
+  void FreeEntry(BinnedClockHandle* h, uint64_t meta);
+  // Sweep the clock until usage + charge fits the capacity and, if
+  // need_slot, the table has a free slot under the load limit, or the
+  // sweep gives up
+  void Evict(size_t charge, bool need_slot);
+  // Free the first unreferenced entry on the insert probe of hash, when
+  // the clock left no free slot there; returns false if all are in use
+  bool EvictOnProbe(uint32_t hash);
+
+  void AddToBin(uint64_t epoch, int64_t bytes);
+
+  // Initialized before use.
+  std::atomic<size_t> capacity_;
+  std::atomic<size_t> high_pri_pool_capacity_;
+  std::atomic<bool> strict_capacity_limit_;
+  std::atomic<double> high_pri_pool_ratio_;
+
+  const size_t table_size_;
+  const uint32_t table_mask_;
+  // slots an insert probes at most, and how many may be taken
+  const size_t max_insert_probes_;
+  const size_t occupancy_limit_;
+  std::unique_ptr<BinnedClockHandle[]> table_;
+
+  // ------------^^^^^^^^^^^^^-----------
+  // Not frequently modified data members
+  // ------------------------------------
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> clock_pointer_{0};
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> usage_{0};
+  // slots taken, detached entries excluded
+  std::atomic<size_t> occupancy_{0};
+  std::atomic<size_t> high_pri_pool_usage_{0};
+  std::atomic<size_t> detached_usage_{0};
+
+  // Ring of byte counters for age binning; a bin is valid for the epoch
+  // it was last reset for, older entries no longer count in any bin
+  static constexpr uint32_t kMaxAgeBins = 1024;
+  struct AgeBin {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<int64_t> bytes{0};
+  };
+  std::unique_ptr<AgeBin[]> age_bins_;
+  std::atomic<uint64_t> age_epoch_{0};
+  std::atomic<uint32_t> bin_count_{1};
+};
+
+class BinnedClockCache : public ShardedCache {
+ public:
+  BinnedClockCache(CephContext *c, size_t capacity, int num_shard_bits,
+      bool strict_capacity_limit, double high_pri_pool_ratio,
+      size_t estimated_entry_charge);
+  virtual ~BinnedClockCache();
+  virtual const char* Name() const override { return "BinnedClockCache"; }
+  virtual CacheShard* GetShard(int shard) override;
+  virtual const CacheShard* GetShard(int shard) const override;
+  virtual void* Value(Handle* handle) override;
+  virtual size_t GetCharge(Handle* handle) const override;
+  virtual uint32_t GetHash(Handle* handle) const override;
+  virtual void DisownData() override;
+#if (ROCKSDB_MAJOR >= 7 || (ROCKSDB_MAJOR == 6 && ROCKSDB_MINOR >= 22))
+  virtual DeleterFn GetDeleter(Handle* handle) const override;
+#endif
+  // Sets the high pri pool ratio
+  void SetHighPriPoolRatio(double high_pri_pool_ratio);
+  //  Retrieves high pri pool ratio
+  double GetHighPriPoolRatio() const;
+  // Retrieves high pri pool usage
+  size_t GetHighPriPoolUsage() const;
+  size_t TEST_GetOccupancy() const;
+  size_t TEST_GetTableSize() const;
+
+  // PriorityCache
+  virtual int64_t request_cache_bytes(
+      PriorityCache::Priority pri, uint64_t total_cache) const;
+  virtual int64_t commit_cache_size(uint64_t total_cache);
+  virtual int64_t get_committed_size() const {
+    return GetCapacity();
+  }
+  virtual void shift_bins();
+  uint64_t sum_bins(uint32_t start, uint32_t end) const;
+  uint32_t get_bin_count() const;
+  void set_bin_count(uint32_t count);
+
+  virtual std::string get_cache_name() const {
+    return "RocksDB Binned Clock Cache";
+  }
+
+ private:
+  CephContext *cct;
+  BinnedClockCacheShard* shards_;
+  int num_shards_ = 0;
+};
+
+}  // namespace rocksdb_cache
+
+#endif // ROCKSDB_BINNED_CLOCK_CACHE
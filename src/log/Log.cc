@@ -26,6 +26,7 @@
 #include <syslog.h>
 
 #include <algorithm>
+#include <array>
 #include <iostream>
 #include <set>
 
@@ -39,6 +40,80 @@ namespace logging {
 
 static OnExitManager exit_callbacks;
 
+/// Single producer, single consumer ring of the entries a thread
+/// submitted and the flush thread has not picked up yet.  SIZE bounds
+/// how far a thread may run ahead of the flusher, like max_new does for
+/// the shared queue.  An entry carries 1 KB of inline storage, so slots
+/// are allocated on first use and then reused: a thread only holds as
+/// many as it ever had in flight.
+struct ThreadQueue {
+  static constexpr std::size_t SIZE = 64;
+
+  std::array<std::unique_ptr<ConcreteEntry>, SIZE> slots;
+  alignas(64) std::atomic<std::size_t> head = 0; ///< next to pop, by the flusher
+  alignas(64) std::atomic<std::size_t> tail = 0; ///< next to push, by the thread
+  std::atomic<bool> orphaned = false; ///< the thread exited
+  std::atomic<bool> detached = false; ///< the Log went away
+
+  bool full() const {
+    return tail.load(std::memory_order_relaxed) -
+      head.load(std::memory_order_acquire) == SIZE;
+  }
+  bool empty() const {
+    return head.load(std::memory_order_relaxed) ==
+      tail.load(std::memory_order_acquire);
+  }
+  /// e is left untouched if the queue is full
+  bool push(Entry& e) {
+    auto t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == SIZE) {
+      return false;
+    }
+    auto& slot = slots[t % SIZE];
+    if (slot) {
+      *slot = e;
+    } else {
+      slot = std::make_unique<ConcreteEntry>(e);
+    }
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  void pop_all(std::vector<ConcreteEntry>& q) {
+    auto h = head.load(std::memory_order_relaxed);
+    auto t = tail.load(std::memory_order_acquire);
+    for (; h != t; ++h) {
+      q.emplace_back(std::move(*slots[h % SIZE]));
+    }
+    head.store(h, std::memory_order_release);
+  }
+};
+
+namespace {
+
+std::atomic<uint64_t> last_log_id = 0;
+
+/// set once the thread's queues are gone, e.g. when logging from the
+/// destructor of another thread_local
+thread_local bool thread_exiting = false;
+
+/// the queues of the current thread, one per Log it submitted to
+struct ThreadQueues {
+  uint64_t last_id = 0;
+  ThreadQueue *last = nullptr;
+  std::vector<std::pair<uint64_t, std::shared_ptr<ThreadQueue>>> queues;
+
+  ~ThreadQueues() {
+    thread_exiting = true;
+    for (auto& [id, q] : queues) {
+      q->orphaned = true;
+    }
+  }
+};
+
+thread_local ThreadQueues thread_queues;
+
+}
+
 static void log_on_exit(void *p)
 {
   Log *l = *(Log **)p;
@@ -50,6 +125,7 @@ static void log_on_exit(void *p)
 Log::Log(const SubsystemMap *s)
   : m_indirect_this(nullptr),
     m_subs(s),
+    m_id(++last_log_id),
     m_recent(DEFAULT_MAX_RECENT)
 {
   m_log_buf.reserve(MAX_LOG_BUF);
@@ -63,6 +139,9 @@ Log::~Log()
   }
 
   ceph_assert(!is_started());
+  for (auto& q : m_queues) {
+    q->detached = true;
+  }
   if (m_fd >= 0) {
     VOID_TEMP_FAILURE_RETRY(::close(m_fd));
     m_fd = -1;
@@ -247,14 +326,143 @@ void Log::stop_journald_logger()
   m_journald.reset();
 }
 
-void Log::submit_entry(Entry&& e)
+ThreadQueue *Log::_get_thread_queue()
 {
-  std::unique_lock lock(m_queue_mutex);
-  m_queue_mutex_holder = pthread_self();
+  if (unlikely(thread_exiting)) {
+    return nullptr;
+  }
+  auto& tq = thread_queues;
+  if (likely(tq.last_id == m_id)) {
+    return tq.last;
+  }
+  ThreadQueue *found = nullptr;
+  std::erase_if(tq.queues, [&](auto& p) {
+    if (p.first == m_id) {
+      found = p.second.get();
+    }
+    return p.second->detached.load();
+  });
+  if (!found) {
+    auto q = std::make_shared<ThreadQueue>();
+    {
+      std::scoped_lock lock(m_queues_mutex);
+      m_queues.push_back(q);
+    }
+    found = q.get();
+    tq.queues.emplace_back(m_id, std::move(q));
+  }
+  tq.last_id = m_id;
+  tq.last = found;
+  return found;
+}
+
+bool Log::_queues_empty()
+{
+  std::scoped_lock lock(m_queues_mutex);
+  return std::all_of(m_queues.begin(), m_queues.end(),
+		     [](auto& q) { return q->empty(); });
+}
 
+void Log::_drain_queues(EntryVector& t)
+{
+  // each queue, and t itself, is in stamp order; note where they start
+  // in t and merge them
+  std::vector<std::pair<std::size_t, std::size_t>> runs;
+  auto add_run = [&](std::size_t begin) {
+    if (t.size() > begin) {
+      runs.emplace_back(begin, t.size());
+    }
+  };
+  add_run(0);
+  {
+    std::scoped_lock lock(m_queues_mutex);
+    std::erase_if(m_queues, [&](auto& q) {
+      // check before draining, the thread may push right up to its exit
+      bool orphaned = q->orphaned;
+      auto begin = t.size();
+      q->pop_all(t);
+      add_run(begin);
+      return orphaned;
+    });
+  }
+  if (runs.size() < 2) {
+    return;
+  }
+
+  // k-way merge on the head of each run, the earlier run first on a tie
+  auto later = [&t](const auto& a, const auto& b) {
+    auto& ea = t[a.first];
+    auto& eb = t[b.first];
+    return ea.m_stamp != eb.m_stamp ? ea.m_stamp > eb.m_stamp :
+      a.second > b.second;
+  };
+  std::priority_queue<std::pair<std::size_t, std::size_t>,
+		      std::vector<std::pair<std::size_t, std::size_t>>,
+		      decltype(later)> heads(later);
+  for (std::size_t i = 0; i < runs.size(); ++i) {
+    heads.emplace(runs[i].first, i);
+  }
+  assert(m_merge.empty());
+  m_merge.reserve(t.size());
+  while (!heads.empty()) {
+    auto [pos, run] = heads.top();
+    heads.pop();
+    m_merge.emplace_back(std::move(t[pos]));
+    if (++pos < runs[run].second) {
+      heads.emplace(pos, run);
+    }
+  }
+  t.swap(m_merge);
+  m_merge.clear();
+}
+
+void Log::_wake_flusher()
+{
+  // pairs with the fence in entry(): either we see the flusher going to
+  // sleep, or it sees our entry
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_flusher_sleeping.load(std::memory_order_relaxed) &&
+      m_flusher_sleeping.exchange(false)) {
+    std::scoped_lock lock(m_queue_mutex);
+    m_cond_flusher.notify_all();
+  }
+}
+
+void Log::submit_entry(Entry&& e)
+{
   if (unlikely(m_inject_segv))
     *(volatile int *)(0) = 0xdead;
 
+  // while the flush thread runs, hand the entry over through a queue of
+  // our own, taking no lock unless the flusher falls behind
+  ThreadQueue *q;
+  if (likely(m_use_queues.load(std::memory_order_acquire)) &&
+      (q = _get_thread_queue())) {
+    bool queued;
+    while (!(queued = q->push(e))) {
+      std::unique_lock lock(m_queue_mutex);
+      m_queue_mutex_holder = pthread_self();
+      bool use_queues = m_use_queues;
+      if (use_queues) {
+	// wait for flush to catch up
+	m_flusher_sleeping = false;
+	m_cond_flusher.notify_all();
+	m_cond_loggers.wait(lock, [&] { return !q->full() || !m_use_queues; });
+      }
+      m_queue_mutex_holder = 0;
+      if (!use_queues) {
+	break;
+      }
+    }
+    if (queued) {
+      _wake_flusher();
+      return;
+    }
+  }
+
+  std::unique_lock lock(m_queue_mutex);
+  m_queue_mutex_holder = pthread_self();
+
   // wait for flush to catch up
   while (is_started() &&
 	 m_new.size() > m_max_new) {
@@ -277,6 +485,7 @@ void Log::flush()
     m_queue_mutex_holder = pthread_self();
     assert(m_flush.empty());
     m_flush.swap(m_new);
+    _drain_queues(m_flush);
     m_cond_loggers.notify_all();
     m_queue_mutex_holder = 0;
   }
@@ -487,6 +696,8 @@ void Log::dump_recent()
     m_queue_mutex_holder = pthread_self();
     assert(m_flush.empty());
     m_flush.swap(m_new);
+    _drain_queues(m_flush);
+    m_cond_loggers.notify_all();
     m_queue_mutex_holder = 0;
   }
 
@@ -542,6 +753,7 @@ void Log::start()
   {
     std::scoped_lock lock(m_queue_mutex);
     m_stop = false;
+    m_use_queues = true;
   }
   create("log");
 }
@@ -552,6 +764,7 @@ void Log::stop()
     {
       std::scoped_lock lock(m_queue_mutex);
       m_stop = true;
+      m_use_queues = false;
       m_cond_flusher.notify_one();
       m_cond_loggers.notify_all();
     }
@@ -566,7 +779,7 @@ void *Log::entry()
     std::unique_lock lock(m_queue_mutex);
     m_queue_mutex_holder = pthread_self();
     while (!m_stop) {
-      if (!m_new.empty()) {
+      if (!m_new.empty() || !_queues_empty()) {
         m_queue_mutex_holder = 0;
         lock.unlock();
         flush();
@@ -575,7 +788,13 @@ void *Log::entry()
         continue;
       }
 
-      m_cond_flusher.wait(lock);
+      // pairs with the fence in _wake_flusher()
+      m_flusher_sleeping = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (_queues_empty()) {
+        m_cond_flusher.wait(lock);
+      }
+      m_flusher_sleeping = false;
     }
     m_queue_mutex_holder = 0;
   }
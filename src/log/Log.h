@@ -6,12 +6,14 @@
 
 #include <boost/circular_buffer.hpp>
 
+#include <atomic>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "common/Thread.h"
 #include "common/likely.h"
@@ -28,6 +30,7 @@ namespace logging {
 class Graylog;
 class JournaldLogger;
 class SubsystemMap;
+struct ThreadQueue;
 
 class Log : private Thread
 {
@@ -94,17 +97,25 @@ private:
 
   const SubsystemMap *m_subs;
 
+  const uint64_t m_id; ///< tells our queue apart among a thread's queues
+
   std::mutex m_queue_mutex;
   std::mutex m_flush_mutex;
+  std::mutex m_queues_mutex;
   std::condition_variable m_cond_loggers;
   std::condition_variable m_cond_flusher;
 
   pthread_t m_queue_mutex_holder;
   pthread_t m_flush_mutex_holder;
 
-  EntryVector m_new;    ///< new entries
+  EntryVector m_new;    ///< new entries, while the flush thread is not running
+  /// per-thread queues of new entries, drained by the flush thread
+  std::vector<std::shared_ptr<ThreadQueue>> m_queues;
+  std::atomic<bool> m_use_queues = false;
+  std::atomic<bool> m_flusher_sleeping = false;
   EntryRing m_recent; ///< recent (less new) entries we've already written at low detail
   EntryVector m_flush; ///< entries to be flushed (here to optimize heap allocations)
+  EntryVector m_merge; ///< scratch for merging the per-thread queues in stamp order
 
   std::string m_log_file;
   int m_fd = -1;
@@ -136,6 +147,11 @@ private:
 
   void *entry() override;
 
+  ThreadQueue *_get_thread_queue();
+  bool _queues_empty();
+  void _drain_queues(EntryVector& q);
+  void _wake_flusher();
+
   void _log_safe_write(std::string_view sv);
   void _flush_logbuf();
   void _log_message(std::string_view s, bool crash);
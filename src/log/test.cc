@@ -14,6 +14,10 @@
 
 #include <limits.h>
 
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
 using namespace std;
 using namespace ceph::logging;
 
@@ -170,6 +174,104 @@ TEST(Log, ManyGather)
   log.stop();
 }
 
+namespace {
+/// counts the flushed batches that are not in stamp order
+class StampOrderLog : public Log {
+public:
+  using Log::Log;
+  std::atomic<int> unordered = 0;
+protected:
+  void _flush(EntryVector& q, bool crash) override {
+    if (!std::is_sorted(q.begin(), q.end(), [](auto& a, auto& b) {
+	  return a.m_stamp < b.m_stamp;
+	})) {
+      ++unordered;
+    }
+    Log::_flush(q, crash);
+  }
+};
+}
+
+TEST(Log, ManyThreads)
+{
+  static const char* test_file = "many_threads";
+  SubsystemMap subs;
+  subs.set_log_level(1, 20);
+  subs.set_gather_level(1, 10);
+  StampOrderLog log(&subs);
+  log.set_coarse_timestamps(false);
+  log.start();
+  unlink(test_file);
+  log.set_log_file(test_file);
+  log.reopen_log_file();
+  const int threads = 16;
+  const int per_thread = 1000;
+  std::vector<std::thread> ts;
+  for (int t = 0; t < threads; t++) {
+    ts.emplace_back([&log, t] {
+      for (int i = 0; i < per_thread; i++) {
+	MutableEntry e(10, 1);
+	e.get_ostream() << "thread " << t << " seq " << i;
+	log.submit_entry(std::move(e));
+      }
+    });
+  }
+  for (auto& t : ts) {
+    t.join();
+  }
+  log.flush();
+  log.stop();
+
+  // every entry made it, in order for each thread
+  std::ifstream in(test_file);
+  std::vector<int> next(threads, 0);
+  std::string line;
+  int lines = 0;
+  while (std::getline(in, line)) {
+    int t, i;
+    auto p = line.find("thread ");
+    ASSERT_NE(p, std::string::npos);
+    ASSERT_EQ(2, sscanf(line.c_str() + p, "thread %d seq %d", &t, &i));
+    ASSERT_EQ(next[t]++, i);
+    ++lines;
+  }
+  ASSERT_EQ(threads * per_thread, lines);
+  // the queues of the threads are merged, not appended one by one
+  ASSERT_EQ(0, log.unordered);
+}
+
+TEST(Log, Speed_threads)
+{
+  SubsystemMap subs;
+  subs.set_log_level(1, 20);
+  subs.set_gather_level(1, 10);
+  Log log(&subs);
+  log.start();
+  log.set_log_file("big");
+  log.reopen_log_file();
+  const int threads = 64;
+  const int per_thread = many;
+  std::vector<std::thread> ts;
+  auto start = ceph::mono_clock::now();
+  for (int t = 0; t < threads; t++) {
+    ts.emplace_back([&log, per_thread] {
+      for (int i = 0; i < per_thread; i++) {
+	MutableEntry e(10, 1);
+	e.get_ostream() << "this is a long string asdf asdf asdf asdf " << i;
+	log.submit_entry(std::move(e));
+      }
+    });
+  }
+  for (auto& t : ts) {
+    t.join();
+  }
+  log.flush();
+  auto elapsed = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+  log.stop();
+  std::cout << threads << " threads: " << threads * per_thread / elapsed
+	    << " entries/s" << std::endl;
+}
+
 static void readpipe(int fd, int verify)
 {
   while (1) {
@@ -0,0 +1,106 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MOSDREPOPBATCH_H
+#define CEPH_MOSDREPOPBATCH_H
+
+#include "msg/Message.h"
+#include "MOSDRepOp.h"
+
+/*
+ * replication sub ops from any number of PGs, headed to the same OSD
+ *
+ * Each op keeps its own front and header fields; their data segments are
+ * concatenated into the data segment of the batch.  The receiver turns
+ * them back into plain MOSDRepOps and dispatches them in order.
+ */
+
+class MOSDRepOpBatch final : public Message {
+private:
+  static constexpr int HEAD_VERSION = 1;
+  static constexpr int COMPAT_VERSION = 1;
+
+public:
+  std::vector<ceph::ref_t<MOSDRepOp>> ops;
+
+  void encode_payload(uint64_t features) override {
+    using ceph::encode;
+    // we may be encoded again for a peer with other features
+    data.clear();
+    encode(static_cast<uint32_t>(ops.size()), payload);
+    for (auto& op : ops) {
+      op->clear_payload();
+      op->encode(features, 0);
+      const ceph_msg_header& h = op->get_header();
+      encode(h.version, payload);
+      encode(h.compat_version, payload);
+      encode(h.tid, payload);
+      encode(h.priority, payload);
+      encode(h.data_off, payload);
+      encode(op->get_payload(), payload);
+      encode(static_cast<uint32_t>(op->get_data().length()), payload);
+      data.append(op->get_data());
+    }
+  }
+
+  void decode_payload() override {
+    using ceph::decode;
+    auto p = payload.cbegin();
+    auto d = data.cbegin();
+    uint32_t num;
+    decode(num, p);
+    ops.clear();
+    ops.reserve(num);
+    for (uint32_t i = 0; i < num; ++i) {
+      ceph_msg_header h = header;
+      h.type = MSG_OSD_REPOP;
+      decode(h.version, p);
+      decode(h.compat_version, p);
+      decode(h.tid, p);
+      decode(h.priority, p);
+      decode(h.data_off, p);
+      ceph::buffer::list front, opdata;
+      decode(front, p);
+      uint32_t data_len;
+      decode(data_len, p);
+      d.copy(data_len, opdata);
+      h.front_len = front.length();
+      h.middle_len = 0;
+      h.data_len = data_len;
+      auto op = ceph::make_message<MOSDRepOp>();
+      op->set_connection(get_connection());
+      op->set_header(h);
+      op->set_payload(front);
+      op->set_data(opdata);
+      op->decode_payload();
+      ops.push_back(std::move(op));
+    }
+  }
+
+  MOSDRepOpBatch()
+    : Message{MSG_OSD_REPOP_BATCH, HEAD_VERSION, COMPAT_VERSION} {}
+
+private:
+  ~MOSDRepOpBatch() final {}
+
+public:
+  std::string_view get_type_name() const override { return "osd_repop_batch"; }
+  void print(std::ostream& out) const override {
+    out << "osd_repop_batch(" << ops.size() << " ops)";
+  }
+
+private:
+  template<class T, typename... Args>
+  friend boost::intrusive_ptr<T> ceph::make_message(Args&&... args);
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include "Mgr.h"
 
 #include "osd/OSDMap.h"
+#include "osd/OSDMapMapping.h"
 #include "common/errno.h"
 #include "common/version.h"
 #include "include/stringify.h"
@@ -23,6 +24,7 @@ using std::vector;
 typedef struct {
   PyObject_HEAD
   OSDMap *osdmap;
+  OSDMapMapping *mapping;  // see get_mapping()
 } BasePyOSDMap;
 
 typedef struct {
@@ -37,6 +39,32 @@ typedef struct {
 
 // ----------
 
+// The up set of every PG, mapped on first use.  The OSDMap does not
+// change once wrapped, and the balancer maps every pool for its
+// MappingState and then again in calc_pg_upmaps() on the same object, so
+// one mapping serves both.  Called with the GIL held, like the per-PG
+// mapping it replaces, which also keeps two callers from building it.
+static const OSDMapMapping& get_mapping(BasePyOSDMap *self)
+{
+  if (!self->mapping) {
+    auto start = ceph::mono_clock::now();
+    ThreadPool tp(g_ceph_context, "mgr::osdmap_mapping_tp", "tp_osdmap_map",
+		  g_conf()->mon_cpu_threads);
+    tp.start();
+    ParallelPGMapper mapper(g_ceph_context, &tp);
+    auto mapping = std::make_unique<OSDMapMapping>();
+    auto job = mapping->start_update(*self->osdmap, mapper,
+				     g_conf()->mon_osd_mapping_pgs_per_chunk);
+    job->wait();
+    tp.stop();
+    self->mapping = mapping.release();
+    dout(10) << __func__ << " mapped " << self->mapping->get_num_pgs()
+	     << " pgs of epoch " << self->osdmap->get_epoch() << " in "
+	     << ceph::mono_clock::now() - start << dendl;
+  }
+  return *self->mapping;
+}
+
 static PyObject *osdmap_get_epoch(BasePyOSDMap *self, PyObject *obj)
 {
   return PyLong_FromLong(self->osdmap->get_epoch());
@@ -151,12 +179,15 @@ static PyObject *osdmap_calc_pg_upmaps(BasePyOSDMap* self, PyObject *args)
 	   << " max_iterations " << max_iterations
 	   << " pools " << pools
 	   << dendl;
+  const OSDMapMapping& mapping = get_mapping(self);
   PyThreadState *tstate = PyEval_SaveThread();
   int r = self->osdmap->calc_pg_upmaps(g_ceph_context,
 				 max_deviation,
 				 max_iterations,
 				 pools,
-				 incobj->inc);
+				 incobj->inc,
+				 nullptr,
+				 &mapping);
   PyEval_RestoreThread(tstate);
   dout(10) << __func__ << " r = " << r << dendl;
   return PyLong_FromLong(r);
@@ -172,10 +203,11 @@ static PyObject *osdmap_map_pool_pgs_up(BasePyOSDMap* self, PyObject *args)
   auto pi = self->osdmap->get_pg_pool(poolid);
   if (!pi)
     return nullptr;
+  const OSDMapMapping& mapping = get_mapping(self);
   map<pg_t,vector<int>> pm;
   for (unsigned ps = 0; ps < pi->get_pg_num(); ++ps) {
     pg_t pgid(ps, poolid);
-    self->osdmap->pg_to_up_acting_osds(pgid, &pm[pgid], nullptr, nullptr, nullptr);
+    mapping.get(pgid, &pm[pgid], nullptr, nullptr, nullptr);
   }
   PyFormatter f;
   for (auto p : pm) {
@@ -210,6 +242,7 @@ BasePyOSDMap_init(BasePyOSDMap *self, PyObject *args, PyObject *kwds)
     self->osdmap = (OSDMap*)PyCapsule_GetPointer(
         osdmap_capsule, nullptr);
     ceph_assert(self->osdmap);
+    self->mapping = nullptr;
 
     return 0;
 }
@@ -219,6 +252,8 @@ static void
 BasePyOSDMap_dealloc(BasePyOSDMap *self)
 {
   if (self->osdmap) {
+    delete self->mapping;
+    self->mapping = nullptr;
     delete self->osdmap;
     self->osdmap = nullptr;
   } else {
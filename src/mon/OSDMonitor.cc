@@ -6331,7 +6331,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	    break;
 	  case HIT_SET_FPP:
 	    {
-	      if (p->hit_set_params.get_type() == HitSet::TYPE_BLOOM) {
+	      if (HitSet::is_bloom(p->hit_set_params.get_type())) {
 		BloomHitSet::Params *bloomp =
 		  static_cast<BloomHitSet::Params*>(p->hit_set_params.impl.get());
 		f->dump_float("hit_set_fpp", bloomp->get_fpp());
@@ -6478,7 +6478,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	    break;
 	  case HIT_SET_FPP:
 	    {
-	      if (p->hit_set_params.get_type() == HitSet::TYPE_BLOOM) {
+	      if (HitSet::is_bloom(p->hit_set_params.get_type())) {
 		BloomHitSet::Params *bloomp =
 		  static_cast<BloomHitSet::Params*>(p->hit_set_params.impl.get());
 		ss << "hit_set_fpp: " << bloomp->get_fpp() << "\n";
@@ -8686,6 +8686,20 @@ int OSDMonitor::prepare_command_pool_set(const cmdmap_t& cmdmap,
 	BloomHitSet::Params *bsp = new BloomHitSet::Params;
 	bsp->set_fpp(g_conf().get_val<double>("osd_pool_default_hit_set_bloom_fpp"));
 	p.hit_set_params = HitSet::Params(bsp);
+      } else if (val == "blocked_bloom") {
+	if (osdmap.require_osd_release < ceph_release_t::reef) {
+	  ss << "reef OSDs are required for hit_set_type blocked_bloom";
+	  return -EPERM;
+	}
+	// every client decodes the pool's hit_set_params with the osdmap
+	if (osdmap.require_min_compat_client < ceph_release_t::reef) {
+	  ss << "require_min_compat_client reef is required for hit_set_type "
+	     << "blocked_bloom; older clients cannot decode it";
+	  return -EPERM;
+	}
+	BlockedBloomHitSet::Params *bsp = new BlockedBloomHitSet::Params;
+	bsp->set_fpp(g_conf().get_val<double>("osd_pool_default_hit_set_bloom_fpp"));
+	p.hit_set_params = HitSet::Params(bsp);
       } else if (val == "explicit_hash")
 	p.hit_set_params = HitSet::Params(new ExplicitHashHitSet::Params);
       else if (val == "explicit_object")
@@ -8721,7 +8735,7 @@ int OSDMonitor::prepare_command_pool_set(const cmdmap_t& cmdmap,
       ss << "hit_set_fpp should be in the range 0..1";
       return -EINVAL;
     }
-    if (p.hit_set_params.get_type() != HitSet::TYPE_BLOOM) {
+    if (!HitSet::is_bloom(p.hit_set_params.get_type())) {
       ss << "hit set is not of type Bloom; invalid to set a false positive rate!";
       return -EINVAL;
     }
@@ -13818,6 +13832,17 @@ bool OSDMonitor::prepare_command_impl(MonOpRequestRef op,
       BloomHitSet::Params *bsp = new BloomHitSet::Params;
       bsp->set_fpp(g_conf().get_val<double>("osd_pool_default_hit_set_bloom_fpp"));
       hsp = HitSet::Params(bsp);
+    } else if (cache_hit_set_type == "blocked_bloom") {
+      if (osdmap.require_osd_release < ceph_release_t::reef ||
+	  osdmap.require_min_compat_client < ceph_release_t::reef) {
+	ss << "reef OSDs and require_min_compat_client reef are required for "
+	   << "osd tier cache default hit set type blocked_bloom";
+	err = -EPERM;
+	goto reply;
+      }
+      BlockedBloomHitSet::Params *bsp = new BlockedBloomHitSet::Params;
+      bsp->set_fpp(g_conf().get_val<double>("osd_pool_default_hit_set_bloom_fpp"));
+      hsp = HitSet::Params(bsp);
     } else if (cache_hit_set_type == "explicit_hash") {
       hsp = HitSet::Params(new ExplicitHashHitSet::Params);
     } else if (cache_hit_set_type == "explicit_object") {
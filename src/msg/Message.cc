@@ -70,6 +70,7 @@
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
 #include "messages/MOSDRepOp.h"
+#include "messages/MOSDRepOpBatch.h"
 #include "messages/MOSDRepOpReply.h"
 #include "messages/MOSDMap.h"
 #include "messages/MMonGetOSDMap.h"
@@ -522,6 +523,9 @@ Message *decode_message(CephContext *cct,
   case MSG_OSD_REPOPREPLY:
     m = make_message<MOSDRepOpReply>();
     break;
+  case MSG_OSD_REPOP_BATCH:
+    m = make_message<MOSDRepOpBatch>();
+    break;
   case MSG_OSD_PG_CREATED:
     m = make_message<MOSDPGCreated>();
     break;
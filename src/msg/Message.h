@@ -151,6 +151,8 @@
 #define MSG_OSD_PG_LEASE        133
 #define MSG_OSD_PG_LEASE_ACK    134
 
+#define MSG_OSD_REPOP_BATCH     136
+
 // *** MDS ***
 
 #define MSG_MDS_BEACON             100  // to monitor
@@ -161,6 +161,7 @@ class MOSDPGUpdateLogMissing;
 class MOSDPGUpdateLogMissingReply;
 class MOSDPing;
 class MOSDRepOp;
+class MOSDRepOpBatch;
 class MOSDRepOpReply;
 class MOSDRepScrub;
 class MOSDRepScrubMap;
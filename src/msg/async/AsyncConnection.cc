@@ -134,8 +134,8 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
   write_callback_handler = new C_handle_write_callback(this);
   wakeup_handler = new C_time_wakeup(this);
   tick_handler = new C_tick_wakeup(this);
-  // double recv_max_prefetch see "read_until"
-  recv_buf = new char[2*recv_max_prefetch];
+  // only ever filled from offset 0, see "read_until"
+  recv_buf = new char[recv_max_prefetch];
   if (local) {
     protocol = std::unique_ptr<Protocol>(new LoopbackProtocolV1(this));
   } else if (m2) {
@@ -233,44 +233,25 @@ ssize_t AsyncConnection::read_until(unsigned len, char *p)
   }
 
   recv_end = recv_start = 0;
-  /* nothing left in the prefetch buffer */
-  if (left > (uint64_t)recv_max_prefetch) {
-    /* this was a large read, we don't prefetch for these */
-    do {
-      r = read_bulk(p+state_offset, left);
-      ldout(async_msgr->cct, 25) << __func__ << " read_bulk left is " << left << " got " << r << dendl;
-      if (r < 0) {
-        ldout(async_msgr->cct, 1) << __func__ << " read failed" << dendl;
-        return -1;
-      } else if (r == static_cast<int>(left)) {
-        state_offset = 0;
-        return 0;
-      }
-      state_offset += r;
-      left -= r;
-    } while (r > 0);
-  } else {
-    do {
-      r = read_bulk(recv_buf+recv_end, recv_max_prefetch);
-      ldout(async_msgr->cct, 25) << __func__ << " read_bulk recv_end is " << recv_end
-                                 << " left is " << left << " got " << r << dendl;
-      if (r < 0) {
-        ldout(async_msgr->cct, 1) << __func__ << " read failed" << dendl;
-        return -1;
-      }
-      recv_end += r;
-      if (r >= static_cast<int>(left)) {
-        recv_start = len - state_offset;
-        memcpy(p+state_offset, recv_buf, recv_start);
-        state_offset = 0;
-        return 0;
-      }
-      left -= r;
-    } while (r > 0);
-    memcpy(p+state_offset, recv_buf, recv_end-recv_start);
-    state_offset += (recv_end - recv_start);
-    recv_end = recv_start = 0;
-  }
+  /* nothing left in the prefetch buffer: read straight into the caller's
+   * buffer and let whatever follows it on the wire (the next header, most
+   * likely) land in "recv_buf" with the same syscall.  Only prefetched
+   * bytes are ever copied, so large segments are not. */
+  do {
+    r = read_bulk(p+state_offset, left, recv_buf, recv_max_prefetch);
+    ldout(async_msgr->cct, 25) << __func__ << " read_bulk left is " << left
+                               << " got " << r << dendl;
+    if (r < 0) {
+      ldout(async_msgr->cct, 1) << __func__ << " read failed" << dendl;
+      return -1;
+    } else if (static_cast<uint64_t>(r) >= left) {
+      recv_end = r - left;
+      state_offset = 0;
+      return 0;
+    }
+    state_offset += r;
+    left -= r;
+  } while (r > 0);
   ldout(async_msgr->cct, 25) << __func__ << " need len " << len << " remaining "
                              << len - state_offset << " bytes" << dendl;
   return len - state_offset;
@@ -278,11 +259,16 @@ ssize_t AsyncConnection::read_until(unsigned len, char *p)
 
 /* return -1 means `fd` occurs error or closed, it should be closed
  * return 0 means EAGAIN or EINTR */
-ssize_t AsyncConnection::read_bulk(char *buf, unsigned len)
+ssize_t AsyncConnection::read_bulk(char *buf, unsigned len,
+                                   char *tail, unsigned tail_len)
 {
   ssize_t nread;
  again:
-  nread = cs.read(buf, len);
+  if (tail_len) {
+    nread = cs.read_with_tail(buf, len, tail, tail_len);
+  } else {
+    nread = cs.read(buf, len);
+  }
   if (nread < 0) {
     if (nread == -EAGAIN) {
       nread = 0;
@@ -298,6 +284,7 @@ ssize_t AsyncConnection::read_bulk(char *buf, unsigned len)
                               << cs.fd() << dendl;
     return -1;
   }
+  traffic_bytes.fetch_add(nread, std::memory_order_relaxed);
   return nread;
 }
 
@@ -338,6 +325,7 @@ ssize_t AsyncConnection::_try_send(bool more)
     ldout(async_msgr->cct, 1) << __func__ << " send error: " << cpp_strerror(r) << dendl;
     return r;
   }
+  traffic_bytes.fetch_add(r, std::memory_order_relaxed);
 
   ldout(async_msgr->cct, 10) << __func__ << " sent bytes " << r
                              << " remaining bytes " << outgoing_bl.length() << dendl;
@@ -375,6 +363,11 @@ bool AsyncConnection::inject_network_congestion() const {
 
 void AsyncConnection::process() {
   std::lock_guard<std::mutex> l(lock);
+  if (migrated.load(std::memory_order_relaxed) && !center->in_thread()) {
+    // queued on the worker we were moved away from
+    center->dispatch_event_external(read_handler);
+    return;
+  }
   last_active = ceph::coarse_mono_clock::now();
   recv_start_time = ceph::mono_clock::now();
 
@@ -727,11 +720,22 @@ void AsyncConnection::mark_down()
 void AsyncConnection::handle_write()
 {
   ldout(async_msgr->cct, 10) << __func__ << dendl;
+  if (migrated.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> l(write_lock);
+    if (!center->in_thread()) {
+      center->dispatch_event_external(write_handler);
+      return;
+    }
+  }
   protocol->write_event();
 }
 
 void AsyncConnection::handle_write_callback() {
   std::lock_guard<std::mutex> l(lock);
+  if (migrated.load(std::memory_order_relaxed) && !center->in_thread()) {
+    center->dispatch_event_external(write_callback_handler);
+    return;
+  }
   last_active = ceph::coarse_mono_clock::now();
   recv_start_time = ceph::mono_clock::now();
   write_lock.lock();
@@ -745,6 +749,77 @@ void AsyncConnection::handle_write_callback() {
   write_lock.unlock();
 }
 
+void AsyncConnection::migrate(Worker *to)
+{
+  std::lock_guard<std::mutex> l(lock);
+  if (worker == to || state != STATE_CONNECTION_ESTABLISHED)
+    return;
+  center->submit_to(center->get_id(), [conn = AsyncConnectionRef(this), to] {
+    conn->_migrate(to);
+  }, true);
+}
+
+void AsyncConnection::_migrate(Worker *to)
+{
+  std::lock_guard<std::mutex> l(lock);
+  // things may have changed since migrate() was called; the time events
+  // of throttling and delayed delivery are not worth carrying over
+  if (worker == to || !center->in_thread() || migrated ||
+      state != STATE_CONNECTION_ESTABLISHED || !protocol->is_connected() ||
+      !cs || !register_time_events.empty() || delay_state) {
+    ldout(async_msgr->cct, 10) << __func__ << " not moving to worker "
+                               << to->id << dendl;
+    return;
+  }
+  std::lock_guard<std::mutex> wl(write_lock);
+  ldout(async_msgr->cct, 5) << __func__ << " from worker " << worker->id
+                            << " to " << to->id << dendl;
+  center->delete_file_event(cs.fd(), EVENT_READABLE | EVENT_WRITABLE);
+  if (last_tick_id) {
+    center->delete_time_event(last_tick_id);
+    last_tick_id = 0;
+  }
+
+  ++to->references;
+  worker->release_worker();
+  logger->inc(l_msgr_migrated_out_connections);
+  logger->dec(l_msgr_active_connections);
+  logger = to->get_perf_counter();
+  logger->inc(l_msgr_migrated_in_connections);
+  logger->inc(l_msgr_active_connections);
+  EventCenter *from = center;
+  worker = to;
+  center = &to->center;
+  migrated = true;
+  // events dispatched to the old center before the switch are still
+  // queued there; they are forwarded as they run, so go through it once
+  // more before handing over
+  from->submit_to(from->get_id(), [conn = AsyncConnectionRef(this), from,
+				   id = center->get_id()] {
+    from->submit_to(id, [conn] {
+      conn->finish_migrate();
+    }, true);
+  }, true);
+}
+
+void AsyncConnection::finish_migrate()
+{
+  std::lock_guard<std::mutex> l(lock);
+  ceph_assert(center->in_thread());
+  // nothing is left on the old center, so later events need no forwarding
+  migrated = false;
+  if (state != STATE_CONNECTION_ESTABLISHED)
+    return;
+  ldout(async_msgr->cct, 10) << __func__ << dendl;
+  if (!last_tick_id)
+    last_tick_id = center->create_time_event(inactive_timeout_us, tick_handler);
+  center->create_file_event(cs.fd(), EVENT_READABLE, read_handler);
+  if (open_write)
+    center->create_file_event(cs.fd(), EVENT_WRITABLE, write_handler);
+  // pick up whatever arrived while no worker was watching the socket
+  center->dispatch_event_external(read_handler);
+}
+
 void AsyncConnection::stop(bool queue_reset) {
   lock.lock();
   bool need_queue_reset = (state != STATE_CLOSED) && queue_reset;
@@ -54,7 +54,8 @@ class AsyncConnection : public Connection {
   ssize_t read(unsigned len, char *buffer,
                std::function<void(char *, ssize_t)> callback);
   ssize_t read_until(unsigned needed, char *p);
-  ssize_t read_bulk(char *buf, unsigned len);
+  ssize_t read_bulk(char *buf, unsigned len,
+                    char *tail = nullptr, unsigned tail_len = 0);
 
   ssize_t write(ceph::buffer::list &bl, std::function<void(ssize_t)> callback,
                 bool more=false);
@@ -69,6 +70,9 @@ class AsyncConnection : public Connection {
   bool is_queued() const;
   void shutdown_socket();
 
+  void _migrate(Worker *to);
+  void finish_migrate();
+
    /**
    * The DelayedDelivery is for injecting delays into Message delivery off
    * the socket. It is only enabled if delays are requested, and if they
@@ -128,6 +132,24 @@ public:
 	      const entity_addr_t &peer_addr);
   int send_message(Message *m) override;
 
+  /**
+   * Move the connection to another worker's EventCenter.
+   *
+   * Asynchronous and best effort: it happens on the current worker once
+   * the connection is established and idle enough (no pending time
+   * events), and is silently dropped otherwise.  Only for stacks that
+   * support_connection_migration().
+   */
+  void migrate(Worker *to);
+  Worker *get_worker() {
+    std::lock_guard<std::mutex> l(lock);
+    return worker;
+  }
+  /// bytes moved over the socket since the previous call
+  uint64_t take_traffic() {
+    return traffic_bytes.exchange(0, std::memory_order_relaxed);
+  }
+
   void send_keepalive() override;
   void mark_down() override;
   void mark_disposable() override {
@@ -219,6 +241,11 @@ private:
   uint64_t state_offset;
   Worker *worker;
   EventCenter *center;
+  // set while migrate() hands over from one center to another; events
+  // queued on the old one before the switch need forwarding.  no other
+  // migration starts until finish_migrate() clears it
+  std::atomic<bool> migrated = {false};
+  std::atomic<uint64_t> traffic_bytes = {0};
 
   std::unique_ptr<Protocol> protocol;
 
@@ -16,6 +16,7 @@
 
 #include "acconfig.h"
 
+#include <cmath>
 #include <iostream>
 #include <fstream>
 
@@ -247,9 +248,17 @@ void Processor::stop()
 }
 
 
+/// shared by the messengers of one NetworkStack, see rebalance_workers()
+struct WorkerBalance {
+  ceph::mutex lock = ceph::make_mutex("AsyncMessenger::WorkerBalance::lock");
+  std::set<AsyncMessenger*> msgrs;
+  ceph::mono_clock::time_point last_round;
+};
+
 struct StackSingleton {
   CephContext *cct;
   std::shared_ptr<NetworkStack> stack;
+  WorkerBalance balance;
 
   explicit StackSingleton(CephContext *c): cct(c) {}
   void ready(std::string &type) {
@@ -273,6 +282,16 @@ class C_handle_reap : public EventCallback {
   }
 };
 
+class C_handle_rebalance : public EventCallback {
+  AsyncMessenger *msgr;
+
+  public:
+  explicit C_handle_rebalance(AsyncMessenger *m): msgr(m) {}
+  void do_request(uint64_t id) override {
+    msgr->rebalance_workers();
+  }
+};
+
 /*******************
  * AsyncMessenger
  */
@@ -288,17 +307,21 @@ AsyncMessenger::AsyncMessenger(CephContext *cct, entity_name_t name,
     transport_type = "rdma";
   else if (type.find("dpdk") != std::string::npos)
     transport_type = "dpdk";
+  else if (type.find("io_uring") != std::string::npos)
+    transport_type = "io_uring";
 
   auto single = &cct->lookup_or_create_singleton_object<StackSingleton>(
     "AsyncMessenger::NetworkStack::" + transport_type, true, cct);
   single->ready(transport_type);
   stack = single->stack.get();
+  balance = &single->balance;
   stack->start();
   local_worker = stack->get_worker();
   local_connection = ceph::make_ref<AsyncConnection>(cct, this, &dispatch_queue,
 					 local_worker, true, true);
   init_local_connection();
   reap_handler = new C_handle_reap(this);
+  rebalance_handler = new C_handle_rebalance(this);
   unsigned processor_num = 1;
   if (stack->support_local_listen_table())
     processor_num = stack->get_num_worker();
@@ -312,7 +335,12 @@ AsyncMessenger::AsyncMessenger(CephContext *cct, entity_name_t name,
  */
 AsyncMessenger::~AsyncMessenger()
 {
+  {
+    std::lock_guard l{balance->lock};
+    balance->msgrs.erase(this);
+  }
   delete reap_handler;
+  delete rebalance_handler;
   ceph_assert(!did_bind); // either we didn't bind or we shut down the Processor
   for (auto &&p : processors)
     delete p;
@@ -331,6 +359,16 @@ void AsyncMessenger::ready()
     }
   }
 
+  if (stack->support_connection_migration()) {
+    {
+      std::lock_guard l{balance->lock};
+      balance->msgrs.insert(this);
+    }
+    local_worker->center.submit_to(local_worker->center.get_id(), [this] {
+      schedule_rebalance();
+    }, true);
+  }
+
   std::lock_guard l{lock};
   for (auto &&p : processors)
     p->start();
@@ -342,6 +380,16 @@ int AsyncMessenger::shutdown()
   ldout(cct,10) << __func__ << " " << get_myaddrs() << dendl;
 
   // done!  clean up.
+  {
+    std::lock_guard l{balance->lock};
+    balance->msgrs.erase(this);
+  }
+  local_worker->center.submit_to(local_worker->center.get_id(), [this] {
+    if (rebalance_event_id) {
+      local_worker->center.delete_time_event(rebalance_event_id);
+      rebalance_event_id = 0;
+    }
+  }, false);
   for (auto &&p : processors)
     p->stop();
   mark_down_all();
@@ -955,3 +1003,95 @@ void AsyncMessenger::reap_dead()
     deleted_conns.clear();
   }
 }
+
+void AsyncMessenger::schedule_rebalance()
+{
+  ceph_assert(local_worker->center.in_thread());
+  ceph_assert(!rebalance_event_id);
+  double interval = cct->_conf.get_val<double>("ms_async_rebalance_interval");
+  if (interval <= 0)
+    interval = 10;  // disabled; keep checking whether that changes
+  rebalance_event_id = local_worker->center.create_time_event(
+    interval * 1000000, rebalance_handler);
+}
+
+void AsyncMessenger::rebalance_workers()
+{
+  rebalance_event_id = 0;
+  double interval = cct->_conf.get_val<double>("ms_async_rebalance_interval");
+  if (interval <= 0 || stack->get_num_worker() < 2) {
+    schedule_rebalance();
+    return;
+  }
+
+  // every messenger of the stack runs this timer; whichever is due first
+  // does the round for all of them, the others find it too recent.  The
+  // lock also keeps the messengers registered until the round is over.
+  std::lock_guard bl{balance->lock};
+  auto now = ceph::mono_clock::now();
+  if (now - balance->last_round < ceph::make_timespan(interval)) {
+    schedule_rebalance();
+    return;
+  }
+  balance->last_round = now;
+  stack->sample_load(ceph::make_timespan(interval / 2));
+  Worker *busiest = nullptr, *idlest = nullptr;
+  unsigned busiest_load = 0, idlest_load = 0;
+  for (unsigned i = 0; i < stack->get_num_worker(); ++i) {
+    Worker *w = stack->get_worker(i);
+    unsigned load = w->load;
+    if (!busiest || load > busiest_load) {
+      busiest = w;
+      busiest_load = load;
+    }
+    if (!idlest || load < idlest_load) {
+      idlest = w;
+      idlest_load = load;
+    }
+  }
+  double gap = (busiest_load - idlest_load) / 1000.0;
+
+  std::vector<AsyncConnectionRef> candidates;
+  for (auto m : balance->msgrs) {
+    std::lock_guard l{m->lock};
+    for (auto& [addrs, c] : m->conns)
+      candidates.push_back(c);
+    for (auto& c : m->anon_conns)
+      candidates.push_back(c);
+  }
+  // sample everyone's traffic so that the next round sees a fresh interval
+  AsyncConnectionRef best;
+  uint64_t best_bytes = 0;
+  uint64_t busiest_bytes = 0;
+  std::vector<std::pair<uint64_t, AsyncConnectionRef>> on_busiest;
+  for (auto& c : candidates) {
+    uint64_t bytes = c->take_traffic();
+    if (bytes && c->get_worker() == busiest) {
+      busiest_bytes += bytes;
+      on_busiest.emplace_back(bytes, c);
+    }
+  }
+  if (busiest != idlest &&
+      gap > cct->_conf.get_val<double>("ms_async_rebalance_threshold")) {
+    // moving a connection carrying load L changes the gap to |gap - 2L|
+    double best_left = gap;
+    for (auto& [bytes, c] : on_busiest) {
+      double l = busiest_load / 1000.0 * bytes / busiest_bytes;
+      double left = std::abs(gap - 2 * l);
+      if (left < best_left) {
+	best_left = left;
+	best = c;
+	best_bytes = bytes;
+      }
+    }
+    if (best) {
+      ldout(cct, 5) << __func__ << " worker " << busiest->id
+		    << " load " << busiest_load << " worker " << idlest->id
+		    << " load " << idlest_load << ", moving " << best
+		    << " with " << best_bytes << "/" << busiest_bytes
+		    << " bytes" << dendl;
+      best->migrate(idlest);
+    }
+  }
+  schedule_rebalance();
+}
@@ -38,6 +38,7 @@
 #include "include/ceph_assert.h"
 
 class AsyncMessenger;
+struct WorkerBalance;
 
 /**
  * If the Messenger binds to a specific address, the Processor runs
@@ -299,6 +300,12 @@ private:
 
   EventCallbackRef reap_handler;
 
+  // periodic worker rebalancing, on local_worker; see rebalance_workers()
+  WorkerBalance *balance;
+  EventCallbackRef rebalance_handler;
+  uint64_t rebalance_event_id = 0;
+  void schedule_rebalance();
+
   /// internal cluster protocol version, if any, for talking to entities of the same type.
   int cluster_protocol = 0;
 
@@ -425,6 +432,18 @@ public:
    */
   void reap_dead();
 
+  /**
+   * Move one connection from the busiest to the idlest worker
+   *
+   * Runs every ms_async_rebalance_interval seconds, at most once per
+   * interval for all messengers sharing the NetworkStack.  If the busy
+   * time of the busiest worker exceeds that of the idlest by more than
+   * ms_async_rebalance_threshold, pick the connection, of any of these
+   * messengers, whose share of the busiest worker's traffic best halves
+   * the gap and migrate it.
+   */
+  void rebalance_workers();
+
   /**
    * @} // AsyncMessenger Internals
    */
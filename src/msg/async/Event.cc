@@ -21,6 +21,9 @@
 #ifdef HAVE_DPDK
 #include "dpdk/EventDPDK.h"
 #endif
+#ifdef HAVE_ASYNC_IO_URING
+#include "EventIoUring.h"
+#endif
 
 #ifdef HAVE_EPOLL
 #include "EventEpoll.h"
@@ -105,7 +108,7 @@ EventCenter::Poller::~Poller()
 std::ostream& EventCenter::_event_prefix(std::ostream *_dout)
 {
   return *_dout << "Event(" << this << " nevent=" << nevent
-                << " time_id=" << time_event_next_id << ").";
+                << " time_events=" << time_events.size() << ").";
 }
 
 int EventCenter::init(int nevent, unsigned center_id, const std::string &type)
@@ -119,6 +122,10 @@ int EventCenter::init(int nevent, unsigned center_id, const std::string &type)
   if (type == "dpdk") {
 #ifdef HAVE_DPDK
     driver = new DPDKDriver(cct);
+#endif
+  } else if (type == "io_uring") {
+#ifdef HAVE_ASYNC_IO_URING
+    driver = new IoUringDriver(cct);
 #endif
   } else {
 #ifdef HAVE_EPOLL
@@ -192,7 +199,6 @@ EventCenter::~EventCenter()
     }
   }
   time_events.clear();
-  //assert(time_events.empty());
 
   if (notify_receive_fd >= 0)
     compat_closesocket(notify_receive_fd);
@@ -305,17 +311,12 @@ void EventCenter::delete_file_event(int fd, int mask)
 uint64_t EventCenter::create_time_event(uint64_t microseconds, EventCallbackRef ctxt)
 {
   ceph_assert(in_thread());
-  uint64_t id = time_event_next_id++;
-
-  ldout(cct, 30) << __func__ << " id=" << id << " trigger after " << microseconds << "us"<< dendl;
-  EventCenter::TimeEvent event;
   clock_type::time_point expire = clock_type::now() + std::chrono::microseconds(microseconds);
-  event.id = id;
-  event.time_cb = ctxt;
-  std::multimap<clock_type::time_point, TimeEvent>::value_type s_val(expire, event);
-  auto it = time_events.insert(std::move(s_val));
-  event_map[id] = it;
+  // never fire early: round up to the next tick, unless due right away
+  auto tick = microseconds ? to_tick(expire, true) : time_events.now();
+  uint64_t id = time_events.add(tick, ctxt);
 
+  ldout(cct, 30) << __func__ << " id=" << id << " trigger after " << microseconds << "us"<< dendl;
   return id;
 }
 
@@ -323,17 +324,12 @@ void EventCenter::delete_time_event(uint64_t id)
 {
   ceph_assert(in_thread());
   ldout(cct, 30) << __func__ << " id=" << id << dendl;
-  if (id >= time_event_next_id || id == 0)
+  if (id == 0)
     return ;
 
-  auto it = event_map.find(id);
-  if (it == event_map.end()) {
+  if (!time_events.cancel(id)) {
     ldout(cct, 10) << __func__ << " id=" << id << " not found" << dendl;
-    return ;
   }
-
-  time_events.erase(it->second);
-  event_map.erase(it);
 }
 
 void EventCenter::wakeup()
@@ -366,20 +362,13 @@ int EventCenter::process_time_events()
   using ceph::operator <<;
   ldout(cct, 30) << __func__ << " cur time is " << now << dendl;
 
-  while (!time_events.empty()) {
-    auto it = time_events.begin();
-    if (now >= it->first) {
-      TimeEvent &e = it->second;
-      EventCallbackRef cb = e.time_cb;
-      uint64_t id = e.id;
-      time_events.erase(it);
-      event_map.erase(id);
-      ldout(cct, 30) << __func__ << " process time event: id=" << id << dendl;
-      processed++;
-      cb->do_request(id);
-    } else {
-      break;
-    }
+  time_events.advance(to_tick(now, false));
+  uint64_t id;
+  EventCallbackRef cb;
+  while (time_events.pop_expired(&id, &cb)) {
+    ldout(cct, 30) << __func__ << " process time event: id=" << id << dendl;
+    processed++;
+    cb->do_request(id);
   }
 
   return processed;
@@ -393,10 +382,11 @@ int EventCenter::process_events(unsigned timeout_microseconds,  ceph::timespan *
   auto now = clock_type::now();
   clock_type::time_point end_time = now + std::chrono::microseconds(timeout_microseconds);
 
-  auto it = time_events.begin();
-  if (it != time_events.end() && end_time >= it->first) {
+  auto next_tick = time_events.next_wakeup();
+  if (next_tick &&
+      end_time >= time_base + *next_tick * time_tick) {
     trigger_time = true;
-    end_time = it->first;
+    end_time = time_base + *next_tick * time_tick;
 
     if (end_time > now) {
       timeout_microseconds = std::chrono::duration_cast<std::chrono::microseconds>(end_time - now).count();
@@ -48,6 +48,7 @@
 #include "common/ceph_time.h"
 #include "common/dout.h"
 #include "net_handler.h"
+#include "TimerWheel.h"
 
 #define EVENT_NONE 0
 #define EVENT_READABLE 1
@@ -111,13 +112,6 @@ class EventCenter {
     FileEvent(): mask(0), read_cb(NULL), write_cb(NULL) {}
   };
 
-  struct TimeEvent {
-    uint64_t id;
-    EventCallbackRef time_cb;
-
-    TimeEvent(): id(0), time_cb(NULL) {}
-  };
-
  public:
   /**
      * A Poller object is invoked once each time through the dispatcher's
@@ -166,13 +160,15 @@ class EventCenter {
   std::deque<EventCallbackRef> external_events;
   std::vector<FileEvent> file_events;
   EventDriver *driver;
-  std::multimap<clock_type::time_point, TimeEvent> time_events;
+  // time events are kept in a timing wheel ticking every "time_tick"
+  // since "time_base"
+  static constexpr std::chrono::milliseconds time_tick{1};
+  clock_type::time_point time_base;
+  TimerWheel<EventCallbackRef> time_events;
   // Keeps track of all of the pollers currently defined.  We don't
   // use an intrusive list here because it isn't reentrant: we need
   // to add/remove elements while the center is traversing the list.
   std::vector<Poller*> pollers;
-  std::map<uint64_t, std::multimap<clock_type::time_point, TimeEvent>::iterator> event_map;
-  uint64_t time_event_next_id;
   int notify_receive_fd;
   int notify_send_fd;
   ceph::NetHandler net;
@@ -181,6 +177,14 @@ class EventCenter {
   AssociatedCenters *global_centers = nullptr;
 
   int process_time_events();
+  TimerWheel<EventCallbackRef>::tick_t to_tick(clock_type::time_point t,
+                                               bool round_up) const {
+    auto d = t - time_base;
+    auto ticks = d / time_tick;
+    if (round_up && d % time_tick != clock_type::duration::zero())
+      ++ticks;
+    return ticks;
+  }
   FileEvent *_get_file_event(int fd) {
     ceph_assert(fd < nevent);
     return &file_events[fd];
@@ -190,7 +194,7 @@ class EventCenter {
   explicit EventCenter(CephContext *c):
     cct(c), nevent(0),
     external_num_events(0),
-    driver(NULL), time_event_next_id(1),
+    driver(NULL), time_base(clock_type::now()),
     notify_receive_fd(-1), notify_send_fd(-1), net(c),
     notify_handler(NULL), center_id(0) { }
   ~EventCenter();
@@ -0,0 +1,313 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <poll.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <bit>
+
+#include "common/errno.h"
+#include "EventIoUring.h"
+
+#define dout_subsys ceph_subsys_ms
+
+#undef dout_prefix
+#define dout_prefix *_dout << "IoUringDriver."
+
+IoUringDriver::~IoUringDriver()
+{
+  if (!ring_inited)
+    return;
+  if (buf_ring)
+    io_uring_free_buf_ring(&ring, buf_ring, buf_count, BUFFER_GROUP);
+  io_uring_queue_exit(&ring);
+  if (buf_base)
+    ::munmap(buf_base, static_cast<size_t>(buf_count) * buf_size);
+}
+
+int IoUringDriver::init(EventCenter *c, int nevent)
+{
+  unsigned entries = cct->_conf.get_val<uint64_t>("ms_async_io_uring_queue_depth");
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+    IORING_SETUP_COOP_TASKRUN;
+  params.cq_entries = entries * 4;
+  int r = io_uring_queue_init_params(entries, &ring, &params);
+  if (r == -EINVAL) {
+    // older kernel; the flags above are only optimizations
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    r = io_uring_queue_init_params(entries, &ring, &params);
+  }
+  if (r < 0) {
+    lderr(cct) << __func__ << " unable to set up io_uring: "
+	       << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ring_inited = true;
+
+  buf_count = std::bit_ceil<unsigned>(std::max<uint64_t>(
+    1, cct->_conf.get_val<uint64_t>("ms_async_io_uring_recv_buffers")));
+  buf_size = cct->_conf.get_val<Option::size_t>("ms_async_io_uring_recv_buffer_size");
+  buf_limit = std::min<uint64_t>(
+    buf_count,
+    cct->_conf.get_val<uint64_t>("ms_async_io_uring_recv_buffers_per_connection"));
+  void *p = ::mmap(nullptr, static_cast<size_t>(buf_count) * buf_size,
+		   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    r = -errno;
+    lderr(cct) << __func__ << " unable to allocate receive buffers: "
+	       << cpp_strerror(r) << dendl;
+    return r;
+  }
+  buf_base = static_cast<char*>(p);
+  buf_ring = io_uring_setup_buf_ring(&ring, buf_count, BUFFER_GROUP, 0, &r);
+  if (!buf_ring) {
+    lderr(cct) << __func__ << " unable to register provided buffers"
+	       << " (needs Linux 5.19 or later): " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  for (unsigned i = 0; i < buf_count; ++i) {
+    io_uring_buf_ring_add(buf_ring, get_buffer(i), buf_size, i,
+			  io_uring_buf_ring_mask(buf_count), i);
+  }
+  io_uring_buf_ring_advance(buf_ring, buf_count);
+
+  fds.resize(nevent);
+  ldout(cct, 10) << __func__ << " sq " << params.sq_entries
+		 << " cq " << params.cq_entries
+		 << " recv buffers " << buf_count << "x" << buf_size
+		 << " (" << buf_limit << " per fd)" << dendl;
+  return 0;
+}
+
+struct io_uring_sqe *IoUringDriver::get_sqe()
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  if (!sqe) {
+    // submission queue is full, flush it early
+    io_uring_submit(&ring);
+    sqe = io_uring_get_sqe(&ring);
+  }
+  ceph_assert(sqe);
+  return sqe;
+}
+
+void IoUringDriver::arm_poll(int fd, int mask)
+{
+  unsigned poll_mask = 0;
+  if (mask & EVENT_READABLE)
+    poll_mask |= POLLIN;
+  if (mask & EVENT_WRITABLE)
+    poll_mask |= POLLOUT;
+  struct io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_poll_multishot(sqe, fd, poll_mask);
+  io_uring_sqe_set_data64(sqe, (static_cast<uint64_t>(fd) << OP_BITS) | OP_POLL);
+  fds[fd].polling = true;
+}
+
+int IoUringDriver::add_event(int fd, int cur_mask, int add_mask)
+{
+  ldout(cct, 20) << __func__ << " add event fd=" << fd << " cur_mask=" << cur_mask
+		 << " add_mask=" << add_mask << dendl;
+  fd_state &s = get_fd(fd);
+  int old_mask = s.mask;
+  s.mask |= add_mask;
+  if (s.managed) {
+    set_ready(fd, 0);
+    return 0;
+  }
+  if (s.mask != old_mask) {
+    if (s.polling) {
+      struct io_uring_sqe *sqe = get_sqe();
+      io_uring_prep_poll_remove(sqe, (static_cast<uint64_t>(fd) << OP_BITS) | OP_POLL);
+      io_uring_sqe_set_data64(sqe, OP_IGNORE);
+    }
+    arm_poll(fd, s.mask);
+  }
+  return 0;
+}
+
+int IoUringDriver::del_event(int fd, int cur_mask, int del_mask)
+{
+  ldout(cct, 20) << __func__ << " del event fd=" << fd << " cur_mask=" << cur_mask
+		 << " delmask=" << del_mask << dendl;
+  if (static_cast<size_t>(fd) >= fds.size())
+    return 0;
+  fd_state &s = fds[fd];
+  int old_mask = s.mask;
+  s.mask &= ~del_mask;
+  if (s.managed || s.mask == old_mask || !s.polling)
+    return 0;
+  struct io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_poll_remove(sqe, (static_cast<uint64_t>(fd) << OP_BITS) | OP_POLL);
+  io_uring_sqe_set_data64(sqe, OP_IGNORE);
+  s.polling = false;
+  if (s.mask)
+    arm_poll(fd, s.mask);
+  return 0;
+}
+
+int IoUringDriver::resize_events(int newsize)
+{
+  if (static_cast<size_t>(newsize) > fds.size())
+    fds.resize(newsize);
+  return 0;
+}
+
+void IoUringDriver::manage(int fd)
+{
+  fd_state &s = get_fd(fd);
+  if (s.polling) {
+    // events were asked for before the handler took over
+    struct io_uring_sqe *sqe = get_sqe();
+    io_uring_prep_poll_remove(sqe, (static_cast<uint64_t>(fd) << OP_BITS) | OP_POLL);
+    io_uring_sqe_set_data64(sqe, OP_IGNORE);
+    s.polling = false;
+  }
+  s.managed = true;
+  s.ready = 0;
+}
+
+void IoUringDriver::unmanage(int fd)
+{
+  fd_state &s = get_fd(fd);
+  s.managed = false;
+  s.ready = 0;
+  s.mask = 0;
+}
+
+void IoUringDriver::set_ready(int fd, int mask)
+{
+  fd_state &s = fds[fd];
+  s.ready |= mask;
+  if ((s.ready & s.mask) && !s.queued) {
+    s.queued = true;
+    ready_fds.push_back(fd);
+  }
+}
+
+void IoUringDriver::put_buffer(unsigned bid)
+{
+  io_uring_buf_ring_add(buf_ring, get_buffer(bid), buf_size, bid,
+			io_uring_buf_ring_mask(buf_count), 0);
+  io_uring_buf_ring_advance(buf_ring, 1);
+  buffers_returned = true;
+}
+
+void IoUringDriver::wait_for_buffers(Handler *h)
+{
+  starved.push_back(h);
+}
+
+void IoUringDriver::forget(Handler *h)
+{
+  starved.erase(std::remove(starved.begin(), starved.end(), h), starved.end());
+}
+
+void IoUringDriver::handle_poll(int fd, int res, uint32_t flags)
+{
+  fd_state &s = fds[fd];
+  if (res == -ECANCELED)
+    return;
+  if (!(flags & IORING_CQE_F_MORE)) {
+    s.polling = false;
+    if (s.mask && !s.managed)
+      arm_poll(fd, s.mask);
+  }
+  if (s.managed) {
+    // raced with the poll_remove of manage()
+    return;
+  }
+  if (res < 0) {
+    ldout(cct, 1) << __func__ << " poll on fd=" << fd << " failed: "
+		  << cpp_strerror(res) << dendl;
+    return;
+  }
+  int mask = 0;
+  if (res & (POLLIN | POLLERR | POLLHUP))
+    mask |= EVENT_READABLE;
+  if (res & (POLLOUT | POLLERR | POLLHUP))
+    mask |= EVENT_WRITABLE;
+  s.ready |= mask;
+  if ((s.ready & s.mask) && !s.queued) {
+    s.queued = true;
+    ready_fds.push_back(fd);
+  }
+}
+
+void IoUringDriver::reap()
+{
+  struct io_uring_cqe *cqes[64];
+  unsigned n;
+  do {
+    n = io_uring_peek_batch_cqe(&ring, cqes, std::size(cqes));
+    for (unsigned i = 0; i < n; ++i) {
+      uint64_t data = cqes[i]->user_data;
+      unsigned op = data & ((1u << OP_BITS) - 1);
+      if (op == OP_POLL) {
+	handle_poll(data >> OP_BITS, cqes[i]->res, cqes[i]->flags);
+      } else if (op != OP_IGNORE) {
+	reinterpret_cast<Handler*>(data & ~uint64_t((1u << OP_BITS) - 1))
+	  ->handle_cqe(op, cqes[i]->res, cqes[i]->flags);
+      }
+    }
+    io_uring_cq_advance(&ring, n);
+  } while (n == std::size(cqes));
+}
+
+int IoUringDriver::event_wait(std::vector<FiredFileEvent> &fired_events, struct timeval *tvp)
+{
+  if (buffers_returned) {
+    buffers_returned = false;
+    std::vector<Handler*> waiting;
+    waiting.swap(starved);
+    for (auto h : waiting)
+      h->buffers_available();
+  }
+
+  int r;
+  if (!ready_fds.empty() || (tvp && !tvp->tv_sec && !tvp->tv_usec)) {
+    r = io_uring_submit(&ring);
+  } else if (tvp) {
+    struct __kernel_timespec ts;
+    ts.tv_sec = tvp->tv_sec;
+    ts.tv_nsec = tvp->tv_usec * 1000;
+    struct io_uring_cqe *cqe;
+    r = io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &ts, nullptr);
+  } else {
+    r = io_uring_submit_and_wait(&ring, 1);
+  }
+  if (r < 0 && r != -ETIME && r != -EINTR && r != -EBUSY) {
+    lderr(cct) << __func__ << " io_uring_enter failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+
+  reap();
+
+  fired_events.clear();
+  for (int fd : ready_fds) {
+    fd_state &s = fds[fd];
+    s.queued = false;
+    int mask = s.ready & s.mask;
+    if (mask) {
+      // edge triggered: the next completion reports it again
+      s.ready &= ~mask;
+      fired_events.push_back({fd, mask});
+    }
+  }
+  ready_fds.clear();
+  return fired_events.size();
+}
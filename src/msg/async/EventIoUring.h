@@ -0,0 +1,128 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_EVENTIOURING_H
+#define CEPH_MSG_EVENTIOURING_H
+
+#include <liburing.h>
+
+#include <vector>
+
+#include "Event.h"
+
+/**
+ * EventDriver backed by a per-EventCenter io_uring.
+ *
+ * event_wait() submits every SQE queued since the previous iteration and
+ * reaps completions with a single io_uring_enter().  There are two kinds
+ * of fds:
+ *
+ *  - "managed" fds belong to the io_uring network stack, which does all of
+ *    their I/O through the ring.  Their readiness is whatever the stack
+ *    reports with set_ready() while handling a completion, and is handed
+ *    to the EventCenter edge triggered, like EpollDriver does.
+ *  - any other fd (the EventCenter notify pipe) is watched with a
+ *    multishot poll request.
+ *
+ * The ring also owns the provided buffer ring that multishot receives pick
+ * their buffers from.  All methods must be called from the thread owning
+ * the EventCenter.
+ */
+class IoUringDriver : public EventDriver {
+ public:
+  /// completion sink; the low OP_BITS of user_data select the operation
+  class Handler {
+   public:
+    virtual ~Handler() {}
+    virtual void handle_cqe(unsigned op, int res, uint32_t flags) = 0;
+    /// called once provided buffers are available again, see wait_for_buffers()
+    virtual void buffers_available() {}
+  };
+  static constexpr unsigned OP_BITS = 3;
+  static constexpr uint16_t BUFFER_GROUP = 0;
+
+ private:
+  // user_data tags used by the driver itself; handler ops use the rest
+  static constexpr unsigned OP_POLL = (1u << OP_BITS) - 1;
+  static constexpr unsigned OP_IGNORE = OP_POLL - 1;
+
+  struct fd_state {
+    int mask = 0;        ///< events the EventCenter is interested in
+    int ready = 0;       ///< events reported but not handed out yet
+    bool managed = false;
+    bool queued = false; ///< in ready_fds
+    bool polling = false;
+  };
+
+  CephContext *cct;
+  struct io_uring ring;
+  bool ring_inited = false;
+  std::vector<fd_state> fds;
+  std::vector<int> ready_fds;
+
+  struct io_uring_buf_ring *buf_ring = nullptr;
+  char *buf_base = nullptr;
+  unsigned buf_count = 0;
+  unsigned buf_size = 0;
+  unsigned buf_limit = 0;
+  bool buffers_returned = false;
+  std::vector<Handler*> starved;
+
+  fd_state &get_fd(int fd) {
+    if (static_cast<size_t>(fd) >= fds.size())
+      fds.resize(fd + 1);
+    return fds[fd];
+  }
+  void arm_poll(int fd, int mask);
+  void handle_poll(int fd, int res, uint32_t flags);
+  void reap();
+
+ public:
+  explicit IoUringDriver(CephContext *c): cct(c) {}
+  ~IoUringDriver() override;
+
+  int init(EventCenter *c, int nevent) override;
+  int add_event(int fd, int cur_mask, int add_mask) override;
+  int del_event(int fd, int cur_mask, int del_mask) override;
+  int resize_events(int newsize) override;
+  int event_wait(std::vector<FiredFileEvent> &fired_events,
+		 struct timeval *tp) override;
+
+  static uint64_t make_user_data(Handler *h, unsigned op) {
+    ceph_assert(op < OP_IGNORE);
+    return reinterpret_cast<uintptr_t>(h) | op;
+  }
+  /// an SQE to fill in; it goes out with the next event_wait()
+  struct io_uring_sqe *get_sqe();
+
+  /// hand all I/O on "fd" over to a Handler
+  void manage(int fd);
+  void unmanage(int fd);
+  /// report events on a managed fd
+  void set_ready(int fd, int mask);
+
+  char *get_buffer(unsigned bid) {
+    return buf_base + static_cast<size_t>(bid) * buf_size;
+  }
+  /// number of provided buffers one fd may hold
+  unsigned get_buffer_limit() const {
+    return buf_limit;
+  }
+  /// give a provided buffer back to the kernel
+  void put_buffer(unsigned bid);
+  /// call h->buffers_available() once buffers have been put back
+  void wait_for_buffers(Handler *h);
+  /// drop any pending callback registered for "h"
+  void forget(Handler *h);
+};
+
+#endif
@@ -0,0 +1,677 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <deque>
+
+#include "IoUringStack.h"
+
+#include "include/buffer.h"
+#include "common/errno.h"
+#include "common/dout.h"
+#include "include/compat.h"
+#include "include/sock_compat.h"
+
+#define dout_subsys ceph_subsys_ms
+#undef dout_prefix
+#define dout_prefix *_dout << "IoUringStack "
+
+/**
+ * State of one connected socket.
+ *
+ * It lives on the worker owning the socket and outlives the
+ * ConnectedSocket wrapper: close() only asks the kernel to cancel
+ * whatever is in flight, and the object goes away together with the fd
+ * once the last completion referring to it has been reaped.
+ */
+class IoUringSocket final : public IoUringDriver::Handler {
+  enum {
+    OP_CONNECT,
+    OP_RECV,
+    OP_SEND,
+    OP_CANCEL,
+  };
+  // stop taking data from send() beyond this much unsent data, until
+  // the kernel catches up; it shows up as EVENT_WRITABLE once it does
+  static constexpr size_t TX_HIGH_WATER = 4 << 20;
+
+  struct chunk_t {
+    unsigned bid;   // provided buffer
+    unsigned off;
+    unsigned len;
+  };
+
+  CephContext *cct;
+  EventCenter *center;
+  IoUringDriver *driver;
+  ceph::NetHandler &handler;
+  int _fd;
+  entity_addr_t sa;
+  bool connected;
+  bool closed = false;
+  bool shut = false;      // shutdown() was called
+  bool eof = false;
+  int error = 0;
+  unsigned inflight = 0;  // submissions whose last completion is pending
+
+  bool recv_armed = false;
+  bool recv_cancelling = false;
+  // holding get_buffer_limit() buffers; read() re-arms the recv
+  bool recv_paused = false;
+  std::deque<chunk_t> rx;
+
+  bool send_inflight = false;
+  bool want_writable = false;
+  ceph::buffer::list tx_pending;
+  ceph::buffer::list tx_inflight;
+  struct msghdr tx_msg;
+  struct iovec tx_iov[IOV_MAX];
+
+  void submit(struct io_uring_sqe *sqe, unsigned op) {
+    io_uring_sqe_set_data64(sqe, IoUringDriver::make_user_data(this, op));
+    ++inflight;
+  }
+
+  void arm_recv() {
+    struct io_uring_sqe *sqe = driver->get_sqe();
+    io_uring_prep_recv_multishot(sqe, _fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IoUringDriver::BUFFER_GROUP;
+    submit(sqe, OP_RECV);
+    recv_armed = true;
+  }
+
+  bool rx_full() const {
+    return rx.size() >= driver->get_buffer_limit();
+  }
+
+  // stop the multishot recv; its last completion (-ECANCELED) re-arms it
+  // if read() has made room in the meantime.  The cancel misses a recv
+  // that is busy posting completions and is tried again then, see
+  // handle_cqe()
+  void pause_recv() {
+    recv_paused = true;
+    if (!recv_armed || recv_cancelling)
+      return;
+    struct io_uring_sqe *sqe = driver->get_sqe();
+    io_uring_prep_cancel64(sqe, IoUringDriver::make_user_data(this, OP_RECV), 0);
+    submit(sqe, OP_CANCEL);
+    recv_cancelling = true;
+  }
+
+  void flush_send() {
+    if (send_inflight || !connected || error || tx_pending.length() == 0)
+      return;
+    tx_inflight.swap(tx_pending);
+    size_t n = 0;
+    for (auto& p : tx_inflight.buffers()) {
+      if (n == IOV_MAX)
+	break;
+      tx_iov[n].iov_base = const_cast<char*>(p.c_str());
+      tx_iov[n].iov_len = p.length();
+      ++n;
+    }
+    memset(&tx_msg, 0, sizeof(tx_msg));
+    tx_msg.msg_iov = tx_iov;
+    tx_msg.msg_iovlen = n;
+    struct io_uring_sqe *sqe = driver->get_sqe();
+    io_uring_prep_sendmsg(sqe, _fd, &tx_msg, MSG_NOSIGNAL);
+    submit(sqe, OP_SEND);
+    send_inflight = true;
+  }
+
+  void set_error(int r) {
+    if (!error)
+      error = r;
+    driver->set_ready(_fd, EVENT_READABLE | EVENT_WRITABLE);
+  }
+
+  void set_connected() {
+    connected = true;
+    arm_recv();
+    flush_send();
+  }
+
+  void handle_connect(int res) {
+    if (closed || connected)
+      return;
+    if (res >= 0) {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      if (::getsockopt(_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+	err = ceph_sock_errno();
+      res = -err;
+    }
+    if (res < 0) {
+      ldout(cct, 10) << __func__ << " connect to " << sa << ": "
+		     << cpp_strerror(res) << dendl;
+      set_error(res);
+      return;
+    }
+    set_connected();
+    driver->set_ready(_fd, EVENT_WRITABLE);
+  }
+
+  void handle_recv(int res, uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+      recv_armed = false;
+      recv_cancelling = false;
+    }
+    if (flags & IORING_CQE_F_BUFFER) {
+      unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+      if (closed || res <= 0)
+	driver->put_buffer(bid);
+      else
+	rx.push_back({bid, 0, static_cast<unsigned>(res)});
+    }
+    if (closed)
+      return;
+    if (res > 0) {
+      if (rx_full())
+	pause_recv();
+      else if (!recv_armed)
+	arm_recv();
+      driver->set_ready(_fd, EVENT_READABLE);
+    } else if (res == 0) {
+      eof = true;
+      driver->set_ready(_fd, EVENT_READABLE | EVENT_WRITABLE);
+    } else if (res == -ENOBUFS) {
+      // the pool ran dry; re-arm once someone gives buffers back
+      ldout(cct, 20) << __func__ << " fd=" << _fd << " out of receive buffers"
+		     << dendl;
+      driver->wait_for_buffers(this);
+    } else if (res == -ECANCELED) {
+      if (!recv_paused && !recv_armed && !eof && !error)
+	arm_recv();
+    } else {
+      set_error(res);
+    }
+  }
+
+  void handle_send(int res) {
+    send_inflight = false;
+    if (res < 0) {
+      tx_inflight.clear();
+      tx_pending.clear();
+      if (!closed)
+	set_error(res);
+      return;
+    }
+    if (static_cast<unsigned>(res) < tx_inflight.length()) {
+      // short send, or more buffers than fit in one sendmsg
+      tx_inflight.splice(0, res);
+      tx_inflight.claim_append(tx_pending);
+      tx_pending.swap(tx_inflight);
+    } else {
+      tx_inflight.clear();
+    }
+    if (closed)
+      return;
+    flush_send();
+    if (want_writable && tx_pending.length() + tx_inflight.length() < TX_HIGH_WATER) {
+      want_writable = false;
+      driver->set_ready(_fd, EVENT_WRITABLE);
+    }
+  }
+
+  void destroy() {
+    ldout(cct, 20) << __func__ << " fd=" << _fd << dendl;
+    driver->unmanage(_fd);
+    ::close(_fd);
+    delete this;
+  }
+
+ public:
+  IoUringSocket(CephContext *c, IoUringWorker *w, ceph::NetHandler &h,
+		const entity_addr_t &addr, int f, bool connected)
+    : cct(c), center(&w->center), driver(w->get_driver()), handler(h),
+      _fd(f), sa(addr), connected(connected) {}
+
+  /// start receiving; called on the owning worker
+  void start() {
+    driver->manage(_fd);
+    arm_recv();
+  }
+
+  void connect() {
+    driver->manage(_fd);
+    // a nonblocking connect like PosixStack's, that is done by the time
+    // it returns for a local peer; the ring only waits for it otherwise
+    int flags = ::fcntl(_fd, F_GETFL);
+    ::fcntl(_fd, F_SETFL, flags | O_NONBLOCK);
+    int r = ::connect(_fd, sa.get_sockaddr(), sa.get_sockaddr_len());
+    int err = r < 0 ? ceph_sock_errno() : 0;
+    ::fcntl(_fd, F_SETFL, flags);
+    if (r == 0) {
+      set_connected();
+    } else if (err != EINPROGRESS) {
+      ldout(cct, 10) << __func__ << " connect to " << sa << ": "
+		     << cpp_strerror(err) << dendl;
+      set_error(-err);
+    } else {
+      struct io_uring_sqe *sqe = driver->get_sqe();
+      io_uring_prep_poll_add(sqe, _fd, POLLOUT);
+      submit(sqe, OP_CONNECT);
+    }
+  }
+
+  void handle_cqe(unsigned op, int res, uint32_t flags) override {
+    if (!(flags & IORING_CQE_F_MORE))
+      --inflight;
+    switch (op) {
+    case OP_CONNECT:
+      handle_connect(res);
+      break;
+    case OP_RECV:
+      handle_recv(res, flags);
+      break;
+    case OP_SEND:
+      handle_send(res);
+      break;
+    case OP_CANCEL:
+      if (res == -ENOENT || res == -EALREADY) {
+	recv_cancelling = false;
+	if (!closed && recv_paused && recv_armed && rx_full())
+	  pause_recv();
+      }
+      break;
+    }
+    if (closed && inflight == 0)
+      destroy();
+  }
+
+  void buffers_available() override {
+    if (!closed && !recv_armed && !recv_paused && !eof && !error)
+      arm_recv();
+  }
+
+  int is_connected() {
+    if (error)
+      return error;
+    if (!connected) {
+      // whoever finds it connected here gets no event for it later
+      sockaddr_storage ss;
+      socklen_t slen = sizeof(ss);
+      if (::getpeername(_fd, (sockaddr*)&ss, &slen) == 0)
+	set_connected();
+    }
+    return connected;
+  }
+
+  ssize_t read(char *buf, size_t len) {
+    size_t copied = 0;
+    while (copied < len && !rx.empty()) {
+      chunk_t &c = rx.front();
+      size_t n = std::min<size_t>(len - copied, c.len);
+      memcpy(buf + copied, driver->get_buffer(c.bid) + c.off, n);
+      copied += n;
+      c.off += n;
+      c.len -= n;
+      if (c.len == 0) {
+	driver->put_buffer(c.bid);
+	rx.pop_front();
+      }
+    }
+    if (recv_paused && !rx_full()) {
+      recv_paused = false;
+      if (!recv_armed && !eof && !error)
+	arm_recv();
+    }
+    if (copied)
+      return copied;
+    if (error)
+      return error;
+    if (eof)
+      return 0;
+    return -EAGAIN;
+  }
+
+  ssize_t send(ceph::buffer::list &bl, bool more) {
+    if (error)
+      return error;
+    if (shut)
+      return -EPIPE;
+    if (tx_pending.length() + tx_inflight.length() >= TX_HIGH_WATER) {
+      want_writable = true;
+      return 0;
+    }
+    size_t len = bl.length();
+    tx_pending.claim_append(bl);
+    flush_send();
+    return len;
+  }
+
+  void shutdown() {
+    shut = true;
+    ::shutdown(_fd, SHUT_RDWR);
+  }
+
+  void close() {
+    if (!center->in_thread()) {
+      center->submit_to(center->get_id(), [this] { close(); }, true);
+      return;
+    }
+    ldout(cct, 20) << __func__ << " fd=" << _fd << " inflight=" << inflight
+		   << dendl;
+    closed = true;
+    driver->forget(this);
+    for (auto& c : rx)
+      driver->put_buffer(c.bid);
+    rx.clear();
+    tx_pending.clear();
+    if (inflight == 0) {
+      destroy();
+      return;
+    }
+    // like close(2) on a socket, let a send already handed to the kernel
+    // finish and cancel everything else
+    if (send_inflight && !recv_armed)
+      return;
+    struct io_uring_sqe *sqe = driver->get_sqe();
+    if (send_inflight)
+      io_uring_prep_cancel64(sqe, IoUringDriver::make_user_data(this, OP_RECV), 0);
+    else
+      io_uring_prep_cancel_fd(sqe, _fd, IORING_ASYNC_CANCEL_ALL);
+    submit(sqe, OP_CANCEL);
+  }
+
+  void set_priority(int sd, int prio, int domain) {
+    handler.set_priority(sd, prio, domain);
+  }
+  int fd() const {
+    return _fd;
+  }
+};
+
+class IoUringConnectedSocketImpl final : public ConnectedSocketImpl {
+  IoUringSocket *s;
+
+ public:
+  explicit IoUringConnectedSocketImpl(IoUringSocket *s) : s(s) {}
+  ~IoUringConnectedSocketImpl() override {
+    if (s)
+      s->close();
+  }
+  int is_connected() override {
+    return s->is_connected();
+  }
+  ssize_t read(char *buf, size_t len) override {
+    return s->read(buf, len);
+  }
+  ssize_t send(ceph::buffer::list &bl, bool more) override {
+    return s->send(bl, more);
+  }
+  void shutdown() override {
+    s->shutdown();
+  }
+  void close() override {
+    if (s) {
+      s->close();
+      s = nullptr;
+    }
+  }
+  void set_priority(int sd, int prio, int domain) override {
+    s->set_priority(sd, prio, domain);
+  }
+  int fd() const override {
+    return s->fd();
+  }
+};
+
+/**
+ * State of a listening socket; a multishot accept collects incoming
+ * connections and accept() hands them out.  Lifetime as IoUringSocket.
+ */
+class IoUringListener final : public IoUringDriver::Handler {
+  enum {
+    OP_ACCEPT,
+    OP_CANCEL,
+  };
+
+  CephContext *cct;
+  EventCenter *center;
+  IoUringDriver *driver;
+  ceph::NetHandler &handler;
+  int _fd;
+  bool armed = false;
+  bool closed = false;
+  int error = 0;
+  unsigned inflight = 0;
+  std::deque<int> accepted;
+
+  void arm() {
+    struct io_uring_sqe *sqe = driver->get_sqe();
+    io_uring_prep_multishot_accept(sqe, _fd, nullptr, nullptr, SOCK_CLOEXEC);
+    io_uring_sqe_set_data64(sqe, IoUringDriver::make_user_data(this, OP_ACCEPT));
+    ++inflight;
+    armed = true;
+  }
+
+ public:
+  IoUringListener(CephContext *c, IoUringWorker *w, ceph::NetHandler &h, int f)
+    : cct(c), center(&w->center), driver(w->get_driver()), handler(h), _fd(f) {}
+
+  void start() {
+    driver->manage(_fd);
+    arm();
+  }
+
+  void handle_cqe(unsigned op, int res, uint32_t flags) override {
+    if (!(flags & IORING_CQE_F_MORE)) {
+      --inflight;
+      if (op == OP_ACCEPT)
+	armed = false;
+    }
+    if (op == OP_ACCEPT) {
+      if (res >= 0) {
+	if (closed)
+	  ::close(res);
+	else
+	  accepted.push_back(res);
+      } else if (res != -ECANCELED && !closed) {
+	// reported once by accept(), which re-arms
+	error = res;
+      }
+      if (!closed)
+	driver->set_ready(_fd, EVENT_READABLE);
+    }
+    if (closed && inflight == 0) {
+      driver->unmanage(_fd);
+      ::close(_fd);
+      delete this;
+    }
+  }
+
+  int accept(ConnectedSocket *sock, const SocketOptions &opt,
+	     entity_addr_t *out, unsigned addr_type, Worker *w) {
+    if (accepted.empty()) {
+      if (error) {
+	int r = error;
+	error = 0;
+	return r;
+      }
+      if (!armed)
+	arm();
+      return -EAGAIN;
+    }
+    int sd = accepted.front();
+    accepted.pop_front();
+
+    int r = handler.set_socket_options(sd, opt.nodelay, opt.rcbuf_size);
+    if (r < 0) {
+      ::close(sd);
+      return r;
+    }
+
+    sockaddr_storage ss;
+    socklen_t slen = sizeof(ss);
+    if (::getpeername(sd, (sockaddr*)&ss, &slen) < 0) {
+      r = -ceph_sock_errno();
+      ::close(sd);
+      return r;
+    }
+
+    ceph_assert(NULL != out); //out should not be NULL in accept connection
+
+    out->set_type(addr_type);
+    out->set_sockaddr((sockaddr*)&ss);
+    handler.set_priority(sd, opt.priority, out->get_family());
+
+    IoUringSocket *s = new IoUringSocket(w->cct, static_cast<IoUringWorker*>(w),
+					 handler, *out, sd, true);
+    if (w->center.in_thread()) {
+      s->start();
+    } else {
+      // queued ahead of anything the new connection submits to that worker
+      w->center.submit_to(w->center.get_id(), [s] { s->start(); }, true);
+    }
+    *sock = ConnectedSocket(std::make_unique<IoUringConnectedSocketImpl>(s));
+    return 0;
+  }
+
+  void close() {
+    if (!center->in_thread()) {
+      center->submit_to(center->get_id(), [this] { close(); }, true);
+      return;
+    }
+    closed = true;
+    for (int sd : accepted)
+      ::close(sd);
+    accepted.clear();
+    // refuse new connections now rather than once the accept is cancelled
+    ::shutdown(_fd, SHUT_RDWR);
+    if (armed) {
+      struct io_uring_sqe *sqe = driver->get_sqe();
+      io_uring_prep_cancel64(sqe, IoUringDriver::make_user_data(this, OP_ACCEPT), 0);
+      io_uring_sqe_set_data64(sqe, IoUringDriver::make_user_data(this, OP_CANCEL));
+      ++inflight;
+    }
+    if (inflight == 0) {
+      driver->unmanage(_fd);
+      ::close(_fd);
+      delete this;
+    }
+  }
+
+  int fd() const {
+    return _fd;
+  }
+};
+
+class IoUringServerSocketImpl : public ServerSocketImpl {
+  IoUringListener *l;
+  int _fd;
+
+ public:
+  IoUringServerSocketImpl(IoUringListener *l, const entity_addr_t& listen_addr,
+			  unsigned slot)
+    : ServerSocketImpl(listen_addr.get_type(), slot),
+      l(l), _fd(l->fd()) {}
+  int accept(ConnectedSocket *sock, const SocketOptions &opts, entity_addr_t *out, Worker *w) override {
+    ceph_assert(sock);
+    return l->accept(sock, opts, out, addr_type, w);
+  }
+  void abort_accept() override {
+    if (l) {
+      l->close();
+      l = nullptr;
+      _fd = -1;
+    }
+  }
+  int fd() const override {
+    return _fd;
+  }
+};
+
+int IoUringWorker::listen(entity_addr_t &sa,
+			  unsigned addr_slot,
+			  const SocketOptions &opt,
+			  ServerSocket *sock)
+{
+  int listen_sd = net.create_socket(sa.get_family(), true);
+  if (listen_sd < 0) {
+    return listen_sd;
+  }
+
+  int r = net.set_socket_options(listen_sd, opt.nodelay, opt.rcbuf_size);
+  if (r < 0) {
+    ::close(listen_sd);
+    return r;
+  }
+
+  r = ::bind(listen_sd, sa.get_sockaddr(), sa.get_sockaddr_len());
+  if (r < 0) {
+    r = -ceph_sock_errno();
+    ldout(cct, 10) << __func__ << " unable to bind to " << sa.get_sockaddr()
+                   << ": " << cpp_strerror(r) << dendl;
+    ::close(listen_sd);
+    return r;
+  }
+
+  r = ::listen(listen_sd, cct->_conf->ms_tcp_listen_backlog);
+  if (r < 0) {
+    r = -ceph_sock_errno();
+    lderr(cct) << __func__ << " unable to listen on " << sa << ": " << cpp_strerror(r) << dendl;
+    ::close(listen_sd);
+    return r;
+  }
+
+  // the Processor calls us on this worker's thread
+  IoUringListener *l = new IoUringListener(cct, this, net, listen_sd);
+  l->start();
+  *sock = ServerSocket(
+          std::unique_ptr<IoUringServerSocketImpl>(
+	    new IoUringServerSocketImpl(l, sa, addr_slot)));
+  return 0;
+}
+
+int IoUringWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, ConnectedSocket *socket) {
+  int sd = net.create_socket(addr.get_family());
+  if (sd < 0) {
+    return sd;
+  }
+
+  net.set_socket_options(sd, cct->_conf->ms_tcp_nodelay, cct->_conf->ms_tcp_rcvbuf);
+
+  entity_addr_t bind_addr = opts.connect_bind_addr;
+  if (cct->_conf->ms_bind_before_connect && (!bind_addr.is_blank_ip())) {
+    bind_addr.set_port(0);
+    int r = ::bind(sd, bind_addr.get_sockaddr(), bind_addr.get_sockaddr_len());
+    if (r < 0) {
+      r = -ceph_sock_errno();
+      ldout(cct, 2) << __func__ << " client bind error " << ", " << cpp_strerror(r) << dendl;
+      ::close(sd);
+      return r;
+    }
+  }
+
+  net.set_priority(sd, opts.priority, addr.get_family());
+  // completes asynchronously whatever opts.nonblock says; is_connected()
+  // tells once it has
+  IoUringSocket *s = new IoUringSocket(cct, this, net, addr, sd, false);
+  s->connect();
+  *socket = ConnectedSocket(std::make_unique<IoUringConnectedSocketImpl>(s));
+  return 0;
+}
+
+IoUringNetworkStack::IoUringNetworkStack(CephContext *c)
+    : NetworkStack(c)
+{
+}
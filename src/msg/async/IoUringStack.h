@@ -0,0 +1,71 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_ASYNC_IOURINGSTACK_H
+#define CEPH_MSG_ASYNC_IOURINGSTACK_H
+
+#include <thread>
+
+#include "msg/msg_types.h"
+#include "msg/async/net_handler.h"
+
+#include "EventIoUring.h"
+#include "Stack.h"
+
+/**
+ * TCP transport doing all socket I/O through the worker's io_uring.
+ *
+ * Sockets are plain blocking TCP sockets.  Each one keeps a multishot
+ * recv armed that fills buffers from the ring's provided buffer pool,
+ * up to ms_async_io_uring_recv_buffers_per_connection of them until
+ * read() returns some, and at most one sendmsg in flight that carries
+ * everything queued by send() since the previous one was submitted.
+ * Connecting is a nonblocking connect(2) as with PosixStack, reported as
+ * writable once it completes.  The submissions of all
+ * connections on a worker go out together with one io_uring_enter() per
+ * event loop iteration, see IoUringDriver.
+ */
+class IoUringWorker : public Worker {
+  ceph::NetHandler net;
+ public:
+  IoUringWorker(CephContext *c, unsigned i)
+      : Worker(c, i), net(c) {}
+  IoUringDriver *get_driver() {
+    return static_cast<IoUringDriver*>(center.get_driver());
+  }
+  int listen(entity_addr_t &sa,
+	     unsigned addr_slot,
+	     const SocketOptions &opt,
+	     ServerSocket *socks) override;
+  int connect(const entity_addr_t &addr, const SocketOptions &opts, ConnectedSocket *socket) override;
+};
+
+class IoUringNetworkStack : public NetworkStack {
+  std::vector<std::thread> threads;
+
+  virtual Worker* create_worker(CephContext *c, unsigned worker_id) override {
+    return new IoUringWorker(c, worker_id);
+  }
+
+ public:
+  explicit IoUringNetworkStack(CephContext *c);
+
+  void spawn_worker(std::function<void ()> &&func) override {
+    threads.emplace_back(std::move(func));
+  }
+  void join_worker(unsigned i) override {
+    ceph_assert(threads.size() > i && threads[i].joinable());
+    threads[i].join();
+  }
+};
+
+#endif //CEPH_MSG_ASYNC_IOURINGSTACK_H
@@ -15,12 +15,20 @@
  */
 
 #include <sys/socket.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
 
 #include <algorithm>
+#include <deque>
+#include <map>
 
 #include "PosixStack.h"
 
@@ -37,16 +45,107 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "PosixStack "
 
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && \
+  defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_MSG_ZEROCOPY 1
+#endif
+
 class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
+  CephContext *cct;
   ceph::NetHandler &handler;
   int _fd;
   entity_addr_t sa;
   bool connected;
 
+#ifdef HAVE_MSG_ZEROCOPY
+  // MSG_ZEROCOPY state.  The kernel numbers every successful zerocopy
+  // sendmsg() on the socket and later reports completed ranges of those
+  // numbers on the error queue; until then the pages are still referenced
+  // by queued skbs and must not be released or reused.
+  struct zerocopy_pending_t {
+    uint32_t last_seq;	      // last sendmsg() covering these bytes
+    ceph::buffer::list bl;
+  };
+  uint64_t zerocopy_min = 0;  // 0 means zerocopy is off for this socket
+  uint32_t zerocopy_next_seq = 0;
+  uint32_t zerocopy_done = 0; // every seq before this has completed
+  std::map<uint32_t, uint32_t> zerocopy_done_ranges; // out of order lo -> hi
+  std::deque<zerocopy_pending_t> zerocopy_pending;
+
+  static bool seq_before(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+  }
+
+  void zerocopy_complete(uint32_t lo, uint32_t hi) {
+    if (lo != zerocopy_done) {
+      zerocopy_done_ranges[lo] = hi;
+      return;
+    }
+    zerocopy_done = hi + 1;
+    for (auto p = zerocopy_done_ranges.find(zerocopy_done);
+	 p != zerocopy_done_ranges.end();
+	 p = zerocopy_done_ranges.find(zerocopy_done)) {
+      zerocopy_done = p->second + 1;
+      zerocopy_done_ranges.erase(p);
+    }
+  }
+
+  // drain zerocopy completions from the socket error queue and drop our
+  // references to the buffers the kernel is done with.
+  void reap_zerocopy() {
+    while (!zerocopy_pending.empty()) {
+      char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (::recvmsg(_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+	break;
+      for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+	if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+	      (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+	  continue;
+	auto serr = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+	if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+	  continue;
+	if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && zerocopy_min) {
+	  // the kernel had to copy anyway (e.g. loopback or a device without
+	  // scatter-gather); pinning pages only costs us from here on.
+	  ldout(cct, 10) << __func__ << " fd " << _fd
+				 << " zerocopy send was copied, disabling"
+				 << dendl;
+	  zerocopy_min = 0;
+	}
+	zerocopy_complete(serr->ee_info, serr->ee_data);
+      }
+      while (!zerocopy_pending.empty() &&
+	     seq_before(zerocopy_pending.front().last_seq, zerocopy_done)) {
+	zerocopy_pending.pop_front();
+      }
+    }
+  }
+#endif
+
  public:
-  explicit PosixConnectedSocketImpl(ceph::NetHandler &h, const entity_addr_t &sa,
-				    int f, bool connected)
-      : handler(h), _fd(f), sa(sa), connected(connected) {}
+  explicit PosixConnectedSocketImpl(CephContext *c, ceph::NetHandler &h,
+				    const entity_addr_t &sa, int f, bool connected)
+      : cct(c), handler(h), _fd(f), sa(sa), connected(connected) {
+#ifdef HAVE_MSG_ZEROCOPY
+    uint64_t min_size =
+      cct->_conf.get_val<Option::size_t>("ms_tcp_zerocopy_min_size");
+    if (min_size) {
+      int on = 1;
+      if (::setsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+	zerocopy_min = min_size;
+      } else {
+	int r = ceph_sock_errno();
+	ldout(cct, 5) << __func__ << " fd " << _fd
+			      << " cannot enable SO_ZEROCOPY: "
+			      << cpp_strerror(r) << dendl;
+      }
+    }
+#endif
+  }
 
   int is_connected() override {
     if (connected)
@@ -64,6 +163,10 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
 
   ssize_t read(char *buf, size_t len) override {
+#ifdef HAVE_MSG_ZEROCOPY
+    // completions raise EPOLLERR, which is delivered as a read event
+    reap_zerocopy();
+#endif
     #ifdef _WIN32
     ssize_t r = ::recv(_fd, buf, len, 0);
     #else
@@ -74,25 +177,53 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     return r;
   }
 
+  #ifndef _WIN32
+  ssize_t read_with_tail(char *buf, size_t len, char *tail,
+			 size_t tail_len) override {
+#ifdef HAVE_MSG_ZEROCOPY
+    reap_zerocopy();
+#endif
+    struct iovec iov[2] = {{buf, len}, {tail, tail_len}};
+    ssize_t r = ::readv(_fd, iov, 2);
+    if (r < 0)
+      r = -ceph_sock_errno();
+    return r;
+  }
+  #endif
+
   // return the sent length
   // < 0 means error occurred
   #ifndef _WIN32
-  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more)
+  // if "zerocopy_calls" is given, MSG_ZEROCOPY is tried and it is bumped
+  // for every sendmsg() the kernel accepted that way.
+  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more,
+			    uint32_t *zerocopy_calls = nullptr)
   {
     size_t sent = 0;
+    int zerocopy_flag = 0;
+#ifdef HAVE_MSG_ZEROCOPY
+    if (zerocopy_calls)
+      zerocopy_flag = MSG_ZEROCOPY;
+#endif
     while (1) {
       MSGR_SIGPIPE_STOPPER;
       ssize_t r;
-      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0) | zerocopy_flag);
       if (r < 0) {
         int err = ceph_sock_errno();
         if (err == EINTR) {
           continue;
         } else if (err == EAGAIN) {
           break;
+        } else if (err == ENOBUFS && zerocopy_flag) {
+          // out of optmem for completion notifications; copy instead
+          zerocopy_flag = 0;
+          continue;
         }
         return -err;
       }
+      if (zerocopy_flag)
+        ++*zerocopy_calls;
 
       sent += r;
       if (len == sent) break;
@@ -115,27 +246,49 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 
   ssize_t send(ceph::buffer::list &bl, bool more) override {
     size_t sent_bytes = 0;
+    uint32_t zerocopy_calls = 0;
+#ifdef HAVE_MSG_ZEROCOPY
+    reap_zerocopy();
+#endif
     auto pb = std::cbegin(bl.buffers());
-    uint64_t left_pbrs = bl.get_num_buffers();
-    while (left_pbrs) {
+    auto pend = std::cend(bl.buffers());
+    while (pb != pend) {
       struct msghdr msg;
       struct iovec msgvec[IOV_MAX];
-      uint64_t size = std::min<uint64_t>(left_pbrs, IOV_MAX);
-      left_pbrs -= size;
       // FIPS zeroization audit 20191115: this memset is not security related.
       memset(&msg, 0, sizeof(msg));
-      msg.msg_iovlen = size;
       msg.msg_iov = msgvec;
       unsigned msglen = 0;
-      for (auto iov = msgvec; iov != msgvec + size; iov++) {
-	iov->iov_base = (void*)(pb->c_str());
-	iov->iov_len = pb->length();
-	msglen += pb->length();
-	++pb;
+      uint32_t *zc = nullptr;
+      size_t size = 0;
+      while (pb != pend && size < IOV_MAX) {
+        bool large = false;
+#ifdef HAVE_MSG_ZEROCOPY
+        // a large segment is sent alone with MSG_ZEROCOPY, the small ones
+        // around it (headers, footers) are copied
+        large = zerocopy_min && pb->length() >= zerocopy_min;
+#endif
+        if (large && size)
+          break;
+        msgvec[size].iov_base = (void*)(pb->c_str());
+        msgvec[size].iov_len = pb->length();
+        msglen += pb->length();
+        ++size;
+        ++pb;
+        if (large) {
+          zc = &zerocopy_calls;
+          break;
+        }
       }
-      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more);
-      if (r < 0)
+      msg.msg_iovlen = size;
+      ssize_t r = do_sendmsg(_fd, msg, msglen, pb != pend || more, zc);
+      if (r < 0) {
+#ifdef HAVE_MSG_ZEROCOPY
+        if (zerocopy_calls)
+          hold_zerocopy(bl, sent_bytes, zerocopy_calls);
+#endif
         return r;
+      }
 
       // "r" is the remaining length
       sent_bytes += r;
@@ -144,6 +297,12 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
       // only "r" == 0 continue
     }
 
+#ifdef HAVE_MSG_ZEROCOPY
+    if (zerocopy_calls) {
+      hold_zerocopy(bl, sent_bytes, zerocopy_calls);
+      return static_cast<ssize_t>(sent_bytes);
+    }
+#endif
     if (sent_bytes) {
       ceph::buffer::list swapped;
       if (sent_bytes < bl.length()) {
@@ -156,6 +315,23 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 
     return static_cast<ssize_t>(sent_bytes);
   }
+
+#ifdef HAVE_MSG_ZEROCOPY
+  // move the sent prefix of "bl" onto the pending list instead of dropping
+  // it, so the pages stay alive until the kernel reports completion.
+  void hold_zerocopy(ceph::buffer::list &bl, size_t sent_bytes,
+		     uint32_t calls) {
+    zerocopy_pending_t p;
+    zerocopy_next_seq += calls;
+    p.last_seq = zerocopy_next_seq - 1;
+    if (sent_bytes < bl.length()) {
+      bl.splice(0, sent_bytes, &p.bl);
+    } else {
+      p.bl.swap(bl);
+    }
+    zerocopy_pending.push_back(std::move(p));
+  }
+#endif
   #else
   ssize_t send(bufferlist &bl, bool more) override
   {
@@ -204,6 +380,20 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     ::shutdown(_fd, SHUT_RDWR);
   }
   void close() override {
+#ifdef HAVE_MSG_ZEROCOPY
+    reap_zerocopy();
+    if (!zerocopy_pending.empty()) {
+      // the kernel may still be transmitting from the pinned pages of
+      // these buffers, which are released with us.  abort the connection
+      // so that close() discards the queued data instead of sending
+      // whatever gets written to those pages next.
+      ldout(cct, 10) << __func__ << " fd " << _fd << " "
+		     << zerocopy_pending.size()
+		     << " zerocopy sends still pending, resetting" << dendl;
+      struct linger l = {1, 0};
+      ::setsockopt(_fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+    }
+#endif
     compat_closesocket(_fd);
   }
   void set_priority(int sd, int prio, int domain) override {
@@ -262,7 +452,7 @@ int PosixServerSocketImpl::accept(ConnectedSocket *sock, const SocketOptions &op
   out->set_sockaddr((sockaddr*)&ss);
   handler.set_priority(sd, opt.priority, out->get_family());
 
-  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(handler, *out, sd, true));
+  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(w->cct, handler, *out, sd, true));
   *sock = ConnectedSocket(std::move(csi));
   return 0;
 }
@@ -331,7 +521,7 @@ int PosixWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, C
 
   net.set_priority(sd, opts.priority, addr.get_family());
   *socket = ConnectedSocket(
-      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock)));
+      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(cct, net, addr, sd, !opts.nonblock)));
   return 0;
 }
 
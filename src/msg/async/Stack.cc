@@ -26,6 +26,9 @@
 #ifdef HAVE_DPDK
 #include "dpdk/DPDKStack.h"
 #endif
+#ifdef HAVE_ASYNC_IO_URING
+#include "IoUringStack.h"
+#endif
 
 #include "common/dout.h"
 #include "include/ceph_assert.h"
@@ -54,6 +57,7 @@ std::function<void ()> NetworkStack::add_thread(Worker* w)
           // TODO do something?
         }
         w->perf_logger->tinc(l_msgr_running_total_time, dur);
+        w->busy_ns.fetch_add(dur.count(), std::memory_order_relaxed);
       }
       w->reset();
       w->destroy();
@@ -75,6 +79,10 @@ std::shared_ptr<NetworkStack> NetworkStack::create(CephContext *c,
   else if (t == "dpdk")
     stack.reset(new DPDKStack(c));
 #endif
+#ifdef HAVE_ASYNC_IO_URING
+  else if (t == "io_uring")
+    stack.reset(new IoUringNetworkStack(c));
+#endif
 
   if (stack == nullptr) {
     lderr(c) << __func__ << " ms_async_transport_type " << t <<
@@ -143,7 +151,8 @@ Worker* NetworkStack::get_worker()
   // this will happen so rarely that there's no need for special case.
   for (Worker* worker : workers) {
     unsigned worker_load = worker->references.load();
-    if (worker_load < min_load) {
+    if (worker_load < min_load ||
+	(worker_load == min_load && worker->load < current_best->load)) {
       current_best = worker;
       min_load = worker_load;
     }
@@ -155,6 +164,32 @@ Worker* NetworkStack::get_worker()
   return current_best;
 }
 
+void NetworkStack::sample_load(ceph::timespan min_interval)
+{
+  std::lock_guard lk(pool_spin);
+  auto now = ceph::mono_clock::now();
+  if (last_busy_ns.size() != workers.size()) {
+    last_busy_ns.resize(workers.size());
+    for (unsigned i = 0; i < workers.size(); ++i)
+      last_busy_ns[i] = workers[i]->busy_ns.load(std::memory_order_relaxed);
+    last_load_sample = now;
+    return;
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    now - last_load_sample).count();
+  if (elapsed <= 0 || now - last_load_sample < min_interval)
+    return;
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    uint64_t busy = workers[i]->busy_ns.load(std::memory_order_relaxed);
+    unsigned load = std::min<uint64_t>(
+      1000, (busy - last_busy_ns[i]) * 1000 / elapsed);
+    last_busy_ns[i] = busy;
+    workers[i]->load = load;
+    workers[i]->perf_logger->set(l_msgr_load, load);
+  }
+  last_load_sample = now;
+}
+
 void NetworkStack::stop()
 {
   std::lock_guard lk(pool_spin);
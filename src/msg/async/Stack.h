@@ -28,6 +28,16 @@ class ConnectedSocketImpl {
   virtual ~ConnectedSocketImpl() {}
   virtual int is_connected() = 0;
   virtual ssize_t read(char*, size_t) = 0;
+  // fill "buf" first and then, if more is already available, "tail"
+  virtual ssize_t read_with_tail(char *buf, size_t len, char *tail, size_t tail_len) {
+    ssize_t r = read(buf, len);
+    if (r == static_cast<ssize_t>(len)) {
+      ssize_t t = read(tail, tail_len);
+      if (t > 0)
+        r += t;
+    }
+    return r;
+  }
   virtual ssize_t send(ceph::buffer::list &bl, bool more) = 0;
   virtual void shutdown() = 0;
   virtual void close() = 0;
@@ -94,6 +104,13 @@ class ConnectedSocket {
   ssize_t read(char* buf, size_t len) {
     return _csi->read(buf, len);
   }
+  /// Read into \c buf and continue into \c tail.
+  ///
+  /// Behaves like readv(2) over the two buffers: \c tail only receives
+  /// data once \c buf is full.
+  ssize_t read_with_tail(char* buf, size_t len, char* tail, size_t tail_len) {
+    return _csi->read_with_tail(buf, len, tail, tail_len);
+  }
   /// Gets the output stream.
   ///
   /// Gets an object that sends data to the remote endpoint.
@@ -211,6 +228,10 @@ enum {
   l_msgr_recv_encrypted_bytes,
   l_msgr_send_encrypted_bytes,
 
+  l_msgr_load,
+  l_msgr_migrated_in_connections,
+  l_msgr_migrated_out_connections,
+
   l_msgr_last,
 };
 
@@ -229,6 +250,11 @@ class Worker {
   std::atomic_uint references;
   EventCenter center;
 
+  /// time spent handling events, see NetworkStack::sample_load()
+  std::atomic<uint64_t> busy_ns = {0};
+  /// busy time over the last sample, in 1/1000 of a thread
+  std::atomic<unsigned> load = {0};
+
   Worker(const Worker&) = delete;
   Worker& operator=(const Worker&) = delete;
 
@@ -257,6 +283,10 @@ class Worker {
     plb.add_u64_counter(l_msgr_recv_encrypted_bytes, "msgr_recv_encrypted_bytes", "Network received encrypted bytes", NULL, 0, unit_t(UNIT_BYTES));
     plb.add_u64_counter(l_msgr_send_encrypted_bytes, "msgr_send_encrypted_bytes", "Network sent encrypted bytes", NULL, 0, unit_t(UNIT_BYTES));
 
+    plb.add_u64(l_msgr_load, "msgr_load", "Recent busy time of the worker thread, in permille");
+    plb.add_u64_counter(l_msgr_migrated_in_connections, "msgr_migrated_in_connections", "Connections moved to this worker for balance");
+    plb.add_u64_counter(l_msgr_migrated_out_connections, "msgr_migrated_out_connections", "Connections moved off this worker for balance");
+
     perf_logger = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perf_logger);
   }
@@ -306,6 +336,8 @@ class Worker {
 class NetworkStack {
   ceph::spinlock pool_spin;
   bool started = false;
+  ceph::mono_clock::time_point last_load_sample;
+  std::vector<uint64_t> last_busy_ns;
 
   std::function<void ()> add_thread(Worker* w);
 
@@ -341,6 +373,10 @@ class NetworkStack {
   // need to let each thread do binding port.
   virtual bool support_local_listen_table() const { return false; }
   virtual bool nonblock_connect_need_writable_event() const { return true; }
+  // whether a connected socket may be handed from one worker's
+  // EventCenter to another's; only true for stacks whose sockets are
+  // plain fds with no per-worker state.
+  virtual bool support_connection_migration() const { return false; }
 
   void start();
   void stop();
@@ -349,6 +385,8 @@ class NetworkStack {
     return workers[worker_id];
   }
   void drain();
+  /// refresh Worker::load unless the last sample is younger than min_interval
+  void sample_load(ceph::timespan min_interval);
   unsigned get_num_worker() const {
     return workers.size();
   }
@@ -0,0 +1,265 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_TIMERWHEEL_H
+#define CEPH_MSG_TIMERWHEEL_H
+
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "include/ceph_assert.h"
+
+/**
+ * Hierarchical timing wheel.
+ *
+ * Time is measured in abstract ticks.  Level L has 64 slots of 64^L ticks
+ * each; a timer sits in the lowest level whose span covers its distance
+ * from the current tick and is cascaded one level down whenever the wheel
+ * crosses into its slot.  Timers further out than the top level can
+ * reach are parked in the top level and re-filed on every cascade.
+ *
+ * Insert and cancel are O(1).  Timers are kept in intrusive lists
+ * indexed into a single vector, and an id carries its node index plus a
+ * generation, so cancelling never needs a lookup table.  Expired timers
+ * are moved in bulk, a whole slot at a time, onto an expired queue that
+ * the caller drains with pop_expired().
+ *
+ * Not thread safe.
+ */
+template <typename T>
+class TimerWheel {
+ public:
+  using tick_t = uint64_t;
+
+ private:
+  static constexpr unsigned SLOT_BITS = 6;
+  static constexpr unsigned SLOTS = 1u << SLOT_BITS;
+  static constexpr unsigned LEVELS = 6;
+  static constexpr tick_t MAX_SPAN = tick_t(1) << (SLOT_BITS * LEVELS);
+
+  // list heads: one per slot, then the expired queue
+  static constexpr uint32_t EXPIRED = LEVELS * SLOTS;
+  static constexpr uint32_t NUM_LISTS = EXPIRED + 1;
+  static constexpr uint32_t FREE = ~0u;
+
+  struct node_t {
+    uint32_t prev = 0, next = 0;
+    uint32_t list = FREE;     ///< list head this node hangs off, or FREE
+    uint32_t gen = 0;
+    tick_t expire = 0;
+    T payload = T();
+  };
+
+  std::vector<node_t> nodes;  ///< [0, NUM_LISTS) are the list heads
+  uint32_t free_head = FREE;
+  uint64_t occupied[LEVELS] = {};  ///< non-empty slots, per level
+  tick_t cur;
+  size_t num = 0;
+
+  static uint64_t make_id(uint32_t gen, uint32_t idx) {
+    return (uint64_t(gen) << 32) | idx;
+  }
+
+  void link_tail(uint32_t list, uint32_t idx) {
+    node_t &n = nodes[idx];
+    n.list = list;
+    n.next = list;
+    n.prev = nodes[list].prev;
+    nodes[n.prev].next = idx;
+    nodes[list].prev = idx;
+    if (list < EXPIRED)
+      occupied[list / SLOTS] |= uint64_t(1) << (list % SLOTS);
+  }
+
+  void unlink(uint32_t idx) {
+    node_t &n = nodes[idx];
+    nodes[n.prev].next = n.next;
+    nodes[n.next].prev = n.prev;
+    uint32_t list = n.list;
+    if (list < EXPIRED && nodes[list].next == list)
+      occupied[list / SLOTS] &= ~(uint64_t(1) << (list % SLOTS));
+    n.list = FREE;
+  }
+
+  void release(uint32_t idx) {
+    node_t &n = nodes[idx];
+    n.payload = T();
+    n.next = free_head;
+    free_head = idx;
+    --num;
+  }
+
+  // file a node by its expiry relative to "cur"
+  void place(uint32_t idx) {
+    tick_t expire = nodes[idx].expire;
+    if (expire <= cur) {
+      link_tail(EXPIRED, idx);
+      return;
+    }
+    tick_t delta = expire - cur;
+    if (delta >= MAX_SPAN) {
+      delta = MAX_SPAN - 1;
+      expire = cur + delta;
+    }
+    unsigned level = (63 - std::countl_zero(delta)) / SLOT_BITS;
+    unsigned slot = (expire >> (level * SLOT_BITS)) & (SLOTS - 1);
+    link_tail(level * SLOTS + slot, idx);
+  }
+
+  // apply "fn" to every node on "list", after emptying it
+  template <typename F>
+  void drain_list(uint32_t list, F &&fn) {
+    uint32_t idx = nodes[list].next;
+    if (idx == list)
+      return;
+    nodes[nodes[list].prev].next = FREE;
+    nodes[list].next = nodes[list].prev = list;
+    if (list < EXPIRED)
+      occupied[list / SLOTS] &= ~(uint64_t(1) << (list % SLOTS));
+    while (idx != FREE) {
+      uint32_t next = nodes[idx].next;
+      fn(idx);
+      idx = next;
+    }
+  }
+
+  // "cur" just crossed a level-1 boundary: re-file the slots whose span
+  // starts here, from level 1 upwards as far as the boundary reaches
+  void cascade() {
+    for (unsigned level = 1; level < LEVELS; ++level) {
+      unsigned slot = (cur >> (level * SLOT_BITS)) & (SLOTS - 1);
+      drain_list(level * SLOTS + slot, [this](uint32_t idx) { place(idx); });
+      if (slot)
+	break;
+    }
+  }
+
+  // the first tick after "cur" at which a level-0 slot fires or a
+  // higher level slot cascades
+  std::optional<tick_t> next_slot() const {
+    std::optional<tick_t> best;
+    for (unsigned level = 0; level < LEVELS; ++level) {
+      uint64_t bits = occupied[level];
+      if (!bits)
+	continue;
+      unsigned shift = level * SLOT_BITS;
+      tick_t pos = cur >> shift;
+      unsigned idx = pos & (SLOTS - 1);
+      uint64_t ahead = idx == SLOTS - 1 ? 0 : bits & (~uint64_t(0) << (idx + 1));
+      tick_t slot = ahead ? std::countr_zero(ahead) :
+	std::countr_zero(bits) + SLOTS;
+      tick_t t = (pos - idx + slot) << shift;
+      if (!best || t < *best)
+	best = t;
+    }
+    return best;
+  }
+
+ public:
+  explicit TimerWheel(tick_t now = 0) : nodes(NUM_LISTS), cur(now) {
+    for (uint32_t i = 0; i < NUM_LISTS; ++i)
+      nodes[i].prev = nodes[i].next = i;
+  }
+
+  tick_t now() const { return cur; }
+  size_t size() const { return num; }
+  bool empty() const { return num == 0; }
+
+  /// arm a timer firing once the wheel reaches "expire"; never returns 0
+  uint64_t add(tick_t expire, T payload) {
+    uint32_t idx;
+    if (free_head != FREE) {
+      idx = free_head;
+      free_head = nodes[idx].next;
+    } else {
+      idx = nodes.size();
+      ceph_assert(idx != FREE);
+      nodes.emplace_back();
+    }
+    node_t &n = nodes[idx];
+    ++n.gen;
+    n.expire = expire;
+    n.payload = std::move(payload);
+    ++num;
+    place(idx);
+    return make_id(n.gen, idx);
+  }
+
+  /// disarm a timer; false if it already fired or was cancelled
+  bool cancel(uint64_t id) {
+    uint32_t idx = id & 0xffffffff;
+    if (idx < NUM_LISTS || idx >= nodes.size())
+      return false;
+    node_t &n = nodes[idx];
+    if (n.list == FREE || make_id(n.gen, idx) != id)
+      return false;
+    unlink(idx);
+    release(idx);
+    return true;
+  }
+
+  /// move every timer due at or before "now" onto the expired queue
+  void advance(tick_t now) {
+    // hop from one occupied slot (or cascade point) to the next rather
+    // than tick by tick; nothing happens in between
+    while (cur < now) {
+      auto next = next_slot();
+      if (!next || *next > now) {
+	cur = now;
+	break;
+      }
+      cur = *next;
+      if ((cur & (SLOTS - 1)) == 0)
+	cascade();
+      drain_list(cur & (SLOTS - 1), [this](uint32_t idx) {
+	link_tail(EXPIRED, idx);
+      });
+    }
+  }
+
+  /// take the oldest expired timer, if any
+  bool pop_expired(uint64_t *id, T *payload) {
+    uint32_t idx = nodes[EXPIRED].next;
+    if (idx == EXPIRED)
+      return false;
+    unlink(idx);
+    *id = make_id(nodes[idx].gen, idx);
+    *payload = std::move(nodes[idx].payload);
+    release(idx);
+    return true;
+  }
+
+  /**
+   * earliest tick at which advance() may have work to do
+   *
+   * This is exact for timers in level 0 and a lower bound (the cascade
+   * point) for the others, so a caller sleeping until then never
+   * oversleeps a timer.
+   */
+  std::optional<tick_t> next_wakeup() const {
+    if (nodes[EXPIRED].next != EXPIRED)
+      return cur;
+    return next_slot();
+  }
+
+  void clear() {
+    for (uint32_t list = 0; list < NUM_LISTS; ++list)
+      drain_list(list, [this](uint32_t idx) {
+	nodes[idx].list = FREE;
+	release(idx);
+      });
+  }
+};
+
+#endif
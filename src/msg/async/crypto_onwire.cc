@@ -19,6 +19,13 @@ static constexpr const std::size_t AESGCM_IV_LEN{12};
 static constexpr const std::size_t AESGCM_TAG_LEN{16};
 static constexpr const std::size_t AESGCM_BLOCK_LEN{16};
 
+// OpenSSL only engages its stitched AES-NI/VAES GCM kernels for long
+// inputs, and any piece that isn't a multiple of the block size leaves
+// a partial block for the next call to finish.  Runs of buffers shorter
+// than this are therefore handed to EVP together: contiguous on rx,
+// copied next to each other into the output buffer on tx.
+static constexpr const std::size_t AESGCM_COALESCE_LEN{2048};
+
 struct nonce_t {
   ceph_le32 fixed;
   ceph_le64 counter;
@@ -31,6 +38,20 @@ static_assert(sizeof(nonce_t) == AESGCM_IV_LEN);
 
 using key_t = std::array<std::uint8_t, AESGCM_KEY_LEN>;
 
+static const EVP_CIPHER* aes_128_gcm()
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  // fetch explicitly so the provider lookup happens once, not whenever a
+  // context is set up
+  static EVP_CIPHER* const cipher =
+    EVP_CIPHER_fetch(nullptr, "AES-128-GCM", nullptr);
+  if (cipher) {
+    return cipher;
+  }
+#endif
+  return EVP_aes_128_gcm();
+}
+
 // http://www.mindspring.com/~dmcgrew/gcm-nist-6.pdf
 // https://www.openssl.org/docs/man1.0.2/crypto/EVP_aes_128_gcm.html#GCM-mode
 // https://wiki.openssl.org/index.php/EVP_Authenticated_Encryption_and_Decryption
@@ -39,11 +60,17 @@ class AES128GCM_OnWireTxHandler : public ceph::crypto::onwire::TxHandler {
   CephContext* const cct;
   std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)> ectx;
   ceph::bufferlist buffer;
+  // plaintext copied into "buffer" but not encrypted yet
+  char* pending = nullptr;
+  unsigned pending_len = 0;
   nonce_t nonce, initial_nonce;
   bool used_initial_nonce;
   bool new_nonce_format;  // 64-bit counter?
   static_assert(sizeof(nonce) == AESGCM_IV_LEN);
 
+  void encrypt(char* out, const char* in, unsigned len);
+  void flush_pending();
+
 public:
   AES128GCM_OnWireTxHandler(CephContext* const cct,
 			    const key_t& key,
@@ -56,7 +83,7 @@ public:
     ceph_assert_always(ectx);
     ceph_assert_always(key.size() * CHAR_BIT == 128);
 
-    if (1 != EVP_EncryptInit_ex(ectx.get(), EVP_aes_128_gcm(),
+    if (1 != EVP_EncryptInit_ex(ectx.get(), aes_128_gcm(),
 			        nullptr, nullptr, nullptr)) {
       throw std::runtime_error("EVP_EncryptInit_ex failed");
     }
@@ -95,6 +122,8 @@ void AES128GCM_OnWireTxHandler::reset_tx_handler(const uint32_t* first,
 
   ceph_assert(buffer.get_append_buffer_unused_tail_length() == 0);
   buffer.reserve(std::accumulate(first, last, AESGCM_TAG_LEN));
+  pending = nullptr;
+  pending_len = 0;
 
   if (!new_nonce_format) {
     // msgr2.0: 32-bit counter followed by 64-bit fixed field,
@@ -105,6 +134,31 @@ void AES128GCM_OnWireTxHandler::reset_tx_handler(const uint32_t* first,
   }
 }
 
+void AES128GCM_OnWireTxHandler::encrypt(char* out, const char* in,
+                                         unsigned len)
+{
+  int update_len = 0;
+
+  if(1 != EVP_EncryptUpdate(ectx.get(),
+      reinterpret_cast<unsigned char*>(out),
+      &update_len,
+      reinterpret_cast<const unsigned char*>(in),
+      len)) {
+    throw std::runtime_error("EVP_EncryptUpdate failed");
+  }
+  ceph_assert_always(update_len >= 0);
+  ceph_assert(static_cast<unsigned>(update_len) == len);
+}
+
+void AES128GCM_OnWireTxHandler::flush_pending()
+{
+  if (pending_len > 0) {
+    encrypt(pending, pending, pending_len);
+  }
+  pending = nullptr;
+  pending_len = 0;
+}
+
 void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
   const ceph::bufferlist& plaintext)
 {
@@ -112,19 +166,22 @@ void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
               plaintext.length());
   auto filler = buffer.append_hole(plaintext.length());
 
+  // the plaintext buffers may be shared (e.g. with a message kept for
+  // resending), so they are never encrypted in place; short ones are
+  // gathered in the output and encrypted there in one go, possibly
+  // together with those of the preceding and following updates.
   for (const auto& plainbuf : plaintext.buffers()) {
-    int update_len = 0;
-
-    if(1 != EVP_EncryptUpdate(ectx.get(),
-	reinterpret_cast<unsigned char*>(filler.c_str()),
-	&update_len,
-	reinterpret_cast<const unsigned char*>(plainbuf.c_str()),
-	plainbuf.length())) {
-      throw std::runtime_error("EVP_EncryptUpdate failed");
+    if (plainbuf.length() < AESGCM_COALESCE_LEN) {
+      if (!pending) {
+        pending = filler.c_str();
+      }
+      filler.copy_in(plainbuf.length(), plainbuf.c_str());
+      pending_len += plainbuf.length();
+    } else {
+      flush_pending();
+      encrypt(filler.c_str(), plainbuf.c_str(), plainbuf.length());
+      filler.advance(plainbuf.length());
     }
-    ceph_assert_always(update_len >= 0);
-    ceph_assert(static_cast<unsigned>(update_len) == plainbuf.length());
-    filler.advance(update_len);
   }
 
   ldout(cct, 15) << __func__
@@ -135,6 +192,8 @@ void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
 
 ceph::bufferlist AES128GCM_OnWireTxHandler::authenticated_encrypt_final()
 {
+  flush_pending();
+
   int final_len = 0;
   ceph_assert(buffer.get_append_buffer_unused_tail_length() ==
               AESGCM_BLOCK_LEN);
@@ -177,7 +236,7 @@ public:
     ceph_assert_always(ectx);
     ceph_assert_always(key.size() * CHAR_BIT == 128);
 
-    if (1 != EVP_DecryptInit_ex(ectx.get(), EVP_aes_128_gcm(),
+    if (1 != EVP_DecryptInit_ex(ectx.get(), aes_128_gcm(),
 			        nullptr, nullptr, nullptr)) {
       throw std::runtime_error("EVP_DecryptInit_ex failed");
     }
@@ -221,16 +280,32 @@ void AES128GCM_OnWireRxHandler::authenticated_decrypt_update(
 {
   // discard cached crcs as we will be writing through c_str()
   bl.invalidate_crc();
-  for (auto& buf : bl.buffers()) {
-    auto p = reinterpret_cast<unsigned char*>(const_cast<char*>(buf.c_str()));
-    int update_len = 0;
 
-    if (1 != EVP_DecryptUpdate(ectx.get(), p, &update_len, p, buf.length())) {
+  // buffers carved out of the same receive buffer are usually adjacent
+  // in memory; decrypt each such run with a single call
+  unsigned char* run = nullptr;
+  unsigned run_len = 0;
+  auto flush_run = [this, &run, &run_len] {
+    if (run_len == 0) {
+      return;
+    }
+    int update_len = 0;
+    if (1 != EVP_DecryptUpdate(ectx.get(), run, &update_len, run, run_len)) {
       throw std::runtime_error("EVP_DecryptUpdate failed");
     }
     ceph_assert_always(update_len >= 0);
-    ceph_assert(static_cast<unsigned>(update_len) == buf.length());
+    ceph_assert(static_cast<unsigned>(update_len) == run_len);
+  };
+  for (auto& buf : bl.buffers()) {
+    auto p = reinterpret_cast<unsigned char*>(const_cast<char*>(buf.c_str()));
+    if (run + run_len != p) {
+      flush_run();
+      run = p;
+      run_len = 0;
+    }
+    run_len += buf.length();
   }
+  flush_run();
 }
 
 void AES128GCM_OnWireRxHandler::authenticated_decrypt_update_final(
@@ -371,6 +371,31 @@ void BlueFS::_init_logger()
 		    "Bytes requested in prefetch read mode",
 		     NULL,
 		    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_read_prefetch_async_count,
+		    "read_prefetch_async_count",
+		    "Asynchronous readahead reads issued for sequential readers",
+		    NULL,
+		    PerfCountersBuilder::PRIO_USEFUL);
+  b.add_u64_counter(l_bluefs_read_prefetch_async_bytes,
+		    "read_prefetch_async_bytes",
+		    "Bytes read by asynchronous readahead",
+		    NULL,
+		    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_read_prefetch_async_hit,
+		    "read_prefetch_async_hit",
+		    "Asynchronous readahead reads consumed by a reader",
+		    NULL,
+		    PerfCountersBuilder::PRIO_USEFUL);
+  b.add_u64_counter(l_bluefs_read_random_multi_count,
+		    "read_random_multi_count",
+		    "Batched random read calls (RocksDB MultiRead)",
+		    NULL,
+		    PerfCountersBuilder::PRIO_USEFUL);
+  b.add_u64_counter(l_bluefs_read_random_multi_reqs,
+		    "read_random_multi_reqs",
+		    "Ranges read by batched random read calls",
+		    NULL,
+		    PerfCountersBuilder::PRIO_USEFUL);
  b.add_time_avg     (l_bluefs_compaction_lat, "compact_lat",
                     "Average bluefs log compaction latency",
                     "c__t",
@@ -2147,6 +2172,189 @@ int64_t BlueFS::_read_random(
   return ret;
 }
 
+int BlueFS::_read_random_multi(
+  FileReader *h,
+  read_random_req_t *reqs,
+  size_t n)
+{
+  dout(10) << __func__ << " h " << h << " " << n << " reqs"
+	   << " from " << lock_fnode_print(h->file) << dendl;
+  logger->inc(l_bluefs_read_random_multi_count, 1);
+  logger->inc(l_bluefs_read_random_multi_reqs, n);
+
+  if (n > 1 &&
+      cct->_conf->bluefs_buffered_io &&
+      !cct->_conf->bluefs_check_for_zeros) {
+    // the page cache serves the reads one by one; have the kernel start
+    // fetching all of them first so that they reach the device together
+    uint64_t size = h->file->fnode.size;
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t off = reqs[i].offset;
+      uint64_t end = off + reqs[i].len;
+      if (!h->ignore_eof) {
+	end = std::min(end, size);
+      }
+      while (off < end) {
+	uint64_t x_off = 0;
+	auto p = h->file->fnode.seek(off, &x_off);
+	if (p == h->file->fnode.extents.end()) {
+	  break;
+	}
+	uint64_t l = std::min(p->length - x_off, end - off);
+	bdev[p->bdev]->readahead(p->offset + x_off, l);
+	off += l;
+      }
+    }
+  }
+  if (n < 2 ||
+      cct->_conf->bluefs_buffered_io ||
+      cct->_conf->bluefs_check_for_zeros) {
+    for (size_t i = 0; i < n; ++i) {
+      reqs[i].r = _read_random(h, reqs[i].offset, reqs[i].len, reqs[i].out);
+    }
+    return 0;
+  }
+
+  // each request is rounded out to whole blocks, which is what the
+  // device aio needs; only the requested part is copied out afterwards
+  struct piece_t {
+    read_random_req_t *req;
+    uint64_t pos;   ///< offset into req->out
+    uint64_t skip;  ///< leading bytes of bl before the requested part
+    uint64_t len;   ///< bytes of bl to copy to req->out + pos
+    bufferlist bl;
+  };
+  std::deque<piece_t> pieces;
+  std::array<std::unique_ptr<IOContext>, MAX_BDEV> iocs;
+
+  ++h->file->num_reading;
+  uint64_t size = h->file->fnode.size;
+  for (size_t i = 0; i < n; ++i) {
+    auto& req = reqs[i];
+    uint64_t len = req.len;
+    if (!h->ignore_eof && req.offset + len > size) {
+      len = req.offset > size ? 0 : size - req.offset;
+    }
+    req.r = len;
+    if (!len) {
+      continue;
+    }
+    logger->inc(l_bluefs_read_random_count, 1);
+    logger->inc(l_bluefs_read_random_bytes, len);
+    uint64_t req_end = req.offset + len;
+    uint64_t off = p2align(req.offset, (uint64_t)super.block_size);
+    uint64_t end = p2roundup(req_end, (uint64_t)super.block_size);
+    while (off < end) {
+      uint64_t x_off = 0;
+      auto p = h->file->fnode.seek(off, &x_off);
+      ceph_assert(p != h->file->fnode.extents.end());
+      uint64_t l = std::min(p->length - x_off, end - off);
+      dout(20) << __func__ << " read random 0x"
+	       << std::hex << x_off << "~" << l << std::dec
+	       << " of " << *p << dendl;
+      auto& ioc = iocs[p->bdev];
+      if (!ioc) {
+	ioc = std::make_unique<IOContext>(cct, nullptr, true);
+      }
+      uint64_t from = std::max(off, req.offset);
+      uint64_t to = std::min(off + l, req_end);
+      auto& piece = pieces.emplace_back(
+	piece_t{&req, from - req.offset, from - off, to - from});
+      int r = bdev[p->bdev]->aio_read(p->offset + x_off, l, &piece.bl,
+				      ioc.get());
+      ceph_assert(r == 0);
+      logger->inc(l_bluefs_read_random_disk_count, 1);
+      logger->inc(l_bluefs_read_random_disk_bytes, l);
+      switch (p->bdev) {
+	case BDEV_WAL: logger->inc(l_bluefs_read_random_disk_bytes_wal, l); break;
+	case BDEV_DB: logger->inc(l_bluefs_read_random_disk_bytes_db, l); break;
+	case BDEV_SLOW: logger->inc(l_bluefs_read_random_disk_bytes_slow, l); break;
+      }
+      off += l;
+    }
+  }
+  for (unsigned i = 0; i < MAX_BDEV; ++i) {
+    if (iocs[i] && iocs[i]->has_pending_aios()) {
+      bdev[i]->aio_submit(iocs[i].get());
+    }
+  }
+
+  int ret = 0;
+  for (auto& ioc : iocs) {
+    if (ioc) {
+      ioc->aio_wait();
+      if (ioc->get_return_value() < 0) {
+	ret = ioc->get_return_value();
+      }
+      ioc->release_running_aios();
+    }
+  }
+  if (ret < 0) {
+    derr << __func__ << " failed: " << cpp_strerror(ret) << dendl;
+  } else {
+    for (auto& piece : pieces) {
+      auto q = piece.bl.cbegin(piece.skip);
+      q.copy(piece.len, piece.req->out + piece.pos);
+    }
+  }
+  --h->file->num_reading;
+  return ret;
+}
+
+void BlueFS::_prefetch_async(FileReader *h)
+{
+  FileReaderBuffer *buf = &(h->buf);
+  ceph_assert(!buf->pf_len);
+  if (h->ignore_eof ||
+      !cct->_conf.get_val<bool>("bluefs_async_prefetch")) {
+    return;
+  }
+  uint64_t start = buf->get_buf_end();
+  uint64_t eof_offset = round_up_to(h->file->fnode.size, super.block_size);
+  if (start >= eof_offset) {
+    return;
+  }
+  uint64_t x_off = 0;
+  auto p = h->file->fnode.seek(start, &x_off);
+  if (p == h->file->fnode.extents.end()) {
+    return;
+  }
+  uint64_t l = std::min({p->length - x_off, buf->readahead,
+			 eof_offset - start});
+  dout(20) << __func__ << " 0x" << std::hex << start << "~" << l
+	   << " (0x" << x_off << " of " << *p << ")" << std::dec << dendl;
+  if (cct->_conf->bluefs_buffered_io) {
+    // the next buffered read finds it in the page cache; nothing to track
+    bdev[p->bdev]->readahead(p->offset + x_off, l);
+    logger->inc(l_bluefs_read_prefetch_async_count, 1);
+    logger->inc(l_bluefs_read_prefetch_async_bytes, l);
+    return;
+  }
+  if (!buf->pf_ioc) {
+    buf->pf_ioc = std::make_unique<IOContext>(cct, nullptr, true);
+  }
+  int r = bdev[p->bdev]->aio_read(p->offset + x_off, l, &buf->pf_bl,
+				  buf->pf_ioc.get());
+  if (r < 0) {
+    buf->pf_bl.clear();
+    return;
+  }
+  if (buf->pf_ioc->has_pending_aios()) {
+    bdev[p->bdev]->aio_submit(buf->pf_ioc.get());
+  }
+  buf->pf_off = start;
+  buf->pf_len = l;
+  logger->inc(l_bluefs_read_prefetch_async_count, 1);
+  logger->inc(l_bluefs_read_prefetch_async_bytes, l);
+  logger->inc(l_bluefs_read_disk_count, 1);
+  logger->inc(l_bluefs_read_disk_bytes, l);
+  switch (p->bdev) {
+    case BDEV_WAL: logger->inc(l_bluefs_read_disk_bytes_wal, l); break;
+    case BDEV_DB: logger->inc(l_bluefs_read_disk_bytes_db, l); break;
+    case BDEV_SLOW: logger->inc(l_bluefs_read_disk_bytes_slow, l); break;
+  }
+}
+
 int64_t BlueFS::_read(
   FileReader *h,         ///< [in] read from here
   uint64_t off,          ///< [in] offset
@@ -2194,6 +2402,47 @@ int64_t BlueFS::_read(
       buf->bl.reassign_to_mempool(mempool::mempool_bluefs_file_reader);
       if (off < buf->bl_off || off >= buf->get_buf_end()) {
         // if precondition hasn't changed during locking upgrade.
+	// a reader continuing right where the buffer ends is sequential:
+	// grow its readahead, otherwise start over from max_prefetch
+	bool sequential = buf->bl.length() && off == buf->get_buf_end();
+	if (sequential) {
+	  buf->readahead = std::clamp(
+	    buf->readahead * 2, buf->max_prefetch,
+	    std::max<uint64_t>(
+	      buf->max_prefetch,
+	      cct->_conf.get_val<Option::size_t>("bluefs_readahead_max")));
+	} else {
+	  buf->readahead = buf->max_prefetch;
+	}
+	if (buf->pf_len &&
+	    off >= buf->pf_off && off < buf->pf_off + buf->pf_len) {
+	  buf->pf_ioc->aio_wait();
+	  int r = buf->pf_ioc->get_return_value();
+	  buf->pf_ioc->release_running_aios();
+	  if (r == 0) {
+	    dout(20) << __func__ << " using async prefetch 0x"
+		     << std::hex << buf->pf_off << "~" << buf->pf_len
+		     << std::dec << dendl;
+	    buf->bl = std::move(buf->pf_bl);
+	    buf->bl.reassign_to_mempool(mempool::mempool_bluefs_file_reader);
+	    buf->bl_off = buf->pf_off;
+	    logger->inc(l_bluefs_read_prefetch_async_hit, 1);
+	  } else {
+	    derr << __func__ << " async prefetch 0x" << std::hex << buf->pf_off
+		 << "~" << buf->pf_len << std::dec << " failed: "
+		 << cpp_strerror(r) << ", reading again" << dendl;
+	  }
+	  buf->pf_bl.clear();
+	  buf->pf_off = 0;
+	  buf->pf_len = 0;
+	  if (r == 0) {
+	    _prefetch_async(h);
+	    u_lock.unlock();
+	    s_lock.lock();
+	    continue;
+	  }
+	}
+	buf->drop_prefetch();
         buf->bl.clear();
         buf->bl_off = off & super.block_mask();
         uint64_t x_off = 0;
@@ -2206,7 +2455,7 @@ int64_t BlueFS::_read(
 
         uint64_t want = round_up_to(len + (off & ~super.block_mask()),
 				    super.block_size);
-        want = std::max(want, buf->max_prefetch);
+        want = std::max(want, buf->readahead);
         uint64_t l = std::min(p->length - x_off, want);
         //hard cap to 1GB
 	l = std::min(l, uint64_t(1) << 30);
@@ -2231,6 +2480,9 @@ int64_t BlueFS::_read(
 	logger->inc(l_bluefs_read_disk_bytes, l);
 
         ceph_assert(r == 0);
+	if (sequential) {
+	  _prefetch_async(h);
+	}
       }
       u_lock.unlock();
       s_lock.lock();
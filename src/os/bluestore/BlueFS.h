@@ -6,6 +6,7 @@
 #include <atomic>
 #include <mutex>
 #include <limits>
+#include <memory>
 
 #include "bluefs_types.h"
 #include "blk/BlockDevice.h"
@@ -61,6 +62,11 @@ enum {
   l_bluefs_read_disk_bytes_slow,
   l_bluefs_read_prefetch_count,
   l_bluefs_read_prefetch_bytes,
+  l_bluefs_read_prefetch_async_count,
+  l_bluefs_read_prefetch_async_bytes,
+  l_bluefs_read_prefetch_async_hit,
+  l_bluefs_read_random_multi_count,
+  l_bluefs_read_random_multi_reqs,
   l_bluefs_compaction_lat,
   l_bluefs_compaction_lock_lat,
   l_bluefs_alloc_shared_dev_fallbacks,
@@ -270,9 +276,31 @@ public:
     ceph::buffer::list bl;          ///< prefetch buffer
     uint64_t pos = 0;       ///< current logical offset
     uint64_t max_prefetch;  ///< max allowed prefetch
+    uint64_t readahead;     ///< current sequential readahead, >= max_prefetch
+
+    // asynchronous read of the range following the buffer, issued
+    // while the reader is sequential
+    uint64_t pf_off = 0;
+    uint64_t pf_len = 0;    ///< 0 if nothing is in flight
+    ceph::buffer::list pf_bl;
+    std::unique_ptr<IOContext> pf_ioc;
 
     explicit FileReaderBuffer(uint64_t mpf)
-      : max_prefetch(mpf) {}
+      : max_prefetch(mpf), readahead(mpf) {}
+    ~FileReaderBuffer() {
+      drop_prefetch();
+    }
+
+    /// wait for the async prefetch, if any, and forget about it
+    void drop_prefetch() {
+      if (pf_len) {
+	pf_ioc->aio_wait();
+	pf_ioc->release_running_aios();
+	pf_bl.clear();
+	pf_off = 0;
+	pf_len = 0;
+      }
+    }
 
     uint64_t get_buf_end() const {
       return bl_off + bl.length();
@@ -294,6 +322,9 @@ public:
 	bl.clear();
 	bl_off = 0;
       }
+      if (offset >= pf_off && offset < pf_off + pf_len) {
+	drop_prefetch();
+      }
     }
   };
 
@@ -322,6 +353,13 @@ public:
     }
   };
 
+  struct read_random_req_t {
+    uint64_t offset = 0;
+    uint64_t len = 0;
+    char *out = nullptr;
+    int64_t r = 0;       ///< [out] bytes read
+  };
+
   struct FileLock {
     MEMPOOL_CLASS_HELPERS();
 
@@ -507,6 +545,11 @@ private:
     uint64_t offset, ///< [in] offset
     uint64_t len,    ///< [in] this many bytes
     char *out);      ///< [out] optional: or copy it here
+  int _read_random_multi(
+    FileReader *h,   ///< [in] read from here
+    read_random_req_t *reqs, ///< [in,out] requests
+    size_t n);       ///< [in] number of requests
+  void _prefetch_async(FileReader *h);
 
   int _open_super();
   int _write_super(int dev);
@@ -658,6 +701,12 @@ public:
     // atomics and asserts).
     return _read_random(h, offset, len, out);
   }
+  /// read several ranges of a file; the device reads of all of them
+  /// are issued before waiting for any
+  int read_random_multi(FileReader *h, read_random_req_t *reqs, size_t n) {
+    // no need to hold the global lock here, see read_random()
+    return _read_random_multi(h, reqs, n);
+  }
   void invalidate_cache(FileRef f, uint64_t offset, uint64_t len);
   int preallocate(FileRef f, uint64_t offset, uint64_t len);
   int truncate(FileWriter *h, uint64_t offset);
@@ -121,6 +121,28 @@ class BlueRocksRandomAccessFile : public rocksdb::RandomAccessFile {
     return rocksdb::Status::OK();
   }
 
+  // Read a bunch of blocks as described by reqs. The blocks can
+  // optionally be read in parallel.
+  rocksdb::Status MultiRead(rocksdb::ReadRequest* reqs,
+			    size_t num_reqs) override {
+    std::vector<BlueFS::read_random_req_t> rr(num_reqs);
+    for (size_t i = 0; i < num_reqs; ++i) {
+      rr[i].offset = reqs[i].offset;
+      rr[i].len = reqs[i].len;
+      rr[i].out = reqs[i].scratch;
+    }
+    int r = fs->read_random_multi(h, rr.data(), num_reqs);
+    if (r < 0) {
+      return err_to_status(r);
+    }
+    for (size_t i = 0; i < num_reqs; ++i) {
+      ceph_assert(rr[i].r >= 0);
+      reqs[i].result = rocksdb::Slice(reqs[i].scratch, rr[i].r);
+      reqs[i].status = rocksdb::Status::OK();
+    }
+    return rocksdb::Status::OK();
+  }
+
   // Tries to get an unique ID for this file that will be the same each time
   // the file is opened (and will stay the same while the file is open).
   // Furthermore, it tries to make this ID at most "max_size" bytes. If such an
@@ -36,6 +36,7 @@
 #include "include/stringify.h"
 #include "include/str_map.h"
 #include "include/util.h"
+#include "common/admin_socket.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
 #include "common/PriorityCache.h"
@@ -118,6 +119,7 @@ using ceph::make_timespan;
 using ceph::mono_clock;
 using ceph::mono_time;
 using ceph::timespan_str;
+using TOPNSPC::common::cmd_getval;
 
 // kv store prefixes
 const string PREFIX_SUPER = "S";       // field -> value
@@ -151,6 +153,109 @@ const string BLUESTORE_GLOBAL_STATFS_KEY = "bluestore_statfs";
 
 #define OBJECT_MAX_SIZE 0xffffffff // 32 bits
 
+class BlueStore::SocketHook : public AdminSocketHook {
+  BlueStore* store;
+public:
+  static BlueStore::SocketHook* create(BlueStore* store)
+  {
+    BlueStore::SocketHook* hook = nullptr;
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    if (admin_socket) {
+      hook = new BlueStore::SocketHook(store);
+      int r = admin_socket->register_command(
+	"bluestore deferred policy",
+	hook,
+	"Show the state of the adaptive deferred write policy");
+      if (r != 0) {
+	ldout(store->cct, 1) << __func__ << " cannot register SocketHook"
+			     << dendl;
+	delete hook;
+	hook = nullptr;
+      } else {
+	r = admin_socket->register_command(
+	  "bluestore deferred policy pin "
+	  "name=prefer_deferred_size,type=CephInt,range=0 "
+	  "name=deferred_batch_ops,type=CephInt,range=0",
+	  hook,
+	  "Pin the deferred write thresholds, overriding the adaptive policy");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command(
+	  "bluestore deferred policy unpin",
+	  hook,
+	  "Let the adaptive deferred write policy move the thresholds again");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command(
+	  "bluestore rocksdb reshard "
+	  "name=sharding,type=CephString",
+	  hook,
+	  "Reshard a column family of the db online (shard count and hash range only)");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command(
+	  "bluestore rocksdb reshard status",
+	  hook,
+	  "Show the progress of an online reshard of the db");
+	ceph_assert(r == 0);
+      }
+    }
+    return hook;
+  }
+
+  ~SocketHook() {
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    admin_socket->unregister_commands(this);
+  }
+private:
+  SocketHook(BlueStore* store) :
+    store(store) {}
+  int call(std::string_view command, const cmdmap_t& cmdmap,
+	   const bufferlist&,
+	   Formatter *f,
+	   std::ostream& errss,
+	   bufferlist& out) override {
+    if (command == "bluestore rocksdb reshard" ||
+	command == "bluestore rocksdb reshard status") {
+      auto rdb = dynamic_cast<RocksDBStore*>(store->db);
+      if (!rdb) {
+	errss << "db is not rocksdb" << std::endl;
+	return -EOPNOTSUPP;
+      }
+      if (command == "bluestore rocksdb reshard") {
+	std::string sharding;
+	cmd_getval(cmdmap, "sharding", sharding);
+	int r = rdb->reshard_online(sharding);
+	if (r < 0) {
+	  errss << "cannot reshard online: " << cpp_strerror(r) << std::endl;
+	  return r;
+	}
+      }
+      rdb->dump_online_reshard(f);
+      return 0;
+    }
+    if (command == "bluestore deferred policy pin") {
+      int64_t size = 0, batch_ops = 0;
+      cmd_getval(cmdmap, "prefer_deferred_size", size);
+      cmd_getval(cmdmap, "deferred_batch_ops", batch_ops);
+      store->deferred_policy.pin(size, batch_ops);
+      store->prefer_deferred_size = size;
+      store->deferred_batch_ops = batch_ops;
+    } else if (command == "bluestore deferred policy unpin") {
+      store->deferred_policy.unpin();
+      if (!store->deferred_adaptive && store->bdev) {
+	// nothing will move them again, go back to the configured values
+	store->_set_alloc_sizes();
+      }
+    } else if (command != "bluestore deferred policy") {
+      errss << "Invalid command" << std::endl;
+      return -ENOSYS;
+    }
+    f->open_object_section("deferred_policy");
+    f->dump_bool("adaptive", store->deferred_adaptive);
+    store->deferred_policy.dump(f);
+    f->close_section();
+    return 0;
+  }
+};
+
 
 /*
  * extent map blob encoding
@@ -1870,7 +1975,7 @@ void BlueStore::BufferSpace::_finish_write(BufferCacheShard* cache, uint64_t seq
       b->state = Buffer::STATE_CLEAN;
       writing.erase(i++);
       b->maybe_rebuild();
-      b->data.reassign_to_mempool(mempool::mempool_bluestore_cache_data);
+      cache->_adopt_data(b);
       cache->_add(b, 1, nullptr);
       ldout(cache->cct, 20) << __func__ << " added " << *b << dendl;
     }
@@ -4634,15 +4739,19 @@ BlueStore::BlueStore(CephContext *cct,
 #endif
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(std::countr_zero(_min_alloc_size)),
+    deferred_policy(cct),
+    compression_pool(cct),
     mempool_thread(this)
 {
   _init_logger();
   cct->_conf.add_observer(this);
   set_cache_shards(1);
+  asok_hook = SocketHook::create(this);
 }
 
 BlueStore::~BlueStore()
 {
+  delete asok_hook;
   cct->_conf.remove_observer(this);
   _shutdown_logger();
   ceph_assert(!mounted);
@@ -4680,6 +4789,7 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_deferred_batch_ops",
     "bluestore_deferred_batch_ops_hdd",
     "bluestore_deferred_batch_ops_ssd",
+    "bluestore_deferred_adaptive",
     "bluestore_throttle_bytes",
     "bluestore_throttle_deferred_bytes",
     "bluestore_throttle_cost_per_io_hdd",
@@ -4745,7 +4855,8 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
       changed.count("bluestore_max_alloc_size") ||
       changed.count("bluestore_deferred_batch_ops") ||
       changed.count("bluestore_deferred_batch_ops_hdd") ||
-      changed.count("bluestore_deferred_batch_ops_ssd")) {
+      changed.count("bluestore_deferred_batch_ops_ssd") ||
+      changed.count("bluestore_deferred_adaptive")) {
     if (bdev) {
       // only after startup
       _set_alloc_sizes();
@@ -5197,6 +5308,33 @@ void BlueStore::_init_logger()
       "Small writes into existing or sparse small blobs skipped due to zero detection (bytes)");
   //****************************************
 
+  // adaptive deferred write policy
+  //****************************************
+  b.add_u64(l_bluestore_deferred_adaptive_size, "deferred_adaptive_size",
+	    "Current prefer_deferred_size threshold",
+	    NULL,
+	    PerfCountersBuilder::PRIO_DEBUGONLY,
+	    UNIT_BYTES);
+  b.add_u64(l_bluestore_deferred_adaptive_batch_ops,
+	    "deferred_adaptive_batch_ops",
+	    "Current deferred_batch_ops threshold");
+  b.add_u64(l_bluestore_deferred_adaptive_main_lat,
+	    "deferred_adaptive_main_lat",
+	    "Main device write tail latency (us) seen by the deferred policy");
+  b.add_u64(l_bluestore_deferred_adaptive_db_lat,
+	    "deferred_adaptive_db_lat",
+	    "DB device commit tail latency (us) seen by the deferred policy");
+  b.add_u64_counter(l_bluestore_deferred_adaptive_raised,
+		    "deferred_adaptive_raised",
+		    "Times the deferred policy raised the thresholds");
+  b.add_u64_counter(l_bluestore_deferred_adaptive_lowered,
+		    "deferred_adaptive_lowered",
+		    "Times the deferred policy lowered the thresholds");
+  b.add_u64_counter(l_bluestore_deferred_adaptive_relaxed,
+		    "deferred_adaptive_relaxed",
+		    "Times the deferred policy moved back towards the config");
+  //****************************************
+
   // compressions stats
   //****************************************
   b.add_u64(l_bluestore_compressed, "compressed",
@@ -5262,6 +5400,16 @@ void BlueStore::_init_logger()
 	    NULL,
 	    PerfCountersBuilder::PRIO_DEBUGONLY,
 	    unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_buffer_arena_bytes, "buffer_arena_bytes",
+	    "Bytes mapped by the buffer cache arenas",
+	    NULL,
+	    PerfCountersBuilder::PRIO_DEBUGONLY,
+	    unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_buffer_arena_used_bytes, "buffer_arena_used_bytes",
+	    "Bytes of the buffer cache arenas holding buffer data",
+	    NULL,
+	    PerfCountersBuilder::PRIO_DEBUGONLY,
+	    unit_t(UNIT_BYTES));
   //****************************************
 
   // internal stats
@@ -5339,6 +5487,14 @@ void BlueStore::_init_logger()
     alloc_hist_x_axis_config, alloc_hist_y_axis_config,
     "Histogram of requested block allocations vs. given ones");
 
+  // updated by every shard thread for every read and transaction
+  for (int idx : {l_bluestore_throttle_lat, l_bluestore_submit_lat,
+		  l_bluestore_txc, l_bluestore_read_onode_meta_lat,
+		  l_bluestore_read_wait_aio_lat, l_bluestore_csum_lat,
+		  l_bluestore_read_lat}) {
+    b.set_sharded(idx);
+  }
+
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -5507,41 +5663,85 @@ void BlueStore::_set_alloc_sizes(void)
 {
   max_alloc_size = cct->_conf->bluestore_max_alloc_size;
 
+  bool adaptive = cct->_conf.get_val<bool>("bluestore_deferred_adaptive");
+  uint64_t base_deferred_size;
 #ifdef HAVE_LIBZBD
   ceph_assert(bdev);
   if (bdev->is_smr()) {
-    prefer_deferred_size = 0;
+    base_deferred_size = 0;
+    adaptive = false;
   } else
 #endif
   if (cct->_conf->bluestore_prefer_deferred_size) {
-    prefer_deferred_size = cct->_conf->bluestore_prefer_deferred_size;
+    base_deferred_size = cct->_conf->bluestore_prefer_deferred_size;
   } else {
     if (_use_rotational_settings()) {
-      prefer_deferred_size = cct->_conf->bluestore_prefer_deferred_size_hdd;
+      base_deferred_size = cct->_conf->bluestore_prefer_deferred_size_hdd;
     } else {
-      prefer_deferred_size = cct->_conf->bluestore_prefer_deferred_size_ssd;
+      base_deferred_size = cct->_conf->bluestore_prefer_deferred_size_ssd;
     }
   }
 
+  int base_batch_ops;
   if (cct->_conf->bluestore_deferred_batch_ops) {
-    deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops;
+    base_batch_ops = cct->_conf->bluestore_deferred_batch_ops;
   } else {
     if (_use_rotational_settings()) {
-      deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops_hdd;
+      base_batch_ops = cct->_conf->bluestore_deferred_batch_ops_hdd;
     } else {
-      deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops_ssd;
+      base_batch_ops = cct->_conf->bluestore_deferred_batch_ops_ssd;
     }
   }
 
+  deferred_policy.set_base(base_deferred_size, base_batch_ops);
+  deferred_adaptive = adaptive;
+  if (adaptive || deferred_policy.is_pinned()) {
+    prefer_deferred_size = deferred_policy.get_prefer_deferred_size();
+    deferred_batch_ops = deferred_policy.get_deferred_batch_ops();
+  } else {
+    prefer_deferred_size = base_deferred_size;
+    deferred_batch_ops = base_batch_ops;
+  }
+  logger->set(l_bluestore_deferred_adaptive_size, prefer_deferred_size);
+  logger->set(l_bluestore_deferred_adaptive_batch_ops, deferred_batch_ops);
+
   dout(10) << __func__ << " min_alloc_size 0x" << std::hex << min_alloc_size
 	   << std::dec << " order " << (int)min_alloc_size_order
 	   << " max_alloc_size 0x" << std::hex << max_alloc_size
 	   << " prefer_deferred_size 0x" << prefer_deferred_size
 	   << std::dec
 	   << " deferred_batch_ops " << deferred_batch_ops
+	   << " adaptive " << adaptive
 	   << dendl;
 }
 
+void BlueStore::_update_deferred_policy()
+{
+  DeferredWritePolicy::decision_t d;
+  if (!deferred_policy.maybe_update(mono_clock::now(), &d)) {
+    return;
+  }
+  prefer_deferred_size = d.prefer_deferred_size;
+  deferred_batch_ops = d.deferred_batch_ops;
+  logger->set(l_bluestore_deferred_adaptive_size, d.prefer_deferred_size);
+  logger->set(l_bluestore_deferred_adaptive_batch_ops, d.deferred_batch_ops);
+  logger->set(l_bluestore_deferred_adaptive_main_lat, d.main_lat_us);
+  logger->set(l_bluestore_deferred_adaptive_db_lat, d.db_lat_us);
+  switch (d.applied) {
+  case DeferredWritePolicy::verdict_t::RAISE:
+    logger->inc(l_bluestore_deferred_adaptive_raised);
+    break;
+  case DeferredWritePolicy::verdict_t::LOWER:
+    logger->inc(l_bluestore_deferred_adaptive_lowered);
+    break;
+  case DeferredWritePolicy::verdict_t::RELAX:
+    logger->inc(l_bluestore_deferred_adaptive_relaxed);
+    break;
+  case DeferredWritePolicy::verdict_t::NONE:
+    break;
+  }
+}
+
 int BlueStore::_open_bdev(bool create)
 {
   ceph_assert(bdev == NULL);
@@ -7694,10 +7894,25 @@ void BlueStore::set_cache_shards(unsigned num)
         OnodeCacheShard::create(cct, cct->_conf->bluestore_cache_type,
                                  logger);
   }
+  bool arena = cct->_conf.get_val<bool>("bluestore_cache_arena");
+  int numa_node = cct->_conf.get_val<int64_t>("bluestore_cache_arena_numa_node");
+  bool hugetlb = cct->_conf.get_val<bool>("bluestore_cache_arena_hugetlb");
+  uint64_t arena_max = cct->_conf.get_val<Option::size_t>(
+    "bluestore_cache_arena_max_bytes") / num;
+  // the cap is split between all shards, the existing ones included
+  for (unsigned i = 0; i < bold; ++i) {
+    if (buffer_cache_shards[i]->arena) {
+      buffer_cache_shards[i]->arena->set_max_bytes(arena_max);
+    }
+  }
   for (unsigned i = bold; i < num; ++i) {
     buffer_cache_shards[i] = 
         BufferCacheShard::create(cct, cct->_conf->bluestore_cache_type,
                                  logger);
+    if (arena) {
+      buffer_cache_shards[i]->arena =
+	BufferArena::create(cct, numa_node, hugetlb, arena_max);
+    }
   }
 }
 
@@ -10674,12 +10889,18 @@ void BlueStore::_update_logger()
   uint64_t num_blobs = 0;
   uint64_t num_buffers = 0;
   uint64_t num_buffer_bytes = 0;
+  uint64_t arena_bytes = 0;
+  uint64_t arena_used_bytes = 0;
   for (auto c : onode_cache_shards) {
     c->add_stats(&num_onodes, &num_pinned_onodes);
   }
   for (auto c : buffer_cache_shards) {
     c->add_stats(&num_extents, &num_blobs,
                  &num_buffers, &num_buffer_bytes);
+    if (c->arena) {
+      arena_bytes += c->arena->get_slab_bytes();
+      arena_used_bytes += c->arena->get_used_bytes();
+    }
   }
   logger->set(l_bluestore_onodes, num_onodes);
   logger->set(l_bluestore_pinned_onodes, num_pinned_onodes);
@@ -10687,6 +10908,8 @@ void BlueStore::_update_logger()
   logger->set(l_bluestore_blobs, num_blobs);
   logger->set(l_bluestore_buffers, num_buffers);
   logger->set(l_bluestore_buffer_bytes, num_buffer_bytes);
+  logger->set(l_bluestore_buffer_arena_bytes, arena_bytes);
+  logger->set(l_bluestore_buffer_arena_used_bytes, arena_used_bytes);
 }
 
 // ---------------
@@ -12101,15 +12324,23 @@ int BlueStore::omap_get_values(
   {
     const string& prefix = o->get_omap_prefix();
     o->get_omap_key(string(), &final_key);
-    size_t base_key_len = final_key.size();
-    for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
-      final_key.resize(base_key_len); // keep prefix
-      final_key += *p;
-      bufferlist val;
-      if (db->get(prefix, final_key, &val) >= 0) {
-	dout(30) << __func__ << "  got " << pretty_binary_string(final_key)
+    vector<string> final_keys;
+    final_keys.reserve(keys.size());
+    for (auto& k : keys) {
+      final_keys.push_back(final_key + k);
+    }
+    vector<bufferlist> vals;
+    vector<int> rs;
+    db->multi_get(prefix, final_keys, &vals, &rs);
+    auto p = keys.begin();
+    for (size_t i = 0; i < final_keys.size(); ++i, ++p) {
+      if (rs[i] == 0) {
+	dout(30) << __func__ << "  got " << pretty_binary_string(final_keys[i])
 		 << " -> " << *p << dendl;
-	out->insert(make_pair(*p, val));
+	out->emplace_hint(out->end(), *p, std::move(vals[i]));
+      } else if (rs[i] != -ENOENT) {
+	r = rs[i];
+	break;
       }
     }
   }
@@ -12193,18 +12424,26 @@ int BlueStore::omap_check_keys(
   {
     const string& prefix = o->get_omap_prefix();
     o->get_omap_key(string(), &final_key);
-    size_t base_key_len = final_key.size();
-    for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
-      final_key.resize(base_key_len); // keep prefix
-      final_key += *p;
-      bufferlist val;
-      if (db->get(prefix, final_key, &val) >= 0) {
-	dout(30) << __func__ << "  have " << pretty_binary_string(final_key)
+    vector<string> final_keys;
+    final_keys.reserve(keys.size());
+    for (auto& k : keys) {
+      final_keys.push_back(final_key + k);
+    }
+    vector<bufferlist> vals;
+    vector<int> rs;
+    db->multi_get(prefix, final_keys, &vals, &rs);
+    auto p = keys.begin();
+    for (size_t i = 0; i < final_keys.size(); ++i, ++p) {
+      if (rs[i] == 0) {
+	dout(30) << __func__ << "  have " << pretty_binary_string(final_keys[i])
 		 << " -> " << *p << dendl;
 	out->insert(*p);
-      } else {
-	dout(30) << __func__ << "  miss " << pretty_binary_string(final_key)
+      } else if (rs[i] == -ENOENT) {
+	dout(30) << __func__ << "  miss " << pretty_binary_string(final_keys[i])
 		 << " -> " << *p << dendl;
+      } else {
+	r = rs[i];
+	break;
       }
     }
   }
@@ -12610,6 +12849,9 @@ void BlueStore::_txc_state_proc(TransContext *txc)
       {
 	mono_clock::duration lat = throttle.log_state_latency(
 	  *txc, logger, l_bluestore_state_aio_wait_lat);
+	if (deferred_adaptive) {
+	  deferred_policy.note_main_latency(lat);
+	}
 	if (ceph::to_seconds<double>(lat) >= cct->_conf->bluestore_log_op_age) {
 	  dout(0) << __func__ << " slow aio_wait, txc = " << txc
 		  << ", latency = " << lat
@@ -13202,6 +13444,8 @@ void BlueStore::_kv_start()
   dout(10) << __func__ << dendl;
 
   finisher.start();
+  compression_pool.start(
+    cct->_conf.get_val<uint64_t>("bluestore_compression_threads"));
   kv_sync_thread.create("bstore_kv_sync");
   kv_finalize_thread.create("bstore_kv_final");
 }
@@ -13239,6 +13483,7 @@ void BlueStore::_kv_stop()
   dout(10) << __func__ << " stopping finishers" << dendl;
   finisher.wait_for_empty();
   finisher.stop();
+  compression_pool.stop();
   dout(10) << __func__ << " stopped" << dendl;
 }
 
@@ -13497,6 +13742,9 @@ void BlueStore::_kv_sync_thread()
 	  l_bluestore_kv_commit_lat,
 	  dur_kv,
 	  cct->_conf->bluestore_log_op_age);
+	if (deferred_adaptive) {
+	  deferred_policy.note_db_latency(dur_kv);
+	}
 	log_latency("kv_sync",
 	  l_bluestore_kv_sync_lat,
 	  dur,
@@ -13566,6 +13814,9 @@ void BlueStore::_kv_finalize_thread()
 	  deferred_try_submit();
 	}
       }
+      if (deferred_adaptive) {
+	_update_deferred_policy();
+      }
 
       // this is as good a place as any ...
       _reap_collections();
@@ -13983,7 +14234,11 @@ void BlueStore::_deferred_aio_finish(OpSequencer *osr)
     {
       for (auto& i : b->txcs) {
 	TransContext *txc = &i;
-	throttle.log_state_latency(*txc, logger, l_bluestore_state_deferred_aio_wait_lat);
+	auto lat = throttle.log_state_latency(
+	  *txc, logger, l_bluestore_state_deferred_aio_wait_lat);
+	if (deferred_adaptive) {
+	  deferred_policy.note_main_latency(lat);
+	}
 	txc->set_state(TransContext::STATE_DEFERRED_CLEANUP);
 	costs += txc->cost;
       }
@@ -15552,18 +15807,32 @@ int BlueStore::_do_alloc_write(
   // and the condition is : (data_size < deferred).
 
   auto max_bsize = std::max(wctx->target_blob_size, min_alloc_size);
+  std::vector<CompressionPool::Job> cjobs;
+  if (c) {
+    cjobs.reserve(wctx->writes.size());
+    for (auto& wi : wctx->writes) {
+      if (wi.blob_length > min_alloc_size) {
+	ceph_assert(wi.b_off == 0);
+	ceph_assert(wi.blob_length == wi.bl.length());
+	cjobs.emplace_back(c, &wi.bl);
+      }
+    }
+    // compress all blobs of this write at once, in parallel if we have
+    // compression threads
+    compression_pool.run(
+      cjobs,
+      cct->_conf.get_val<double>("bluestore_compression_entropy_threshold"));
+  }
+  auto cjob = cjobs.begin();
   for (auto& wi : wctx->writes) {
     if (c && wi.blob_length > min_alloc_size) {
       auto start = mono_clock::now();
-
-      // compress
-      ceph_assert(wi.b_off == 0);
-      ceph_assert(wi.blob_length == wi.bl.length());
+      ceph_assert(cjob != cjobs.end());
+      auto& job = *cjob++;
 
       // FIXME: memory alignment here is bad
-      bufferlist t;
-      std::optional<int32_t> compressor_message;
-      int r = c->compress(wi.bl, t, compressor_message);
+      bufferlist& t = job.out;
+      int r = job.r;
       uint64_t want_len_raw = wi.blob_length * crr;
       uint64_t want_len = p2roundup(want_len_raw, min_alloc_size);
       bool rejected = false;
@@ -15571,11 +15840,18 @@ int BlueStore::_do_alloc_write(
       // do an approximate (fast) estimation for resulting blob size
       // that doesn't take header overhead  into account
       uint64_t result_len = p2roundup(compressed_len, min_alloc_size);
-      if (r == 0 && result_len <= want_len && result_len < wi.blob_length) {
+      if (job.skipped) {
+	dout(20) << __func__ << std::hex << "  0x" << wi.blob_length
+		 << " looks incompressible, leaving uncompressed"
+		 << std::dec << dendl;
+	logger->inc(l_bluestore_compress_rejected_count);
+	need += wi.blob_length;
+	data_size += wi.bl.length();
+      } else if (r == 0 && result_len <= want_len && result_len < wi.blob_length) {
 	bluestore_compression_header_t chdr;
 	chdr.type = c->get_type();
 	chdr.length = t.length();
-	chdr.compressor_message = compressor_message;
+	chdr.compressor_message = job.compressor_message;
 	encode(chdr, wi.compressed_bl);
 	wi.compressed_bl.claim_append(t);
 
@@ -15629,7 +15905,7 @@ int BlueStore::_do_alloc_write(
       }
       log_latency("compress@_do_alloc_write",
 	l_bluestore_compress_lat,
-        mono_clock::now() - start,
+	job.lat + (mono_clock::now() - start),
 	cct->_conf->bluestore_log_op_age );
     } else {
       need += wi.blob_length;
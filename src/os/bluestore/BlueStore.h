@@ -51,6 +51,9 @@
 
 #include "bluestore_types.h"
 #include "BlueFS.h"
+#include "BufferArena.h"
+#include "CompressionPool.h"
+#include "DeferredWritePolicy.h"
 #include "common/EventTrace.h"
 
 #ifdef WITH_BLKIN
@@ -150,6 +153,17 @@ enum {
   l_bluestore_write_small_skipped_bytes,
   //****************************************
 
+  // adaptive deferred write policy
+  //****************************************
+  l_bluestore_deferred_adaptive_size,
+  l_bluestore_deferred_adaptive_batch_ops,
+  l_bluestore_deferred_adaptive_main_lat,
+  l_bluestore_deferred_adaptive_db_lat,
+  l_bluestore_deferred_adaptive_raised,
+  l_bluestore_deferred_adaptive_lowered,
+  l_bluestore_deferred_adaptive_relaxed,
+  //****************************************
+
   // compressions stats
   //****************************************
   l_bluestore_compressed,
@@ -179,6 +193,8 @@ enum {
   l_bluestore_buffer_bytes,
   l_bluestore_buffer_hit_bytes,
   l_bluestore_buffer_miss_bytes,
+  l_bluestore_buffer_arena_bytes,
+  l_bluestore_buffer_arena_used_bytes,
   //****************************************
 
   // internal stats
@@ -393,7 +409,7 @@ public:
           writing.insert(it, *b);
         }
       } else {
-        b->data.reassign_to_mempool(mempool::mempool_bluestore_cache_data);
+        cache->_adopt_data(b);
         cache->_add(b, level, near);
       }
       cache->_audit("_add_buffer end");
@@ -1426,6 +1442,9 @@ private:
     uint64_t buffer_bytes = 0;
 
   public:
+    /// optional huge page (and NUMA bound) home for clean buffer data
+    std::shared_ptr<BufferArena> arena;
+
     BufferCacheShard(CephContext* cct) : CacheShard(cct) {}
     static BufferCacheShard *create(CephContext* cct, std::string type, 
                                     PerfCounters *logger);
@@ -1439,6 +1458,19 @@ private:
       return buffer_bytes;
     }
 
+    /// account the data of a buffer entering the cache; moves it into
+    /// the arena, if we have one
+    void _adopt_data(Buffer *b) {
+      if (arena && b->data.length() >= BufferArena::PAGE_SIZE) {
+        ceph::buffer::list bl;
+        if (arena->copy(b->data, &bl)) {
+          b->data.swap(bl);
+          return;
+        }
+      }
+      b->data.reassign_to_mempool(mempool::mempool_bluestore_cache_data);
+    }
+
     void add_extent() {
       ++num_extents;
     }
@@ -2201,6 +2233,9 @@ private:
   // --------------------------------------------------------
   // members
 private:
+  class SocketHook;
+  SocketHook* asok_hook = nullptr;
+
   BlueFS *bluefs = nullptr;
   bluefs_layout_t bluefs_layout;
   utime_t next_dump_on_bluefs_alloc_failure;
@@ -2324,12 +2359,17 @@ private:
   ///< size threshold for forced deferred writes
   std::atomic<uint64_t> prefer_deferred_size = {0};
 
+  ///< adjusts the two thresholds above when bluestore_deferred_adaptive
+  DeferredWritePolicy deferred_policy;
+  std::atomic<bool> deferred_adaptive = {false};
+
   ///< approx cost per io, in bytes
   std::atomic<uint64_t> throttle_cost_per_io = {0};
 
   std::atomic<Compressor::CompressionMode> comp_mode =
     {Compressor::COMP_NONE}; ///< compression mode
   CompressorRef compressor;
+  CompressionPool compression_pool;
   std::atomic<uint64_t> comp_min_blob_size = {0};
   std::atomic<uint64_t> comp_max_blob_size = {0};
 
@@ -2618,6 +2658,7 @@ private:
   int _write_fsid();
   void _close_fsid();
   void _set_alloc_sizes();
+  void _update_deferred_policy();
   void _set_blob_size();
   void _set_finisher_num();
   void _set_per_pool_omap();
@@ -0,0 +1,254 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "BufferArena.h"
+
+#include <sys/mman.h>
+
+#include "common/debug.h"
+#include "common/errno.h"
+#include "common/Formatter.h"
+#include "common/numa.h"
+#include "include/buffer_raw.h"
+#include "include/intarith.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef  dout_prefix
+#define dout_prefix *_dout << "bluestore.BufferArena(" << this << ") "
+
+static mempool::pool_t& cache_data_pool()
+{
+  return mempool::get_pool(mempool::mempool_bluestore_cache_data);
+}
+
+class BufferArena::raw_arena : public ceph::buffer::raw {
+  std::shared_ptr<BufferArena> arena;
+  size_t pages;
+public:
+  raw_arena(char *p, unsigned len, size_t pages,
+	    std::shared_ptr<BufferArena> arena)
+    : raw(p, len, mempool::mempool_bluestore_cache_data),
+      arena(std::move(arena)), pages(pages) {}
+  ~raw_arena() override {
+    // ~raw() takes len off the pool, which BufferArena::copy() took
+    // off already
+    cache_data_pool().adjust_count(0, len);
+    arena->release(data, pages);
+  }
+};
+
+static size_t max_bytes_to_slabs(size_t max_bytes)
+{
+  return std::max<size_t>(1, max_bytes / BufferArena::SLAB_SIZE);
+}
+
+std::shared_ptr<BufferArena> BufferArena::create(
+  CephContext *cct, int numa_node, bool hugetlb, size_t max_bytes)
+{
+  return std::shared_ptr<BufferArena>(
+    new BufferArena(cct, numa_node, hugetlb, max_bytes_to_slabs(max_bytes)));
+}
+
+void BufferArena::set_max_bytes(size_t max_bytes)
+{
+  std::lock_guard l(lock);
+  max_slabs = max_bytes_to_slabs(max_bytes);
+  // unmap free slabs over the new cap now, the others as they drain
+  for (auto it = slabs.begin();
+       it != slabs.end() && slabs.size() > max_slabs; ) {
+    if (it->second.free_pages == SLAB_PAGES) {
+      it = drop_slab(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+BufferArena::~BufferArena()
+{
+  // every raw_arena holds a reference, so all pages are back by now
+  ceph_assert(used_pages == 0);
+  for (auto& [base, slab] : slabs) {
+    unmap_slab(base);
+  }
+}
+
+void BufferArena::unmap_slab(char *base)
+{
+  dout(20) << __func__ << " " << (void*)base << dendl;
+  ::munmap(base, SLAB_SIZE);
+  cache_data_pool().adjust_count(0, -(ssize_t)SLAB_SIZE);
+}
+
+char *BufferArena::map_slab()
+{
+  void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (hugetlb) {
+    p = ::mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+      dout(5) << __func__ << " no explicit huge page available"
+	      << " (vm.nr_hugepages?), falling back to THP" << dendl;
+    }
+  }
+#endif
+  if (p == MAP_FAILED) {
+    // over-map so a 2MB aligned slab, which THP can back with a single
+    // huge page, fits; then trim the excess on both sides
+    size_t len = SLAB_SIZE * 2;
+    void *r = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+      derr << __func__ << " mmap failed: " << cpp_strerror(errno) << dendl;
+      return nullptr;
+    }
+    char *base = (char*)r;
+    char *aligned = (char*)p2roundup((uintptr_t)base, (uintptr_t)SLAB_SIZE);
+    if (aligned > base) {
+      ::munmap(base, aligned - base);
+    }
+    char *end = aligned + SLAB_SIZE;
+    if (end < base + len) {
+      ::munmap(end, base + len - end);
+    }
+#ifdef MADV_HUGEPAGE
+    ::madvise(aligned, SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+    p = aligned;
+  }
+  if (numa_node >= 0) {
+    int r = bind_memory_to_numa_node(p, SLAB_SIZE, numa_node);
+    if (r < 0) {
+      dout(5) << __func__ << " unable to bind slab to numa node "
+	      << numa_node << ": " << cpp_strerror(r) << dendl;
+    }
+  }
+  cache_data_pool().adjust_count(0, SLAB_SIZE);
+  dout(20) << __func__ << " " << p << dendl;
+  return (char*)p;
+}
+
+std::map<char*, BufferArena::slab_t>::iterator BufferArena::find_slab(char *p)
+{
+  auto it = slabs.upper_bound(p);
+  ceph_assert(it != slabs.begin());
+  return --it;
+}
+
+std::map<char*, BufferArena::slab_t>::iterator BufferArena::drop_slab(
+  std::map<char*, slab_t>::iterator it)
+{
+  ceph_assert(it->second.free_pages == SLAB_PAGES);
+  free_runs.erase({SLAB_PAGES, it->first});
+  --free_slabs;
+  unmap_slab(it->first);
+  return slabs.erase(it);
+}
+
+char *BufferArena::alloc(size_t pages)
+{
+  ceph_assert(pages > 0 && pages <= SLAB_PAGES);
+  std::lock_guard l(lock);
+  // best fit, so that whole free slabs are the last to be split
+  auto f = free_runs.lower_bound({pages, nullptr});
+  if (f == free_runs.end()) {
+    if (slabs.size() >= max_slabs) {
+      ++failed;
+      return nullptr;
+    }
+    char *base = map_slab();
+    if (!base) {
+      ++failed;
+      return nullptr;
+    }
+    slabs[base].free[0] = SLAB_PAGES;
+    ++free_slabs;
+    f = free_runs.emplace(SLAB_PAGES, base).first;
+  }
+  auto [run, p] = *f;
+  free_runs.erase(f);
+  auto& [base, slab] = *find_slab(p);
+  if (slab.free_pages == SLAB_PAGES) {
+    --free_slabs;
+  }
+  size_t first = (p - base) / PAGE_SIZE;
+  slab.free.erase(first);
+  if (run > pages) {
+    slab.free[first + pages] = run - pages;
+    free_runs.emplace(run - pages, p + pages * PAGE_SIZE);
+  }
+  slab.free_pages -= pages;
+  used_pages += pages;
+  return p;
+}
+
+void BufferArena::release(char *p, size_t pages)
+{
+  std::lock_guard l(lock);
+  auto it = find_slab(p);
+  auto& [base, slab] = *it;
+  size_t first = (p - base) / PAGE_SIZE;
+  size_t end = first + pages;
+  ceph_assert(end <= SLAB_PAGES);
+  // merge with the free runs right after and right before
+  auto next = slab.free.lower_bound(first);
+  ceph_assert(next == slab.free.end() || next->first >= end);
+  if (next != slab.free.end() && next->first == end) {
+    free_runs.erase({next->second, base + next->first * PAGE_SIZE});
+    end += next->second;
+    next = slab.free.erase(next);
+  }
+  if (next != slab.free.begin()) {
+    auto prev = std::prev(next);
+    ceph_assert(prev->first + prev->second <= first);
+    if (prev->first + prev->second == first) {
+      free_runs.erase({prev->second, base + prev->first * PAGE_SIZE});
+      first = prev->first;
+      slab.free.erase(prev);
+    }
+  }
+  slab.free[first] = end - first;
+  free_runs.emplace(end - first, base + first * PAGE_SIZE);
+  slab.free_pages += pages;
+  used_pages -= pages;
+  if (slab.free_pages == SLAB_PAGES) {
+    ++free_slabs;
+    if (slabs.size() > max_slabs || free_slabs > RESERVE_SLABS) {
+      drop_slab(it);
+    }
+  }
+}
+
+bool BufferArena::copy(const ceph::buffer::list& bl, ceph::buffer::list *out)
+{
+  size_t len = bl.length();
+  if (len == 0 || len > SLAB_SIZE) {
+    return false;
+  }
+  size_t pages = p2roundup(len, PAGE_SIZE) / PAGE_SIZE;
+  char *p = alloc(pages);
+  if (!p) {
+    return false;
+  }
+  bl.begin().copy(len, p);
+  out->clear();
+  out->push_back(ceph::buffer::ptr(ceph::unique_leakable_ptr<ceph::buffer::raw>(
+    new raw_arena(p, len, pages, shared_from_this()))));
+  // the slab is charged already, see ~raw_arena()
+  cache_data_pool().adjust_count(0, -(ssize_t)len);
+  return true;
+}
+
+void BufferArena::dump(ceph::Formatter *f) const
+{
+  std::lock_guard l(lock);
+  f->dump_int("numa_node", numa_node);
+  f->dump_bool("hugetlb", hugetlb);
+  f->dump_unsigned("slabs", slabs.size());
+  f->dump_unsigned("free_slabs", free_slabs);
+  f->dump_unsigned("max_slabs", max_slabs);
+  f->dump_unsigned("used_bytes", used_pages * PAGE_SIZE);
+  f->dump_unsigned("failed", failed);
+}
@@ -0,0 +1,108 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+
+#include "common/ceph_mutex.h"
+#include "include/buffer.h"
+#include "include/common_fwd.h"
+
+namespace ceph {
+  class Formatter;
+}
+
+/*
+ * Slab arena for the data of a BufferCacheShard.
+ *
+ * Clean buffers entering the cache are copied into 2MB slabs that are
+ * backed by huge pages (explicit MAP_HUGETLB pages if requested, else
+ * transparent huge pages) and, optionally, bound to a NUMA node.  A
+ * cache hit then touches one TLB entry per 2MB instead of per 4KB,
+ * and memory local to the node of the shard's threads.
+ *
+ * Slabs are carved in 4KB pages, best fit from an index of the free
+ * page runs ordered by length, and freed runs coalesce with their
+ * neighbours within the slab.  A few free slabs stay mapped, so that a
+ * cache hovering around a slab boundary does not mmap and munmap one
+ * on every insert and eviction.  The resulting buffer::raw
+ * holds a reference to the arena and returns its pages when the last
+ * bufferlist referencing it goes away, which may well be after the
+ * buffer left the cache.  The bluestore_cache_data mempool is charged
+ * for whole mapped slabs rather than for the payload bytes, so that it
+ * includes the page rounding and free space of the slabs.
+ */
+class BufferArena : public std::enable_shared_from_this<BufferArena> {
+public:
+  static constexpr size_t SLAB_SIZE = 2ull << 20;
+  static constexpr size_t PAGE_SIZE = 4096;
+  static constexpr size_t SLAB_PAGES = SLAB_SIZE / PAGE_SIZE;
+  /// free slabs kept mapped (within the cap) for the next inserts
+  static constexpr size_t RESERVE_SLABS = 2;
+
+  /// @numa_node to bind slabs to, or -1 for first touch (local) policy
+  static std::shared_ptr<BufferArena> create(
+    CephContext *cct, int numa_node, bool hugetlb, size_t max_bytes);
+  ~BufferArena();
+
+  /// copy @bl into a single arena backed ptr; false if it does not fit
+  bool copy(const ceph::buffer::list& bl, ceph::buffer::list *out);
+
+  uint64_t get_slab_bytes() const {
+    std::lock_guard l(lock);
+    return slabs.size() * SLAB_SIZE;
+  }
+  uint64_t get_used_bytes() const {
+    std::lock_guard l(lock);
+    return used_pages * PAGE_SIZE;
+  }
+  /// change the cap; slabs over it are unmapped as they become free
+  void set_max_bytes(size_t max_bytes);
+  void dump(ceph::Formatter *f) const;
+
+private:
+  class raw_arena;
+
+  struct slab_t {
+    std::map<size_t, size_t> free;   ///< first page -> pages
+    size_t free_pages = SLAB_PAGES;
+  };
+
+  CephContext *cct;
+  const int numa_node;
+  const bool hugetlb;
+  size_t max_slabs;
+
+  mutable ceph::mutex lock = ceph::make_mutex("BufferArena::lock");
+  std::map<char*, slab_t> slabs;   ///< by base address
+  /// (pages, address) of every free run of every slab
+  std::set<std::pair<size_t, char*>> free_runs;
+  size_t free_slabs = 0;
+  size_t used_pages = 0;
+  uint64_t failed = 0;   ///< allocations that did not fit
+
+  BufferArena(CephContext *cct, int numa_node, bool hugetlb,
+	      size_t max_slabs)
+    : cct(cct), numa_node(numa_node), hugetlb(hugetlb),
+      max_slabs(max_slabs) {}
+
+  char *map_slab();
+  void unmap_slab(char *base);
+  std::map<char*, slab_t>::iterator find_slab(char *p);
+  std::map<char*, slab_t>::iterator drop_slab(
+    std::map<char*, slab_t>::iterator it);
+  char *alloc(size_t pages);
+  void release(char *p, size_t pages);
+};
@@ -0,0 +1,205 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "CompressionPool.h"
+
+#include <cmath>
+
+#include "common/debug.h"
+#include "common/perf_counters.h"
+#include "common/Thread.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef  dout_prefix
+#define dout_prefix *_dout << "bluestore.CompressionPool "
+
+// entropy is estimated from this many slices of this size, spread
+// evenly over the blob
+static constexpr unsigned ENTROPY_SLICES = 16;
+static constexpr unsigned ENTROPY_SLICE_LEN = 256;
+
+CompressionPool::CompressionPool(CephContext *cct)
+  : cct(cct)
+{
+  for (int a = Compressor::COMP_ALG_NONE + 1; a < Compressor::COMP_ALG_LAST;
+       ++a) {
+    PerfCountersBuilder b(
+      cct, std::string("bluestore-compressor-") + Compressor::get_comp_alg_name(a),
+      l_bluestore_compressor_first, l_bluestore_compressor_last);
+    b.add_u64_counter(l_bluestore_compressor_in_bytes, "in_bytes",
+		      "Bytes passed to the compressor",
+		      NULL,
+		      PerfCountersBuilder::PRIO_USEFUL,
+		      unit_t(UNIT_BYTES));
+    b.add_u64_counter(l_bluestore_compressor_out_bytes, "out_bytes",
+		      "Bytes produced by the compressor",
+		      NULL,
+		      PerfCountersBuilder::PRIO_USEFUL,
+		      unit_t(UNIT_BYTES));
+    b.add_time_avg(l_bluestore_compressor_lat, "lat",
+		   "Average compression latency per blob");
+    b.add_u64_counter(l_bluestore_compressor_skipped_entropy,
+		      "skipped_entropy",
+		      "Blobs not compressed because they looked incompressible");
+    loggers[a] = b.create_perf_counters();
+    cct->get_perfcounters_collection()->add(loggers[a]);
+  }
+}
+
+CompressionPool::~CompressionPool()
+{
+  ceph_assert(threads.empty());
+  for (auto l : loggers) {
+    if (l) {
+      cct->get_perfcounters_collection()->remove(l);
+      delete l;
+    }
+  }
+}
+
+void CompressionPool::start(unsigned num_threads)
+{
+  dout(10) << __func__ << " " << num_threads << " threads" << dendl;
+  ceph_assert(threads.empty());
+  stopping = false;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    threads.emplace_back(
+      make_named_thread("bstore_compress", &CompressionPool::worker, this));
+  }
+}
+
+void CompressionPool::stop()
+{
+  dout(10) << __func__ << dendl;
+  {
+    std::lock_guard l(lock);
+    stopping = true;
+    cond.notify_all();
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  threads.clear();
+  ceph_assert(queue.empty());
+}
+
+double CompressionPool::sample_entropy(const ceph::buffer::list& bl)
+{
+  std::array<uint32_t, 256> hist = {};
+  uint32_t total = 0;
+  auto count = [&](const char *p, unsigned len) {
+    for (unsigned i = 0; i < len; ++i) {
+      ++hist[(unsigned char)p[i]];
+    }
+    total += len;
+  };
+
+  unsigned len = bl.length();
+  char slice[ENTROPY_SLICE_LEN];
+  if (len <= ENTROPY_SLICES * ENTROPY_SLICE_LEN) {
+    for (auto& p : bl.buffers()) {
+      count(p.c_str(), p.length());
+    }
+  } else {
+    unsigned stride = len / ENTROPY_SLICES;
+    auto it = bl.cbegin();
+    for (unsigned i = 0; i < ENTROPY_SLICES; ++i) {
+      it.seek(i * stride);
+      it.copy(ENTROPY_SLICE_LEN, slice);
+      count(slice, ENTROPY_SLICE_LEN);
+    }
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  double e = 0;
+  for (auto h : hist) {
+    if (h) {
+      double p = (double)h / total;
+      e -= p * std::log2(p);
+    }
+  }
+  return e;
+}
+
+CompressionPool::Job *CompressionPool::claim(Batch **b)
+{
+  ceph_assert(!queue.empty());
+  *b = queue.front();
+  Job *j = &(*b)->jobs[(*b)->next++];
+  if ((*b)->next == (*b)->jobs.size()) {
+    queue.pop_front();
+  }
+  return j;
+}
+
+void CompressionPool::process(Batch *b, Job *j)
+{
+  auto start = ceph::mono_clock::now();
+  PerfCounters *logger = loggers[j->c->get_type()];
+  logger->inc(l_bluestore_compressor_in_bytes, j->in->length());
+  if (b->entropy_threshold > 0 &&
+      sample_entropy(*j->in) > b->entropy_threshold) {
+    j->skipped = true;
+    logger->inc(l_bluestore_compressor_skipped_entropy);
+  } else {
+    j->r = j->c->compress(*j->in, j->out, j->compressor_message);
+    logger->inc(l_bluestore_compressor_out_bytes,
+		j->r == 0 ? j->out.length() : j->in->length());
+  }
+  j->lat = ceph::mono_clock::now() - start;
+  logger->tinc(l_bluestore_compressor_lat, j->lat);
+
+  std::lock_guard l(b->lock);
+  if (++b->done == b->jobs.size()) {
+    b->cond.notify_all();
+  }
+}
+
+void CompressionPool::run(std::vector<Job>& jobs, double entropy_threshold)
+{
+  if (jobs.empty()) {
+    return;
+  }
+  Batch b(jobs, entropy_threshold);
+  if (threads.empty() || jobs.size() == 1) {
+    for (auto& j : jobs) {
+      process(&b, &j);
+    }
+    return;
+  }
+
+  std::unique_lock l(lock);
+  queue.push_back(&b);
+  cond.notify_all();
+  // help out rather than sit idle; stop once our batch is fully claimed
+  while (b.next < jobs.size()) {
+    Batch *cb;
+    Job *j = claim(&cb);
+    l.unlock();
+    process(cb, j);
+    l.lock();
+  }
+  l.unlock();
+
+  std::unique_lock bl(b.lock);
+  b.cond.wait(bl, [&] { return b.done == jobs.size(); });
+}
+
+void CompressionPool::worker()
+{
+  std::unique_lock l(lock);
+  while (!stopping) {
+    if (queue.empty()) {
+      cond.wait(l);
+      continue;
+    }
+    Batch *b;
+    Job *j = claim(&b);
+    l.unlock();
+    process(b, j);
+    l.lock();
+  }
+}
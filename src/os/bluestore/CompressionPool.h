@@ -0,0 +1,107 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <deque>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "common/ceph_mutex.h"
+#include "common/ceph_time.h"
+#include "compressor/Compressor.h"
+#include "include/buffer.h"
+#include "include/common_fwd.h"
+
+enum {
+  l_bluestore_compressor_first = 732800,
+  l_bluestore_compressor_in_bytes,
+  l_bluestore_compressor_out_bytes,
+  l_bluestore_compressor_lat,
+  l_bluestore_compressor_skipped_entropy,
+  l_bluestore_compressor_last,
+};
+
+/*
+ * Worker threads that compress the blobs of a write in parallel.
+ *
+ * _do_alloc_write() hands all blobs it wants compressed to run() as one
+ * batch; the workers and the calling thread pull blobs off the batch
+ * until it is exhausted, and run() returns once every blob is done.  A
+ * large write thus costs roughly one blob's compression latency instead
+ * of the sum over all its blobs.  With no threads configured the batch
+ * is compressed inline by the caller.
+ *
+ * Before compressing, a few slices of the blob are sampled and the
+ * byte entropy estimated; data that looks incompressible is skipped
+ * without running the compressor.
+ *
+ * Throughput (in_bytes / lat) and ratio (out_bytes / in_bytes) are
+ * accounted per algorithm in "bluestore-compressor-<alg>" counters.
+ */
+class CompressionPool {
+public:
+  struct Job {
+    CompressorRef c;
+    const ceph::buffer::list *in;
+
+    ceph::buffer::list out;
+    std::optional<int32_t> compressor_message;
+    int r = 0;
+    bool skipped = false;   ///< looked incompressible, not attempted
+    ceph::timespan lat = ceph::timespan::zero();
+
+    Job(CompressorRef c, const ceph::buffer::list *in)
+      : c(std::move(c)), in(in) {}
+  };
+
+  explicit CompressionPool(CephContext *cct);
+  ~CompressionPool();
+
+  void start(unsigned num_threads);
+  void stop();
+
+  /// compress every job; entropy_threshold in bits per byte, 0 = off
+  void run(std::vector<Job>& jobs, double entropy_threshold);
+
+  /// estimated order-0 entropy of @bl in bits per byte, from a sample
+  static double sample_entropy(const ceph::buffer::list& bl);
+
+private:
+  struct Batch {
+    std::vector<Job>& jobs;
+    double entropy_threshold;
+    size_t next = 0;   ///< protected by CompressionPool::lock
+    size_t done = 0;   ///< protected by Batch::lock
+    ceph::mutex lock = ceph::make_mutex("CompressionPool::Batch::lock");
+    ceph::condition_variable cond;
+
+    Batch(std::vector<Job>& jobs, double entropy_threshold)
+      : jobs(jobs), entropy_threshold(entropy_threshold) {}
+  };
+
+  CephContext *cct;
+  std::array<PerfCounters*, Compressor::COMP_ALG_LAST> loggers = {};
+
+  ceph::mutex lock = ceph::make_mutex("CompressionPool::lock");
+  ceph::condition_variable cond;
+  std::deque<Batch*> queue;
+  std::vector<std::thread> threads;
+  bool stopping = false;
+
+  /// claim the next job of the oldest batch; lock must be held
+  Job *claim(Batch **b);
+  void process(Batch *b, Job *j);
+  void worker();
+};
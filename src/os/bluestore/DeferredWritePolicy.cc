@@ -0,0 +1,283 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "DeferredWritePolicy.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "common/config_proxy.h"
+#include "common/debug.h"
+#include "common/Formatter.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef  dout_prefix
+#define dout_prefix *_dout << "bluestore.DeferredWritePolicy "
+
+unsigned DeferredWritePolicy::LatencyWindow::bucket_of(uint64_t us)
+{
+  if (us < 4) {
+    return us;
+  }
+  unsigned order = std::min<unsigned>(std::bit_width(us) - 1, MAX_ORDER);
+  unsigned sub = (us >> (order - 2)) & 3;
+  return (order << 2) | sub;
+}
+
+uint64_t DeferredWritePolicy::LatencyWindow::bucket_upper_bound(unsigned b)
+{
+  if (b < 4) {
+    return b + 1;
+  }
+  unsigned order = b >> 2;
+  uint64_t sub = b & 3;
+  return ((4 | sub) + 1) << (order - 2);
+}
+
+void DeferredWritePolicy::LatencyWindow::add(ceph::timespan lat)
+{
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(lat).count();
+  buckets[bucket_of(std::max<int64_t>(us, 0))].fetch_add(
+    1, std::memory_order_relaxed);
+}
+
+uint64_t DeferredWritePolicy::LatencyWindow::drain(double pct, uint64_t *count)
+{
+  std::array<uint64_t, BUCKETS> snap;
+  uint64_t total = 0;
+  for (unsigned b = 0; b < BUCKETS; ++b) {
+    snap[b] = buckets[b].exchange(0, std::memory_order_relaxed);
+    total += snap[b];
+  }
+  *count = total;
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t want = std::max<uint64_t>(1, total * pct);
+  uint64_t seen = 0;
+  for (unsigned b = 0; b < BUCKETS; ++b) {
+    seen += snap[b];
+    if (seen >= want) {
+      return bucket_upper_bound(b);
+    }
+  }
+  return bucket_upper_bound(BUCKETS - 1);
+}
+
+const char *DeferredWritePolicy::get_verdict_name(verdict_t v)
+{
+  switch (v) {
+  case verdict_t::NONE: return "none";
+  case verdict_t::RAISE: return "raise";
+  case verdict_t::LOWER: return "lower";
+  case verdict_t::RELAX: return "relax";
+  }
+  return "???";
+}
+
+void DeferredWritePolicy::set_base(uint64_t prefer_deferred_size,
+				   int deferred_batch_ops)
+{
+  std::lock_guard l(lock);
+  base_size = prefer_deferred_size;
+  base_batch = deferred_batch_ops;
+  if (!pinned) {
+    cur_size = base_size;
+    cur_batch = base_batch;
+  }
+  pending = verdict_t::NONE;
+  pending_windows = 0;
+  dout(10) << __func__ << " base size 0x" << std::hex << base_size << std::dec
+	   << " batch_ops " << base_batch << dendl;
+}
+
+void DeferredWritePolicy::pin(uint64_t prefer_deferred_size,
+			      int deferred_batch_ops)
+{
+  std::lock_guard l(lock);
+  pinned = true;
+  cur_size = prefer_deferred_size;
+  cur_batch = deferred_batch_ops;
+  pending = verdict_t::NONE;
+  pending_windows = 0;
+  dout(1) << __func__ << " size 0x" << std::hex << cur_size << std::dec
+	  << " batch_ops " << cur_batch << dendl;
+}
+
+void DeferredWritePolicy::unpin()
+{
+  std::lock_guard l(lock);
+  pinned = false;
+  dout(1) << __func__ << " resuming from size 0x" << std::hex << cur_size
+	  << std::dec << " batch_ops " << cur_batch << dendl;
+}
+
+DeferredWritePolicy::verdict_t DeferredWritePolicy::judge(
+  uint64_t main_us, uint64_t main_n,
+  uint64_t db_us, uint64_t db_n) const
+{
+  auto& conf = cct->_conf;
+  uint64_t min_samples =
+    conf.get_val<uint64_t>("bluestore_deferred_adaptive_min_samples");
+  auto to_us = [](double sec) { return uint64_t(sec * 1000000.0); };
+  uint64_t main_low =
+    to_us(conf.get_val<double>("bluestore_deferred_adaptive_main_lat_low"));
+  uint64_t main_high =
+    to_us(conf.get_val<double>("bluestore_deferred_adaptive_main_lat_high"));
+  uint64_t db_low =
+    to_us(conf.get_val<double>("bluestore_deferred_adaptive_db_lat_low"));
+  uint64_t db_high =
+    to_us(conf.get_val<double>("bluestore_deferred_adaptive_db_lat_high"));
+
+  bool main_valid = main_n >= min_samples;
+  bool db_valid = db_n >= min_samples;
+  if (!main_valid && !db_valid) {
+    return verdict_t::NONE;
+  }
+  bool db_hot = db_valid && db_us > db_high;
+  bool db_cool = !db_valid || db_us < db_low;
+  bool main_hot = main_valid && main_us > main_high;
+  bool main_cool = !main_valid || main_us < main_low;
+  if (db_hot) {
+    return verdict_t::LOWER;
+  }
+  if (main_hot && db_cool) {
+    return verdict_t::RAISE;
+  }
+  if (main_cool && db_cool) {
+    return verdict_t::RELAX;
+  }
+  return verdict_t::NONE;
+}
+
+bool DeferredWritePolicy::step(verdict_t v)
+{
+  auto& conf = cct->_conf;
+  uint64_t min_size =
+    conf.get_val<Option::size_t>("bluestore_deferred_adaptive_min_size");
+  uint64_t max_size = std::max<uint64_t>(
+    min_size,
+    conf.get_val<Option::size_t>("bluestore_deferred_adaptive_max_size"));
+  int min_batch = conf.get_val<uint64_t>(
+    "bluestore_deferred_adaptive_min_batch_ops");
+  int max_batch = std::max<int>(
+    min_batch,
+    conf.get_val<uint64_t>("bluestore_deferred_adaptive_max_batch_ops"));
+
+  uint64_t size = cur_size;
+  int batch = cur_batch;
+  switch (v) {
+  case verdict_t::RAISE:
+    size = std::max<uint64_t>(size * 2, min_size);
+    batch = std::max(batch * 2, min_batch);
+    break;
+  case verdict_t::LOWER:
+    size /= 2;
+    batch /= 2;
+    break;
+  case verdict_t::RELAX:
+    {
+      uint64_t target_size = std::clamp(base_size, min_size, max_size);
+      int target_batch = std::clamp(base_batch, min_batch, max_batch);
+      if (size > target_size) {
+	size = std::max(size / 2, target_size);
+      } else if (size < target_size) {
+	size = std::min(std::max<uint64_t>(size * 2, min_size), target_size);
+      }
+      if (batch > target_batch) {
+	batch = std::max(batch / 2, target_batch);
+      } else if (batch < target_batch) {
+	batch = std::min(std::max(batch * 2, min_batch), target_batch);
+      }
+    }
+    break;
+  case verdict_t::NONE:
+    break;
+  }
+  if (base_size == 0) {
+    // 0 means never defer (the ssd default); only the batch size adapts
+    size = 0;
+  } else {
+    size = std::clamp(size, min_size, max_size);
+  }
+  batch = std::clamp(batch, min_batch, max_batch);
+  if (size == cur_size && batch == cur_batch) {
+    return false;
+  }
+  dout(10) << __func__ << " " << get_verdict_name(v)
+	   << " size 0x" << std::hex << cur_size << " -> 0x" << size
+	   << std::dec << " batch_ops " << cur_batch << " -> " << batch
+	   << dendl;
+  cur_size = size;
+  cur_batch = batch;
+  return true;
+}
+
+bool DeferredWritePolicy::maybe_update(ceph::mono_clock::time_point now,
+				       decision_t *d)
+{
+  auto& conf = cct->_conf;
+  double interval = conf.get_val<double>("bluestore_deferred_adaptive_interval");
+  std::lock_guard l(lock);
+  if (now - last_update < ceph::make_timespan(interval)) {
+    return false;
+  }
+  last_update = now;
+
+  double pct = conf.get_val<double>("bluestore_deferred_adaptive_percentile");
+  uint64_t main_n, db_n;
+  last_main_us = main_lat.drain(pct, &main_n);
+  last_db_us = db_lat.drain(pct, &db_n);
+
+  d->applied = verdict_t::NONE;
+  if (!pinned) {
+    verdict_t v = judge(last_main_us, main_n, last_db_us, db_n);
+    if (v == pending) {
+      ++pending_windows;
+    } else {
+      pending = v;
+      pending_windows = 1;
+    }
+    unsigned hysteresis = std::max<uint64_t>(
+      1, conf.get_val<uint64_t>("bluestore_deferred_adaptive_hysteresis"));
+    dout(20) << __func__ << " main " << last_main_us << "us/" << main_n
+	     << " db " << last_db_us << "us/" << db_n
+	     << " verdict " << get_verdict_name(v)
+	     << " x" << pending_windows << dendl;
+    if (v != verdict_t::NONE && pending_windows >= hysteresis) {
+      pending_windows = 0;
+      if (step(v)) {
+	d->applied = v;
+	switch (v) {
+	case verdict_t::RAISE: ++raised; break;
+	case verdict_t::LOWER: ++lowered; break;
+	case verdict_t::RELAX: ++relaxed; break;
+	default: break;
+	}
+      }
+    }
+  }
+  d->prefer_deferred_size = cur_size;
+  d->deferred_batch_ops = cur_batch;
+  d->main_lat_us = last_main_us;
+  d->db_lat_us = last_db_us;
+  return true;
+}
+
+void DeferredWritePolicy::dump(ceph::Formatter *f) const
+{
+  std::lock_guard l(lock);
+  f->dump_bool("pinned", pinned);
+  f->dump_unsigned("prefer_deferred_size", cur_size);
+  f->dump_int("deferred_batch_ops", cur_batch);
+  f->dump_unsigned("base_prefer_deferred_size", base_size);
+  f->dump_int("base_deferred_batch_ops", base_batch);
+  f->dump_unsigned("main_lat_us", last_main_us);
+  f->dump_unsigned("db_lat_us", last_db_us);
+  f->dump_string("pending_verdict", get_verdict_name(pending));
+  f->dump_unsigned("pending_windows", pending_windows);
+  f->dump_unsigned("raised", raised);
+  f->dump_unsigned("lowered", lowered);
+  f->dump_unsigned("relaxed", relaxed);
+}
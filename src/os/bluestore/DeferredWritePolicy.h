@@ -0,0 +1,135 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "common/ceph_mutex.h"
+#include "common/ceph_time.h"
+#include "include/common_fwd.h"
+
+namespace ceph {
+  class Formatter;
+}
+
+/*
+ * Latency-driven controller for the deferred write knobs
+ * (prefer_deferred_size and deferred_batch_ops).
+ *
+ * The static defaults are tuned for an idle device.  On hybrid
+ * HDD+flash OSDs the right threshold moves with load: when the main
+ * device is seek bound, deferring more (and batching more before the
+ * deferred writes hit the HDD) saves seeks; when the DB/WAL device is
+ * the bottleneck, deferring less takes bytes off the WAL.
+ *
+ * BlueStore feeds in write completion latencies of both devices; every
+ * evaluation window the controller compares their tail latency with a
+ * low/high band per device and moves the knobs one power-of-two step.
+ * A step is only taken after the same verdict in several consecutive
+ * windows, and the knobs are clamped to configured bounds.  An admin
+ * can pin the knobs, which freezes the controller.
+ */
+class DeferredWritePolicy {
+public:
+  /// log-linear latency histogram, lock free on the add() side
+  class LatencyWindow {
+    // four buckets per power of two microseconds, up to ~2^30us
+    static constexpr unsigned MAX_ORDER = 30;
+    static constexpr unsigned BUCKETS = (MAX_ORDER + 1) << 2;
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets = {};
+
+    static unsigned bucket_of(uint64_t us);
+    static uint64_t bucket_upper_bound(unsigned b);
+  public:
+    void add(ceph::timespan lat);
+    /// reset the window; returns the number of samples it held and the
+    /// upper bound (in us) of the bucket holding the @pct quantile
+    uint64_t drain(double pct, uint64_t *count);
+  };
+
+  enum class verdict_t {
+    NONE,    ///< not enough samples or latencies within bands
+    RAISE,   ///< main device is the bottleneck, defer more
+    LOWER,   ///< db/wal device is the bottleneck, defer less
+    RELAX,   ///< both devices idle, drift back to the base values
+  };
+  static const char *get_verdict_name(verdict_t v);
+
+  struct decision_t {
+    uint64_t prefer_deferred_size = 0;
+    int deferred_batch_ops = 0;
+    uint64_t main_lat_us = 0;   ///< main device tail latency last window
+    uint64_t db_lat_us = 0;     ///< db device tail latency last window
+    verdict_t applied = verdict_t::NONE;  ///< step taken, if any
+  };
+
+  explicit DeferredWritePolicy(CephContext *cct) : cct(cct) {}
+
+  /// the statically configured values, used as start and relax target
+  void set_base(uint64_t prefer_deferred_size, int deferred_batch_ops);
+
+  void note_main_latency(ceph::timespan lat) {
+    main_lat.add(lat);
+  }
+  void note_db_latency(ceph::timespan lat) {
+    db_lat.add(lat);
+  }
+
+  /// re-evaluate if an interval has passed; true if *d is filled in
+  bool maybe_update(ceph::mono_clock::time_point now, decision_t *d);
+
+  void pin(uint64_t prefer_deferred_size, int deferred_batch_ops);
+  void unpin();
+  bool is_pinned() const {
+    std::lock_guard l(lock);
+    return pinned;
+  }
+
+  uint64_t get_prefer_deferred_size() const {
+    std::lock_guard l(lock);
+    return cur_size;
+  }
+  int get_deferred_batch_ops() const {
+    std::lock_guard l(lock);
+    return cur_batch;
+  }
+
+  void dump(ceph::Formatter *f) const;
+
+private:
+  CephContext *cct;
+  LatencyWindow main_lat;
+  LatencyWindow db_lat;
+
+  mutable ceph::mutex lock = ceph::make_mutex("DeferredWritePolicy::lock");
+  uint64_t base_size = 0;
+  int base_batch = 0;
+  uint64_t cur_size = 0;
+  int cur_batch = 0;
+  bool pinned = false;
+
+  ceph::mono_clock::time_point last_update;
+  verdict_t pending = verdict_t::NONE;  ///< verdict being confirmed
+  unsigned pending_windows = 0;         ///< consecutive windows with it
+  uint64_t last_main_us = 0;
+  uint64_t last_db_us = 0;
+  uint64_t raised = 0;
+  uint64_t lowered = 0;
+  uint64_t relaxed = 0;
+
+  verdict_t judge(uint64_t main_us, uint64_t main_n,
+		  uint64_t db_us, uint64_t db_n) const;
+  bool step(verdict_t v);
+};
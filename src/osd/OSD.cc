@@ -83,6 +83,7 @@
 #include "messages/MOSDBackoff.h"
 #include "messages/MOSDBeacon.h"
 #include "messages/MOSDRepOp.h"
+#include "messages/MOSDRepOpBatch.h"
 #include "messages/MOSDRepOpReply.h"
 #include "messages/MOSDBoot.h"
 #include "messages/MOSDPGTemp.h"
@@ -259,6 +260,9 @@ OSDService::OSDService(OSD *osd, ceph::async::io_context_pool& poolctx) :
   osd_skip_data_digest(cct->_conf, "osd_skip_data_digest"),
   publish_lock{ceph::make_mutex("OSDService::publish_lock")},
   pre_publish_lock{ceph::make_mutex("OSDService::pre_publish_lock")},
+  repop_batcher(cct, [this](int peer, auto& ops) {
+    send_repop_batch(peer, ops);
+  }),
   m_scrub_queue{cct, *this},
   agent_valid_iterator(false),
   agent_ops(0),
@@ -543,6 +547,7 @@ void OSDService::init()
   mono_timer.resume();
 
   agent_thread.create("osd_srv_agent");
+  repop_batcher.start();
 
   if (cct->_conf->osd_recovery_delay_start)
     defer_recovery(cct->_conf->osd_recovery_delay_start);
@@ -1096,6 +1101,10 @@ void OSDService::send_message_osd_cluster(int peer, Message *m, epoch_t from_epo
 {
   dout(20) << __func__ << " " << m->get_type_name() << " to osd." << peer
 	   << " from_epoch " << from_epoch << dendl;
+  if (m->get_type() == MSG_OSD_REPOP && queue_repop(peer, m, from_epoch)) {
+    return;
+  }
+  flush_repops(peer);
   OSDMapRef next_map = get_nextmap_reserved();
   // service map is always newer/newest
   ceph_assert(from_epoch <= next_map->get_epoch());
@@ -1126,6 +1135,7 @@ void OSDService::send_message_osd_cluster(std::vector<std::pair<int, Message*>>&
   ceph_assert(from_epoch <= next_map->get_epoch());
 
   for (auto& iter : messages) {
+    flush_repops(iter.first);
     if (next_map->is_down(iter.first) ||
 	next_map->get_info(iter.first).up_from > from_epoch) {
       iter.second->put();
@@ -1147,6 +1157,8 @@ ConnectionRef OSDService::get_con_osd_cluster(int peer, epoch_t from_epoch)
 {
   dout(20) << __func__ << " to osd." << peer
 	   << " from_epoch " << from_epoch << dendl;
+  // whatever the caller sends on it must not overtake held back sub ops
+  flush_repops(peer);
   OSDMapRef next_map = get_nextmap_reserved();
   // service map is always newer/newest
   ceph_assert(from_epoch <= next_map->get_epoch());
@@ -1167,6 +1179,57 @@ ConnectionRef OSDService::get_con_osd_cluster(int peer, epoch_t from_epoch)
   return con;
 }
 
+bool OSDService::queue_repop(int peer, Message *m, epoch_t from_epoch)
+{
+  if (peer == whoami) {
+    return false;
+  }
+  return repop_batcher.queue(peer, MessageRef{m, false}, from_epoch);
+}
+
+void OSDService::flush_repops(int peer)
+{
+  repop_batcher.flush(peer);
+}
+
+void OSDService::send_repop_batch(int peer,
+				  std::vector<RepOpBatcher::queued_t>& ops)
+{
+  OSDMapRef next_map = get_nextmap_reserved();
+  auto now = ceph::mono_clock::now();
+  auto m = ceph::make_message<MOSDRepOpBatch>();
+  for (auto& q : ops) {
+    // dropped just like send_message_osd_cluster() would have
+    if (next_map->is_down(peer) ||
+	next_map->get_info(peer).up_from > q.from_epoch) {
+      continue;
+    }
+    logger->tinc(l_osd_repop_batch_wait, now - q.queued);
+    m->ops.push_back(ceph::ref_cast<MOSDRepOp>(std::move(q.op)));
+  }
+  if (!m->ops.empty()) {
+    ConnectionRef peer_con = cluster_messenger->connect_to_osd(
+      next_map->get_cluster_addrs(peer), false, true);
+    maybe_share_map(peer_con.get(), next_map);
+    uint64_t size = m->ops.size();
+    if (size == 1) {
+      peer_con->send_message2(std::move(m->ops.front()));
+    } else if (HAVE_FEATURE(next_map->get_xinfo(peer).features, SERVER_REEF)) {
+      peer_con->send_message2(std::move(m));
+    } else {
+      for (auto& op : m->ops) {
+	peer_con->send_message2(std::move(op));
+      }
+    }
+    logger->inc(l_osd_repop_batch_size, size);
+    logger->hinc(
+      l_osd_repop_batch_wait_size_hist,
+      std::chrono::nanoseconds(now - ops.front().queued).count(),
+      size);
+  }
+  release_map(next_map);
+}
+
 pair<ConnectionRef,ConnectionRef> OSDService::get_con_osd_hb(int peer, epoch_t from_epoch)
 {
   dout(20) << __func__ << " to osd." << peer
@@ -4516,6 +4579,7 @@ int OSD::shutdown()
 
   dout(10) << "stopping agent" << dendl;
   service.agent_stop();
+  service.repop_batch_stop();
 
   boot_finisher.wait_for_empty();
 
@@ -7342,6 +7406,8 @@ void OSD::ms_fast_dispatch(Message *m)
     return handle_fast_pg_info(static_cast<MOSDPGInfo*>(m));
   case MSG_OSD_PG_REMOVE:
     return handle_fast_pg_remove(static_cast<MOSDPGRemove*>(m));
+  case MSG_OSD_REPOP_BATCH:
+    return handle_fast_repop_batch(static_cast<MOSDRepOpBatch*>(m));
     // these are single-pg messages that handle themselves
   case MSG_OSD_PG_LOG:
   case MSG_OSD_PG_TRIM:
@@ -9196,6 +9262,24 @@ void OSD::handle_fast_pg_remove(MOSDPGRemove *m)
   m->put();
 }
 
+void OSD::handle_fast_repop_batch(MOSDRepOpBatch *m)
+{
+  dout(20) << __func__ << " " << *m << " from " << m->get_source() << dendl;
+  if (!require_osd_peer(m)) {
+    m->put();
+    return;
+  }
+  // in order, so each PG sees its sub ops as if they came one by one
+  for (auto& op : m->ops) {
+    op->set_recv_stamp(m->get_recv_stamp());
+    op->set_throttle_stamp(m->get_throttle_stamp());
+    op->set_recv_complete_stamp(m->get_recv_complete_stamp());
+    op->set_dispatch_stamp(m->get_dispatch_stamp());
+    ms_fast_dispatch(op.detach());
+  }
+  m->put();
+}
+
 void OSD::handle_fast_force_recovery(MOSDForceRecovery *m)
 {
   dout(10) << __func__ << " " << *m << dendl;
@@ -10726,9 +10810,22 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
   // thread_index(thread_index < num_shards) of shard to do oncommit
   // callback.
   bool is_smallest_thread_index = thread_index < osd->num_shards;
+  // when work held back by the scheduler of another shard gets ready
+  double steal_at = 0;
 
   // peek at spg_t
   sdata->shard_lock.lock();
+  if (work_stealing &&
+      sdata->scheduler->empty() &&
+      (!is_smallest_thread_index || sdata->context_queue.empty())) {
+    // nothing to do here; help out a shard that is falling behind
+    // before going to sleep
+    sdata->shard_lock.unlock();
+    if (_steal(shard_index, hb, &steal_at)) {
+      return;
+    }
+    sdata->shard_lock.lock();
+  }
   if (sdata->scheduler->empty() &&
       (!is_smallest_thread_index || sdata->context_queue.empty())) {
     std::unique_lock wait_lock{sdata->sdata_wait_lock};
@@ -10738,10 +10835,19 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     } else if (!sdata->stop_waiting) {
       dout(20) << __func__ << " empty q, waiting" << dendl;
       osd->cct->get_heartbeat_map()->clear_timeout(hb);
+      osd->logger->inc(l_osd_op_wq_idle);
+      ++sdata->idle_threads;
       sdata->shard_lock.unlock();
-      sdata->sdata_cond.wait(wait_lock);
+      if (steal_at > 0) {
+	// come back for it then
+	sdata->sdata_cond.wait_until(wait_lock,
+				     ceph::real_clock::from_double(steal_at));
+      } else {
+	sdata->sdata_cond.wait(wait_lock);
+      }
       wait_lock.unlock();
       sdata->shard_lock.lock();
+      --sdata->idle_threads;
       if (sdata->scheduler->empty() &&
          !(is_smallest_thread_index && !sdata->context_queue.empty())) {
 	sdata->shard_lock.unlock();
@@ -10757,7 +10863,70 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       return;
     }
   }
+  _process_shard(sdata, is_smallest_thread_index, false, hb);
+}
 
+bool OSD::ShardedOpWQ::_steal(uint32_t shard_index, heartbeat_handle_d *hb,
+				double *ready_at)
+{
+  const double now = ceph::real_clock::to_double(ceph::real_clock::now());
+  auto held_back = [now, ready_at](OSDShard *victim) {
+    double ready = victim->ready_at.load(std::memory_order_relaxed);
+    if (ready <= now) {
+      return false;
+    }
+    if (*ready_at == 0 || ready < *ready_at) {
+      *ready_at = ready;
+    }
+    return true;
+  };
+  for (uint32_t i = 1; i < osd->num_shards; ++i) {
+    OSDShard *victim = osd->shards[(shard_index + i) % osd->num_shards];
+    if (victim->idle_threads.load(std::memory_order_relaxed)) {
+      // its own threads will get to it
+      continue;
+    }
+    if (held_back(victim)) {
+      // nothing there is due yet
+      continue;
+    }
+    if (!victim->shard_lock.try_lock()) {
+      continue;
+    }
+    if (victim->scheduler->empty() || victim->idle_threads) {
+      victim->shard_lock.unlock();
+      continue;
+    }
+    dout(20) << __func__ << " shard " << shard_index
+	     << " taking work from shard " << victim->shard_id << dendl;
+    if (_process_shard(victim, false, true, hb)) {
+      return true;
+    }
+    // the scheduler held its work back; the shard lock is released
+    held_back(victim);
+  }
+  return false;
+}
+
+void OSD::ShardedOpWQ::_wake_stealer(uint32_t shard_index)
+{
+  for (uint32_t i = 1; i < osd->num_shards; ++i) {
+    OSDShard *other = osd->shards[(shard_index + i) % osd->num_shards];
+    if (other->idle_threads.load(std::memory_order_relaxed)) {
+      std::lock_guard l{other->sdata_wait_lock};
+      other->sdata_cond.notify_one();
+      return;
+    }
+  }
+}
+
+bool OSD::ShardedOpWQ::_process_shard(OSDShard *sdata,
+				      bool is_smallest_thread_index,
+				      bool stolen,
+				      heartbeat_handle_d *hb)
+{
+  ceph_assert(ceph_mutex_is_locked_by_me(sdata->shard_lock));
+  [[maybe_unused]] const uint32_t shard_index = sdata->shard_id;
   list<Context *> oncommits;
   if (is_smallest_thread_index) {
     sdata->context_queue.move_to(oncommits);
@@ -10772,11 +10941,11 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
           dout(10) << __func__ << " discarding in-flight oncommit " << c << dendl;
           delete c;
         }
-        return;    // OSD shutdown, discard.
+        return false;    // OSD shutdown, discard.
       }
       sdata->shard_lock.unlock();
       handle_oncommits(oncommits);
-      return;
+      return false;
     }
 
     work_item = sdata->scheduler->dequeue();
@@ -10786,12 +10955,19 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
         dout(10) << __func__ << " discarding in-flight oncommit " << c << dendl;
         delete c;
       }
-      return;    // OSD shutdown, discard.
+      return false;    // OSD shutdown, discard.
     }
 
     // If the work item is scheduled in the future, wait until
     // the time returned in the dequeue response before retrying.
     if (auto when_ready = std::get_if<double>(&work_item)) {
+      // tell threads of other shards not to bother until then
+      sdata->ready_at.store(*when_ready, std::memory_order_relaxed);
+      if (stolen) {
+	// leave it to the shard's own threads
+	sdata->shard_lock.unlock();
+	return false;
+      }
       if (is_smallest_thread_index) {
         sdata->shard_lock.unlock();
         handle_oncommits(oncommits);
@@ -10821,13 +10997,14 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
 
   // Access the stored item
   auto item = std::move(std::get<OpSchedulerItem>(work_item));
+  sdata->ready_at.store(0, std::memory_order_relaxed);
   if (osd->is_stopping()) {
     sdata->shard_lock.unlock();
     for (auto c : oncommits) {
       dout(10) << __func__ << " discarding in-flight oncommit " << c << dendl;
       delete c;
     }
-    return;    // OSD shutdown, discard.
+    return true;    // OSD shutdown, discard.
   }
 
   const auto token = item.get_ordering_token();
@@ -10868,7 +11045,7 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       pg->unlock();
       sdata->shard_lock.unlock();
       handle_oncommits(oncommits);
-      return;
+      return true;
     }
     slot = q->second.get();
     --slot->num_running;
@@ -10880,7 +11057,7 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       pg->unlock();
       sdata->shard_lock.unlock();
       handle_oncommits(oncommits);
-      return;
+      return true;
     }
     if (requeue_seq != slot->requeue_seq) {
       dout(20) << __func__ << " " << token
@@ -10890,7 +11067,7 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       pg->unlock();
       sdata->shard_lock.unlock();
       handle_oncommits(oncommits);
-      return;
+      return true;
     }
     if (slot->pg != pg) {
       // this can happen if we race with pg removal.
@@ -10933,6 +11110,9 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       if (!qi.peering_requires_pg()) {
 	// for pg-less events, we run them under the ordering lock, since
 	// we don't have the pg lock to keep them ordered.
+	if (stolen) {
+	  osd->logger->inc(l_osd_op_wq_steal);
+	}
 	qi.run(osd, sdata, pg, tp_handle);
       } else if (osdmap->is_up_acting_osd_shard(token, osd->whoami)) {
 	if (create_info) {
@@ -10989,12 +11169,12 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
 	sdata->shard_lock.unlock();
 	osd->service.release_reserved_pushes(pushes_to_free);
 	handle_oncommits(oncommits);
-	return;
+	return true;
       }
     }
     sdata->shard_lock.unlock();
     handle_oncommits(oncommits);
-    return;
+    return true;
   }
   if (qi.is_peering()) {
     OSDMapRef osdmap = sdata->shard_osdmap;
@@ -11003,7 +11183,7 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       sdata->shard_lock.unlock();
       pg->unlock();
       handle_oncommits(oncommits);
-      return;
+      return true;
     }
   }
   sdata->shard_lock.unlock();
@@ -11037,6 +11217,9 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
   delete f;
   *_dout << dendl;
 
+  if (stolen) {
+    osd->logger->inc(l_osd_op_wq_steal);
+  }
   qi.run(osd, sdata, pg, tp_handle);
 
   {
@@ -11051,6 +11234,7 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
   }
 
   handle_oncommits(oncommits);
+  return true;
 }
 
 void OSD::ShardedOpWQ::_enqueue(OpSchedulerItem&& item) {
@@ -11075,6 +11259,7 @@ void OSD::ShardedOpWQ::_enqueue(OpSchedulerItem&& item) {
     std::lock_guard l{sdata->shard_lock};
     empty = sdata->scheduler->empty();
     sdata->scheduler->enqueue(std::move(item));
+    sdata->ready_at.store(0, std::memory_order_relaxed);
   }
 
   {
@@ -11085,6 +11270,13 @@ void OSD::ShardedOpWQ::_enqueue(OpSchedulerItem&& item) {
       sdata->sdata_cond.notify_one();
     }
   }
+
+  if (work_stealing && !empty &&
+      !sdata->idle_threads.load(std::memory_order_relaxed)) {
+    // a backlog is building up and all of this shard's threads are
+    // busy; let an idle thread elsewhere come and take some of it
+    _wake_stealer(shard_index);
+  }
 }
 
 void OSD::ShardedOpWQ::_enqueue_front(OpSchedulerItem&& item)
@@ -11115,6 +11307,7 @@ void OSD::ShardedOpWQ::_enqueue_front(OpSchedulerItem&& item)
     dout(20) << __func__ << " " << item << dendl;
   }
   sdata->scheduler->enqueue_front(std::move(item));
+  sdata->ready_at.store(0, std::memory_order_relaxed);
   sdata->shard_lock.unlock();
   std::lock_guard l{sdata->sdata_wait_lock};
   sdata->sdata_cond.notify_one();
@@ -52,6 +52,7 @@
 #include "messages/MOSDOp.h"
 #include "common/EventTrace.h"
 #include "osd/osd_perf_counters.h"
+#include "osd/RepOpBatcher.h"
 #include "common/Finisher.h"
 #include "scrubber/osd_scrub_sched.h"
 
@@ -90,6 +91,7 @@ class MOSDPGNotify;
 class MOSDPGInfo;
 class MOSDPGRemove;
 class MOSDForceRecovery;
+class MOSDRepOpBatch;
 class MMonGetPurgedSnapsReply;
 
 class OSD;
@@ -230,6 +232,22 @@ public:
   }
   entity_name_t get_cluster_msgr_name() const;
 
+  /// hold back an MOSDRepOp to be sent along with others to the same peer;
+  /// false if batching is off (osd_repop_batch_window_us = 0)
+  bool queue_repop(int peer, Message *m, epoch_t from_epoch);
+  /// send the sub ops held back for "peer", ahead of any other message
+  void flush_repops(int peer);
+
+private:
+  // -- replication sub op batching --
+  RepOpBatcher repop_batcher;
+  void send_repop_batch(int peer, std::vector<RepOpBatcher::queued_t>& ops);
+
+public:
+  void repop_batch_stop() {
+    repop_batcher.stop();
+  }
+
 
 public:
 
@@ -962,6 +980,13 @@ struct OSDShard {
   ceph::mutex sdata_wait_lock;
   ceph::condition_variable sdata_cond;
   int waiting_threads = 0;
+  /// threads asleep on an empty queue; changed under shard_lock, read
+  /// without it by threads of other shards looking for work to steal
+  std::atomic<int> idle_threads = {0};
+  /// when the item the scheduler last held back gets ready, or 0 if
+  /// it may have work ready now; read without shard_lock by threads of
+  /// other shards, to skip it until then
+  std::atomic<double> ready_at = {0};
 
   ceph::mutex osdmap_lock;  ///< protect shard_osdmap updates vs users w/o shard_lock
   OSDMapRef shard_osdmap;
@@ -1554,13 +1579,26 @@ protected:
   {
     OSD *osd;
     bool m_fast_shutdown = false;
+    /// let idle threads run work queued on other, busier shards
+    const bool work_stealing;
+
+    /// false if it took no item off the queue
+    bool _process_shard(OSDShard *sdata, bool is_smallest_thread_index,
+			bool stolen, ceph::heartbeat_handle_d *hb);
+    /// run an item of another shard; if there is none, ready_at is when
+    /// the first one held back by a scheduler gets ready (0 if none is)
+    bool _steal(uint32_t shard_index, ceph::heartbeat_handle_d *hb,
+		double *ready_at);
+    void _wake_stealer(uint32_t shard_index);
   public:
     ShardedOpWQ(OSD *o,
 		ceph::timespan ti,
 		ceph::timespan si,
 		ShardedThreadPool* tp)
       : ShardedThreadPool::ShardedWQ<OpSchedulerItem>(ti, si, tp),
-        osd(o) {
+        osd(o),
+	work_stealing(o->get_num_op_shards() > 1 &&
+		      o->cct->_conf.get_val<bool>("osd_op_queue_work_stealing")) {
     }
 
     void _add_slot_waiter(
@@ -1848,6 +1886,7 @@ protected:
   void handle_pg_notify_nopg(const MNotifyRec& q);
   void handle_fast_pg_info(MOSDPGInfo *m);
   void handle_fast_pg_remove(MOSDPGRemove *m);
+  void handle_fast_repop_batch(MOSDRepOpBatch *m);
 
 public:
   // used by OSDShard
@@ -1899,6 +1938,7 @@ private:
     case MSG_OSD_RECOVERY_RESERVE:
     case MSG_OSD_REPOP:
     case MSG_OSD_REPOPREPLY:
+    case MSG_OSD_REPOP_BATCH:
     case MSG_OSD_PG_PUSH:
     case MSG_OSD_PG_PULL:
     case MSG_OSD_PG_PUSH_REPLY:
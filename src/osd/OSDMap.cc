@@ -24,6 +24,7 @@
 #include <boost/algorithm/string.hpp>
 
 #include "OSDMap.h"
+#include "OSDMapMapping.h"
 #include "common/config.h"
 #include "common/errno.h"
 #include "common/Formatter.h"
@@ -1817,6 +1818,12 @@ ceph_release_t OSDMap::get_min_compat_client() const
 {
   uint64_t f = get_features(CEPH_ENTITY_TYPE_CLIENT, nullptr);
 
+  for (auto& [id, pool] : pools) {
+    // older clients fail to decode the pool
+    if (pool.hit_set_params.get_type() == HitSet::TYPE_BLOCKED_BLOOM) {
+      return ceph_release_t::reef;
+    }
+  }
   if (HAVE_FEATURE(f, OSDMAP_PG_UPMAP) ||      // v12.0.0-1733-g27d6f43
       HAVE_FEATURE(f, CRUSH_CHOOSE_ARGS)) {    // v12.0.1-2172-gef1ef28
     return ceph_release_t::luminous;  // v12.2.0
@@ -5162,7 +5169,8 @@ int OSDMap::calc_pg_upmaps(
   int max,
   const set<int64_t>& only_pools,
   OSDMap::Incremental *pending_inc,
-  std::random_device::result_type *p_seed)
+  std::random_device::result_type *p_seed,
+  const OSDMapMapping *mapping)
 {
   ldout(cct, 10) << __func__ << " pools " << only_pools << dendl;
   OSDMap tmp_osd_map;
@@ -5181,7 +5189,12 @@ int OSDMap::calc_pg_upmaps(
     return 0;
   }
 
-  osd_weight_total = build_pool_pgs_info(cct, only_pools, tmp_osd_map, 
+  if (mapping && mapping->get_epoch() != get_epoch()) {
+    ldout(cct, 10) << __func__ << " ignoring mapping of epoch "
+                   << mapping->get_epoch() << dendl;
+    mapping = nullptr;
+  }
+  osd_weight_total = build_pool_pgs_info(cct, only_pools, tmp_osd_map, mapping,
                                          total_pgs, pgs_by_osd, osd_weight);
   if (osd_weight_total == 0) {
     lderr(cct) << __func__ << " abort due to osd_weight_total == 0" << dendl;
@@ -5224,6 +5237,7 @@ int OSDMap::calc_pg_upmaps(
     fill_overfull_underfull(cct, deviation_osd, max_deviation, 
     			    overfull, more_overfull,
 			    underfull, more_underfull);
+    const set<int> underfull_set(underfull.begin(), underfull.end());
 
     if (underfull.empty() && overfull.empty()) {
       ldout(cct, 20) << __func__ << " failed to build overfull and underfull" << dendl;
@@ -5250,7 +5264,9 @@ int OSDMap::calc_pg_upmaps(
 
     set<pg_t> to_unmap;
     map<pg_t, mempool::osdmap::vector<pair<int32_t,int32_t>>> to_upmap;
-    auto temp_pgs_by_osd = pgs_by_osd;
+    // changes are staged as moves against pgs_by_osd rather than on a
+    // copy of it, which would cost O(pgs) per iteration
+    pg_moves_t moves;
     // always start with fullest, break if we find any changes to make
     for (auto p = deviation_osd.rbegin(); p != deviation_osd.rend(); ++p) {
       if (skip_overfull && !underfull.empty()) {
@@ -5287,8 +5303,9 @@ int OSDMap::calc_pg_upmaps(
       }
 
       vector<pg_t> pgs;
-      pgs.reserve(pgs_by_osd[osd].size());
-      for (auto& pg : pgs_by_osd[osd]) {
+      const auto& osd_pgs = pgs_by_osd[osd];
+      pgs.reserve(osd_pgs.size());
+      for (auto& pg : osd_pgs) {
         if (to_skip.count(pg))
           continue;
         pgs.push_back(pg);
@@ -5299,7 +5316,7 @@ int OSDMap::calc_pg_upmaps(
       }
       // look for remaps we can un-remap
       if (try_drop_remap_overfull(cct, pgs, tmp_osd_map, osd,
-				  temp_pgs_by_osd, to_unmap, to_upmap))
+				  moves, to_unmap, to_upmap))
 	goto test_change;
 
       // try upmap
@@ -5357,7 +5374,7 @@ int OSDMap::calc_pg_upmaps(
           // definitely make distribution of PGs converging to
           // the perfect status.
 	  add_remap_pair(cct, orig[pos], out[pos], pg, (size_t)pg_pool_size, 
-	  		 osd, existing, temp_pgs_by_osd,
+	  		 osd, existing, moves,
 			 new_upmap_items, to_upmap);
           goto test_change;
 	}
@@ -5377,8 +5394,7 @@ int OSDMap::calc_pg_upmaps(
     ldout(cct, 10) << " failed to find any changes for overfull osds"
                    << dendl;
     for (auto& [deviation, osd] : deviation_osd) {
-      if (std::find(underfull.begin(), underfull.end(), osd) ==
-                    underfull.end())
+      if (!underfull_set.count(osd))
         break;
       float target = osd_weight[osd] * pgs_per_weight;
       ceph_assert(target > 0);
@@ -5395,7 +5411,7 @@ int OSDMap::calc_pg_upmaps(
       // look for remaps we can un-remap
       candidates_t candidates = build_candidates(cct, tmp_osd_map, to_skip,
       						 only_pools, aggressive, p_seed);
-      if (try_drop_remap_underfull(cct, candidates, osd, temp_pgs_by_osd,
+      if (try_drop_remap_underfull(cct, candidates, osd, moves,
           to_unmap, to_upmap)) {
 	goto test_change;
       }
@@ -5423,14 +5439,11 @@ int OSDMap::calc_pg_upmaps(
 
     // test change, apply if change is good
     ceph_assert(to_unmap.size() || to_upmap.size());
-    float new_stddev = 0;
-    map<int,float> temp_osd_deviation;
-    multimap<float,int> temp_deviation_osd;
-    float cur_max_deviation = calc_deviations(cct, temp_pgs_by_osd, osd_weight,
-    					      pgs_per_weight, temp_osd_deviation,
-					      temp_deviation_osd, new_stddev);
-    ldout(cct, 10) << " stddev " << stddev << " -> " << new_stddev << dendl;
-    if (new_stddev >= stddev) {
+    float cur_max_deviation = apply_pg_moves(cct, moves, osd_weight,
+					     pgs_per_weight, pgs_by_osd,
+					     osd_deviation, deviation_osd,
+					     stddev);
+    if (cur_max_deviation < 0) {
       if (!aggressive) {
         ldout(cct, 10) << " break because stddev is not decreasing"
                        << " and aggressive mode is not enabled"
@@ -5458,12 +5471,7 @@ int OSDMap::calc_pg_upmaps(
       goto retry;
     }
 
-    // ready to go
-    ceph_assert(new_stddev < stddev);
-    stddev = new_stddev;
-    pgs_by_osd = temp_pgs_by_osd;
-    osd_deviation = temp_osd_deviation;
-    deviation_osd = temp_deviation_osd;
+    // ready to go, apply_pg_moves() already updated the distribution
     n_changes++;
 
 
@@ -5556,6 +5564,7 @@ float OSDMap::build_pool_pgs_info (
   CephContext *cct,
   const std::set<int64_t>& only_pools,        ///< [optional] restrict to pool
   const OSDMap& tmp_osd_map,
+  const OSDMapMapping *mapping,
   int& total_pgs,
   map<int,set<pg_t>>& pgs_by_osd,
   map<int,float>& osds_weight)
@@ -5572,7 +5581,11 @@ float OSDMap::build_pool_pgs_info (
     for (unsigned ps = 0; ps < pdata.get_pg_num(); ++ps) {
       pg_t pg(ps, pid);
       vector<int> up;
-      tmp_osd_map.pg_to_up_acting_osds(pg, &up, nullptr, nullptr, nullptr);
+      if (mapping) {
+        mapping->get(pg, &up, nullptr, nullptr, nullptr);
+      } else {
+        tmp_osd_map.pg_to_up_acting_osds(pg, &up, nullptr, nullptr, nullptr);
+      }
       ldout(cct, 20) << __func__ << " " << pg << " up " << up << dendl;
       for (auto osd : up) {
         if (osd != CRUSH_ITEM_NONE)
@@ -5636,6 +5649,89 @@ float OSDMap::calc_deviations (
   return cur_max_deviation;
 }
 
+float OSDMap::apply_pg_moves(
+  CephContext *cct,
+  const pg_moves_t& moves,
+  const map<int,float>& osd_weight,
+  float pgs_per_weight,
+  map<int,set<pg_t>>& pgs_by_osd,
+  map<int,float>& osd_deviation,
+  multimap<float,int>& deviation_osd,
+  float& stddev)
+{
+  //
+  // This function applies the moves staged by one calc_pg_upmaps iteration
+  // to pgs_by_osd and keeps them only if they lower stddev, in which case 
+  // osd_deviation, deviation_osd and stddev are updated to match. Only the
+  // OSDs involved are looked at, so the cost does not grow with the number
+  // of PGs and OSDs like a calc_deviations pass does. Returns the new max 
+  // deviation, or -1 if the moves were reverted.
+  //
+  struct applied_t {
+    pg_t pg;
+    int osd;
+    bool inserted;
+  };
+  vector<applied_t> applied;
+  for (auto& m : moves) {
+    auto p = pgs_by_osd.find(m.from);
+    if (p != pgs_by_osd.end() && p->second.erase(m.pg))
+      applied.push_back({m.pg, m.from, false});
+    if (pgs_by_osd[m.to].insert(m.pg).second)
+      applied.push_back({m.pg, m.to, true});
+  }
+
+  map<int,float> new_deviation;
+  double delta = 0;
+  for (auto& a : applied) {
+    if (new_deviation.count(a.osd))
+      continue;
+    // make sure osd is still there (belongs to this crush-tree)
+    ceph_assert(osd_weight.count(a.osd));
+    float target = osd_weight.at(a.osd) * pgs_per_weight;
+    float deviation = (float)pgs_by_osd[a.osd].size() - target;
+    float old_deviation = osd_deviation.at(a.osd);
+    ldout(cct, 20) << " osd." << a.osd
+                   << "\tpgs " << pgs_by_osd[a.osd].size()
+                   << "\ttarget " << target
+                   << "\tdeviation " << old_deviation << " -> " << deviation
+                   << dendl;
+    new_deviation[a.osd] = deviation;
+    delta += (double)deviation * deviation -
+      (double)old_deviation * old_deviation;
+  }
+  float new_stddev = stddev + delta;
+  ldout(cct, 10) << " stddev " << stddev << " -> " << new_stddev << dendl;
+  if (delta >= 0) {
+    for (auto a = applied.rbegin(); a != applied.rend(); ++a) {
+      if (a->inserted)
+        pgs_by_osd[a->osd].erase(a->pg);
+      else
+        pgs_by_osd[a->osd].insert(a->pg);
+    }
+    return -1;
+  }
+
+  stddev = new_stddev;
+  for (auto& [oid, deviation] : new_deviation) {
+    int osd = oid;
+    float& cur = osd_deviation[osd];
+    auto [first, last] = deviation_osd.equal_range(cur);
+    auto i = std::find_if(first, last,
+                          [osd](auto& d) { return d.second == osd; });
+    ceph_assert(i != last);
+    deviation_osd.erase(i);
+    // keep osds with equal deviations in id order, like calc_deviations
+    std::tie(first, last) = deviation_osd.equal_range(deviation);
+    while (first != last && first->second < osd)
+      ++first;
+    deviation_osd.emplace_hint(first, deviation, osd);
+    cur = deviation;
+  }
+  return std::max(fabsf(deviation_osd.begin()->first),
+                  fabsf(deviation_osd.rbegin()->first));
+}
+
 void OSDMap::fill_overfull_underfull (
   CephContext *cct,
   const std::multimap<float,int>& deviation_osd,
@@ -5741,13 +5837,13 @@ bool OSDMap::try_drop_remap_overfull(
   const std::vector<pg_t>& pgs,
   const OSDMap& tmp_osd_map,
   int osd,
-  map<int,std::set<pg_t>>& temp_pgs_by_osd,
+  pg_moves_t& moves,
   set<pg_t>& to_unmap,
   map<pg_t, mempool::osdmap::vector<pair<int32_t,int32_t>>>& to_upmap)
 {
   //
   // This function tries to drop existimg upmap items which map data to overfull 
-  // OSDs. It updates temp_pgs_by_osd, to_unmap and to_upmap and rerturns true 
+  // OSDs. It updates moves, to_unmap and to_upmap and rerturns true 
   // if it found an item that can be dropped, false if not. 
   //
   for (auto pg : pgs) {
@@ -5766,8 +5862,7 @@ bool OSDMap::try_drop_remap_overfull(
                        << " which remapped " << pg
                        << " into overfull osd." << osd
                        << dendl;
-        temp_pgs_by_osd[um_to].erase(pg);
-        temp_pgs_by_osd[um_from].insert(pg);
+        moves.push_back({pg, um_to, um_from});
         } else {
           new_upmap_items.push_back(um_pair);
         }
@@ -5798,13 +5893,13 @@ bool OSDMap::try_drop_remap_underfull(
     CephContext *cct,
     const candidates_t& candidates,
     int osd,
-    map<int,std::set<pg_t>>& temp_pgs_by_osd,
+    pg_moves_t& moves,
     set<pg_t>& to_unmap,
     map<pg_t, mempool::osdmap::vector<std::pair<int32_t,int32_t>>>& to_upmap)
 {
   // 
   // This function tries to drop existimg upmap items which map data from underfull
-  // OSDs. It updates temp_pgs_by_osd, to_unmap and to_upmap and rerturns true 
+  // OSDs. It updates moves, to_unmap and to_upmap and rerturns true 
   // if it found an item that can be dropped, false if not. 
   //
   for (auto& [pg, um_pairs] : candidates) {
@@ -5819,8 +5914,7 @@ bool OSDMap::try_drop_remap_underfull(
                        << " which remapped " << pg
                        << " out from underfull osd." << osd
                        << dendl;
-        temp_pgs_by_osd[um_to].erase(pg);
-        temp_pgs_by_osd[um_from].insert(pg);
+        moves.push_back({pg, um_to, um_from});
       } else {
         new_upmap_items.push_back(ump);
       }
@@ -5857,7 +5951,7 @@ void OSDMap::add_remap_pair(
   size_t pg_pool_size,
   int osd,
   set<int>& existing,
-  map<int,set<pg_t>>& temp_pgs_by_osd,
+  pg_moves_t& moves,
   mempool::osdmap::vector<pair<int32_t,int32_t>> new_upmap_items,
   map<pg_t, mempool::osdmap::vector<pair<int32_t,int32_t>>>& to_upmap) 
 {
@@ -5871,8 +5965,7 @@ void OSDMap::add_remap_pair(
                  << dendl;
   existing.insert(orig);
   existing.insert(out);
-  temp_pgs_by_osd[orig].erase(pg);
-  temp_pgs_by_osd[out].insert(pg);
+  moves.push_back({pg, orig, out});
   ceph_assert(new_upmap_items.size() < pg_pool_size);
   new_upmap_items.push_back(make_pair(orig, out));
   // append new remapping pairs slowly
@@ -5888,7 +5981,7 @@ int OSDMap::find_best_remap (
   const vector<int>& orig,
   const vector<int>& out,
   const set<int>& existing,
-  const map<int,float> osd_deviation) 
+  const map<int,float>& osd_deviation) 
 {
   //
   // Find the best remap from the suggestions in orig and out - the best remap 
@@ -5914,7 +6007,7 @@ int OSDMap::find_best_remap (
 OSDMap::candidates_t OSDMap::build_candidates(
   CephContext *cct,
   const OSDMap& tmp_osd_map,
-  const set<pg_t> to_skip,
+  const set<pg_t>& to_skip,
   const set<int64_t>& only_pools,
   bool aggressive,
   std::random_device::result_type *p_seed)
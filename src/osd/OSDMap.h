@@ -42,6 +42,7 @@
 
 // forward declaration
 class CrushWrapper;
+class OSDMapMapping;
 class health_check_map_t;
 
 /*
@@ -1487,7 +1488,8 @@ public:
     int max_iterations,  ///< max iterations to run
     const std::set<int64_t>& pools,        ///< [optional] restrict to pool
     Incremental *pending_inc,
-    std::random_device::result_type *p_seed = nullptr  ///< [optional] for regression tests
+    std::random_device::result_type *p_seed = nullptr,  ///< [optional] for regression tests
+    const OSDMapMapping *mapping = nullptr  ///< [optional] up sets of this epoch
     );
 
   std::map<uint64_t,std::set<pg_t>> get_pgs_by_osd(
@@ -1510,6 +1512,7 @@ private: // Bunch of internal functions used only by calc_pg_upmaps (result of c
     CephContext *cct,
     const std::set<int64_t>& pools,        ///< [optional] restrict to pool
     const OSDMap& tmp_osd_map,
+    const OSDMapMapping *mapping,
     int& total_pgs,
     std::map<int, std::set<pg_t>>& pgs_by_osd,
     std::map<int,float>& osds_weight
@@ -1548,12 +1551,31 @@ private: // Bunch of internal functions used only by calc_pg_upmaps (result of c
     std::random_device::result_type *p_seed
   );
 
+  /// a pg changing osds, staged by one calc_pg_upmaps iteration
+  struct pg_move_t {
+    pg_t pg;
+    int from;
+    int to;
+  };
+  typedef std::vector<pg_move_t> pg_moves_t;
+
+  float apply_pg_moves(
+    CephContext *cct,
+    const pg_moves_t& moves,
+    const std::map<int,float>& osd_weight,
+    float pgs_per_weight,
+    std::map<int,std::set<pg_t>>& pgs_by_osd,
+    std::map<int,float>& osd_deviation,
+    std::multimap<float,int>& deviation_osd,
+    float& stddev
+  );  // return new max deviation, or -1 if stddev would not decrease
+
   bool try_drop_remap_overfull(
     CephContext *cct,
     const std::vector<pg_t>& pgs,
     const OSDMap& tmp_osd_map,
     int osd,
-    std::map<int,std::set<pg_t>>& temp_pgs_by_osd,
+    pg_moves_t& moves,
     std::set<pg_t>& to_unmap,
     std::map<pg_t, mempool::osdmap::vector<std::pair<int32_t,int32_t>>>& to_upmap
   );
@@ -1565,7 +1587,7 @@ bool try_drop_remap_underfull(
     CephContext *cct,
     const candidates_t& candidates,
     int osd,
-    std::map<int,std::set<pg_t>>& temp_pgs_by_osd,
+    pg_moves_t& moves,
     std::set<pg_t>& to_unmap,
     std::map<pg_t, mempool::osdmap::vector<std::pair<int32_t,int32_t>>>& to_upmap
   );
@@ -1578,7 +1600,7 @@ bool try_drop_remap_underfull(
     size_t pg_pool_size,
     int osd,
     std::set<int>& existing,
-    std::map<int,std::set<pg_t>>& temp_pgs_by_osd,
+    pg_moves_t& moves,
     mempool::osdmap::vector<std::pair<int32_t,int32_t>> new_upmap_items,
     std::map<pg_t, mempool::osdmap::vector<std::pair<int32_t,int32_t>>>& to_upmap
   );
@@ -1588,13 +1610,13 @@ bool try_drop_remap_underfull(
     const std::vector<int>& orig,
     const std::vector<int>& out,
     const std::set<int>& existing,
-    const std::map<int,float> osd_deviation
+    const std::map<int,float>& osd_deviation
   );
 
   candidates_t build_candidates(
     CephContext *cct,
     const OSDMap& tmp_osd_map,
-    const std::set<pg_t> to_skip,
+    const std::set<pg_t>& to_skip,
     const std::set<int64_t>& only_pools,
     bool aggressive,
     std::random_device::result_type *p_seed
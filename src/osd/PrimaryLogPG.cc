@@ -14447,7 +14447,7 @@ void PrimaryLogPG::hit_set_create()
   HitSet::Params params(pool.info.hit_set_params);
 
   dout(20) << __func__ << " " << params << dendl;
-  if (pool.info.hit_set_params.get_type() == HitSet::TYPE_BLOOM) {
+  if (HitSet::is_bloom(pool.info.hit_set_params.get_type())) {
     BloomHitSet::Params *p =
       static_cast<BloomHitSet::Params*>(params.impl.get());
 
@@ -0,0 +1,203 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "RepOpBatcher.h"
+
+#include <optional>
+#include <shared_mutex>
+
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_osd
+#undef dout_prefix
+#define dout_prefix *_dout << "RepOpBatcher "
+
+RepOpBatcher::RepOpBatcher(CephContext *cct, send_func_t send)
+  : cct(cct),
+    send(std::move(send)),
+    window_us(cct->_conf, "osd_repop_batch_window_us"),
+    max_ops(cct->_conf, "osd_repop_batch_max_ops"),
+    flush_thread(this)
+{}
+
+RepOpBatcher::~RepOpBatcher()
+{
+  ceph_assert(!flush_thread.is_started());
+}
+
+void RepOpBatcher::start()
+{
+  flush_thread.create("osd_srv_repop");
+}
+
+void RepOpBatcher::stop()
+{
+  {
+    std::lock_guard l{lock};
+    stopping = true;
+    cond.notify_all();
+  }
+  flush_thread.join();
+  // the messenger is going away, nothing held back will be sent; count
+  // it as sent so that flush() does not wait for it
+  std::shared_lock pl{peers_lock};
+  for (auto& [peer, p] : peers) {
+    std::lock_guard l{p->lock};
+    auto n = p->pending.size();
+    p->pending.clear();
+    p->sent += n;
+    p->unsent -= n;
+    p->cond.notify_all();
+  }
+}
+
+RepOpBatcher::peer_t *RepOpBatcher::get_peer(int peer, bool create)
+{
+  {
+    std::shared_lock l{peers_lock};
+    auto p = peers.find(peer);
+    if (p != peers.end()) {
+      return p->second.get();
+    }
+  }
+  if (!create) {
+    return nullptr;
+  }
+  std::lock_guard l{peers_lock};
+  auto& p = peers[peer];
+  if (!p) {
+    p = std::make_unique<peer_t>();
+  }
+  return p.get();
+}
+
+void RepOpBatcher::kick_flusher()
+{
+  std::lock_guard l{lock};
+  kicked = true;
+  cond.notify_all();
+}
+
+bool RepOpBatcher::queue(int peer, MessageRef m, epoch_t from_epoch)
+{
+  if (!window_us) {
+    return false;
+  }
+  auto p = get_peer(peer, true);
+  std::unique_lock l{p->lock};
+  p->pending.push_back({from_epoch, ceph::mono_clock::now(), std::move(m)});
+  ++p->queued;
+  ++p->unsent;
+  if (p->pending.size() >= max_ops && !p->sending) {
+    send_batch(l, peer, *p);
+  } else if (p->pending.size() == 1 || p->pending.size() >= max_ops) {
+    // the flusher may need to wake up earlier, or to send this batch
+    // once the one in flight is out
+    kick_flusher();
+  }
+  return true;
+}
+
+void RepOpBatcher::flush(int peer)
+{
+  auto p = get_peer(peer, false);
+  if (!p || !p->unsent) {
+    return;
+  }
+  std::unique_lock l{p->lock};
+  // a batch in flight may carry ops queued before us; wait for it, then
+  // send whatever of ours is left
+  const auto target = p->queued;
+  while (p->sent < target) {
+    if (p->sending) {
+      p->cond.wait(l);
+    } else {
+      send_batch(l, peer, *p);
+    }
+  }
+}
+
+void RepOpBatcher::send_batch(std::unique_lock<ceph::mutex>& l, int peer,
+			      peer_t& p)
+{
+  ceph_assert(!p.sending);
+  std::vector<queued_t> pending;
+  pending.swap(p.pending);
+  auto n = pending.size();
+  p.sending = true;
+  l.unlock();
+
+  ldout(cct, 20) << __func__ << " " << n << " ops to osd." << peer << dendl;
+  send(peer, pending);
+
+  l.lock();
+  p.sending = false;
+  p.sent += n;
+  p.unsent -= n;
+  p.cond.notify_all();
+  if (!p.pending.empty()) {
+    // queued while we were sending; the flusher skipped the peer
+    kick_flusher();
+  }
+}
+
+void RepOpBatcher::flush_entry()
+{
+  ldout(cct, 10) << __func__ << " start" << dendl;
+  std::vector<std::pair<int, peer_t*>> all;
+  std::unique_lock fl{lock};
+  while (!stopping) {
+    kicked = false;
+    fl.unlock();
+    {
+      std::shared_lock pl{peers_lock};
+      if (all.size() != peers.size()) {
+	all.clear();
+	for (auto& [peer, p] : peers) {
+	  all.emplace_back(peer, p.get());
+	}
+      }
+    }
+    auto now = ceph::mono_clock::now();
+    auto window = std::chrono::microseconds(static_cast<uint64_t>(window_us));
+    std::optional<ceph::mono_time> next;
+    for (auto [peer, p] : all) {
+      std::unique_lock l{p->lock};
+      if (p->pending.empty() || p->sending) {
+	// whoever is sending kicks us if more is left once it is done
+	continue;
+      }
+      auto due = p->pending.front().queued + window;
+      if (due <= now || p->pending.size() >= max_ops) {
+	send_batch(l, peer, *p);
+	if (p->pending.empty()) {
+	  continue;
+	}
+	due = p->pending.front().queued + window;
+      }
+      if (!next || due < *next) {
+	next = due;
+      }
+    }
+    fl.lock();
+    if (kicked || stopping) {
+      continue;
+    }
+    if (next) {
+      cond.wait_until(fl, *next);
+    } else {
+      cond.wait(fl);
+    }
+  }
+  ldout(cct, 10) << __func__ << " finish" << dendl;
+}
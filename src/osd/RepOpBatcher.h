@@ -0,0 +1,109 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_REPOPBATCHER_H
+#define CEPH_OSD_REPOPBATCHER_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "common/ceph_context.h"
+#include "common/ceph_mutex.h"
+#include "common/ceph_time.h"
+#include "common/config_cacher.h"
+#include "common/Thread.h"
+#include "include/types.h"
+#include "msg/Message.h"
+
+/*
+ * Holds back replication sub ops for up to osd_repop_batch_window_us so
+ * that those headed to the same peer, from any PG, go out together.
+ *
+ * A peer's ops are handed to the send function in the order they were
+ * queued, whether the window expired, osd_repop_batch_max_ops were
+ * queued or a caller flushed the peer ahead of another message.  Sends to
+ * the same peer never overlap; once flush() returns, everything queued
+ * for the peer before the call has been sent.  Waiting for a peer's batch
+ * to go out only holds up callers for that peer.
+ */
+class RepOpBatcher {
+public:
+  struct queued_t {
+    epoch_t from_epoch;
+    ceph::mono_time queued;
+    MessageRef op;
+  };
+  using send_func_t = std::function<void(int peer, std::vector<queued_t>& ops)>;
+
+  RepOpBatcher(CephContext *cct, send_func_t send);
+  ~RepOpBatcher();
+
+  void start();
+  /// stop the flusher and drop whatever is still held back
+  void stop();
+
+  /// false if batching is off (osd_repop_batch_window_us = 0)
+  bool queue(int peer, MessageRef m, epoch_t from_epoch);
+  /// send what is held back for "peer" now
+  void flush(int peer);
+
+private:
+  struct peer_t {
+    ceph::mutex lock = ceph::make_mutex("RepOpBatcher::peer_t::lock");
+    /// signalled when a batch to this peer has been sent
+    ceph::condition_variable cond;
+    std::vector<queued_t> pending;
+    /// ops ever queued, and those of them sent (or dropped by stop())
+    uint64_t queued = 0;
+    uint64_t sent = 0;
+    /// a batch is on its way out; only one at a time, so they stay in order
+    bool sending = false;
+    /// queued - sent, so that flush() is free when the peer is idle
+    std::atomic<uint64_t> unsent = 0;
+  };
+
+  CephContext *cct;
+  const send_func_t send;
+  md_config_cacher_t<uint64_t> window_us;
+  md_config_cacher_t<uint64_t> max_ops;
+
+  /// peers are added but never removed, so a peer_t outlives its lookup
+  ceph::shared_mutex peers_lock =
+    ceph::make_shared_mutex("RepOpBatcher::peers_lock");
+  std::map<int, std::unique_ptr<peer_t>> peers;
+
+  /// for the flusher to sleep on; may be taken under a peer_t::lock,
+  /// never the other way around
+  ceph::mutex lock = ceph::make_mutex("RepOpBatcher::lock");
+  ceph::condition_variable cond;
+  bool kicked = false;
+  bool stopping = false;
+
+  struct FlushThread : public Thread {
+    RepOpBatcher *batcher;
+    explicit FlushThread(RepOpBatcher *b) : batcher(b) {}
+    void *entry() override {
+      batcher->flush_entry();
+      return nullptr;
+    }
+  } flush_thread;
+
+  peer_t *get_peer(int peer, bool create);
+  void kick_flusher();
+  void send_batch(std::unique_lock<ceph::mutex>& l, int peer, peer_t& p);
+  void flush_entry();
+};
+
+#endif
@@ -278,6 +278,49 @@ PerfCounters *build_osd_logger(CephContext *cct) {
   osd_plb.add_u64_counter(
     l_osd_pg_biginfo, "osd_pg_biginfo", "PG updated its biginfo attr");
 
+  osd_plb.add_u64_counter(
+    l_osd_op_wq_idle, "op_wq_idle",
+    "Op shard thread found its queue empty and went to sleep");
+  osd_plb.add_u64_counter(
+    l_osd_op_wq_steal, "op_wq_steal",
+    "Op shard thread ran a work item queued on another shard");
+
+  PerfHistogramCommon::axis_config_d repop_batch_wait_axis_config{
+    "Wait of the oldest op (usec)",
+    PerfHistogramCommon::SCALE_LOG2, ///< Wait in logarithmic scale
+    0,                               ///< Start at 0
+    1000,                            ///< Quantization unit is 1usec
+    24,                              ///< Enough to cover seconds
+  };
+  PerfHistogramCommon::axis_config_d repop_batch_size_axis_config{
+    "Batch size (ops)",
+    PerfHistogramCommon::SCALE_LOG2, ///< Batch size in logarithmic scale
+    0,                               ///< Start at 0
+    1,                               ///< Quantization unit is 1 op
+    16,                              ///< Enough to cover any batch
+  };
+  osd_plb.add_u64_avg(
+    l_osd_repop_batch_size, "repop_batch_size",
+    "Replication sub ops sent per batched message");
+  osd_plb.add_time_avg(
+    l_osd_repop_batch_wait, "repop_batch_wait",
+    "Time replication sub ops were held back to be batched");
+  osd_plb.add_u64_counter_histogram(
+    l_osd_repop_batch_wait_size_hist, "repop_batch_wait_size_histogram",
+    repop_batch_wait_axis_config, repop_batch_size_axis_config,
+    "Histogram of replication sub op batches by wait and size");
+
+  // updated by every op shard thread for every client op
+  for (int idx : {l_osd_op, l_osd_op_inb, l_osd_op_outb, l_osd_op_lat,
+		  l_osd_op_process_lat, l_osd_op_prepare_lat,
+		  l_osd_op_r, l_osd_op_r_outb, l_osd_op_r_lat,
+		  l_osd_op_r_process_lat, l_osd_op_r_prepare_lat,
+		  l_osd_op_w, l_osd_op_w_inb, l_osd_op_w_lat,
+		  l_osd_op_w_process_lat, l_osd_op_w_prepare_lat,
+		  l_osd_op_wq_idle, l_osd_op_wq_steal}) {
+    osd_plb.set_sharded(idx);
+  }
+
   return osd_plb.create_perf_counters();
 }
  
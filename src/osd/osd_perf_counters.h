@@ -118,6 +118,13 @@ enum {
   l_osd_pg_fastinfo,
   l_osd_pg_biginfo,
 
+  l_osd_op_wq_idle,
+  l_osd_op_wq_steal,
+
+  l_osd_repop_batch_size,
+  l_osd_repop_batch_wait,
+  l_osd_repop_batch_wait_size_hist,
+
   l_osd_last,
 };
 
@@ -203,12 +203,13 @@ http::status PerfCounterStatusPage::render(std::ostream& os) {
                 );
               }
             } else {
+              const auto v = data.read_u64();
               if (data.type & PERFCOUNTER_U64) {
-                return format_int_value(data.u64, data.unit);
+                return format_int_value(v, data.unit);
               } else if (data.type & PERFCOUNTER_TIME) {
                 return fmt::format(
-                    "{:d}.{:09d}s", data.u64 / 1000000000ull,
-                    data.u64 % 1000000000ull
+                    "{:d}.{:09d}s", v / 1000000000ull,
+                    v % 1000000000ull
                 );
               } else {
                 return std::string("???");
@@ -302,12 +303,13 @@ http::status PrometheusStatusPage::render(std::ostream& os) {
                   sum / std::max(static_cast<decltype(count)>(1), count);
               return fmt::format("{:f}", avg);
             } else {
+              const auto v = data.read_u64();
               if (data.type & PERFCOUNTER_U64) {
-                return format_int_value(data.u64, data.unit);
+                return format_int_value(v, data.unit);
               } else if (data.type & PERFCOUNTER_TIME) {
                 return fmt::format(
-                    "{:d}.{:09d}", data.u64 / 1000000000ull,
-                    data.u64 % 1000000000ull
+                    "{:d}.{:09d}", v / 1000000000ull,
+                    v % 1000000000ull
                 );
               } else {
                 return std::string("-23.42");
@@ -1337,6 +1337,85 @@ TEST(BufferList, BenchAlloc) {
   bench_bufferlist_alloc(4, 100000, 16);
 }
 
+// roughly the shape of a small message or OSD op: a few ints, a name,
+// a short vector and a tiny payload, in a versioned encoding
+struct bench_small_op_t {
+  uint64_t id = 0;
+  uint32_t flags = 0;
+  std::string name;
+  std::vector<uint64_t> snaps;
+  bufferlist data;
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    encode(id, bl);
+    encode(flags, bl);
+    encode(name, bl);
+    encode(snaps, bl);
+    encode(data, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::const_iterator& p) {
+    DECODE_START(1, p);
+    decode(id, p);
+    decode(flags, p);
+    decode(name, p);
+    decode(snaps, p);
+    decode(data, p);
+    DECODE_FINISH(p);
+  }
+};
+WRITE_CLASS_ENCODER(bench_small_op_t)
+
+TEST(BufferList, BenchSmallOpEncodeDecode) {
+  using ceph::buffer_instrumentation::get_thread_alloc_counters;
+
+  bench_small_op_t op;
+  op.id = 12345;
+  op.flags = 7;
+  op.name = "rbd_data.1234567890ab.0000000000000001";
+  op.snaps = {1, 2, 3};
+  op.data.append("0123456789abcdef", 16);
+
+  constexpr unsigned ops = 200000;
+  // warm up the per-thread caches
+  for (unsigned i = 0; i < 100; ++i) {
+    bufferlist bl;
+    encode(op, bl);
+  }
+  const auto before = get_thread_alloc_counters();
+  const utime_t start = ceph_clock_now();
+  for (unsigned i = 0; i < ops; ++i) {
+    bufferlist bl;
+    encode(op, bl);
+    bench_small_op_t out;
+    auto p = bl.cbegin();
+    decode(out, p);
+    ASSERT_EQ(op.id, out.id);
+  }
+  const utime_t elapsed = ceph_clock_now() - start;
+  const auto after = get_thread_alloc_counters();
+
+  auto per_op = [](uint64_t n) { return (double)n / ops; };
+  const uint64_t nodes = after.node_alloc - before.node_alloc;
+  const uint64_t node_reuse = after.node_reuse - before.node_reuse;
+  const uint64_t combined = after.combined_alloc - before.combined_alloc;
+  const uint64_t combined_reuse =
+    after.combined_reuse - before.combined_reuse;
+  cout << ops << " small op encode+decode in " << elapsed
+       << " (" << (double)elapsed.to_nsec() / ops << " ns/op)" << std::endl;
+  cout << "per op: ptr_node " << per_op(nodes)
+       << " (malloc " << per_op(nodes - node_reuse) << "), append buffer "
+       << per_op(combined)
+       << " (malloc " << per_op(combined - combined_reuse) << ")"
+       << std::endl;
+  if (nodes) {
+    // in steady state everything comes from the per-thread caches
+    EXPECT_LT(per_op(nodes - node_reuse), 0.01);
+    EXPECT_LT(per_op(combined - combined_reuse), 0.01);
+  }
+}
+
 /*
  * append_bench tests now have multiple variants:
  *
@@ -95,6 +95,7 @@
         [--min-rep n] [--max-rep n] [--num-rep n]
         [--pool-id n]      specifies pool id
         [--batches b]      split the CRUSH mapping into b > 1 rounds
+        [--threads n]      spread the CRUSH mapping over n threads
         [--weight|-w devno weight]
                            where weight is 0 to 1.0
         [--simulate]       simulate placements using a random
@@ -0,0 +1,36 @@
+spreading the mappings over threads must not change the output, or its order
+
+  $ crushtool -i "$TESTDIR/test-map-vary-r.crushmap" --test --show-mappings --num-rep 3 --min-x 0 --max-x 2047 > single
+  $ crushtool -i "$TESTDIR/test-map-vary-r.crushmap" --test --show-mappings --num-rep 3 --min-x 0 --max-x 2047 --threads 4 > threaded
+  $ cmp single threaded
+  $ crushtool -i "$TESTDIR/test-map-vary-r.crushmap" --test --show-statistics --show-bad-mappings --show-utilization --min-rep 1 --max-rep 4 --min-x 0 --max-x 1023 > single
+  $ crushtool -i "$TESTDIR/test-map-vary-r.crushmap" --test --show-statistics --show-bad-mappings --show-utilization --min-rep 1 --max-rep 4 --min-x 0 --max-x 1023 --threads 4 > threaded
+  $ cmp single threaded
+  $ rm single threaded
+
+with --show-statistics, --compare also reports the fraction of replicas
+that would move
+
+  $ crushtool -i "$TESTDIR/test-map-vary-r.crushmap" --reweight-item osd.0 0 -o out > /dev/null
+  $ crushtool -i "$TESTDIR/test-map-vary-r.crushmap" --compare out --num-rep 3 --min-x 0 --max-x 1023 --show-statistics --threads 4
+  rule 0 had 35/1024 mismatched mappings (0.0341797)
+  rule 0 moved 40/3072 replicas (0.0130208)
+  rule 1 had 35/1024 mismatched mappings (0.0341797)
+  rule 1 moved 40/3072 replicas (0.0130208)
+  rule 2 had 35/1024 mismatched mappings (0.0341797)
+  rule 2 moved 40/3072 replicas (0.0130208)
+  rule 3 had 33/1024 mismatched mappings (0.0322266)
+  rule 3 moved 38/2048 replicas (0.0185547)
+  warning: maps are NOT equivalent
+  [1]
+  $ crushtool -i "$TESTDIR/test-map-vary-r.crushmap" --compare "$TESTDIR/test-map-vary-r.crushmap" --num-rep 3 --min-x 0 --max-x 1023 --show-statistics
+  rule 0 had 0/1024 mismatched mappings (0)
+  rule 0 moved 0/3072 replicas (0)
+  rule 1 had 0/1024 mismatched mappings (0)
+  rule 1 moved 0/3072 replicas (0)
+  rule 2 had 0/1024 mismatched mappings (0)
+  rule 2 moved 0/3072 replicas (0)
+  rule 3 had 0/1024 mismatched mappings (0)
+  rule 3 moved 0/2048 replicas (0)
+  maps appear equivalent
+  $ rm out
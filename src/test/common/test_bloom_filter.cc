@@ -8,6 +8,7 @@
  * LGPL-2.1 (see COPYING-LGPL2.1) or later
  */
 
+#include <chrono>
 #include <iostream>
 #include <gtest/gtest.h>
 
@@ -321,3 +322,139 @@ TEST(BloomFilter, Assignement) {
   ASSERT_EQ(2U, bf1.element_count());
   ASSERT_EQ(1U, bf2.element_count());
 }
+
+TEST(BlockedBloomFilter, Basic) {
+  blocked_bloom_filter bf(10, .1, 1);
+  bf.insert("foo");
+  bf.insert("bar");
+
+  ASSERT_TRUE(bf.contains("foo"));
+  ASSERT_TRUE(bf.contains("bar"));
+
+  ASSERT_EQ(2U, bf.element_count());
+}
+
+TEST(BlockedBloomFilter, Empty) {
+  blocked_bloom_filter bf;
+  for (int i=0; i<100; ++i) {
+    ASSERT_FALSE(bf.contains((uint32_t) i));
+    ASSERT_FALSE(bf.contains(stringify(i)));
+  }
+}
+
+TEST(BlockedBloomFilter, SweepInt) {
+  std::cout << "probe impl " << blocked_bloom_filter::get_probe_impl() << std::endl;
+  std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+  std::cout.precision(5);
+  std::cout << "# max\tfpp\tactual\tsize\tB/insert\tdensity\tapprox_element_count" << std::endl;
+  for (int ex = 3; ex < 14; ex += 2) {
+    for (float fpp = .001; fpp < .5; fpp *= 4.0) {
+      int max = 2 << ex;
+      blocked_bloom_filter bf(max, fpp, 1);
+      // sequential ints are fine here, unlike bloom_filter
+      for (int n = 0; n < max; n++)
+	bf.insert((uint32_t)n);
+
+      int test = max * 100;
+      int hit = 0;
+      for (int n = 0; n < test; n++)
+	if (bf.contains((uint32_t)(max + n)))
+	  hit++;
+
+      for (int n = 0; n < max; n++)
+	ASSERT_TRUE(bf.contains((uint32_t)n));
+
+      double actual = (double)hit / (double)test;
+
+      bufferlist bl;
+      encode(bf, bl);
+
+      double byte_per_insert = (double)bl.length() / (double)max;
+
+      std::cout << max << "\t" << fpp << "\t" << actual << "\t" << bl.length() << "\t" << byte_per_insert
+		<< "\t" << bf.density() << "\t" << bf.approx_unique_element_count() << std::endl;
+      ASSERT_TRUE(actual < fpp * 3);
+      ASSERT_TRUE(bf.approx_unique_element_count() > max * .9);
+      ASSERT_TRUE(bf.approx_unique_element_count() < max * 1.1);
+    }
+  }
+}
+
+TEST(BlockedBloomFilter, Compress) {
+  int max = 4096;
+  blocked_bloom_filter bf(max, .01, 1);
+  for (int n = 0; n < max; n++)
+    bf.insert("ok" + stringify(n));
+  size_t blocks = bf.block_count();
+
+  ASSERT_FALSE(bf.compress(1.0));
+  ASSERT_TRUE(bf.compress(.5));
+  ASSERT_EQ(blocks / 2, bf.block_count());
+
+  for (int n = 0; n < max; n++)
+    ASSERT_TRUE(bf.contains("ok" + stringify(n)));
+  // the estimate survives the fold
+  ASSERT_TRUE(bf.approx_unique_element_count() > max * .9);
+  ASSERT_TRUE(bf.approx_unique_element_count() < max * 1.1);
+
+  // inserts after the fold land in the folded table
+  bf.insert("after");
+  ASSERT_TRUE(bf.contains("after"));
+}
+
+TEST(BlockedBloomFilter, EncodeDecode) {
+  blocked_bloom_filter bf(1000, .01, 7);
+  for (int n = 0; n < 1000; n++)
+    bf.insert("ok" + stringify(n));
+  bf.compress(.7);
+
+  bufferlist bl;
+  encode(bf, bl);
+  blocked_bloom_filter bf2;
+  auto p = bl.cbegin();
+  decode(bf2, p);
+
+  ASSERT_EQ(bf.block_count(), bf2.block_count());
+  ASSERT_EQ(bf.element_count(), bf2.element_count());
+  for (int n = 0; n < 2000; n++)
+    ASSERT_EQ(bf.contains("ok" + stringify(n)), bf2.contains("ok" + stringify(n)));
+}
+
+TEST(BlockedBloomFilter, Assignement) {
+  blocked_bloom_filter bf1(10, .1, 1), bf2;
+
+  bf1.insert("foo");
+  bf2 = bf1;
+  bf1.insert("bar");
+
+  ASSERT_TRUE(bf2.contains("foo"));
+  ASSERT_FALSE(bf2.contains("bar"));
+
+  ASSERT_EQ(2U, bf1.element_count());
+  ASSERT_EQ(1U, bf2.element_count());
+}
+
+// compare probe throughput and false positives against bloom_filter
+// for a table well beyond the last level cache
+TEST(BlockedBloomFilter, BenchContains) {
+  const uint32_t max = 4 << 20;
+  const double fpp = .01;
+  const uint32_t test = 4 << 20;
+
+  auto bench = [&](const char* name, auto& bf) {
+    for (uint32_t n = 0; n < max; n++)
+      bf.insert(n * 732);
+    auto start = std::chrono::steady_clock::now();
+    int hit = 0;
+    for (uint32_t n = 0; n < test; n++)
+      hit += bf.contains(n * 732 + 1);
+    std::chrono::duration<double> dur = std::chrono::steady_clock::now() - start;
+    std::cout << name << " " << (double)hit / test << " fpp, "
+	      << test / dur.count() / 1e6 << " M probes/s, "
+	      << (double)bf.size() / 8 / max << " B/insert" << std::endl;
+  };
+  bloom_filter classic(max, fpp, 1);
+  bench("bloom_filter", classic);
+  blocked_bloom_filter blocked(max, fpp, 1);
+  bench(blocked_bloom_filter::get_probe_impl(), blocked);
+}
@@ -9,6 +9,8 @@
 #include "include/buffer.h"
 
 #include "common/CDC.h"
+#include "common/FastCDC.h"
+#include "common/ceph_time.h"
 #include "gtest/gtest.h"
 
 using namespace std;
@@ -154,6 +156,74 @@ TEST_P(CDCTest, chunk_random)
 }
 
 
+TEST(FastCDC, bit_exact)
+{
+  // the striped search over contiguous memory must find exactly the cut
+  // points of the byte-at-a-time scan
+  cout << "scan impl: " << FastCDC::get_scan_impl() << std::endl;
+  for (int bits : {12, 14, 16, 18}) {
+    FastCDC cdc(bits);
+    for (int seed = 0; seed < 4; ++seed) {
+      for (int size : {1 << 10, (1 << bits) + 1, 3 << bits,
+		       (4 << 20) + 12345}) {
+	bufferlist fragmented;
+	generate_buffer(size, &fragmented, seed);
+	bufferlist flat = fragmented;
+	flat.rebuild();
+
+	vector<pair<uint64_t, uint64_t>> expected, chunks;
+	cdc.calc_chunks_scalar(flat, &expected);
+	cdc.calc_chunks(flat, &chunks);
+	ASSERT_EQ(expected, chunks) << bits << " " << seed << " " << size;
+	chunks.clear();
+	cdc.calc_chunks(fragmented, &chunks);
+	ASSERT_EQ(expected, chunks) << bits << " " << seed << " " << size;
+      }
+    }
+  }
+
+  // low entropy input has (almost) no matches, so chunks are cut at the
+  // max size and every stripe runs to its end
+  FastCDC cdc(14);
+  for (char c : {'\0', 'a'}) {
+    bufferlist bl;
+    bl.append_zero(1 << 20);
+    memset(bl.c_str(), c, bl.length());  // c_str() also makes it contiguous
+    vector<pair<uint64_t, uint64_t>> expected, chunks;
+    cdc.calc_chunks_scalar(bl, &expected);
+    cdc.calc_chunks(bl, &chunks);
+    ASSERT_EQ(expected, chunks);
+  }
+}
+
+TEST(FastCDC, BenchCalcChunks)
+{
+  const int size = 64 << 20;
+  bufferlist bl;
+  generate_buffer(size, &bl);
+  bl.rebuild();
+  for (int bits : {13, 16, 18}) {
+    FastCDC cdc(bits);
+    vector<pair<uint64_t, uint64_t>> expected, chunks;
+    for (bool scalar : {true, false}) {
+      auto start = ceph::mono_clock::now();
+      chunks.clear();
+      if (scalar) {
+	cdc.calc_chunks_scalar(bl, &chunks);
+	expected = chunks;
+      } else {
+	cdc.calc_chunks(bl, &chunks);
+      }
+      auto elapsed = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+      cout << "target " << (1 << bits) << " "
+	   << (scalar ? "scalar" : FastCDC::get_scan_impl()) << ": "
+	   << size / elapsed / (1 << 20) << " MB/s, "
+	   << chunks.size() << " chunks" << std::endl;
+    }
+    ASSERT_EQ(expected, chunks);
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(
   CDC,
   CDCTest,
@@ -0,0 +1,201 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "include/buffer.h"
+#include "include/utime.h"
+#include "common/Checksummer.h"
+#include "common/Clock.h"
+#include "common/csum_multi.h"
+
+#include "gtest/gtest.h"
+
+using namespace ceph::csum_multi;
+
+namespace {
+
+std::vector<unsigned char> random_data(size_t len)
+{
+  std::mt19937_64 rng(len);
+  std::vector<unsigned char> v(len);
+  for (auto& c : v) {
+    c = rng();
+  }
+  return v;
+}
+
+// buffers at odd offsets and in odd counts so every kernel also runs
+// its unaligned and remainder paths.
+std::vector<const unsigned char*> pick_bufs(
+  const std::vector<unsigned char>& data, size_t len, size_t n)
+{
+  std::vector<const unsigned char*> bufs(n);
+  for (size_t i = 0; i < n; ++i) {
+    bufs[i] = data.data() + (i * 7919 + len * 13) % (data.size() - len);
+  }
+  return bufs;
+}
+
+}
+
+TEST(CsumMulti, Impl) {
+  std::cout << "crc32c " << get_crc32c_impl()
+	    << ", xxhash32 " << get_xxhash32_impl()
+	    << ", xxhash64 " << get_xxhash64_impl() << std::endl;
+}
+
+TEST(CsumMulti, MatchesScalar) {
+  auto data = random_data(1 << 20);
+  for (size_t len : {0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64,
+		     100, 512, 4095, 4096, 8192, 65536}) {
+    for (size_t n = 1; n <= 19; ++n) {
+      auto bufs = pick_bufs(data, len, n);
+      std::vector<uint32_t> a(n), b(n);
+      std::vector<uint64_t> a64(n), b64(n);
+      for (uint64_t seed : {0ull, 1234ull, -1ull}) {
+	crc32c(seed, len, bufs.data(), n, a.data());
+	crc32c_scalar(seed, len, bufs.data(), n, b.data());
+	ASSERT_EQ(a, b) << "crc32c len " << len << " n " << n;
+	xxhash32(seed, len, bufs.data(), n, a.data());
+	xxhash32_scalar(seed, len, bufs.data(), n, b.data());
+	ASSERT_EQ(a, b) << "xxhash32 len " << len << " n " << n;
+	xxhash64(seed, len, bufs.data(), n, a64.data());
+	xxhash64_scalar(seed, len, bufs.data(), n, b64.data());
+	ASSERT_EQ(a64, b64) << "xxhash64 len " << len << " n " << n;
+      }
+    }
+  }
+}
+
+TEST(CsumMulti, Known) {
+  const unsigned char *a = (const unsigned char *)"foo bar baz";
+  const unsigned char *bufs[5] = {a, a, a, a, a};
+  uint32_t out[5];
+  crc32c(0, 11, bufs, 5, out);
+  for (auto v : out) {
+    ASSERT_EQ(4119623852u, v);
+  }
+  crc32c(1234, 11, bufs, 5, out);
+  for (auto v : out) {
+    ASSERT_EQ(881700046u, v);
+  }
+}
+
+// the batched Checksummer must give the same answer as checksumming
+// chunk by chunk, also when chunks straddle bufferlist segments.
+template<class Alg>
+void check_checksummer(const std::vector<unsigned char>& data,
+		       size_t csum_block_size, size_t seg_len)
+{
+  ceph::buffer::list bl;
+  for (size_t off = 0; off < data.size(); off += seg_len) {
+    size_t l = std::min(seg_len, data.size() - off);
+    bl.append((const char*)data.data() + off, l);
+  }
+  size_t blocks = data.size() / csum_block_size;
+  ceph::buffer::ptr csum_data(
+    ceph::buffer::create(blocks * sizeof(typename Alg::value_t)));
+  Checksummer::calculate<Alg>(csum_block_size, 0, data.size(), bl,
+			      &csum_data);
+
+  typename Alg::state_t state;
+  Alg::init(&state);
+  auto p = bl.cbegin();
+  const typename Alg::value_t *pv =
+    reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
+  for (size_t i = 0; i < blocks; ++i) {
+    typename Alg::init_value_t v = Alg::calc(state, -1, csum_block_size, p);
+    ASSERT_EQ(v, pv[i]) << "block " << i << " seg_len " << seg_len;
+  }
+  Alg::fini(&state);
+
+  ASSERT_EQ(-1, Checksummer::verify<Alg>(csum_block_size, 0, data.size(), bl,
+					 csum_data));
+
+  // corrupt one block and make sure we blame the right one
+  ceph::buffer::list bad;
+  bad.append((const char*)data.data(), data.size());
+  size_t victim = (blocks * 2) / 3;
+  bad.c_str()[victim * csum_block_size + 1] ^= 0x40;
+  uint64_t bad_csum = 0;
+  ASSERT_EQ((int)(victim * csum_block_size),
+	    Checksummer::verify<Alg>(csum_block_size, 0, data.size(), bad,
+				     csum_data, &bad_csum));
+}
+
+TEST(CsumMulti, Checksummer) {
+  auto data = random_data(64 * 4096);
+  for (size_t seg_len : {4096ul * 64, 4096ul * 5, 4096ul, 6000ul, 1000ul}) {
+    check_checksummer<Checksummer::crc32c>(data, 4096, seg_len);
+    check_checksummer<Checksummer::crc32c_16>(data, 4096, seg_len);
+    check_checksummer<Checksummer::crc32c_8>(data, 4096, seg_len);
+    check_checksummer<Checksummer::xxhash32>(data, 4096, seg_len);
+    check_checksummer<Checksummer::xxhash64>(data, 4096, seg_len);
+  }
+}
+
+template<typename Fn>
+void perf(const std::string& name, size_t total, Fn&& fn)
+{
+  const int iterations = 100;
+  utime_t start = ceph_clock_now();
+  for (int i = 0; i < iterations; ++i) {
+    fn();
+  }
+  utime_t end = ceph_clock_now();
+  float rate = (float)total * iterations / (float)(1024*1024*1024) /
+    (float)(end - start);
+  std::cout << name << " = " << rate << " GB/sec" << std::endl;
+}
+
+TEST(CsumMulti, Performance) {
+  const size_t chunk = 4096;
+  const size_t chunks = 4096;
+  auto data = random_data(chunk * chunks);
+  std::vector<const unsigned char*> bufs(chunks);
+  for (size_t i = 0; i < chunks; ++i) {
+    bufs[i] = data.data() + i * chunk;
+  }
+  std::vector<uint32_t> out32(chunks);
+  std::vector<uint64_t> out64(chunks);
+  const size_t total = chunk * chunks;
+
+  perf("crc32c scalar", total, [&] {
+    crc32c_scalar(-1, chunk, bufs.data(), chunks, out32.data());
+  });
+  perf(std::string("crc32c ") + get_crc32c_impl(), total, [&] {
+    crc32c(-1, chunk, bufs.data(), chunks, out32.data());
+  });
+  perf("xxhash32 scalar", total, [&] {
+    xxhash32_scalar(-1, chunk, bufs.data(), chunks, out32.data());
+  });
+  perf(std::string("xxhash32 ") + get_xxhash32_impl(), total, [&] {
+    xxhash32(-1, chunk, bufs.data(), chunks, out32.data());
+  });
+  perf("xxhash64 scalar", total, [&] {
+    xxhash64_scalar(-1, chunk, bufs.data(), chunks, out64.data());
+  });
+  perf(std::string("xxhash64 ") + get_xxhash64_impl(), total, [&] {
+    xxhash64(-1, chunk, bufs.data(), chunks, out64.data());
+  });
+
+  // and end to end through Checksummer, as BlueStore calls it
+  ceph::buffer::list bl;
+  bl.append((const char*)data.data(), data.size());
+  ceph::buffer::ptr csum_data(ceph::buffer::create(chunks * 8));
+  perf("Checksummer crc32c", total, [&] {
+    Checksummer::calculate<Checksummer::crc32c>(chunk, 0, total, bl,
+						&csum_data);
+  });
+  perf("Checksummer xxhash32", total, [&] {
+    Checksummer::calculate<Checksummer::xxhash32>(chunk, 0, total, bl,
+						  &csum_data);
+  });
+  perf("Checksummer xxhash64", total, [&] {
+    Checksummer::calculate<Checksummer::xxhash64>(chunk, 0, total, bl,
+						  &csum_data);
+  });
+}
@@ -79,3 +79,37 @@ TEST(formatter, utime)
   EXPECT_EQ(input.sec(), output.sec());
   EXPECT_EQ(input.nsec(), output.nsec());
 }
+
+TEST(formatter, flush_bufferlist)
+{
+  // the same output written in one go and flushed piecewise into a
+  // bufferlist, large enough to span several output segments
+  for (const char *type : {"json", "json-pretty", "xml"}) {
+    std::unique_ptr<ceph::Formatter> a(ceph::Formatter::create(type));
+    std::unique_ptr<ceph::Formatter> b(ceph::Formatter::create(type));
+    std::ostringstream expected;
+    bufferlist bl;
+    for (ceph::Formatter *f : {a.get(), b.get()}) {
+      f->open_array_section("items");
+    }
+    for (int i = 0; i < 20000; ++i) {
+      for (ceph::Formatter *f : {a.get(), b.get()}) {
+	f->open_object_section("item");
+	f->dump_int("id", i);
+	f->dump_float("weight", i / 3.0);
+	f->dump_string("name", "\"quoted\" <name>\t&\x01");
+	f->dump_stream("stream") << "i=" << i;
+	f->close_section();
+      }
+      if (i % 997 == 0) {
+	b->flush(bl);
+      }
+    }
+    for (ceph::Formatter *f : {a.get(), b.get()}) {
+      f->close_section();
+    }
+    a->flush(expected);
+    b->flush(bl);
+    ASSERT_EQ(expected.str(), bl.to_str()) << type;
+  }
+}
@@ -1,6 +1,9 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 // vim: ts=8 sw=2 smarttab
 
+#include <sys/mman.h>
+#include <cstring>
+
 #include "gtest/gtest.h"
 #include "common/numa.h"
 
@@ -70,3 +73,23 @@ TEST(cpu_set, round_trip_list)
   }
 }
 
+
+TEST(numa, bind_memory)
+{
+  int node = get_current_numa_node();
+  if (node == -ENOTSUP) {
+    GTEST_SKIP() << "no numa support on this platform";
+  }
+  ASSERT_GE(node, 0);
+
+  size_t len = 1 << 20;
+  void *p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, p);
+  int r = bind_memory_to_numa_node(p, len, node);
+  // containers may forbid mbind
+  ASSERT_TRUE(r == 0 || r == -EPERM || r == -ENOSYS) << r;
+  memset(p, 1, len);
+  ASSERT_EQ(-EINVAL, bind_memory_to_numa_node(p, len, -1));
+  ::munmap(p, len);
+}
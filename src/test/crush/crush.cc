@@ -658,3 +658,102 @@ TEST_F(CRUSHTest, straw2_reweight) {
     cout << "     vs " << estddev << std::endl;
   }
 }
+
+TEST_F(CRUSHTest, hash32_3_batch) {
+  // every lane of the batched hash must match the scalar one, including
+  // the leftovers past the last full vector
+  vector<__u32> b(203), out(b.size());
+  for (unsigned i = 0; i < b.size(); ++i) {
+    b[i] = i * 2654435761u - 100;
+  }
+  for (__u32 a : {0u, 1u, 0x7fffffffu, 0xdeadbeefu}) {
+    for (unsigned n = 0; n <= b.size(); n += 7) {
+      crush_hash32_3_batch(CRUSH_HASH_RJENKINS1, a, b.data(), 3, out.data(), n);
+      for (unsigned i = 0; i < n; ++i) {
+	ASSERT_EQ(crush_hash32_3(CRUSH_HASH_RJENKINS1, a, b[i], 3), out[i]);
+      }
+    }
+  }
+}
+
+std::unique_ptr<CrushWrapper> build_straw2_map(CephContext *cct,
+					       int num_host, int num_osd)
+{
+  std::unique_ptr<CrushWrapper> c(new CrushWrapper);
+  c->create();
+
+  c->set_type_name(2, "root");
+  c->set_type_name(1, "host");
+  c->set_type_name(0, "osd");
+
+  int rootno;
+  c->add_bucket(0, CRUSH_BUCKET_STRAW2, CRUSH_HASH_RJENKINS1,
+		2, 0, NULL, NULL, &rootno);
+  c->set_item_name(rootno, "default");
+
+  map<string,string> loc;
+  loc["root"] = "default";
+
+  int osd = 0;
+  for (int h=0; h<num_host; ++h) {
+    loc["host"] = string("host-") + stringify(h);
+    for (int o=0; o<num_osd; ++o, ++osd) {
+      c->insert_item(cct, osd, 1.0 + (osd % 5) * .5,
+		     string("osd.") + stringify(osd), loc);
+    }
+  }
+  c->add_simple_rule("rep", "default", "host", "",
+		     "firstn", pg_pool_t::TYPE_REPLICATED);
+  c->add_simple_rule("ec", "default", "host", "",
+		     "indep", pg_pool_t::TYPE_ERASURE);
+  c->finalize();
+  return c;
+}
+
+TEST_F(CRUSHTest, do_rule_batch) {
+  // hosts large enough for straw2 to hash their items in several chunks
+  int num_host = 12, num_osd = 150;
+  auto c = build_straw2_map(cct, num_host, num_osd);
+
+  vector<__u32> weight(num_host * num_osd, 0x10000);
+  for (unsigned i = 0; i < weight.size(); i += 13) {
+    weight[i] = 0;
+  }
+  for (unsigned i = 5; i < weight.size(); i += 17) {
+    weight[i] = 0x8000;
+  }
+
+  vector<int> xs;
+  for (int x = 0; x < 5000; ++x) {
+    xs.push_back(crush_hash32_2(CRUSH_HASH_RJENKINS1, x, 1));
+  }
+  for (int rule : {0, 1}) {
+    vector<vector<int>> batch_out;
+    c->do_rule_batch(rule, xs, batch_out, 6, weight, 0);
+    ASSERT_EQ(xs.size(), batch_out.size());
+    for (unsigned i = 0; i < xs.size(); ++i) {
+      vector<int> out;
+      c->do_rule(rule, xs[i], out, 6, weight, 0);
+      ASSERT_EQ(out, batch_out[i]) << "rule " << rule << " x " << xs[i];
+    }
+  }
+}
+
+TEST_F(CRUSHTest, DISABLED_do_rule_batch_throughput) {
+  for (int num_osd : {4, 12, 24, 60}) {
+    int num_host = 40;
+    auto c = build_straw2_map(cct, num_host, num_osd);
+    vector<__u32> weight(num_host * num_osd, 0x10000);
+    vector<int> xs;
+    for (int x = 0; x < 100000; ++x) {
+      xs.push_back(crush_hash32_2(CRUSH_HASH_RJENKINS1, x, 1));
+    }
+    vector<vector<int>> out;
+    auto start = ceph::mono_clock::now();
+    c->do_rule_batch(0, xs, out, 3, weight, 0);
+    double secs = std::chrono::duration<double>(
+      ceph::mono_clock::now() - start).count();
+    cout << num_host << " hosts x " << num_osd << " osds: "
+	 << (double)xs.size() / secs << " mappings/s" << std::endl;
+  }
+}
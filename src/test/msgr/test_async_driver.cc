@@ -29,8 +29,11 @@
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
 #include "msg/async/Event.h"
+#include "msg/async/TimerWheel.h"
 
 #include <atomic>
+#include <map>
+#include <random>
 
 // We use epoll, kqueue, evport, select in descending order by performance.
 #if defined(__linux__)
@@ -331,6 +334,114 @@ TEST(EventCenterTest, DispatchTest) {
   worker2.join();
 }
 
+TEST(TimerWheelTest, MatchesReference) {
+  std::mt19937_64 rng(42);
+  TimerWheel<int> wheel(1000);
+  // id -> (expire, payload)
+  std::map<uint64_t, std::pair<uint64_t, int>> armed;
+  uint64_t now = 1000;
+  int seq = 0;
+  for (int step = 0; step < 20000; ++step) {
+    int op = rng() % 10;
+    if (op < 5) {
+      static const uint64_t spans[] = {64, 5000, 400000, uint64_t(1) << 40};
+      uint64_t expire = now + rng() % spans[rng() % 4];
+      uint64_t id = wheel.add(expire, seq);
+      ASSERT_NE(0u, id);
+      armed[id] = {expire, seq++};
+    } else if (op < 7 && !armed.empty()) {
+      auto it = armed.lower_bound(rng());
+      if (it == armed.end())
+        it = armed.begin();
+      ASSERT_TRUE(wheel.cancel(it->first));
+      ASSERT_FALSE(wheel.cancel(it->first));
+      armed.erase(it);
+    } else {
+      auto next = wheel.next_wakeup();
+      ASSERT_EQ(armed.empty(), !next);
+      for (auto& [id, e] : armed)
+        ASSERT_LE(*next, std::max(e.first, now));
+      static const uint64_t steps[] = {3, 200, 100000};
+      now += (next && rng() % 2) ? *next - now : rng() % steps[rng() % 3];
+      wheel.advance(now);
+      uint64_t id;
+      int payload;
+      while (wheel.pop_expired(&id, &payload)) {
+        auto it = armed.find(id);
+        ASSERT_NE(armed.end(), it);
+        ASSERT_LE(it->second.first, now);
+        ASSERT_EQ(it->second.second, payload);
+        armed.erase(it);
+      }
+      for (auto& [id, e] : armed)
+        ASSERT_GT(e.first, now);
+    }
+    ASSERT_EQ(armed.size(), wheel.size());
+  }
+}
+
+class TimeEvent : public EventCallback {
+ public:
+  std::vector<uint64_t> *fired;
+  explicit TimeEvent(std::vector<uint64_t> *f) : fired(f) {}
+  void do_request(uint64_t id) override {
+    fired->push_back(id);
+  }
+};
+
+TEST(EventCenterTest, TimeEvents) {
+  EventCenter center(g_ceph_context);
+  center.init(100, 0, "posix");
+  center.set_owner();
+  std::vector<uint64_t> fired;
+  TimeEvent e(&fired);
+  uint64_t late = center.create_time_event(20000, &e);
+  uint64_t early = center.create_time_event(1000, &e);
+  uint64_t cancelled = center.create_time_event(5000, &e);
+  uint64_t now = center.create_time_event(0, &e);
+  center.delete_time_event(cancelled);
+  center.delete_time_event(cancelled);
+  auto start = ceph::coarse_mono_clock::now();
+  while (fired.size() < 3)
+    center.process_events(100000);
+  ASSERT_GE(ceph::coarse_mono_clock::now() - start, std::chrono::milliseconds(15));
+  ASSERT_EQ((std::vector<uint64_t>{now, early, late}), fired);
+  // ids of fired events are dead
+  center.delete_time_event(early);
+}
+
+TEST(EventCenterTest, TimeEventChurn) {
+  // every connection re-arms its tick timer on activity; measure the
+  // cost of that with a realistic number of armed timers
+  EventCenter center(g_ceph_context);
+  center.init(100, 0, "posix");
+  center.set_owner();
+  std::vector<uint64_t> fired;
+  TimeEvent e(&fired);
+  constexpr int timers = 20000, rounds = 20;
+  std::mt19937 rng(0);
+  std::vector<uint64_t> ids(timers);
+  auto start = ceph::mono_clock::now();
+  for (auto& id : ids)
+    id = center.create_time_event(1000000 + rng() % 900000000, &e);
+  for (int r = 0; r < rounds; ++r) {
+    for (int i = 0; i < timers; ++i) {
+      center.delete_time_event(ids[i]);
+      ids[i] = center.create_time_event(1000000 + rng() % 900000000, &e);
+      if (i % 256 == 0)
+        center.process_events(0);
+    }
+  }
+  auto elapsed = ceph::mono_clock::now() - start;
+  std::cout << "re-armed " << timers << " timers " << rounds << " times: "
+            << std::chrono::duration<double, std::nano>(elapsed).count() /
+               (timers * (rounds + 1))
+            << " ns per create+delete" << std::endl;
+  for (auto id : ids)
+    center.delete_time_event(id);
+  ASSERT_TRUE(fired.empty());
+}
+
 INSTANTIATE_TEST_SUITE_P(
   AsyncMessenger,
   EventDriverTest,
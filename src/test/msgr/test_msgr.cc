@@ -19,6 +19,7 @@
 #include <list>
 #include <memory>
 #include <set>
+#include <thread>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
@@ -30,6 +31,7 @@
 
 #define MSG_POLICY_UNIT_TESTING
 
+#include "acconfig.h"
 #include "common/ceph_argparse.h"
 #include "common/ceph_mutex.h"
 #include "global/global_init.h"
@@ -39,6 +41,8 @@
 #include "msg/Dispatcher.h"
 #include "msg/Message.h"
 #include "msg/Messenger.h"
+#include "msg/async/AsyncConnection.h"
+#include "msg/async/AsyncMessenger.h"
 #include "msg/msg_types.h"
 
 typedef boost::mt11213b gen_type;
@@ -2120,6 +2124,43 @@ TEST_P(MessengerTest, SyntheticInjectTest) {
       "ms_dispatch_throttle_bytes", std::to_string(dispatch_throttle_bytes));
 }
 
+TEST_P(MessengerTest, SyntheticZerocopyInjectTest) {
+  // every socket write of a large message goes out with MSG_ZEROCOPY, and
+  // the injected failures close sockets with those sends still pending
+  g_ceph_context->_conf.set_val("ms_tcp_zerocopy_min_size", "4096");
+  g_ceph_context->_conf.set_val("ms_inject_socket_failures", "30");
+  g_ceph_context->_conf.set_val("ms_inject_internal_delays", "0.1");
+  SyntheticWorkload test_msg(8, 32, GetParam(), 100,
+                             Messenger::Policy::stateful_server(0),
+                             Messenger::Policy::lossless_client(0));
+  for (int i = 0; i < 100; ++i) {
+    if (!(i % 10)) lderr(g_ceph_context) << "seeding connection " << i << dendl;
+    test_msg.generate_connection();
+  }
+  gen_type rng(time(NULL));
+  for (int i = 0; i < 1000; ++i) {
+    if (!(i % 10)) {
+      lderr(g_ceph_context) << "Op " << i << ": " << dendl;
+      test_msg.print_internal_state();
+    }
+    boost::uniform_int<> true_false(0, 99);
+    int val = true_false(rng);
+    if (val > 90) {
+      test_msg.generate_connection();
+    } else if (val > 80) {
+      test_msg.drop_connection();
+    } else if (val > 10) {
+      test_msg.send_message();
+    } else {
+      usleep(rand() % 500 + 100);
+    }
+  }
+  test_msg.wait_for_done();
+  g_ceph_context->_conf.set_val("ms_tcp_zerocopy_min_size", "0");
+  g_ceph_context->_conf.set_val("ms_inject_socket_failures", "0");
+  g_ceph_context->_conf.set_val("ms_inject_internal_delays", "0");
+}
+
 TEST_P(MessengerTest, SyntheticInjectTest2) {
   g_ceph_context->_conf.set_val("ms_inject_socket_failures", "30");
   g_ceph_context->_conf.set_val("ms_inject_internal_delays", "0.1");
@@ -2389,10 +2430,162 @@ TEST_P(MessengerTest, MarkdownTest) {
   delete server_msgr2;
 }
 
+class MigrationDispatcher : public Dispatcher {
+ public:
+  ceph::mutex lock = ceph::make_mutex("MigrationDispatcher::lock");
+  ceph::condition_variable cond;
+  ConnectionRef accepted;
+  uint64_t next_seq = 0;
+  uint64_t received = 0;
+  bool in_order = true;
+
+  MigrationDispatcher() : Dispatcher(g_ceph_context) {}
+  bool ms_can_fast_dispatch_any() const override { return true; }
+  bool ms_can_fast_dispatch(const Message *m) const override {
+    return m->get_type() == CEPH_MSG_PING;
+  }
+  void ms_handle_fast_accept(Connection *con) override {
+    std::lock_guard l{lock};
+    accepted = con;
+    cond.notify_all();
+  }
+  bool ms_dispatch(Message *m) override {
+    ceph_abort();
+  }
+  bool ms_handle_reset(Connection *con) override {
+    return true;
+  }
+  void ms_handle_remote_reset(Connection *con) override {
+  }
+  bool ms_handle_refused(Connection *con) override {
+    return false;
+  }
+  int ms_handle_authentication(Connection *con) override {
+    return 1;
+  }
+  void ms_fast_dispatch(Message *m) override {
+    auto p = m->get_data().cbegin();
+    uint64_t seq;
+    decode(seq, p);
+    // the rest is filled with the low byte of seq
+    bool intact = p.get_remaining() == seq % 65536;
+    while (intact && p.get_remaining()) {
+      const char *buf;
+      size_t len = p.get_ptr_and_advance(p.get_remaining(), &buf);
+      intact = std::all_of(buf, buf + len, [seq](char c) {
+	return c == static_cast<char>(seq);
+      });
+    }
+    m->put();
+    std::lock_guard l{lock};
+    if (seq != next_seq || !intact) {
+      lderr(g_ceph_context) << __func__ << " got " << seq << " expected "
+			    << next_seq << " intact " << intact << dendl;
+      in_order = false;
+    }
+    next_seq = seq + 1;
+    ++received;
+    cond.notify_all();
+  }
+
+  static void send_seq(const ConnectionRef& con, uint64_t seq) {
+    bufferlist bl;
+    encode(seq, bl);
+    bufferptr bp(seq % 65536);
+    memset(bp.c_str(), static_cast<char>(seq), bp.length());
+    bl.append(std::move(bp));
+    MPing *m = new MPing();
+    m->set_data(bl);
+    ASSERT_EQ(0, con->send_message(m));
+  }
+};
+
+// move both ends of a connection between workers over and over while
+// messages flow both ways
+TEST_P(MessengerTest, ConnectionMigrationTest) {
+  NetworkStack *stack = static_cast<AsyncMessenger*>(server_msgr)->get_stack();
+  if (!stack->support_connection_migration() || stack->get_num_worker() < 2) {
+    GTEST_SKIP() << GetParam() << " cannot move connections between workers";
+  }
+  MigrationDispatcher cli_dispatcher, srv_dispatcher;
+  entity_addr_t bind_addr;
+  bind_addr.parse("v2:127.0.0.1");
+  server_msgr->set_default_policy(Messenger::Policy::stateful_server(0));
+  client_msgr->set_default_policy(Messenger::Policy::lossless_client(0));
+  server_msgr->bind(bind_addr);
+  server_msgr->add_dispatcher_head(&srv_dispatcher);
+  server_msgr->start();
+  client_msgr->add_dispatcher_head(&cli_dispatcher);
+  client_msgr->start();
+
+  auto sum_migrations = [stack] {
+    uint64_t n = 0;
+    for (unsigned i = 0; i < stack->get_num_worker(); ++i) {
+      n += stack->get_worker(i)->get_perf_counter()->get(
+	l_msgr_migrated_in_connections);
+    }
+    return n;
+  };
+  const uint64_t migrations_before = sum_migrations();
+
+  const uint64_t num_msgs = 20000;
+  ConnectionRef cli_conn = client_msgr->connect_to(server_msgr->get_mytype(),
+						   server_msgr->get_myaddrs());
+  MigrationDispatcher::send_seq(cli_conn, 0);
+  ConnectionRef srv_conn;
+  {
+    std::unique_lock l{srv_dispatcher.lock};
+    srv_dispatcher.cond.wait(l, [&] {
+      return srv_dispatcher.accepted && srv_dispatcher.received;
+    });
+    srv_conn = srv_dispatcher.accepted;
+  }
+
+  std::atomic<bool> done = false;
+  std::thread migrator([&] {
+    for (unsigned i = 0; !done; ++i) {
+      for (auto& con : {cli_conn, srv_conn}) {
+	auto ac = static_cast<AsyncConnection*>(con.get());
+	ac->migrate(stack->get_worker((i + (con == srv_conn)) %
+				      stack->get_num_worker()));
+      }
+      usleep(rand() % 1000 + 100);
+    }
+  });
+  std::thread srv_sender([&] {
+    for (uint64_t seq = 0; seq < num_msgs; ++seq) {
+      MigrationDispatcher::send_seq(srv_conn, seq);
+    }
+  });
+  for (uint64_t seq = 1; seq < num_msgs; ++seq) {
+    MigrationDispatcher::send_seq(cli_conn, seq);
+  }
+  srv_sender.join();
+
+  for (auto d : {&cli_dispatcher, &srv_dispatcher}) {
+    std::unique_lock l{d->lock};
+    d->cond.wait(l, [&] { return d->received == num_msgs; });
+  }
+  done = true;
+  migrator.join();
+
+  ASSERT_TRUE(cli_dispatcher.in_order);
+  ASSERT_TRUE(srv_dispatcher.in_order);
+  ASSERT_GT(sum_migrations(), migrations_before);
+
+  client_msgr->shutdown();
+  client_msgr->wait();
+  server_msgr->shutdown();
+  server_msgr->wait();
+}
+
 INSTANTIATE_TEST_SUITE_P(
   Messenger,
   MessengerTest,
   ::testing::Values(
+#ifdef HAVE_ASYNC_IO_URING
+    "async+io_uring",
+#endif
     "async+posix"
   )
 );
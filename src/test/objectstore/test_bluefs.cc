@@ -16,6 +16,7 @@
 #include "include/stringify.h"
 #include "include/scope_guard.h"
 #include "common/errno.h"
+#include "common/Clock.h"
 
 #include "os/bluestore/Allocator.h"
 #include "os/bluestore/BlueFS.h"
@@ -1331,6 +1332,201 @@ TEST(BlueFS, test_4k_shared_alloc) {
   fs.umount();
 }
 
+TEST(BlueFS, sequential_read_prefetch) {
+  uint64_t size = 1048576 * 256;
+  TempBdev bdev{size};
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_buffered_io", "false");
+  conf.SetVal("bluefs_alloc_size", "1048576");
+  conf.ApplyChanges();
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false, 1048576));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+
+  const uint64_t file_size = 64 * 1048576 + 12345;
+  auto data = gen_buffer(file_size);
+  {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.mkdir("dir"));
+    ASSERT_EQ(0, fs.open_for_write("dir", "sst", &h, false));
+    h->append(data.get(), file_size);
+    fs.fsync(h);
+    fs.close_writer(h);
+  }
+
+  // an iterator scan: small reads front to back
+  auto scan = [&](const char *name, size_t chunk) {
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("dir", "sst", &h));
+    auto pc = fs.get_perf_counters();
+    uint64_t disk0 = pc->get(l_bluefs_read_disk_count);
+    uint64_t hit0 = pc->get(l_bluefs_read_prefetch_async_hit);
+    utime_t start = ceph_clock_now();
+    bufferlist bl;
+    for (uint64_t off = 0; off < file_size; off += chunk) {
+      bl.clear();
+      uint64_t want = std::min<uint64_t>(chunk, file_size - off);
+      ASSERT_EQ((int64_t)want, fs.read(h, off, chunk, &bl, NULL));
+      ASSERT_EQ(0, memcmp(data.get() + off, bl.c_str(), want));
+    }
+    utime_t end = ceph_clock_now();
+    std::cout << name << " chunk " << chunk << ": "
+	      << (double)file_size / 1048576 / (double)(end - start)
+	      << " MB/sec, " << pc->get(l_bluefs_read_disk_count) - disk0
+	      << " disk reads, " << pc->get(l_bluefs_read_prefetch_async_hit) - hit0
+	      << " async prefetch hits" << std::endl;
+    delete h;
+  };
+
+  conf.SetVal("bluefs_async_prefetch", "false");
+  conf.SetVal("bluefs_readahead_max", "1048576");
+  conf.ApplyChanges();
+  scan("sync, fixed readahead", 16384);
+
+  conf.SetVal("bluefs_readahead_max", "8388608");
+  conf.ApplyChanges();
+  scan("sync, adaptive readahead", 16384);
+
+  conf.SetVal("bluefs_async_prefetch", "true");
+  conf.ApplyChanges();
+  uint64_t hit0 = fs.get_perf_counters()->get(l_bluefs_read_prefetch_async_hit);
+  scan("async, adaptive readahead", 16384);
+  scan("async, adaptive readahead", 1000000);
+  ASSERT_GT(fs.get_perf_counters()->get(l_bluefs_read_prefetch_async_hit), hit0);
+
+  // jumping around must still return the right data
+  {
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("dir", "sst", &h));
+    std::mt19937_64 rng(0);
+    bufferlist bl;
+    for (int i = 0; i < 1000; ++i) {
+      uint64_t off = rng() % file_size;
+      uint64_t len = rng() % 300000;
+      if (i % 3) {
+	// a sequential stretch
+	for (int j = 0; j < 20 && off < file_size; ++j) {
+	  uint64_t want = std::min(len, file_size - off);
+	  bl.clear();
+	  ASSERT_EQ((int64_t)want, fs.read(h, off, len, &bl, NULL));
+	  ASSERT_EQ(0, memcmp(data.get() + off, bl.c_str(), want));
+	  off += want;
+	}
+      } else {
+	uint64_t want = std::min(len, file_size - off);
+	bl.clear();
+	ASSERT_EQ((int64_t)want, fs.read(h, off, len, &bl, NULL));
+	ASSERT_EQ(0, memcmp(data.get() + off, bl.c_str(), want));
+      }
+    }
+    delete h;
+  }
+  fs.umount();
+}
+
+TEST(BlueFS, read_random_multi) {
+  uint64_t size = 1048576 * 128;
+  TempBdev bdev{size};
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_buffered_io", "false");
+  conf.SetVal("bluefs_alloc_size", "65536");
+  conf.ApplyChanges();
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false, 1048576));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+
+  const uint64_t file_size = 8 * 1048576 + 777;
+  auto data = gen_buffer(file_size);
+  {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.mkdir("dir"));
+    ASSERT_EQ(0, fs.open_for_write("dir", "sst", &h, false));
+    // several appends so that the file spans multiple extents
+    for (uint64_t off = 0; off < file_size; off += 1000000) {
+      h->append(data.get() + off, std::min<uint64_t>(1000000, file_size - off));
+      fs.fsync(h);
+    }
+    fs.close_writer(h);
+  }
+
+  BlueFS::FileReader *h;
+  ASSERT_EQ(0, fs.open_for_read("dir", "sst", &h, true));
+  std::mt19937_64 rng(0);
+  for (int round = 0; round < 50; ++round) {
+    const size_t n = 1 + rng() % 32;
+    std::vector<BlueFS::read_random_req_t> reqs(n);
+    std::vector<std::unique_ptr<char[]>> bufs(n);
+    for (size_t i = 0; i < n; ++i) {
+      auto& r = reqs[i];
+      if (rng() % 4 == 0) {
+	r.offset = (rng() % file_size) & ~4095ull;
+	r.len = 4096 * (1 + rng() % 64);
+      } else {
+	// sst block handles, neither end aligned
+	r.offset = rng() % file_size;
+	r.len = 1 + rng() % 100000;
+      }
+      bufs[i] = std::make_unique<char[]>(r.len);
+      r.out = bufs[i].get();
+    }
+    ASSERT_EQ(0, fs.read_random_multi(h, reqs.data(), n));
+    for (size_t i = 0; i < n; ++i) {
+      auto& r = reqs[i];
+      uint64_t want = std::min(r.len, file_size - r.offset);
+      ASSERT_EQ((int64_t)want, r.r);
+      ASSERT_EQ(0, memcmp(data.get() + r.offset, r.out, want));
+    }
+  }
+  // unaligned ranges sharing blocks with each other, and crossing
+  // extent boundaries
+  {
+    const uint64_t starts[] = {1, 4095, 4097, 100, 8191, 1000000 - 3,
+			       2 * 1000000 + 17, file_size - 10};
+    const uint64_t lens[] = {1, 2, 4095, 4000, 3, 7, 70000, 10};
+    const size_t n = std::size(starts);
+    std::vector<BlueFS::read_random_req_t> reqs(n);
+    std::vector<std::unique_ptr<char[]>> bufs(n);
+    for (size_t i = 0; i < n; ++i) {
+      reqs[i].offset = starts[i];
+      reqs[i].len = lens[i];
+      bufs[i] = std::make_unique<char[]>(lens[i] + 2);
+      memset(bufs[i].get(), 0xa5, lens[i] + 2);
+      reqs[i].out = bufs[i].get() + 1;
+    }
+    ASSERT_EQ(0, fs.read_random_multi(h, reqs.data(), n));
+    for (size_t i = 0; i < n; ++i) {
+      ASSERT_EQ((int64_t)lens[i], reqs[i].r);
+      ASSERT_EQ(0, memcmp(data.get() + starts[i], reqs[i].out, lens[i]));
+      // nothing written around the requested range
+      ASSERT_EQ((char)0xa5, bufs[i][0]);
+      ASSERT_EQ((char)0xa5, bufs[i][lens[i] + 1]);
+    }
+  }
+  // past the end
+  {
+    char c;
+    BlueFS::read_random_req_t reqs[2];
+    reqs[0].offset = file_size + 4096;
+    reqs[0].len = 1;
+    reqs[0].out = &c;
+    reqs[1].offset = 0;
+    reqs[1].len = 1;
+    reqs[1].out = &c;
+    ASSERT_EQ(0, fs.read_random_multi(h, reqs, 2));
+    ASSERT_EQ(0, reqs[0].r);
+    ASSERT_EQ(1, reqs[1].r);
+    ASSERT_EQ(data[0], c);
+  }
+  delete h;
+  fs.umount();
+}
+
 int main(int argc, char **argv) {
   auto args = argv_to_vec(argc, argv);
   map<string,string> defaults = {
@@ -9,11 +9,15 @@
 #include "os/bluestore/BlueStore.h"
 #include "os/bluestore/simple_bitmap.h"
 #include "os/bluestore/AvlAllocator.h"
+#include "os/bluestore/BufferArena.h"
+#include "os/bluestore/CompressionPool.h"
+#include "os/bluestore/DeferredWritePolicy.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
 #include "global/global_context.h"
 #include "perfglue/heap_profiler.h"
 
+#include <random>
 #include <sstream>
 
 #define _STR(x) #x
@@ -2335,6 +2339,408 @@ TEST(bluestore_blob_use_tracker_t, mempool_stats_test)
   }
 }
 
+TEST(BufferArena, copy)
+{
+  auto arena = BufferArena::create(g_ceph_context, -1, false,
+				   2 * BufferArena::SLAB_SIZE);
+  bufferlist in;
+  in.append(std::string(5000, 'a'));
+  in.append(std::string(3000, 'b'));
+
+  bufferlist out;
+  ASSERT_TRUE(arena->copy(in, &out));
+  ASSERT_TRUE(out.contents_equal(in));
+  ASSERT_EQ(1u, out.get_num_buffers());
+  ASSERT_EQ(2 * BufferArena::PAGE_SIZE, arena->get_used_bytes());
+  ASSERT_EQ(BufferArena::SLAB_SIZE, arena->get_slab_bytes());
+
+  // too large for a slab
+  bufferlist huge, o;
+  huge.append_zero(BufferArena::SLAB_SIZE + 1);
+  ASSERT_FALSE(arena->copy(huge, &o));
+
+  // fill both slabs, then fail
+  std::vector<bufferlist> held;
+  bufferlist mb;
+  mb.append_zero(1 << 20);
+  for (int i = 0; i < 3; ++i) {
+    held.emplace_back();
+    ASSERT_TRUE(arena->copy(mb, &held.back()));
+  }
+  ASSERT_EQ(2 * BufferArena::SLAB_SIZE, arena->get_slab_bytes());
+  ASSERT_FALSE(arena->copy(mb, &o));
+
+  // pages go back when the last reference does, even past the arena's
+  // owner, and emptied slabs stay mapped up to the reserve
+  held.clear();
+  out.clear();
+  ASSERT_EQ(0u, arena->get_used_bytes());
+  ASSERT_EQ(BufferArena::RESERVE_SLABS * BufferArena::SLAB_SIZE,
+	    arena->get_slab_bytes());
+  ASSERT_TRUE(arena->copy(in, &out));
+  arena.reset();
+  ASSERT_TRUE(out.contents_equal(in));
+}
+
+TEST(BufferArena, max_bytes_and_mempool)
+{
+  auto& pool = mempool::get_pool(mempool::mempool_bluestore_cache_data);
+  size_t before = pool.allocated_bytes();
+  auto arena = BufferArena::create(g_ceph_context, -1, false,
+				   4 * BufferArena::SLAB_SIZE);
+  bufferlist mb;
+  mb.append_zero(1 << 20);
+  std::vector<bufferlist> held;
+  for (int i = 0; i < 3; ++i) {
+    held.emplace_back();
+    ASSERT_TRUE(arena->copy(mb, &held.back()));
+  }
+  bufferlist small, so;
+  small.append("x", 1);
+  ASSERT_TRUE(arena->copy(small, &so));
+  // whole slabs are charged, not the bytes stored in them
+  ASSERT_EQ(2 * BufferArena::SLAB_SIZE, arena->get_slab_bytes());
+  ASSERT_EQ(before + 2 * BufferArena::SLAB_SIZE, pool.allocated_bytes());
+
+  // shrinking keeps the slabs in use, and unmaps them as they drain
+  arena->set_max_bytes(BufferArena::SLAB_SIZE);
+  ASSERT_EQ(2 * BufferArena::SLAB_SIZE, arena->get_slab_bytes());
+  bufferlist o;
+  ASSERT_FALSE(arena->copy(mb, &o));
+  held.clear();
+  ASSERT_EQ(BufferArena::SLAB_SIZE, arena->get_slab_bytes());
+  ASSERT_EQ(before + BufferArena::SLAB_SIZE, pool.allocated_bytes());
+
+  so.clear();
+  arena.reset();
+  ASSERT_EQ(before, pool.allocated_bytes());
+}
+
+TEST(BufferArena, reserve_and_best_fit)
+{
+  auto arena = BufferArena::create(g_ceph_context, -1, false,
+				   8 * BufferArena::SLAB_SIZE);
+  bufferlist slab;
+  slab.append_zero(BufferArena::SLAB_SIZE);
+  std::vector<bufferlist> held(6);
+  for (auto& h : held) {
+    ASSERT_TRUE(arena->copy(slab, &h));
+  }
+  ASSERT_EQ(6 * BufferArena::SLAB_SIZE, arena->get_slab_bytes());
+  // only the reserve of free slabs stays mapped
+  held.clear();
+  ASSERT_EQ(BufferArena::RESERVE_SLABS * BufferArena::SLAB_SIZE,
+	    arena->get_slab_bytes());
+
+  // carve one slab into 1, 2, 1, 4, 1 page buffers and free the 2 and 4
+  // page ones; a 2 page buffer then fills the 2 page hole instead of
+  // splitting the 4 page one or a free slab
+  std::vector<size_t> pages = {1, 2, 1, 4, 1};
+  std::vector<bufferlist> bufs(pages.size());
+  std::vector<const char*> at;
+  for (size_t i = 0; i < pages.size(); ++i) {
+    bufferlist bl;
+    bl.append_zero(pages[i] * BufferArena::PAGE_SIZE);
+    ASSERT_TRUE(arena->copy(bl, &bufs[i]));
+    at.push_back(bufs[i].c_str());
+  }
+  for (size_t i = 1; i < pages.size(); ++i) {
+    ASSERT_EQ(at[i - 1] + pages[i - 1] * BufferArena::PAGE_SIZE, at[i]);
+  }
+  bufs[1].clear();
+  bufs[3].clear();
+  bufferlist two, o2;
+  two.append_zero(2 * BufferArena::PAGE_SIZE);
+  ASSERT_TRUE(arena->copy(two, &o2));
+  ASSERT_EQ(at[1], o2.c_str());
+
+  // freed neighbours coalesce: with the 1 page buffers around it gone,
+  // the 2 page one and the 4 page hole make a 9 page run at the start
+  o2.clear();
+  bufs[0].clear();
+  bufs[2].clear();
+  bufs[4].clear();
+  ASSERT_EQ(0u, arena->get_used_bytes());
+  bufferlist nine, o9;
+  nine.append_zero(9 * BufferArena::PAGE_SIZE);
+  ASSERT_TRUE(arena->copy(nine, &o9));
+  ASSERT_EQ(at[0], o9.c_str());
+}
+
+TEST(BufferArena, cache_hit_bench)
+{
+  PerfCountersBuilder b(g_ceph_context, "BufferArena_bench",
+			l_bluestore_first, l_bluestore_last);
+  b.add_u64_counter(l_bluestore_buffer_hit_bytes, "buffer_hit_bytes", "");
+  b.add_u64_counter(l_bluestore_buffer_miss_bytes, "buffer_miss_bytes", "");
+  std::unique_ptr<PerfCounters> logger(b.create_perf_counters());
+
+  const unsigned num_buffers = 4096;
+  const unsigned buffer_len = 65536;
+  bufferlist data;
+  std::mt19937 rng(0);
+  for (unsigned i = 0; i < buffer_len / sizeof(uint32_t); ++i) {
+    uint32_t v = rng();
+    data.append((const char*)&v, sizeof(v));
+  }
+
+  for (bool use_arena : {false, true}) {
+    BlueStore::BufferCacheShard *bc = BlueStore::BufferCacheShard::create(
+      g_ceph_context, "lru", logger.get());
+    bc->set_max(uint64_t(num_buffers) * buffer_len * 2);
+    if (use_arena) {
+      bc->arena = BufferArena::create(g_ceph_context, -1, false,
+				      uint64_t(num_buffers) * buffer_len * 2);
+    }
+    {
+      BlueStore::BufferSpace bs;
+      for (unsigned i = 0; i < num_buffers; ++i) {
+	bufferlist bl;
+	bl.append(data.c_str(), data.length());  // own, unshared copy
+	bs.did_read(bc, i * buffer_len, bl);
+      }
+      if (use_arena) {
+	ASSERT_EQ(uint64_t(num_buffers) * buffer_len,
+		  bc->arena->get_used_bytes());
+      }
+
+      // random 4K hits spread over the whole cache
+      uint64_t sum = 0;
+      const unsigned reads = 1 << 20;
+      auto start = ceph::mono_clock::now();
+      for (unsigned i = 0; i < reads; ++i) {
+	uint32_t off = (rng() % (num_buffers * (buffer_len / 4096))) * 4096;
+	BlueStore::ready_regions_t res;
+	interval_set<uint32_t> res_intervals;
+	bs.read(bc, off, 4096, res, res_intervals);
+	ASSERT_EQ(4096u, res_intervals.size());
+	for (auto& p : res.begin()->second.buffers()) {
+	  for (unsigned j = 0; j < p.length(); j += 64) {
+	    sum += p.c_str()[j];
+	  }
+	}
+      }
+      auto dur = ceph::mono_clock::now() - start;
+      std::cout << (use_arena ? "arena" : "heap") << ": " << reads
+		<< " cache hits in " << dur << " ("
+		<< std::chrono::duration<double, std::nano>(dur).count() / reads
+		<< " ns/hit) " << sum << std::endl;
+
+      std::lock_guard l(bc->lock);
+      bs._clear(bc);
+    }
+    if (use_arena) {
+      ASSERT_EQ(0u, bc->arena->get_used_bytes());
+    }
+    delete bc;
+  }
+}
+
+TEST(DeferredWritePolicy, steps)
+{
+  DeferredWritePolicy p(g_ceph_context);
+  DeferredWritePolicy::decision_t d;
+  auto now = ceph::mono_clock::now();
+  auto window = [&](ceph::timespan main, ceph::timespan db) {
+    for (int i = 0; i < 100; ++i) {
+      p.note_main_latency(main);
+      p.note_db_latency(db);
+    }
+    now += std::chrono::seconds(2);
+    EXPECT_TRUE(p.maybe_update(now, &d));
+  };
+  using namespace std::chrono_literals;
+
+  p.set_base(64 * 1024, 32);
+  ASSERT_EQ(64u * 1024, p.get_prefer_deferred_size());
+  ASSERT_EQ(32, p.get_deferred_batch_ops());
+
+  // slow main device, idle db: raise once the verdict held long enough
+  window(50ms, 500us);
+  window(50ms, 500us);
+  ASSERT_EQ(DeferredWritePolicy::verdict_t::NONE, d.applied);
+  window(50ms, 500us);
+  ASSERT_EQ(DeferredWritePolicy::verdict_t::RAISE, d.applied);
+  ASSERT_EQ(128u * 1024, d.prefer_deferred_size);
+  ASSERT_EQ(64, d.deferred_batch_ops);
+  ASSERT_GE(d.main_lat_us, 50000u);
+
+  // not within the interval
+  ASSERT_FALSE(p.maybe_update(now + 100ms, &d));
+
+  // hot db wins over a hot main device
+  window(50ms, 20ms);
+  window(50ms, 20ms);
+  window(50ms, 20ms);
+  ASSERT_EQ(DeferredWritePolicy::verdict_t::LOWER, d.applied);
+  ASSERT_EQ(64u * 1024, d.prefer_deferred_size);
+  ASSERT_EQ(32, d.deferred_batch_ops);
+
+  // pinned values stick
+  p.pin(16 * 1024, 4);
+  for (int i = 0; i < 5; ++i) {
+    window(50ms, 500us);
+    ASSERT_EQ(DeferredWritePolicy::verdict_t::NONE, d.applied);
+  }
+  ASSERT_EQ(16u * 1024, d.prefer_deferred_size);
+  ASSERT_EQ(4, d.deferred_batch_ops);
+
+  // once unpinned, idle devices drift back to the base
+  p.unpin();
+  for (int i = 0; i < 20; ++i) {
+    window(100us, 100us);
+  }
+  ASSERT_EQ(64u * 1024, d.prefer_deferred_size);
+  ASSERT_EQ(32, d.deferred_batch_ops);
+
+  // too few samples is no signal at all
+  for (int i = 0; i < 5; ++i) {
+    p.note_main_latency(50ms);
+    now += std::chrono::seconds(2);
+    ASSERT_TRUE(p.maybe_update(now, &d));
+    ASSERT_EQ(DeferredWritePolicy::verdict_t::NONE, d.applied);
+  }
+}
+
+TEST(DeferredWritePolicy, never_defer)
+{
+  // prefer_deferred_size 0 (the ssd default) must stay 0 whatever the
+  // latencies say, or enabling the policy would start deferring writes
+  DeferredWritePolicy p(g_ceph_context);
+  DeferredWritePolicy::decision_t d;
+  auto now = ceph::mono_clock::now();
+  auto window = [&](ceph::timespan main, ceph::timespan db) {
+    for (int i = 0; i < 100; ++i) {
+      p.note_main_latency(main);
+      p.note_db_latency(db);
+    }
+    now += std::chrono::seconds(2);
+    EXPECT_TRUE(p.maybe_update(now, &d));
+  };
+  using namespace std::chrono_literals;
+
+  p.set_base(0, 16);
+  for (int i = 0; i < 6; ++i) {
+    window(50ms, 500us);
+    ASSERT_EQ(0u, d.prefer_deferred_size);
+  }
+  ASSERT_EQ(64, d.deferred_batch_ops);
+  for (int i = 0; i < 20; ++i) {
+    window(100us, 100us);
+    ASSERT_EQ(0u, d.prefer_deferred_size);
+  }
+  ASSERT_EQ(16, d.deferred_batch_ops);
+  for (int i = 0; i < 6; ++i) {
+    window(50ms, 20ms);
+    ASSERT_EQ(0u, d.prefer_deferred_size);
+  }
+
+  // a pinned size is kept as long as it is pinned, and dropped after
+  p.pin(16 * 1024, 4);
+  window(50ms, 500us);
+  ASSERT_EQ(16u * 1024, d.prefer_deferred_size);
+  p.unpin();
+  for (int i = 0; i < 3; ++i) {
+    window(100us, 100us);
+  }
+  ASSERT_EQ(0u, d.prefer_deferred_size);
+  ASSERT_EQ(p.get_prefer_deferred_size(), 0u);
+}
+
+namespace {
+// keeps the first half of the input
+class HalfCompressor : public Compressor {
+public:
+  HalfCompressor() : Compressor(COMP_ALG_ZLIB, "zlib") {}
+  int compress(const bufferlist &in, bufferlist &out,
+	       std::optional<int32_t> &compressor_message) override {
+    out.substr_of(in, 0, in.length() / 2);
+    compressor_message = 42;
+    return 0;
+  }
+  int decompress(const bufferlist &in, bufferlist &out,
+		 std::optional<int32_t> compressor_message) override {
+    return -EOPNOTSUPP;
+  }
+  int decompress(bufferlist::const_iterator &p, size_t compressed_len,
+		 bufferlist &out,
+		 std::optional<int32_t> compressor_message) override {
+    return -EOPNOTSUPP;
+  }
+};
+}
+
+TEST(CompressionPool, sample_entropy)
+{
+  bufferlist zeros;
+  zeros.append_zero(65536);
+  ASSERT_EQ(0.0, CompressionPool::sample_entropy(zeros));
+
+  bufferlist abcd;
+  for (int i = 0; i < 1024; ++i) {
+    abcd.append("abcd", 4);
+  }
+  ASSERT_NEAR(2.0, CompressionPool::sample_entropy(abcd), 0.01);
+
+  bufferlist random;
+  std::mt19937 rng(0);
+  for (int i = 0; i < 65536; ++i) {
+    char c = rng();
+    random.append(&c, 1);
+  }
+  ASSERT_GT(CompressionPool::sample_entropy(random), 7.8);
+  ASSERT_LE(CompressionPool::sample_entropy(random), 8.0);
+
+  bufferlist empty;
+  ASSERT_EQ(0.0, CompressionPool::sample_entropy(empty));
+}
+
+TEST(CompressionPool, run)
+{
+  CompressorRef c = std::make_shared<HalfCompressor>();
+
+  bufferlist zeros, random;
+  zeros.append_zero(65536);
+  std::mt19937 rng(0);
+  for (int i = 0; i < 65536; ++i) {
+    char ch = rng();
+    random.append(&ch, 1);
+  }
+
+  for (unsigned num_threads : {0, 1, 4}) {
+    CompressionPool pool(g_ceph_context);
+    pool.start(num_threads);
+    for (int round = 0; round < 20; ++round) {
+      std::vector<CompressionPool::Job> jobs;
+      for (int i = 0; i < 32; ++i) {
+	jobs.emplace_back(c, i % 2 ? &random : &zeros);
+      }
+      pool.run(jobs, 7.5);
+      for (size_t i = 0; i < jobs.size(); ++i) {
+	auto& j = jobs[i];
+	if (i % 2) {
+	  ASSERT_TRUE(j.skipped);
+	  ASSERT_EQ(0u, j.out.length());
+	} else {
+	  ASSERT_FALSE(j.skipped);
+	  ASSERT_EQ(0, j.r);
+	  ASSERT_EQ(32768u, j.out.length());
+	  ASSERT_EQ(42, *j.compressor_message);
+	}
+      }
+      // entropy check disabled
+      std::vector<CompressionPool::Job> more;
+      more.emplace_back(c, &random);
+      more.emplace_back(c, &random);
+      pool.run(more, 0);
+      ASSERT_FALSE(more[0].skipped);
+      ASSERT_FALSE(more[1].skipped);
+      ASSERT_EQ(32768u, more[1].out.length());
+    }
+    pool.stop();
+  }
+}
+
 int main(int argc, char **argv) {
   auto args = argv_to_vec(argc, argv);
   auto cct = global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT,
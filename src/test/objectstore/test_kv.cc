@@ -16,6 +16,9 @@
 #include <string.h>
 #include <iostream>
 #include <time.h>
+#include <algorithm>
+#include <random>
+#include <thread>
 #include <sys/mount.h>
 #include "kv/KeyValueDB.h"
 #include "kv/RocksDBStore.h"
@@ -351,6 +354,115 @@ TEST_P(KVTest, ShardingRMRange) {
 }
 
 
+TEST_P(KVTest, MultiGet) {
+  if(string(GetParam()) != "rocksdb")
+    return;
+  // "O" is sharded over several column families, "P" lives in default
+  std::string cfs("O(7)=");
+  ASSERT_EQ(0, db->create_and_open(cout, cfs));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (size_t i = 0; i < 1000; i += 2) {
+      bufferlist value;
+      value.append("v" + stringify(i));
+      t->set("O", "key" + stringify(i), value);
+      t->set("P", "key" + stringify(i), value);
+    }
+    db->submit_transaction_sync(t);
+  }
+  for (auto prefix : {"O", "P"}) {
+    vector<string> keys;
+    for (size_t i = 0; i < 1000; ++i) {
+      keys.push_back("key" + stringify(i));
+    }
+    // both the sorted and the unsorted flavor
+    for (bool sorted : {false, true}) {
+      if (sorted) {
+	std::sort(keys.begin(), keys.end());
+      }
+      vector<bufferlist> values;
+      vector<int> rs;
+      db->multi_get(prefix, keys, &values, &rs);
+      ASSERT_EQ(keys.size(), values.size());
+      ASSERT_EQ(keys.size(), rs.size());
+      for (size_t i = 0; i < keys.size(); ++i) {
+	size_t n = std::stoul(keys[i].substr(3));
+	if (n % 2) {
+	  ASSERT_EQ(-ENOENT, rs[i]);
+	  ASSERT_EQ(0u, values[i].length());
+	} else {
+	  ASSERT_EQ(0, rs[i]);
+	  ASSERT_EQ("v" + stringify(n), _bl_to_str(values[i]));
+	}
+      }
+    }
+    std::set<string> kset(keys.begin(), keys.end());
+    std::map<string, bufferlist> out;
+    ASSERT_EQ(0, db->get(prefix, kset, &out));
+    ASSERT_EQ(500u, out.size());
+    ASSERT_EQ("v998", _bl_to_str(out["key998"]));
+  }
+  fini();
+}
+
+TEST_P(KVTest, BenchMultiGet) {
+  if(string(GetParam()) != "rocksdb")
+    return;
+  // a large omap, looked up in the key order BlueStore uses
+  const size_t num_keys = 200000;
+  const size_t batch = 1000;
+  const size_t rounds = 100;
+  std::string cfs("m(3) p(3,0-12)");
+  ASSERT_EQ(0, db->create_and_open(cout, cfs));
+  bufferlist value;
+  value.append(std::string(100, 'v'));
+  for (size_t i = 0; i < num_keys; i += 10000) {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (size_t j = i; j < i + 10000; ++j) {
+      char key[32];
+      snprintf(key, sizeof(key), "obj.%08zu", j);
+      t->set("p", key, value);
+    }
+    db->submit_transaction_sync(t);
+  }
+  db->compact();
+
+  std::mt19937 rng(0);
+  std::vector<std::vector<string>> batches(rounds);
+  for (auto& b : batches) {
+    std::set<string> ks;
+    while (ks.size() < batch) {
+      char key[32];
+      snprintf(key, sizeof(key), "obj.%08zu", size_t(rng() % num_keys));
+      ks.insert(key);
+    }
+    b.assign(ks.begin(), ks.end());
+  }
+
+  utime_t start = ceph_clock_now();
+  for (auto& b : batches) {
+    for (auto& k : b) {
+      bufferlist v;
+      ASSERT_EQ(0, db->get("p", k, &v));
+    }
+  }
+  utime_t single = ceph_clock_now() - start;
+
+  start = ceph_clock_now();
+  for (auto& b : batches) {
+    vector<bufferlist> values;
+    vector<int> rs;
+    db->multi_get("p", b, &values, &rs);
+    for (auto r : rs) {
+      ASSERT_EQ(0, r);
+    }
+  }
+  utime_t multi = ceph_clock_now() - start;
+  cout << rounds << " x " << batch << " keys: get " << single
+       << ", multi_get " << multi << std::endl;
+  fini();
+}
+
 TEST_P(KVTest, RocksDBColumnFamilyTest) {
   if(string(GetParam()) != "rocksdb")
     return;
@@ -1274,6 +1386,256 @@ TEST_F(RocksDBResharding, change_reshard) {
   }
 }
 
+TEST_F(RocksDBResharding, online) {
+  ASSERT_EQ(0, db->create_and_open(cout, "Evade(2)"));
+  generate_data();
+  data_to_db();
+  check_db();
+  RocksDBStore::resharding_ctrl ctrl;
+  ctrl.keys_per_batch = 10;
+  ctrl.keys_per_iterator = 100;
+  ASSERT_EQ(db->reshard_online("Evade(5)", &ctrl), 0);
+  // keep writing and reading while keys move
+  size_t i = 0;
+  for (auto& d : data) {
+    string prefix;
+    string key;
+    RocksDBStore::split_key(d.first, &prefix, &key);
+    if (prefix != "Evade") {
+      continue;
+    }
+    bufferlist v;
+    if (++i % 3 == 0) {
+      d.second = "updated" + std::to_string(i);
+      KeyValueDB::Transaction t = db->get_transaction();
+      bufferlist v1;
+      v1.append(d.second);
+      t->set(prefix, key, v1);
+      ASSERT_EQ(db->submit_transaction_sync(t), 0);
+    }
+    ASSERT_EQ(db->get(prefix, key, &v), 0);
+    ASSERT_EQ(v.to_str(), d.second);
+  }
+  ASSERT_EQ(db->wait_online_reshard(), 0);
+  check_db();
+  std::string sharding;
+  ASSERT_TRUE(db->get_sharding(sharding));
+  ASSERT_EQ(sharding, "Evade(5)");
+  db->close();
+  ASSERT_EQ(db->open(cout), 0);
+  check_db();
+  db->close();
+}
+
+TEST_F(RocksDBResharding, online_interrupted) {
+  ASSERT_EQ(0, db->create_and_open(cout, "Evade(2)"));
+  generate_data();
+  data_to_db();
+  // slow enough to be cut short by close()
+  auto& conf = g_ceph_context->_conf;
+  conf.set_val("rocksdb_online_reshard_max_bytes_per_sec", "10000");
+  RocksDBStore::resharding_ctrl ctrl;
+  ctrl.keys_per_batch = 1;
+  ctrl.keys_per_iterator = 10;
+  ASSERT_EQ(db->reshard_online("Evade(1)", &ctrl), 0);
+  ASSERT_EQ(db->reshard_online("Evade(3)", &ctrl), -EBUSY);
+  db->close();
+  conf.rm_val("rocksdb_online_reshard_max_bytes_per_sec");
+
+  // read only, keys are found in either layout
+  ASSERT_EQ(db->open_read_only(cout), 0);
+  check_db();
+  db->close();
+
+  // opening it for writing resumes the reshard
+  ASSERT_EQ(db->open(cout), 0);
+  check_db();
+  ASSERT_EQ(db->wait_online_reshard(), 0);
+  std::string sharding;
+  ASSERT_TRUE(db->get_sharding(sharding));
+  ASSERT_EQ(sharding, "Evade(1)");
+  check_db();
+  db->close();
+  ASSERT_EQ(db->open(cout), 0);
+  check_db();
+  db->close();
+}
+
+TEST_F(RocksDBResharding, online_interrupted_offline_completion) {
+  ASSERT_EQ(0, db->create_and_open(cout, "Evade(2)"));
+  generate_data();
+  data_to_db();
+  auto& conf = g_ceph_context->_conf;
+  conf.set_val("rocksdb_online_reshard_max_bytes_per_sec", "10000");
+  RocksDBStore::resharding_ctrl ctrl;
+  ctrl.keys_per_batch = 1;
+  ASSERT_EQ(db->reshard_online("Evade(3)", &ctrl), 0);
+  db->close();
+  conf.rm_val("rocksdb_online_reshard_max_bytes_per_sec");
+  // an offline reshard completes it as well
+  ASSERT_EQ(db->reshard("Evade(3)"), 0);
+  ASSERT_EQ(db->open(cout), 0);
+  check_db();
+  std::string sharding;
+  ASSERT_TRUE(db->get_sharding(sharding));
+  ASSERT_EQ(sharding, "Evade(3)");
+  db->close();
+}
+
+TEST_F(RocksDBResharding, online_unsupported) {
+  ASSERT_EQ(0, db->create_and_open(cout, "C(2) Evade(2)"));
+  ASSERT_EQ(db->reshard_online("C(2) D Evade(2)"), -ENOTSUP);
+  ASSERT_EQ(db->reshard_online("C(3) Evade(3)"), -EINVAL);
+  ASSERT_EQ(db->reshard_online("C(2) Evade(2)"), 0);
+  db->close();
+}
+
+class RocksDBCacheTest : public ::testing::TestWithParam<const char*> {
+public:
+  std::shared_ptr<rocksdb::Cache> create(size_t capacity, int shard_bits = 4) {
+    if (string(GetParam()) == "binned_clock") {
+      return rocksdb_cache::NewBinnedClockCache(g_ceph_context, capacity,
+						shard_bits, false, 0.1, 4096);
+    }
+    return rocksdb_cache::NewBinnedLRUCache(g_ceph_context, capacity,
+					    shard_bits, false, 0.1);
+  }
+  static void deleter(const rocksdb::Slice&, void* value) {
+    delete static_cast<std::string*>(value);
+  }
+  static const std::string& value(rocksdb::Cache* c,
+				  rocksdb::Cache::Handle* h) {
+    return *static_cast<std::string*>(c->Value(h));
+  }
+};
+
+TEST_P(RocksDBCacheTest, basic) {
+  auto c = create(1 << 20);
+  rocksdb::Cache::Handle* h = nullptr;
+  ASSERT_TRUE(c->Insert("a", new std::string("1"), 4096, deleter, &h).ok());
+  ASSERT_EQ(value(c.get(), h), "1");
+  c->Release(h);
+  h = c->Lookup("a");
+  ASSERT_NE(h, nullptr);
+  // replaced, the old value lives on until released
+  ASSERT_TRUE(c->Insert("a", new std::string("2"), 4096, deleter).ok());
+  ASSERT_EQ(value(c.get(), h), "1");
+  c->Release(h);
+  h = c->Lookup("a");
+  ASSERT_NE(h, nullptr);
+  ASSERT_EQ(value(c.get(), h), "2");
+  ASSERT_EQ(c->GetPinnedUsage(), 4096u);
+  c->Release(h);
+  ASSERT_EQ(c->GetUsage(), 4096u);
+  ASSERT_EQ(c->GetPinnedUsage(), 0u);
+  c->Erase("a");
+  ASSERT_EQ(c->Lookup("a"), nullptr);
+  ASSERT_EQ(c->GetUsage(), 0u);
+}
+
+TEST_P(RocksDBCacheTest, evict) {
+  const size_t capacity = 1 << 20;
+  auto c = create(capacity, 0);
+  for (int i = 0; i < 1000; ++i) {
+    // keep the first one hot
+    auto h = c->Lookup("0");
+    if (h) {
+      c->Release(h);
+    }
+    ASSERT_TRUE(c->Insert(stringify(i), new std::string(stringify(i)), 4096,
+			  deleter).ok());
+    ASSERT_LE(c->GetUsage(), capacity);
+  }
+  // the clock sweeps a few entries at a time and may free a bit more
+  ASSERT_GE(c->GetUsage(), capacity - 4 * 4096);
+  auto h = c->Lookup("0");
+  ASSERT_NE(h, nullptr);
+  c->Release(h);
+  c->EraseUnRefEntries();
+  ASSERT_EQ(c->GetUsage(), 0u);
+}
+
+TEST_P(RocksDBCacheTest, grow_capacity) {
+  // the autotuner may grow the cache well past its initial size
+  const size_t capacity = 1 << 20;
+  auto c = create(capacity, 0);
+  c->SetCapacity(capacity * 8);
+  for (int i = 0; i < 20000; ++i) {
+    ASSERT_TRUE(c->Insert(stringify(i), new std::string(stringify(i)), 4096,
+			  deleter).ok());
+    ASSERT_LE(c->GetUsage(), capacity * 8);
+    // what was just inserted is cached
+    auto h = c->Lookup(stringify(i));
+    ASSERT_NE(h, nullptr) << "entry " << i;
+    c->Release(h);
+  }
+  if (string(GetParam()) == "binned_clock") {
+    // evicted by occupancy before the table fills up
+    auto cc = static_cast<rocksdb_cache::BinnedClockCache*>(c.get());
+    ASSERT_LT(cc->TEST_GetOccupancy(), cc->TEST_GetTableSize());
+  }
+}
+
+TEST_P(RocksDBCacheTest, age_bins) {
+  auto c = create(1 << 20, 0);
+  auto pc = std::dynamic_pointer_cast<rocksdb_cache::ShardedCache>(c);
+  ASSERT_TRUE(pc);
+  pc->import_bins({1, 2, 3});
+  ASSERT_TRUE(c->Insert("old", new std::string("x"), 4096, deleter).ok());
+  pc->shift_bins();
+  ASSERT_TRUE(c->Insert("new", new std::string("x"), 8192, deleter).ok());
+  auto sum = [&](uint32_t start, uint32_t end) {
+    if (string(GetParam()) == "binned_clock") {
+      return static_cast<rocksdb_cache::BinnedClockCache*>(c.get())->sum_bins(start, end);
+    }
+    return static_cast<rocksdb_cache::BinnedLRUCache*>(c.get())->sum_bins(start, end);
+  };
+  ASSERT_EQ(sum(0, 1), 8192u);
+  ASSERT_EQ(sum(1, 2), 4096u);
+  pc->shift_bins();
+  ASSERT_EQ(sum(0, 1), 0u);
+  ASSERT_EQ(sum(1, 3), 4096u + 8192u);
+}
+
+TEST_P(RocksDBCacheTest, BenchLookup) {
+  // the hot blocks of an omap heavy workload, looked up by many threads
+  const size_t num_keys = 4096;
+  const size_t lookups = 1000000;
+  auto c = create(num_keys * 4096 * 2);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < num_keys; ++i) {
+    keys.push_back("block." + stringify(i));
+    ASSERT_TRUE(c->Insert(keys.back(), new std::string(keys.back()), 4096,
+			  deleter).ok());
+  }
+  for (size_t threads : {1, 4, 16, 64}) {
+    std::vector<std::thread> ts;
+    utime_t start = ceph_clock_now();
+    for (size_t t = 0; t < threads; ++t) {
+      ts.emplace_back([&, t] {
+	std::mt19937 rng(t);
+	for (size_t i = 0; i < lookups / threads; ++i) {
+	  auto h = c->Lookup(keys[rng() % num_keys]);
+	  ceph_assert(h);
+	  c->Release(h);
+	}
+      });
+    }
+    for (auto& t : ts) {
+      t.join();
+    }
+    utime_t dur = ceph_clock_now() - start;
+    cout << GetParam() << " " << threads << " threads: "
+	 << (double)lookups / (double)dur / 1000000 << " M lookups/s"
+	 << std::endl;
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  RocksDBCache,
+  RocksDBCacheTest,
+  ::testing::Values("binned_lru", "binned_clock"));
+
 
 INSTANTIATE_TEST_SUITE_P(
   KeyValueDB,
@@ -216,6 +216,64 @@ public:
     cout << "first: " << *first << std::endl;;
     cout << "primary: " << *primary << std::endl;;
   }
+  void update_mapping() {
+    mapping.update(osdmap);
+  }
+  int64_t add_big_pool(const string& name, unsigned pg_num) {
+    OSDMap::Incremental pending_inc(osdmap.get_epoch() + 1);
+    pending_inc.new_pool_max = osdmap.get_pool_max();
+    int64_t pool_id = ++pending_inc.new_pool_max;
+    pg_pool_t empty;
+    auto p = pending_inc.get_new_pool(pool_id, &empty);
+    p->size = 3;
+    p->min_size = 1;
+    p->set_pg_num(pg_num);
+    p->set_pgp_num(pg_num);
+    p->type = pg_pool_t::TYPE_REPLICATED;
+    p->crush_rule = 0;
+    p->set_flag(pg_pool_t::FLAG_HASHPSPOOL);
+    pending_inc.new_pool_names[pool_id] = name;
+    osdmap.apply_incremental(pending_inc);
+    return pool_id;
+  }
+  // largest difference between an osd's pg count and the average
+  float max_pg_deviation(const OSDMap& om, int64_t pool_id) {
+    vector<int> pgs(get_num_osds());
+    auto pool = om.get_pg_pool(pool_id);
+    for (unsigned ps = 0; ps < pool->get_pg_num(); ++ps) {
+      vector<int> up;
+      om.pg_to_up_acting_osds(pg_t(ps, pool_id), &up, nullptr,
+                                  nullptr, nullptr);
+      for (auto osd : up) {
+        if (osd != CRUSH_ITEM_NONE)
+          pgs[osd]++;
+      }
+    }
+    float target = (float)pool->get_pg_num() * pool->get_size() / pgs.size();
+    float max_dev = 0;
+    for (auto n : pgs)
+      max_dev = std::max(max_dev, fabsf(n - target));
+    return max_dev;
+  }
+  // root mean square of the osds' pg count deviations from the average
+  float pg_stddev(const OSDMap& om, int64_t pool_id) {
+    vector<int> pgs(get_num_osds());
+    auto pool = om.get_pg_pool(pool_id);
+    for (unsigned ps = 0; ps < pool->get_pg_num(); ++ps) {
+      vector<int> up;
+      om.pg_to_up_acting_osds(pg_t(ps, pool_id), &up, nullptr,
+                                  nullptr, nullptr);
+      for (auto osd : up) {
+        if (osd != CRUSH_ITEM_NONE)
+          pgs[osd]++;
+      }
+    }
+    float target = (float)pool->get_pg_num() * pool->get_size() / pgs.size();
+    float sum = 0;
+    for (auto n : pgs)
+      sum += (n - target) * (n - target);
+    return sqrtf(sum / pgs.size());
+  }
   void clean_pg_upmaps(CephContext *cct,
                        const OSDMap& om,
                        OSDMap::Incremental& pending_inc) {
@@ -289,6 +347,31 @@ TEST_F(OSDMapTest, Features) {
   // FIXME: test tiering feature bits
 }
 
+TEST_F(OSDMapTest, MinCompatClientBlockedBloom) {
+  set_up_map();
+  ceph_release_t before = osdmap.get_min_compat_client();
+  ASSERT_LT(before, ceph_release_t::reef);
+
+  // older clients cannot decode a pool with a blocked bloom hit set
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    pg_pool_t *p = inc.get_new_pool(my_rep_pool,
+				    osdmap.get_pg_pool(my_rep_pool));
+    p->hit_set_params = HitSet::Params(new BlockedBloomHitSet::Params);
+    osdmap.apply_incremental(inc);
+  }
+  ASSERT_EQ(ceph_release_t::reef, osdmap.get_min_compat_client());
+
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    pg_pool_t *p = inc.get_new_pool(my_rep_pool,
+				    osdmap.get_pg_pool(my_rep_pool));
+    p->hit_set_params = HitSet::Params();
+    osdmap.apply_incremental(inc);
+  }
+  ASSERT_EQ(before, osdmap.get_min_compat_client());
+}
+
 TEST_F(OSDMapTest, MapPG) {
   set_up_map();
 
@@ -2705,6 +2788,103 @@ TEST_F(OSDMapTest, read_balance_random_map) {
   }
 }
 
+TEST_F(OSDMapTest, BenchDump) {
+  set_up_map(10000);
+  for (const char *type : {"json", "json-pretty", "xml"}) {
+    const int rounds = 5;
+    size_t len = 0;
+    auto start = ceph::mono_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      std::unique_ptr<Formatter> f(Formatter::create(type));
+      f->open_object_section("osdmap");
+      osdmap.dump(f.get(), g_ceph_context);
+      f->close_section();
+      bufferlist bl;
+      f->flush(bl);
+      len = bl.length();
+    }
+    auto elapsed = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+    ASSERT_GT(len, 0u);
+    cout << type << ": " << len << " bytes, "
+         << elapsed * 1000 / rounds << " ms per dump" << std::endl;
+  }
+}
+
+TEST_F(OSDMapTest, calc_pg_upmaps_mapping) {
+  // reading the initial distribution from a precalculated mapping must
+  // not change the outcome.  the aggressive mode shuffles with a fresh
+  // seed on every call, so leave it out
+  g_ceph_context->_conf.set_val("osd_calc_pg_upmaps_aggressively", "false");
+  set_up_map(60, true);
+  int64_t pool_id = add_big_pool("big_pool", 1024);
+  set<int64_t> only_pools = {pool_id};
+  float before = max_pg_deviation(osdmap, pool_id);
+
+  OSDMap::Incremental inc1(osdmap.get_epoch() + 1);
+  int r1 = osdmap.calc_pg_upmaps(g_ceph_context, 1, 200, only_pools, &inc1);
+  update_mapping();
+  OSDMap::Incremental inc2(osdmap.get_epoch() + 1);
+  int r2 = osdmap.calc_pg_upmaps(g_ceph_context, 1, 200, only_pools, &inc2,
+                                 nullptr, &mapping);
+  g_ceph_context->_conf.rm_val("osd_calc_pg_upmaps_aggressively");
+  ASSERT_GT(r1, 0);
+  ASSERT_EQ(r1, r2);
+  ASSERT_EQ(inc1.new_pg_upmap_items, inc2.new_pg_upmap_items);
+  ASSERT_EQ(inc1.old_pg_upmap_items, inc2.old_pg_upmap_items);
+
+  osdmap.apply_incremental(inc1);
+  float after = max_pg_deviation(osdmap, pool_id);
+  cout << "max deviation " << before << " -> " << after << std::endl;
+  ASSERT_LT(after, before);
+}
+
+TEST_F(OSDMapTest, calc_pg_upmaps_stddev) {
+  // the incremental bookkeeping must balance at least as well as the
+  // full recompute of every osd's deviation on each iteration did.  that
+  // version got this map and seed down to 0.4
+  set_up_map(60, true);
+  int64_t pool_id = add_big_pool("big_pool", 1024);
+  set<int64_t> only_pools = {pool_id};
+  float before = pg_stddev(osdmap, pool_id);
+  std::random_device::result_type seed = 1234;
+  OSDMap::Incremental pending_inc(osdmap.get_epoch() + 1);
+  int r = osdmap.calc_pg_upmaps(g_ceph_context, 1, 200, only_pools,
+                                &pending_inc, &seed);
+  ASSERT_GT(r, 0);
+  osdmap.apply_incremental(pending_inc);
+  float after = pg_stddev(osdmap, pool_id);
+  cout << "stddev " << before << " -> " << after << std::endl;
+  ASSERT_LE(after, 0.4001);
+}
+
+TEST_F(OSDMapTest, DISABLED_BenchCalcPGUpmaps) {
+  // one balancer round on a 10k osd cluster
+  set_up_map(10000, true);
+  int64_t pool_id = add_big_pool("big_pool", 131072);
+  set<int64_t> only_pools = {pool_id};
+  float before = max_pg_deviation(osdmap, pool_id);
+  // callers map every PG once per epoch and pass that in; with all osds
+  // under one host this costs far more than the balancing itself
+  auto map_start = ceph::mono_clock::now();
+  update_mapping();
+  cout << "mapping in "
+       << ceph::to_seconds<double>(ceph::mono_clock::now() - map_start)
+       << " s" << std::endl;
+  for (int max : {100, 1000}) {
+    OSDMap::Incremental pending_inc(osdmap.get_epoch() + 1);
+    auto start = ceph::mono_clock::now();
+    int changed = osdmap.calc_pg_upmaps(g_ceph_context, 1, max, only_pools,
+                                        &pending_inc, nullptr, &mapping);
+    auto elapsed = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+    OSDMap tmp;
+    tmp.deepish_copy_from(osdmap);
+    tmp.apply_incremental(pending_inc);
+    float after = max_pg_deviation(tmp, pool_id);
+    cout << "max " << max << ": " << changed << " changes in " << elapsed
+         << " s, max deviation " << before << " -> " << after << std::endl;
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(
   OSDMap,
   OSDMapTest,
@@ -122,6 +122,68 @@ TEST_F(BloomHitSetTest, RejectsNoMatch) {
   EXPECT_LT(matches, 2);
 }
 
+class BlockedBloomHitSetTest : public testing::Test, public HitSetTestStrap {
+public:
+
+  BlockedBloomHitSetTest() : HitSetTestStrap(new HitSet(new BlockedBloomHitSet)) {}
+
+  void rebuild(double fp, uint64_t target, uint64_t seed) {
+    BlockedBloomHitSet::Params *bparams =
+      new BlockedBloomHitSet::Params(fp, target, seed);
+    HitSet::Params param(bparams);
+    HitSet new_set(param);
+    *hitset = new_set;
+  }
+};
+
+TEST_F(BlockedBloomHitSetTest, Params) {
+  HitSet::Params params(new BlockedBloomHitSet::Params(0.01, 100, 5));
+  bufferlist bl;
+  params.encode(bl);
+
+  HitSet::Params p2;
+  auto iter = bl.cbegin();
+  p2.decode(iter);
+  ASSERT_EQ(HitSet::TYPE_BLOCKED_BLOOM, p2.get_type());
+  auto bp = static_cast<BlockedBloomHitSet::Params*>(p2.impl.get());
+  EXPECT_EQ(.01, bp->get_fpp());
+  EXPECT_EQ(100u, bp->target_size);
+  EXPECT_EQ(5u, bp->seed);
+}
+
+TEST_F(BlockedBloomHitSetTest, Construct) {
+  ASSERT_EQ(hitset->impl->get_type(), HitSet::TYPE_BLOCKED_BLOOM);
+  ASSERT_TRUE(HitSet::is_bloom(hitset->impl->get_type()));
+  // success!
+}
+
+TEST_F(BlockedBloomHitSetTest, InsertsMatch) {
+  rebuild(0.1, 100, 1);
+  fill(50);
+  verify_fill(50);
+  EXPECT_FALSE(hitset->is_full());
+  hitset->seal();
+  verify_fill(50);
+}
+
+TEST_F(BlockedBloomHitSetTest, RejectsNoMatch) {
+  rebuild(0.001, 100, 1);
+  fill(100);
+  verify_fill(100);
+  EXPECT_TRUE(hitset->is_full());
+
+  char buf[50];
+  int matches = 0;
+  for (int i = 100; i < 200; ++i) {
+    sprintf(buf, "hitsettest_%d", i);
+    hobject_t obj(object_t(buf), "", 0, i, 0, "");
+    if (hitset->contains(obj))
+      ++matches;
+  }
+  // we set a 1 in 1000 false positive; allow one in our 100
+  EXPECT_LT(matches, 2);
+}
+
 class ExplicitHashHitSetTest : public testing::Test, public HitSetTestStrap {
 public:
 
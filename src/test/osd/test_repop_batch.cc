@@ -0,0 +1,240 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/// \file replication sub op batching: the batch message and per-peer order
+
+#include <gtest/gtest.h>
+
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/ceph_argparse.h"
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "messages/MOSDRepOpBatch.h"
+#include "osd/RepOpBatcher.h"
+
+int main(int argc, char** argv)
+{
+  std::vector<const char*> args(argv, argv + argc);
+  auto cct = global_init(nullptr,
+			 args,
+			 CEPH_ENTITY_TYPE_CLIENT,
+			 CODE_ENVIRONMENT_UTILITY,
+			 CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+static ceph::ref_t<MOSDRepOp> make_repop(int i, unsigned data_len)
+{
+  hobject_t poid(object_t("obj" + std::to_string(i)), "", CEPH_NOSNAP, i, 1,
+		 "");
+  auto op = ceph::make_message<MOSDRepOp>(
+    osd_reqid_t(entity_name_t::CLIENT(4), 0, 100 + i),
+    pg_shard_t(2),
+    spg_t(pg_t(i, 1)),
+    poid,
+    CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK,
+    20, 18,
+    1000 + i,
+    eversion_t(20, 300 + i));
+  op->set_priority(63 + i);
+  ceph::buffer::list bl;
+  bl.append(std::string(data_len, 'a' + i));
+  op->set_data(bl);
+  return op;
+}
+
+TEST(MOSDRepOpBatch, encode_decode)
+{
+  // an empty data segment and one that does not end on a page boundary
+  const std::vector<unsigned> data_lens = {0, 1, 4096, 10000, 65537};
+  auto batch = ceph::make_message<MOSDRepOpBatch>();
+  for (unsigned i = 0; i < data_lens.size(); ++i) {
+    batch->ops.push_back(make_repop(i, data_lens[i]));
+  }
+  batch->encode(CEPH_FEATURES_ALL, 0);
+
+  auto decoded = ceph::make_message<MOSDRepOpBatch>();
+  decoded->set_header(batch->get_header());
+  decoded->set_payload(batch->get_payload());
+  decoded->set_data(batch->get_data());
+  decoded->decode_payload();
+
+  ASSERT_EQ(batch->ops.size(), decoded->ops.size());
+  for (unsigned i = 0; i < data_lens.size(); ++i) {
+    auto& sent = batch->ops[i];
+    auto& got = decoded->ops[i];
+    got->finish_decode();
+    EXPECT_EQ(MSG_OSD_REPOP, got->get_type());
+    EXPECT_EQ(sent->get_header().version, got->get_header().version);
+    EXPECT_EQ(sent->get_header().compat_version,
+	      got->get_header().compat_version);
+    EXPECT_EQ(sent->get_tid(), got->get_tid());
+    EXPECT_EQ(sent->get_priority(), got->get_priority());
+    EXPECT_EQ(data_lens[i], got->get_data().length());
+    EXPECT_TRUE(sent->get_data().contents_equal(got->get_data()));
+    EXPECT_EQ(sent->reqid, got->reqid);
+    EXPECT_EQ(sent->pgid, got->pgid);
+    EXPECT_EQ(sent->poid, got->poid);
+    EXPECT_EQ(sent->map_epoch, got->map_epoch);
+    EXPECT_EQ(sent->min_epoch, got->min_epoch);
+    EXPECT_EQ(sent->version, got->version);
+    EXPECT_EQ(sent->from, got->from);
+  }
+}
+
+TEST(RepOpBatcher, per_peer_fifo)
+{
+  // a short window so the flusher keeps sending while the producers hit
+  // osd_repop_batch_max_ops and flush peers themselves
+  auto& conf = g_ceph_context->_conf;
+  conf.set_val("osd_repop_batch_window_us", "50");
+  conf.set_val("osd_repop_batch_max_ops", "4");
+  conf.apply_changes(nullptr);
+
+  constexpr int num_peers = 3;
+  constexpr uint64_t num_producers = 4;
+  constexpr uint64_t ops_per_producer = 20000;
+
+  std::mutex lock;
+  std::map<int, std::vector<ceph_tid_t>> sent;
+  std::map<int, int> sending;
+  bool overlap = false;
+  RepOpBatcher batcher(
+    g_ceph_context,
+    [&](int peer, std::vector<RepOpBatcher::queued_t>& ops) {
+      {
+	std::lock_guard l{lock};
+	overlap |= sending[peer]++ > 0;
+	for (auto& q : ops) {
+	  sent[peer].push_back(q.op->get_tid());
+	}
+      }
+      std::this_thread::yield();
+      std::lock_guard l{lock};
+      --sending[peer];
+    });
+  batcher.start();
+
+  std::vector<std::thread> producers;
+  for (uint64_t p = 0; p < num_producers; ++p) {
+    producers.emplace_back([&batcher, p] {
+      for (uint64_t seq = 0; seq < ops_per_producer; ++seq) {
+	auto op = ceph::make_message<MOSDRepOp>();
+	op->set_tid(p << 32 | seq);
+	int peer = seq % num_peers;
+	ASSERT_TRUE(batcher.queue(peer, std::move(op), 1));
+	if (seq % 97 == 0) {
+	  batcher.flush(peer);
+	}
+      }
+    });
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  for (int peer = 0; peer < num_peers; ++peer) {
+    batcher.flush(peer);
+  }
+  batcher.stop();
+  conf.rm_val("osd_repop_batch_window_us");
+  conf.rm_val("osd_repop_batch_max_ops");
+  conf.apply_changes(nullptr);
+
+  ASSERT_FALSE(overlap);
+  for (int peer = 0; peer < num_peers; ++peer) {
+    // each producer's ops to a peer arrive complete and in queue order
+    std::vector<uint64_t> count(num_producers, 0);
+    for (auto tid : sent[peer]) {
+      uint64_t p = tid >> 32;
+      uint64_t seq = tid & 0xffffffff;
+      ASSERT_LT(p, num_producers);
+      ASSERT_EQ(peer + count[p] * num_peers, seq)
+	<< "producer " << p << " to peer " << peer;
+      ++count[p];
+    }
+    for (uint64_t p = 0; p < num_producers; ++p) {
+      ASSERT_EQ((ops_per_producer - peer + num_peers - 1) / num_peers, count[p])
+	<< "producer " << p << " to peer " << peer;
+    }
+  }
+}
+
+TEST(RepOpBatcher, slow_peer)
+{
+  // a send that does not return must only hold up callers for its peer
+  auto& conf = g_ceph_context->_conf;
+  conf.set_val("osd_repop_batch_window_us", "10000000");
+  conf.apply_changes(nullptr);
+
+  std::promise<void> started, release;
+  auto released = release.get_future().share();
+  std::mutex lock;
+  std::map<int, unsigned> sent;
+  RepOpBatcher batcher(
+    g_ceph_context,
+    [&](int peer, std::vector<RepOpBatcher::queued_t>& ops) {
+      bool first;
+      {
+	std::lock_guard l{lock};
+	first = peer == 0 && !sent.count(0);
+      }
+      if (first) {
+	started.set_value();
+	released.wait();
+      }
+      std::lock_guard l{lock};
+      sent[peer] += ops.size();
+    });
+  batcher.start();
+
+  ASSERT_TRUE(batcher.queue(0, ceph::make_message<MOSDRepOp>(), 1));
+  std::thread stuck([&] { batcher.flush(0); });
+  started.get_future().wait();
+  // another op for the stuck peer, and a flush that has to wait for it
+  ASSERT_TRUE(batcher.queue(0, ceph::make_message<MOSDRepOp>(), 1));
+  std::atomic<bool> waited = false;
+  std::thread waiting([&] {
+    batcher.flush(0);
+    waited = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto other = std::async(std::launch::async, [&] {
+    for (int i = 0; i < 10; ++i) {
+      EXPECT_TRUE(batcher.queue(1, ceph::make_message<MOSDRepOp>(), 1));
+    }
+    batcher.flush(1);
+  });
+  auto status = other.wait_for(std::chrono::seconds(10));
+  EXPECT_FALSE(waited);
+  release.set_value();
+  stuck.join();
+  waiting.join();
+  other.wait();
+  batcher.stop();
+  conf.rm_val("osd_repop_batch_window_us");
+  conf.apply_changes(nullptr);
+
+  ASSERT_EQ(std::future_status::ready, status);
+  ASSERT_TRUE(waited);
+  ASSERT_EQ(2u, sent[0]);
+  ASSERT_EQ(10u, sent[1]);
+}
+
+TEST(RepOpBatcher, disabled)
+{
+  RepOpBatcher batcher(g_ceph_context,
+		       [](int, std::vector<RepOpBatcher::queued_t>&) {
+			 FAIL() << "nothing should be sent";
+		       });
+  batcher.start();
+  ASSERT_FALSE(batcher.queue(1, ceph::make_message<MOSDRepOp>(), 1));
+  batcher.flush(1);
+  batcher.stop();
+}
@@ -258,6 +258,109 @@ TEST(PerfCounters, read_avg) {
   t1.join();
 }
 
+enum {
+  TEST_PERFCOUNTERS5_ELEMENT_FIRST = 600,
+  TEST_PERFCOUNTERS5_ELEMENT_OPS,
+  TEST_PERFCOUNTERS5_ELEMENT_BYTES,
+  TEST_PERFCOUNTERS5_ELEMENT_LAT,
+  TEST_PERFCOUNTERS5_ELEMENT_LAST,
+};
+
+static PerfCounters* setup_test_perfcounter5(CephContext *cct, bool sharded)
+{
+  PerfCountersBuilder bld(cct, "test_perfcounter_5",
+	  TEST_PERFCOUNTERS5_ELEMENT_FIRST, TEST_PERFCOUNTERS5_ELEMENT_LAST);
+  bld.add_u64_counter(TEST_PERFCOUNTERS5_ELEMENT_OPS, "ops");
+  bld.add_u64(TEST_PERFCOUNTERS5_ELEMENT_BYTES, "bytes");
+  bld.add_time_avg(TEST_PERFCOUNTERS5_ELEMENT_LAT, "lat");
+  if (sharded) {
+    bld.set_sharded(TEST_PERFCOUNTERS5_ELEMENT_OPS);
+    bld.set_sharded(TEST_PERFCOUNTERS5_ELEMENT_BYTES);
+    bld.set_sharded(TEST_PERFCOUNTERS5_ELEMENT_LAT);
+  }
+  return bld.create_perf_counters();
+}
+
+TEST(PerfCounters, Sharded) {
+  AdminSocketClient client(get_rand_socket_path());
+  std::string msg;
+  PerfCountersCollection *coll = g_ceph_context->get_perfcounters_collection();
+  coll->clear();
+  PerfCounters* fake_pf = setup_test_perfcounter5(g_ceph_context, true);
+  coll->add(fake_pf);
+
+  const int threads = 8;
+  const int n = 10000;
+  std::atomic<bool> done = false;
+  std::thread reader([&] {
+    while (!done) {
+      // every tinc adds 1ns, so sum and count match in any snapshot
+      auto a = fake_pf->get_tavg_ns(TEST_PERFCOUNTERS5_ELEMENT_LAT);
+      ASSERT_EQ(a.first, a.second);
+    }
+  });
+  std::vector<std::thread> writers;
+  for (int t = 0; t < threads; t++) {
+    writers.emplace_back([&] {
+      for (int i = 0; i < n; i++) {
+	fake_pf->inc(TEST_PERFCOUNTERS5_ELEMENT_OPS);
+	fake_pf->inc(TEST_PERFCOUNTERS5_ELEMENT_BYTES, 3);
+	fake_pf->dec(TEST_PERFCOUNTERS5_ELEMENT_BYTES, 1);
+	fake_pf->tinc(TEST_PERFCOUNTERS5_ELEMENT_LAT, ceph::make_timespan(0.000000001));
+      }
+    });
+  }
+  for (auto& t : writers) {
+    t.join();
+  }
+  done = true;
+  reader.join();
+
+  ASSERT_EQ(uint64_t(threads * n), fake_pf->get(TEST_PERFCOUNTERS5_ELEMENT_OPS));
+  ASSERT_EQ(uint64_t(threads * n * 2), fake_pf->get(TEST_PERFCOUNTERS5_ELEMENT_BYTES));
+  ASSERT_EQ(std::make_pair(uint64_t(threads * n), uint64_t(threads * n)),
+	    fake_pf->get_tavg_ns(TEST_PERFCOUNTERS5_ELEMENT_LAT));
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf dump\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(sd("{\"test_perfcounter_5\":{\"ops\":80000,\"bytes\":160000,"
+	    "\"lat\":{\"avgcount\":80000,\"sum\":0.000080000,\"avgtime\":0.000000001}}}"), msg);
+
+  // set replaces what all the slots add up to
+  fake_pf->set(TEST_PERFCOUNTERS5_ELEMENT_BYTES, 5);
+  ASSERT_EQ(5u, fake_pf->get(TEST_PERFCOUNTERS5_ELEMENT_BYTES));
+  fake_pf->reset();
+  ASSERT_EQ(0u, fake_pf->get(TEST_PERFCOUNTERS5_ELEMENT_OPS));
+  ASSERT_EQ(5u, fake_pf->get(TEST_PERFCOUNTERS5_ELEMENT_BYTES));
+  ASSERT_EQ(std::make_pair(uint64_t(0), uint64_t(0)),
+	    fake_pf->get_tavg_ns(TEST_PERFCOUNTERS5_ELEMENT_LAT));
+  coll->clear();
+}
+
+TEST(PerfCounters, BenchSharded) {
+  const int total = 4000000;
+  for (bool sharded : {false, true}) {
+    std::unique_ptr<PerfCounters> pf(
+      setup_test_perfcounter5(g_ceph_context, sharded));
+    for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+      std::vector<std::thread> ts;
+      auto start = ceph::mono_clock::now();
+      for (int t = 0; t < threads; t++) {
+	ts.emplace_back([&pf, n = total / threads] {
+	  for (int i = 0; i < n; i++) {
+	    pf->inc(TEST_PERFCOUNTERS5_ELEMENT_OPS);
+	    pf->tinc(TEST_PERFCOUNTERS5_ELEMENT_LAT, ceph::timespan(100));
+	  }
+	});
+      }
+      for (auto& t : ts) {
+	t.join();
+      }
+      auto elapsed = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+      std::cout << (sharded ? "sharded" : "shared") << " " << threads
+		<< " threads: " << total / elapsed << " increments/s" << std::endl;
+    }
+  }
+}
+
 static PerfCounters* setup_test_perfcounter4(std::string name, CephContext *cct)
 {
   PerfCountersBuilder bld(cct, name,
@@ -33,6 +33,7 @@ TYPE(BitVector<2>)
 #include "common/bloom_filter.hpp"
 TYPE(bloom_filter)
 TYPE(compressible_bloom_filter)
+TYPE(blocked_bloom_filter)
 
 #include "common/DecayCounter.h"
 TYPE(DecayCounter)
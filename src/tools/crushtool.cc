@@ -215,6 +215,7 @@ void usage()
   cout << "      [--min-rep n] [--max-rep n] [--num-rep n]\n";
   cout << "      [--pool-id n]      specifies pool id\n";
   cout << "      [--batches b]      split the CRUSH mapping into b > 1 rounds\n";
+  cout << "      [--threads n]      spread the CRUSH mapping over n threads\n";
   cout << "      [--weight|-w devno weight]\n";
   cout << "                         where weight is 0 to 1.0\n";
   cout << "      [--simulate]       simulate placements using a random\n";
@@ -812,6 +813,12 @@ int main(int argc, const char **argv)
 	return EXIT_FAILURE;
       }
       tester.set_batches(x);
+    } else if (ceph_argparse_witharg(args, i, &x, err, "--threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+      tester.set_threads(x);
     } else if (ceph_argparse_witharg(args, i, &y, err, "--mark-down-ratio", (char*)NULL)) {
       if (!err.str().empty()) {
         cerr << err.str() << std::endl;
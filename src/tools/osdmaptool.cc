@@ -25,6 +25,7 @@
 
 #include "global/global_init.h"
 #include "osd/OSDMap.h"
+#include "osd/OSDMapMapping.h"
 
 using namespace std;
 
@@ -565,6 +566,13 @@ int main(int argc, const char **argv)
       cout << "No pools available" << std::endl;
       goto skip_upmap;
     }
+    // compute the up sets once per round, rather than in every
+    // calc_pg_upmaps call, the way the mon does
+    ThreadPool mapping_tp(g_ceph_context, "osdmaptool::mapping_tp",
+                          "tp_osdmap_map", g_conf()->mon_cpu_threads);
+    mapping_tp.start();
+    ParallelPGMapper mapper(g_ceph_context, &mapping_tp);
+    OSDMapMapping mapping;
     int rounds = 0;
     struct timespec round_start;
     [[maybe_unused]] int r = clock_gettime(CLOCK_MONOTONIC, &round_start);
@@ -583,6 +591,9 @@ int main(int argc, const char **argv)
       struct timespec begin, end;
       r = clock_gettime(CLOCK_MONOTONIC, &begin);
       assert(r == 0);
+      auto mapping_job = mapping.start_update(
+        osdmap, mapper, g_conf()->mon_osd_mapping_pgs_per_chunk);
+      mapping_job->wait();
       for (auto& i: pools) {
         set<int64_t> one_pool;
         one_pool.insert(i);
@@ -590,7 +601,7 @@ int main(int argc, const char **argv)
         int did = osdmap.calc_pg_upmaps(
           g_ceph_context, upmap_deviation,
           left, one_pool,
-          &pending_inc, upmap_p_seed);
+          &pending_inc, upmap_p_seed, &mapping);
         total_did += did;
         left -= did;
         if (left <= 0)
@@ -642,6 +653,7 @@ int main(int argc, const char **argv)
       }
       ++rounds;
     } while(upmap_active);
+    mapping_tp.stop();
   }
 skip_upmap:
   if (upmap_file != "-") {